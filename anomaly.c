@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include "gd32f4xx.h"
+#include "wave.h"
+#include "anomaly.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define ANOMALY_SEGMENTS       256
+#define ANOMALY_LEARN_COUNT    16 // Acquisitions
+
+/*- Variables ---------------------------------------------------------------*/
+static uint8_t g_low[ANOMALY_SEGMENTS];
+static uint8_t g_high[ANOMALY_SEGMENTS];
+static int g_margin = 0;
+static volatile int g_learned;
+static volatile int g_total;
+static volatile int g_failed;
+static int g_saved;
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+void anomaly_setup(int margin)
+{
+  g_margin = margin;
+  g_total  = 0;
+  g_failed = 0;
+  g_saved  = 0;
+
+  anomaly_reset();
+}
+
+//-----------------------------------------------------------------------------
+// Must not be called while the DMA interrupt may be running the check
+void anomaly_reset(void)
+{
+  for (int i = 0; i < ANOMALY_SEGMENTS; i++)
+  {
+    g_low[i]  = 255;
+    g_high[i] = 0;
+  }
+
+  g_learned = 0;
+}
+
+//-----------------------------------------------------------------------------
+static void learn_range(const uint8_t *data, int count, int segment)
+{
+  uint32_t min = 0xffffffff;
+  uint32_t max = 0;
+  int vmin = g_low[segment];
+  int vmax = g_high[segment];
+
+  while (count > 0 && ((uintptr_t)data & 3))
+  {
+    if (*data < vmin)
+      vmin = *data;
+
+    if (*data > vmax)
+      vmax = *data;
+
+    data++;
+    count--;
+  }
+
+  for (; count >= 4; count -= 4, data += 4)
+  {
+    uint32_t w = *(uint32_t *)data;
+
+    __USUB8(min, w);
+    min = __SEL(w, min);
+
+    __USUB8(max, w);
+    max = __SEL(max, w);
+  }
+
+  for (int i = 0; i < 4; i++)
+  {
+    int bmin = (min >> (i * 8)) & 0xff;
+    int bmax = (max >> (i * 8)) & 0xff;
+
+    if (bmin < vmin)
+      vmin = bmin;
+
+    if (bmax > vmax)
+      vmax = bmax;
+  }
+
+  for (; count > 0; count--, data++)
+  {
+    if (*data < vmin)
+      vmin = *data;
+
+    if (*data > vmax)
+      vmax = *data;
+  }
+
+  g_low[segment]  = vmin;
+  g_high[segment] = vmax;
+}
+
+//-----------------------------------------------------------------------------
+// Returns a non-zero value if any of the samples is outside of the [low, high]
+// range. Saturating subtraction leaves non-zero bytes only for the samples
+// past the limits, so aligned words are checked 4 samples at a time with no
+// branches.
+static uint32_t check_range(const uint8_t *data, int count, int low, int high)
+{
+  uint32_t low4  = (uint32_t)low * 0x01010101;
+  uint32_t high4 = (uint32_t)high * 0x01010101;
+  uint32_t fail = 0;
+
+  for (; count > 0 && ((uintptr_t)data & 3); count--, data++)
+    fail |= (*data < low) | (*data > high);
+
+  for (; count >= 8; count -= 8, data += 8)
+  {
+    uint32_t w0 = ((uint32_t *)data)[0];
+    uint32_t w1 = ((uint32_t *)data)[1];
+
+    fail |= __UQSUB8(low4, w0) | __UQSUB8(w0, high4);
+    fail |= __UQSUB8(low4, w1) | __UQSUB8(w1, high4);
+  }
+
+  for (; count > 0; count--, data++)
+    fail |= (*data < low) | (*data > high);
+
+  return fail;
+}
+
+//-----------------------------------------------------------------------------
+static void finish_learning(void)
+{
+  for (int i = 0; i < ANOMALY_SEGMENTS; i++)
+  {
+    // Segments that never had any samples are not checked
+    if (g_low[i] > g_high[i])
+    {
+      g_low[i]  = 0;
+      g_high[i] = 255;
+      continue;
+    }
+
+    g_low[i]  = (g_low[i] > g_margin) ? (g_low[i] - g_margin) : 0;
+    g_high[i] = (g_high[i] < (255 - g_margin)) ? (g_high[i] + g_margin) : 255;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Called from the DMA interrupt for every triggered acquisition. The record
+// is the whole ring of 'size' samples starting at 'offset', 'min_index' is
+// the index of its first sample relative to the trigger. Envelope segments
+// are anchored at the trigger index 'start', so a few samples of jitter in
+// the record start do not move them. The first ANOMALY_LEARN_COUNT records
+// build the envelope. Returns true if the record falls outside of it.
+bool anomaly_check(const uint8_t *data, int size, int offset, int min_index, int start)
+{
+  int segment_size = size / ANOMALY_SEGMENTS;
+  bool learn = (g_learned < ANOMALY_LEARN_COUNT);
+  int end = min_index + size;
+
+  if (!learn)
+    g_total++;
+
+  for (int i = 0; i < ANOMALY_SEGMENTS; i++, start += segment_size)
+  {
+    int first = (start < min_index) ? min_index : start;
+    int last = ((start + segment_size) > end) ? end : (start + segment_size);
+    int index, count, sz;
+
+    if (first >= last)
+      continue;
+
+    index = offset + (first - min_index);
+
+    if (index >= size)
+      index -= size;
+
+    count = last - first;
+    sz = size - index;
+
+    if (sz > count)
+      sz = count;
+
+    if (learn)
+    {
+      learn_range(&data[index], sz, i);
+
+      if (sz < count)
+        learn_range(data, count - sz, i);
+    }
+    else
+    {
+      uint32_t fail = check_range(&data[index], sz, g_low[i], g_high[i]);
+
+      if (sz < count)
+        fail |= check_range(data, count - sz, g_low[i], g_high[i]);
+
+      if (fail)
+      {
+        g_failed++;
+        return true;
+      }
+    }
+  }
+
+  if (learn && ++g_learned == ANOMALY_LEARN_COUNT)
+    finish_learning();
+
+  return false;
+}
+
+//-----------------------------------------------------------------------------
+// Called once the failed record is handed over from the interrupt. It is only
+// lost if the previous one is still being written.
+void anomaly_save(void)
+{
+  if (wave_save(true))
+    g_saved++;
+}
+
+//-----------------------------------------------------------------------------
+void anomaly_get_stats(int *total, int *failed, int *saved)
+{
+  *total  = g_total;
+  *failed = g_failed;
+  *saved  = g_saved;
+}
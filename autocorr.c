@@ -0,0 +1,445 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "gd32f4xx.h"
+#include "autocorr.h"
+#include "overlay.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define AUTOCORR_WINDOW        8192 // Full rate samples in the fine correlation
+#define AUTOCORR_MIN_WINDOW    256
+#define AUTOCORR_MIN_LAG       8    // Decimated samples, shorter ones may be aliases
+#define AUTOCORR_MIN_POWER     (AUTOCORR_SIZE * 16) // Decimated values are x4
+#define AUTOCORR_MIN_RETAINED  4    // Decimation keeps at least 1/4 of the power
+#define AUTOCORR_PEAK_RATIO    13   // Of 16, peaks within 80% of the highest one
+#define AUTOCORR_MIN_RATIO     6    // Of 16, coarse peak to the zero lag, fine peak to uncorrelated
+#define AUTOCORR_PYRAMID_STEP  8    // Decimation reduction when nothing is found
+#define AUTOCORR_MULTIPLE_STEP 8
+#define AUTOCORR_ITERATIONS    4
+
+/*- Types -------------------------------------------------------------------*/
+// Longest contiguous part of the ring, the fine correlation does not wrap
+typedef struct
+{
+  const uint8_t *data;
+  int      size;
+  int      window;
+  int64_t  energy; // Sum of squares of the window
+  int64_t  sum;
+} Segment;
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+// Box filter over 'step' samples, values are in 1/4 of the ADC count with
+// the mean removed. Returns the number of decimated samples, or 0 if the
+// filter removes most of the signal power, the period can't be found in the
+// decimated copy then.
+static int decimate(const uint8_t *data, int size, int offset, int step)
+{
+  int16_t *samples = overlay.scratch.autocorr.samples;
+  int count = size / step;
+  int index = offset;
+  int64_t sum_sq = 0;
+  int64_t dec_sq = 0;
+  int sum = 0;
+  int mean;
+
+  if (count > AUTOCORR_SIZE)
+    count = AUTOCORR_SIZE;
+
+  count &= ~3;
+
+  for (int i = 0; i < count; i++)
+  {
+    int s = 0;
+
+    for (int j = 0; j < step; j++)
+    {
+      int v = data[index++];
+
+      s += v;
+      sum_sq += v * v;
+
+      if (index == size)
+        index = 0;
+    }
+
+    samples[i] = (s * 4) / step;
+    sum += s;
+  }
+
+  mean = (sum * 4) / (count * step);
+
+  for (int i = 0; i < count; i++)
+  {
+    samples[i] -= mean;
+    dec_sq += samples[i] * samples[i];
+  }
+
+  // Decimated values are x4, power is compared with the full rate samples
+  // over the same count
+  if (step > 1 && dec_sq * step * AUTOCORR_MIN_RETAINED <
+      (sum_sq - ((int64_t)sum * sum) / (count * step)) * 16)
+    return 0;
+
+  return count;
+}
+
+//-----------------------------------------------------------------------------
+// Two adjacent samples packed for the dual 16-bit MAC, the copy compiles into
+// a single load and keeps the int16_t array from being accessed as words
+static inline uint32_t sample_pair(int index)
+{
+  uint32_t pair;
+
+  memcpy(&pair, &overlay.scratch.autocorr.samples[index], sizeof(pair));
+
+  return pair;
+}
+
+//-----------------------------------------------------------------------------
+// Correlation is taken over the fixed window of the first half of the
+// samples for all lags, so the values are not biased towards short lags.
+// Returns the peak lag in samples with 16 fractional bits, or 0.
+static int64_t coarse_peak(int count)
+{
+  int32_t *corr = overlay.scratch.autocorr.corr;
+  int half = count / 2;
+  int zero = 0;
+  int max = 0;
+  int32_t max_corr = 0;
+
+  for (int lag = 0; lag <= half; lag++)
+  {
+    int32_t acc = 0;
+
+    for (int i = 0; i < half / 2; i++)
+      acc = __SMLAD(sample_pair(2 * i), sample_pair(2 * i + lag), acc);
+
+    corr[lag] = acc;
+
+    if (0 == zero && acc < 0)
+      zero = lag;
+
+    if (zero && acc > max_corr)
+    {
+      max = lag;
+      max_corr = acc;
+    }
+  }
+
+  if (corr[0] < AUTOCORR_MIN_POWER || 0 == max ||
+      (int64_t)max_corr * 16 < (int64_t)corr[0] * AUTOCORR_MIN_RATIO)
+    return 0;
+
+  // Multiples of the period are as high as the period itself, the first
+  // one of the high peaks is taken
+  for (int lag = zero + 1; lag < half; lag++)
+  {
+    int32_t c = corr[lag];
+    int64_t cm = corr[lag-1];
+    int64_t cp = corr[lag+1];
+
+    if ((int64_t)c * 16 < (int64_t)max_corr * AUTOCORR_PEAK_RATIO || c < cm || c < cp)
+      continue;
+
+    // Parabolic interpolation of the peak
+    return ((int64_t)lag << 16) + ((cm - cp) << 15) / (cm - 2 * c + cp);
+  }
+
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Similarity of the window and the window shifted by 'lag'. It is the
+// squared difference subtracted from the energy of the window, so unlike
+// the plain dot product it peaks exactly at the period even if the window
+// is not a whole number of periods. Samples are taken 4 at a time, SMLAD
+// multiplies the even and odd halfword lanes. Optional 'variance' receives
+// the sum of the squared deviations of both windows.
+static int64_t correlate(const Segment *seg, int lag, int64_t *variance)
+{
+  const uint32_t *a = (const uint32_t *)seg->data;
+  const uint8_t *b = seg->data + lag;
+  uint32_t ab = 0;
+  uint32_t bb = 0;
+  uint32_t sum = 0;
+
+  for (int i = 0; i < seg->window / 4; i++)
+  {
+    uint32_t wa = a[i];
+    uint32_t wb = __UNALIGNED_UINT32_READ(&b[i * 4]);
+    uint32_t even = __UXTB16(wb);
+    uint32_t odd = __UXTB16(__ROR(wb, 8));
+
+    ab = __SMLAD(__UXTB16(wa), even, ab);
+    ab = __SMLAD(__UXTB16(__ROR(wa, 8)), odd, ab);
+    bb = __SMLAD(even, even, bb);
+    bb = __SMLAD(odd, odd, bb);
+    sum = __USADA8(wb, 0, sum);
+  }
+
+  if (variance)
+  {
+    *variance = seg->energy - (seg->sum * seg->sum) / seg->window +
+        bb - ((int64_t)sum * sum) / seg->window;
+  }
+
+  return 2 * (int64_t)ab - bb;
+}
+
+//-----------------------------------------------------------------------------
+// Squared difference of the window and the window shifted by 'lag'
+static inline int64_t difference(const Segment *seg, int lag, int64_t *variance)
+{
+  return seg->energy - correlate(seg, lag, variance);
+}
+
+//-----------------------------------------------------------------------------
+// Vertex of the parabola through the similarity at 'lag' and 'lag' +/- 'h',
+// iterated until it settles. Spacing of about a quarter of the period keeps
+// it insensitive to the noise of the individual lags, and the peak is
+// symmetric, so the vertex converges to its centre. Lags are in samples with
+// 16 fractional bits, returns 0 if there is no peak in range.
+static int64_t fine_peak(const Segment *seg, int64_t lag, int h)
+{
+  int max_lag = seg->size - seg->window;
+
+  for (int i = 0; i < AUTOCORR_ITERATIONS; i++)
+  {
+    int center = (lag + 0x8000) >> 16;
+    int64_t cm, c, cp, den, delta;
+
+    if (center - h < 1 || center + h >= max_lag)
+      return 0;
+
+    cm  = correlate(seg, center - h, NULL);
+    c   = correlate(seg, center, NULL);
+    cp  = correlate(seg, center + h, NULL);
+    den = cm - 2 * c + cp;
+
+    if (den >= 0)
+      return 0;
+
+    delta = (((cm - cp) * h) << 15) / den;
+
+    if (delta > ((int64_t)h << 16))
+      delta = (int64_t)h << 16;
+    else if (delta < -((int64_t)h << 16))
+      delta = -((int64_t)h << 16);
+
+    lag = ((int64_t)center << 16) + delta;
+
+    if (delta < 0x10000 && delta > -0x10000)
+      break;
+  }
+
+  return lag;
+}
+
+//-----------------------------------------------------------------------------
+// Walks from 'lag' to the nearest local minimum of the difference. Returns
+// the lag, or 0 if it is not found within 'range' steps.
+static int climb(const Segment *seg, int lag, int range)
+{
+  int max_lag = seg->size - seg->window - 1;
+  int64_t dm, d, dp;
+
+  if (lag < 2 || lag >= max_lag)
+    return 0;
+
+  dm = difference(seg, lag - 1, NULL);
+  d  = difference(seg, lag, NULL);
+  dp = difference(seg, lag + 1, NULL);
+
+  while (dm < d || dp < d)
+  {
+    if (--range < 0)
+      return 0;
+
+    if (dp < dm)
+    {
+      if (++lag >= max_lag)
+        return 0;
+
+      dm = d;
+      d  = dp;
+      dp = difference(seg, lag + 1, NULL);
+    }
+    else
+    {
+      if (--lag < 2)
+        return 0;
+
+      dp = d;
+      d  = dm;
+      dm = difference(seg, lag - 1, NULL);
+    }
+  }
+
+  return lag;
+}
+
+//-----------------------------------------------------------------------------
+// Coarse estimate is refined at the full rate, first at one period, then at
+// multiples of it. Each multiple is 8 times the previous one, so the error
+// of the predicted lag stays well within the spacing of the fit.
+static int64_t refine(Segment *seg, int64_t period, int step)
+{
+  int64_t lag, peak, variance;
+  int max_n, n, h;
+
+  seg->window = seg->size - 2 * (period >> 16) - 4;
+
+  if (seg->window > AUTOCORR_WINDOW)
+    seg->window = AUTOCORR_WINDOW;
+
+  // Whole number of periods in the window keeps the peak symmetric
+  if (seg->window > (period >> 16))
+    seg->window = ((((int64_t)seg->window << 16) / period) * period) >> 16;
+
+  seg->window &= ~3;
+
+  // Segment is too short for the refinement, decimated estimate is used
+  if (seg->window < AUTOCORR_MIN_WINDOW)
+    return period;
+
+  seg->sum = 0;
+  seg->energy = 0;
+
+  for (int i = 0; i < seg->window; i++)
+  {
+    seg->sum += seg->data[i];
+    seg->energy += seg->data[i] * seg->data[i];
+  }
+
+  lag = climb(seg, (period + 0x8000) >> 16, step + 2);
+
+  if (0 == lag)
+    return 0;
+
+  // Shifted window must be closer to the window than the uncorrelated
+  // signals are
+  peak = difference(seg, lag, &variance);
+
+  if (peak * 16 > variance * (16 - AUTOCORR_MIN_RATIO))
+    return 0;
+
+  // Fit spacing is a half of the distance where the difference gets half
+  // way to the uncorrelated one, so the parabola stays within the peak
+  for (h = 1; h < lag / 2; h *= 2)
+  {
+    if (difference(seg, lag + h, NULL) * 2 > variance + peak ||
+        difference(seg, lag - h, NULL) * 2 > variance + peak)
+      break;
+  }
+
+  h = (h > 1) ? h / 2 : 1;
+
+  period = fine_peak(seg, (int64_t)lag << 16, h);
+
+  if (0 == period)
+    return 0;
+
+  max_n = ((int64_t)(seg->size - seg->window - h - 1) << 16) / period;
+  n = 1;
+
+  while (n < max_n)
+  {
+    n = (n * AUTOCORR_MULTIPLE_STEP < max_n) ? n * AUTOCORR_MULTIPLE_STEP : max_n;
+    lag = fine_peak(seg, period * n, h);
+
+    if (0 == lag)
+      break;
+
+    period = lag / n;
+  }
+
+  return period;
+}
+
+//-----------------------------------------------------------------------------
+// Data is a ring of 'size' samples with the oldest one at 'offset'. Returns
+// the period in samples with 16 fractional bits, or 0 if the signal has no
+// clear period. Decimation is reduced step by step for the signals that are
+// too fast for it, so at most three coarse searches are done for 32K samples.
+int64_t autocorr_period(const uint8_t *data, int size, int offset)
+{
+  int step = size / AUTOCORR_SIZE;
+  int64_t coarse, period;
+  Segment seg;
+  int start, count;
+
+  if (size < AUTOCORR_MIN_WINDOW * 2)
+    return 0;
+
+  if (step < 1)
+    step = 1;
+
+  if (offset > size / 2)
+  {
+    start = 0;
+    seg.size = offset;
+  }
+  else
+  {
+    start = (offset + 3) & ~3;
+    seg.size = size - start;
+  }
+
+  seg.data = data + start;
+
+  while (1)
+  {
+    count  = decimate(data, size, offset, step);
+    coarse = count ? coarse_peak(count) : 0;
+
+    // Short decimated periods may be aliases of the faster signals
+    if (coarse >= (AUTOCORR_MIN_LAG << 16) || (coarse && 1 == step))
+    {
+      period = refine(&seg, coarse * step, step);
+
+      if (period)
+        return period;
+    }
+
+    if (1 == step)
+      return 0;
+
+    step /= AUTOCORR_PYRAMID_STEP;
+
+    if (step < 1)
+      step = 1;
+  }
+}
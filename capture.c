@@ -31,6 +31,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdalign.h>
+#include <string.h>
 #include "gd32f4xx.h"
 #include "hal_gpio.h"
 #include "utils.h"
@@ -38,6 +39,13 @@
 #include "common.h"
 #include "config.h"
 #include "trigger.h"
+#include "flash.h"
+#include "deep.h"
+#include "history.h"
+#include "anomaly.h"
+#include "logger.h"
+#include "meter.h"
+#include "counter.h"
 #include "capture.h"
 
 /*- Definitions -------------------------------------------------------------*/
@@ -60,11 +68,20 @@ HAL_GPIO_PIN(AC_DC,    C, 15)
 #define DMA_MAX_BUFFER_SIZE    (16 * 1024)
 
 #define STORAGE_BUFFER_SIZE    (32 * 1024)
-#define STORAGE_BUFFER_RATIO   (CAPTURE_BUFFER_SIZE / STORAGE_BUFFER_SIZE)
 
 #define ZERO_POINT             0x80
 
-#define MEASURE_HYSTERESIS     3
+#define DECIMATE_BLOCK_SIZE    32
+#define REARM_COPY_CYCLES      1 // Per sample
+#define REARM_CHECK_CYCLES     1 // Per sample, anomaly check
+#define REARM_METER_CYCLES     2 // Per sample, meter sums
+#define REARM_GUARD_SAMPLES    32
+
+#define UART_MIN_SAMPLES_PER_BIT 4
+
+#define VIDEO_MIN_SAMPLES_PER_LINE 64
+#define VIDEO_PAL_LINE_PERIOD  64000 // ns
+#define VIDEO_NTSC_LINE_PERIOD 63556 // ns
 
 /*- Types -------------------------------------------------------------------*/
 typedef struct
@@ -79,6 +96,7 @@ typedef struct
   uint8_t  *data;
   int      min_index;
   int      max_index;
+  bool     anomaly;
 } BufferInfo;
 
 /*- Variables ---------------------------------------------------------------*/
@@ -87,26 +105,58 @@ typedef struct
 //       critical for performance.
 static volatile uint8_t *g_capture_buffer = (uint8_t *)0x20000000;
 static volatile int g_dma_buffer_size;
+static volatile int g_record_size;
+static volatile int g_storage_ratio;
+static volatile int g_trigger_type;
 static volatile int g_trigger_mode;
 static volatile int g_trigger_edge;
 static volatile int g_trigger_level;
 static volatile int g_trigger_offset;
 static volatile int g_sample_period;
 static volatile bool g_dual_channel;
+static volatile int g_uart_baud;
+static volatile bool g_uart_inverted;
+static volatile int g_uart_value;
+static volatile int g_uart_mask;
+static volatile int g_video_standard;
+static volatile int g_video_sync;
+static volatile int g_video_line;
 static volatile int g_last_sample = 0;
 static int (*g_trigger_find)(uint32_t, uint32_t) = NULL;
 static volatile int g_active_buf_ptr;
 static volatile int g_next_buf_ptr;
-static volatile int g_trigger_ptr;
+static volatile uint32_t g_sample_time;  // Index of the first sample of the active block
+static volatile uint32_t g_trigger_time; // Index of the trigger sample
 static volatile int g_count;
 static volatile int g_remaining;
 static volatile int g_auto_mode_count;
 static volatile bool g_auto_mode_stop;
 static volatile bool g_triggered;
 static volatile bool g_stopped;
+static volatile bool g_rearm;
+static volatile bool g_anomaly;
+static volatile bool g_logger;
+static volatile bool g_meter;
+static volatile bool g_counter;
+static volatile int g_deep_size;
+static volatile bool g_deep_pending;
+static int g_deep_read_index;
+static int g_deep_read_size;
+static volatile bool g_locked;
+static bool g_start_pending;
+static bool g_recalled;
+static volatile BufferInfo *g_view_info = NULL;
+static bool g_playback;
+static volatile int g_stats_acquisitions;
+static volatile uint64_t g_stats_live_time;
 static volatile alignas(32) uint8_t g_storage_buffer[STORAGE_BUFFER_SIZE];
 static volatile BufferInfo g_capture_buffer_info;
 static volatile BufferInfo g_storage_buffer_info;
+static BufferInfo g_playback_buffer_info;
+static volatile uint32_t g_record_id; // Changes with the content of any record
+static const BufferInfo *g_measure_info = NULL;
+static uint32_t g_measure_record_id;
+static Measurements g_measure;
 
 /*- Prototypes --------------------------------------------------------------*/
 static inline int dma_get_count(void);
@@ -250,7 +300,10 @@ void capture_init(void)
   g_triggered      = false;
   g_stopped        = true;
   g_dual_channel   = false;
+  g_record_size    = CAPTURE_BUFFER_SIZE;
+  g_storage_ratio  = CAPTURE_BUFFER_SIZE / STORAGE_BUFFER_SIZE;
   g_trigger_offset = CAPTURE_BUFFER_SIZE / 2;
+  g_trigger_type   = TRIGGER_TYPE_EDGE;
 
   capture_set_trigger_edge(TRIGGER_EDGE_RISE);
   capture_set_trigger_mode(TRIGGER_MODE_AUTO);
@@ -290,47 +343,104 @@ static bool check_trigger_condition(int prev, int new)
 }
 
 //-----------------------------------------------------------------------------
-static void update_capture_buffer(void)
+static void update_capture_buffer(int guard)
 {
-  g_capture_buffer_info.offset = g_next_buf_ptr - dma_get_count();
+  int count = dma_get_count();
+  uint32_t oldest = g_sample_time + g_dma_buffer_size * 2 - count - g_record_size + guard;
+  int min_index, trigger;
+
+  g_capture_buffer_info.offset = g_next_buf_ptr - count + guard;
 
   if (g_capture_buffer_info.offset < 0)
-    g_capture_buffer_info.offset += CAPTURE_BUFFER_SIZE;
-  else if (g_capture_buffer_info.offset >= CAPTURE_BUFFER_SIZE)
-    g_capture_buffer_info.offset -= CAPTURE_BUFFER_SIZE;
+    g_capture_buffer_info.offset += g_record_size;
+  else if (g_capture_buffer_info.offset >= g_record_size)
+    g_capture_buffer_info.offset -= g_record_size;
 
   if (g_auto_mode_stop)
-    g_trigger_ptr = (g_capture_buffer_info.offset + g_trigger_offset) % CAPTURE_BUFFER_SIZE;
+    g_trigger_time = oldest + g_trigger_offset;
+
+  // With the delayed acquisition the trigger sample may be long gone,
+  // so position of the record is determined by the sample indexes
+  min_index = (int)(oldest - g_trigger_time);
+
+  trigger = (g_capture_buffer_info.offset - min_index) % g_record_size;
 
-  g_capture_buffer_info.trigger = g_trigger_ptr;
+  if (trigger < 0)
+    trigger += g_record_size;
+
+  g_capture_buffer_info.size      = g_record_size;
+  g_capture_buffer_info.trigger   = trigger;
+  g_capture_buffer_info.min_index = min_index;
+  g_capture_buffer_info.max_index = min_index + g_record_size - 1;
   g_capture_buffer_info.valid   = true;
 }
 
 //-----------------------------------------------------------------------------
-static void update_storage_buffer(void)
+static void decimate(int index, int size, int offset)
 {
-  int offset = g_capture_buffer_info.trigger % STORAGE_BUFFER_RATIO;
+  uint32_t dst = (uint32_t)g_storage_buffer + index / g_storage_ratio;
+  uint32_t src = (uint32_t)g_capture_buffer + index;
 
-  if (g_storage_buffer_info.valid)
+  if (1 == g_storage_ratio)
+  {
+    memcpy((void *)dst, (void *)src, size);
     return;
+  }
 
   // NOTE: Given the way dual channel trigger event search is implemented,
   //       the reverse version will never be called. I'm still keeping it
   //       here just in case things change in the future.
   if (g_dual_channel && (offset & 1) == 1)
-    buffer_decimate_reverse((uint32_t)g_storage_buffer, (uint32_t)g_capture_buffer, CAPTURE_BUFFER_SIZE, offset);
+    buffer_decimate_reverse(dst, src, size, offset);
   else
-    buffer_decimate((uint32_t)g_storage_buffer, (uint32_t)g_capture_buffer, CAPTURE_BUFFER_SIZE, offset);
+    buffer_decimate(dst, src, size, offset);
+}
 
-  g_storage_buffer_info.offset = g_capture_buffer_info.offset / STORAGE_BUFFER_RATIO;
+//-----------------------------------------------------------------------------
+static void update_storage_buffer(void)
+{
+  int ratio = g_storage_ratio;
+  int offset = g_capture_buffer_info.trigger % ratio;
+  int start = g_capture_buffer_info.offset & ~(DECIMATE_BLOCK_SIZE-1);
+
+  // Locked buffer is being saved, new records are dropped until it is released.
+  // Failed record replaces a normal one that was not displayed yet.
+  if (g_locked || (g_storage_buffer_info.valid &&
+      (g_storage_buffer_info.anomaly || !g_capture_buffer_info.anomaly)))
+    return;
+
+  // Oldest samples are copied first, so DMA may keep running
+  decimate(start, g_record_size - start, offset);
 
-  if (offset < (g_capture_buffer_info.offset % STORAGE_BUFFER_RATIO))
+  if (start > 0)
+    decimate(0, start, offset);
+
+  // Plain copy of the dual channel data needs to be fixed up
+  if (1 == ratio && g_dual_channel)
+    buffer_reverse((uint32_t)g_storage_buffer, g_record_size);
+
+  g_storage_buffer_info.offset = g_capture_buffer_info.offset / ratio;
+
+  if (offset < (g_capture_buffer_info.offset % ratio))
     g_storage_buffer_info.offset++;
 
-  g_storage_buffer_info.period  = g_sample_period * STORAGE_BUFFER_RATIO;
-  g_storage_buffer_info.trigger = g_capture_buffer_info.trigger / STORAGE_BUFFER_RATIO;
+  if (g_storage_buffer_info.offset == (g_record_size / ratio))
+    g_storage_buffer_info.offset = 0;
+
+  g_storage_buffer_info.size    = g_record_size / ratio;
+
+  if (g_capture_buffer_info.min_index < 0)
+    g_storage_buffer_info.min_index = -(-g_capture_buffer_info.min_index / ratio);
+  else
+    g_storage_buffer_info.min_index = (g_capture_buffer_info.min_index + ratio - 1) / ratio;
+
+  g_storage_buffer_info.max_index = g_storage_buffer_info.min_index + g_storage_buffer_info.size - 1;
+
+  g_storage_buffer_info.period  = g_sample_period * ratio;
+  g_storage_buffer_info.trigger = g_capture_buffer_info.trigger / ratio;
   g_storage_buffer_info.vpos    = g_capture_buffer_info.vpos;
   g_storage_buffer_info.vs_mult = g_capture_buffer_info.vs_mult;
+  g_storage_buffer_info.anomaly = g_capture_buffer_info.anomaly;
   g_storage_buffer_info.valid   = true;
 }
 
@@ -363,12 +473,23 @@ static inline void dma_start(void)
 
   g_active_buf_ptr = 0;
   g_next_buf_ptr   = g_dma_buffer_size * 2;
-  g_trigger_ptr    = 0;
+  g_sample_time    = 0;
+  g_trigger_time   = 0;
   g_count          = 0;
   g_remaining      = 0;
   g_triggered      = false;
   g_auto_mode_stop = false;
 
+  trigger_uart_reset();
+  trigger_video_reset();
+
+  if (g_deep_size)
+  {
+    deep_arm(g_deep_size, (uint8_t *)g_capture_buffer, g_record_size, (uint8_t *)g_storage_buffer);
+    g_deep_pending   = false;
+    g_deep_read_size = 0;
+  }
+
   g_capture_buffer_info.period  = g_sample_period;
   g_capture_buffer_info.vpos    = config.vertical_position_mv;
   g_capture_buffer_info.vs_mult = config.calib_vs_mult[config.vertical_scale];
@@ -412,16 +533,72 @@ static inline void dma_wait_count(uint32_t count)
 }
 
 //-----------------------------------------------------------------------------
-static inline void dma_finish(void)
+// Records without a trigger have nothing to align the envelope to
+static inline void check_anomaly(void)
 {
+  g_capture_buffer_info.anomaly = g_anomaly && !g_meter && !g_auto_mode_stop && !g_dual_channel &&
+      anomaly_check((uint8_t *)g_capture_buffer, g_record_size, g_capture_buffer_info.offset,
+      g_capture_buffer_info.min_index, -g_trigger_offset);
+}
+
+//-----------------------------------------------------------------------------
+// Meter only needs the sums, so the record is not copied for the display.
+// With the rearm DMA may overwrite the oldest samples while they are summed,
+// but those are samples of the same signal.
+static inline void update_buffers(void)
+{
+  if (g_meter)
+  {
+    meter_update((uint8_t *)g_capture_buffer, g_record_size, g_capture_buffer_info.vs_mult,
+        g_capture_buffer_info.vpos);
+  }
+  else
+  {
+    check_anomaly();
+    update_storage_buffer();
+  }
+}
+
+//-----------------------------------------------------------------------------
+static inline void dma_rearm(void)
+{
+  update_capture_buffer(REARM_GUARD_SAMPLES);
+  update_buffers();
+
+  // Capture buffer is overwritten from now on, but the tail of the current
+  // record is a valid pre-trigger history for the next one
+  g_capture_buffer_info.valid = false;
+
+  g_count          = g_trigger_offset;
+  g_remaining      = 0;
+  g_triggered      = false;
+  g_auto_mode_stop = false;
+
+  trigger_uart_reset();
+}
+
+//-----------------------------------------------------------------------------
+// Returns true if DMA is still running and the interrupt handler must advance
+// the buffer pointers as usual.
+static inline bool dma_finish(void)
+{
+  g_stats_acquisitions++;
+  g_record_id++;
+
+  if (g_rearm && TRIGGER_MODE_SINGLE != g_trigger_mode)
+  {
+    dma_rearm();
+    return true;
+  }
+
   dma_stop();
-  update_capture_buffer();
-  update_storage_buffer();
+  update_capture_buffer(0);
+  update_buffers();
 
   if (TRIGGER_MODE_SINGLE == g_trigger_mode)
   {
     if (g_dual_channel)
-      buffer_reverse((uint32_t)g_capture_buffer, CAPTURE_BUFFER_SIZE);
+      buffer_reverse((uint32_t)g_capture_buffer, g_record_size);
 
     g_stopped = true;
   }
@@ -429,6 +606,16 @@ static inline void dma_finish(void)
   {
     dma_start();
   }
+
+  return false;
+}
+
+//-----------------------------------------------------------------------------
+static inline void trigger_track(uint8_t *buf)
+{
+  // Video decoder has to see all the samples to keep track of the lines
+  if (TRIGGER_TYPE_VIDEO == g_trigger_type)
+    g_trigger_find((uint32_t)buf, g_dma_buffer_size);
 }
 
 //-----------------------------------------------------------------------------
@@ -443,22 +630,49 @@ void irq_handler_dma1_channel2(void)
   else
     DMA1->CH2M1ADDR = (uint32_t)g_capture_buffer + g_next_buf_ptr;
 
-  if (g_triggered)
+  // Logger reduces every block, nothing is triggered or kept
+  if (g_logger)
+  {
+    logger_update(active_buffer, g_dma_buffer_size);
+  }
+
+  // Counter timestamps the edges of every block against the sample count
+  else if (g_counter)
+  {
+    counter_update(active_buffer, g_dma_buffer_size, g_trigger_level);
+  }
+
+  else if (g_triggered)
   {
-    if (g_remaining >= g_dma_buffer_size)
+    trigger_track(active_buffer);
+
+    if (g_deep_size)
+    {
+      // Deep record ends once all of it is in the ring, the flash writer
+      // may still be behind
+      if (!deep_update(g_sample_time + g_dma_buffer_size))
+      {
+        dma_stop();
+        g_stopped = true;
+        return;
+      }
+    }
+    else if (g_remaining >= g_dma_buffer_size)
     {
       g_remaining -= g_dma_buffer_size;
     }
     else
     {
       dma_wait_count(g_dma_buffer_size - g_remaining);
-      dma_finish();
-      return;
+
+      if (!dma_finish())
+        return;
     }
   }
 
   else if (g_count < g_trigger_offset)
   {
+    trigger_track(active_buffer);
     g_count += g_dma_buffer_size;
   }
 
@@ -466,49 +680,80 @@ void irq_handler_dma1_channel2(void)
   {
     int trigger;
 
-    if (check_trigger_condition(g_last_sample, active_buffer[0]))
+    g_stats_live_time += g_dma_buffer_size * g_sample_period;
+
+    if (TRIGGER_TYPE_EDGE == g_trigger_type && check_trigger_condition(g_last_sample, active_buffer[0]))
       trigger = g_dma_buffer_size;
     else
       trigger = g_trigger_find((uint32_t)active_buffer, g_dma_buffer_size);
 
-    if (trigger > 0)
+    if (trigger > 0 && g_deep_size)
+    {
+      uint32_t time = g_sample_time + (g_dma_buffer_size - trigger);
+
+      // Trigger is ignored until the flash is erased
+      if (deep_start(time - g_trigger_offset, g_dma_buffer_size * 2))
+      {
+        g_triggered    = true;
+        g_trigger_time = time;
+        g_deep_pending = true;
+
+        deep_update(g_sample_time + g_dma_buffer_size);
+      }
+    }
+    else if (trigger > 0)
     {
       g_triggered = true;
-      g_trigger_ptr = g_active_buf_ptr + (g_dma_buffer_size - trigger);
-      g_remaining = (CAPTURE_BUFFER_SIZE - g_trigger_offset) - trigger;
+      g_trigger_time = g_sample_time + (g_dma_buffer_size - trigger);
+      g_remaining = (g_record_size - g_trigger_offset) - trigger;
 
       if (g_remaining < 0)
       {
-        dma_finish();
-        return;
+        if (!dma_finish())
+          return;
       }
       else if (g_remaining < g_dma_buffer_size)
       {
         dma_wait_count(g_dma_buffer_size - g_remaining);
-        dma_finish();
-        return;
+
+        if (!dma_finish())
+          return;
       }
       else
       {
         g_remaining -= g_dma_buffer_size;
       }
     }
-    else if (TRIGGER_MODE_AUTO == g_trigger_mode)
+    else if (TRIGGER_MODE_AUTO == g_trigger_mode && !g_deep_size)
     {
       g_count += g_dma_buffer_size;
 
       if (g_count > g_auto_mode_count)
       {
         g_auto_mode_stop = true;
-        dma_finish();
-        return;
+
+        if (!dma_finish())
+          return;
       }
     }
   }
 
   g_last_sample    = active_buffer[g_dma_buffer_size - (g_dual_channel ? 2 : 1)];
-  g_next_buf_ptr   = (g_next_buf_ptr + g_dma_buffer_size) % CAPTURE_BUFFER_SIZE;
-  g_active_buf_ptr = (g_active_buf_ptr + g_dma_buffer_size) % CAPTURE_BUFFER_SIZE;
+  g_next_buf_ptr   = (g_next_buf_ptr + g_dma_buffer_size) % g_record_size;
+  g_active_buf_ptr = (g_active_buf_ptr + g_dma_buffer_size) % g_record_size;
+  g_sample_time   += g_dma_buffer_size;
+}
+
+//-----------------------------------------------------------------------------
+// Part of the capture buffer past the record is not touched by DMA
+static void update_history_area(void)
+{
+  int size = (g_record_size > STORAGE_BUFFER_SIZE) ? STORAGE_BUFFER_SIZE : g_record_size;
+
+  if (g_deep_size)
+    history_set_area(NULL, 0, 0);
+  else
+    history_set_area((uint8_t *)g_capture_buffer + g_record_size, CAPTURE_BUFFER_SIZE - g_record_size, size);
 }
 
 //-----------------------------------------------------------------------------
@@ -517,8 +762,18 @@ void capture_start(void)
   if (!g_stopped)
     return;
 
-  g_stopped = false;
+  // Capture buffer is being saved, start once it is released
+  if (g_locked)
+  {
+    g_start_pending = true;
+    return;
+  }
+
+  g_stopped  = false;
+  g_recalled = false;
+  g_playback = false;
 
+  update_history_area();
   dma_start();
 }
 
@@ -530,13 +785,63 @@ void capture_stop(void)
 
   dma_stop();
 
+  if (g_deep_size)
+    deep_stop();
+
   g_stopped = true;
 }
 
+//-----------------------------------------------------------------------------
+static void update_uart_decoder(void)
+{
+  uint32_t bit_period = 0;
+
+  // Dual channel data is not suitable for the bit level decoding
+  if (!g_dual_channel && g_uart_baud > 0 && g_sample_period > 0)
+  {
+    uint64_t period = ((uint64_t)1000000000 << 16) / ((uint64_t)g_sample_period * g_uart_baud);
+
+    if (period >= (UART_MIN_SAMPLES_PER_BIT << 16) && period <= INT32_MAX)
+      bit_period = period;
+  }
+
+  trigger_uart_setup(bit_period, g_uart_inverted, g_uart_value, g_uart_mask);
+}
+
+//-----------------------------------------------------------------------------
+static void update_video_decoder(void)
+{
+  bool ntsc = (VIDEO_STANDARD_NTSC == g_video_standard);
+  int line_period = 0;
+
+  if (!g_dual_channel && g_sample_period > 0)
+  {
+    line_period = (ntsc ? VIDEO_NTSC_LINE_PERIOD : VIDEO_PAL_LINE_PERIOD) / g_sample_period;
+
+    if (line_period < VIDEO_MIN_SAMPLES_PER_LINE)
+      line_period = 0;
+  }
+
+  if (ntsc)
+    trigger_video_setup(line_period, VIDEO_NTSC_LINES, 4, 266, g_video_sync, g_video_line);
+  else
+    trigger_video_setup(line_period, VIDEO_PAL_LINES, 1, 313, g_video_sync, g_video_line);
+}
+
 //-----------------------------------------------------------------------------
 static void update_trigger_handler(void)
 {
-  if (g_dual_channel)
+  if (TRIGGER_TYPE_UART == g_trigger_type)
+  {
+    g_trigger_find = trigger_find_uart;
+    update_uart_decoder();
+  }
+  else if (TRIGGER_TYPE_VIDEO == g_trigger_type)
+  {
+    g_trigger_find = trigger_find_video;
+    update_video_decoder();
+  }
+  else if (g_dual_channel)
   {
     if (TRIGGER_EDGE_RISE == g_trigger_edge)
       g_trigger_find = trigger_find_rise_dual;
@@ -566,13 +871,29 @@ void capture_set_vertical_parameters(void)
   set_ac_coupling();
   dac_write(config.calib_dac_zero + offset);
   set_vertical_scale();
+  anomaly_reset();
+  meter_reset();
 
   if (!g_stopped)
     dma_start();
 }
 
 //-----------------------------------------------------------------------------
-void capture_set_horizontal_parameters(int sr_divider, int trigger_offset)
+// Re-arming keeps DMA running while the record is checked and decimated into
+// the storage buffer. This must take less than one DMA block, so the next
+// block interrupt is delayed, but not missed. Both passes are also much faster
+// than DMA at these rates, so the oldest samples are processed before DMA
+// gets to them.
+static void update_rearm(void)
+{
+  uint64_t cycles = g_meter ? REARM_METER_CYCLES : (REARM_COPY_CYCLES + (g_anomaly ? REARM_CHECK_CYCLES : 0));
+
+  g_rearm = !g_dual_channel && !g_deep_size && (cycles * g_record_size * 1000000000 <
+      (uint64_t)g_dma_buffer_size * g_sample_period * F_CPU);
+}
+
+//-----------------------------------------------------------------------------
+void capture_set_horizontal_parameters(int sr_divider, int record_size, int trigger_offset)
 {
   int divider, dma_divider;
 
@@ -591,8 +912,27 @@ void capture_set_horizontal_parameters(int sr_divider, int trigger_offset)
 
   dma_divider = (sr_divider < 6) ? 1 : (1 << (sr_divider - 6));
 
+  // Records longer than the capture buffer are streamed to the SPI flash,
+  // the capture buffer is then used as a ring for the flash writer
+  if (record_size > CAPTURE_BUFFER_SIZE)
+  {
+    g_deep_size = record_size;
+    record_size = CAPTURE_BUFFER_SIZE;
+  }
+  else
+  {
+    g_deep_size = 0;
+  }
+
   g_dma_buffer_size = DMA_MAX_BUFFER_SIZE / dma_divider;
 
+  // Ring must hold at least 4 DMA blocks
+  if (g_dma_buffer_size > record_size / 4)
+    g_dma_buffer_size = record_size / 4;
+
+  g_record_size   = record_size;
+  g_storage_ratio = (record_size > STORAGE_BUFFER_SIZE) ? (record_size / STORAGE_BUFFER_SIZE) : 1;
+
   TIMER0->CTL0 = 0;
   TIMER7->CTL0 = 0;
 
@@ -609,13 +949,18 @@ void capture_set_horizontal_parameters(int sr_divider, int trigger_offset)
   g_sample_period   = BASE_SAMPLE_PERIOD * (1 << sr_divider);
   g_auto_mode_count = (BASE_SAMPLE_RATE / (1 << sr_divider)) / AUTO_MODE_COUNT_DIV;
 
-  if (g_auto_mode_count < CAPTURE_BUFFER_SIZE)
-    g_auto_mode_count = CAPTURE_BUFFER_SIZE;
+  if (g_auto_mode_count < record_size)
+    g_auto_mode_count = record_size;
 
+  update_rearm();
   update_trigger_handler();
+  anomaly_reset();
 
   if (!g_stopped)
+  {
+    update_history_area();
     dma_start();
+  }
 }
 
 //-----------------------------------------------------------------------------
@@ -638,6 +983,52 @@ void capture_set_trigger_edge(int edge)
 
   g_trigger_edge = edge;
 
+  update_trigger_handler();
+  anomaly_reset();
+
+  if (!g_stopped)
+    dma_start();
+}
+
+//-----------------------------------------------------------------------------
+void capture_set_trigger_type(int type)
+{
+  dma_stop();
+
+  g_trigger_type = type;
+
+  update_trigger_handler();
+  anomaly_reset();
+
+  if (!g_stopped)
+    dma_start();
+}
+
+//-----------------------------------------------------------------------------
+void capture_set_uart_trigger(int baud, bool inverted, int value, int mask)
+{
+  dma_stop();
+
+  g_uart_baud     = baud;
+  g_uart_inverted = inverted;
+  g_uart_value    = value;
+  g_uart_mask     = mask;
+
+  update_trigger_handler();
+
+  if (!g_stopped)
+    dma_start();
+}
+
+//-----------------------------------------------------------------------------
+void capture_set_video_trigger(int standard, int sync, int line)
+{
+  dma_stop();
+
+  g_video_standard = standard;
+  g_video_sync     = sync;
+  g_video_line     = line;
+
   update_trigger_handler();
 
   if (!g_stopped)
@@ -655,9 +1046,86 @@ void capture_set_trigger_mode(int mode)
     dma_start();
 }
 
+//-----------------------------------------------------------------------------
+// Every triggered acquisition is checked against the envelope learned from
+// the first few of them, failed ones are passed on to be saved
+void capture_set_anomaly(bool enable, int margin)
+{
+  dma_stop();
+
+  g_anomaly = enable;
+
+  anomaly_setup(margin);
+  update_rearm();
+
+  if (!g_stopped)
+    dma_start();
+}
+
+//-----------------------------------------------------------------------------
+void capture_set_logger(bool enable)
+{
+  dma_stop();
+
+  g_logger = enable;
+
+  if (!g_stopped)
+    dma_start();
+}
+
+//-----------------------------------------------------------------------------
+void capture_set_meter(bool enable)
+{
+  dma_stop();
+
+  g_meter = enable;
+
+  update_rearm();
+  meter_reset();
+
+  if (!g_stopped)
+    dma_start();
+}
+
+//-----------------------------------------------------------------------------
+void capture_set_counter(bool enable)
+{
+  dma_stop();
+
+  g_counter = enable;
+
+  if (!g_stopped)
+    dma_start();
+}
+
+//-----------------------------------------------------------------------------
+// Cached measurements are dropped after their settings change
+void capture_reset_measurements(void)
+{
+  g_measure_info = NULL;
+}
+
+//-----------------------------------------------------------------------------
+void capture_get_stats(int *acquisitions, int64_t *live_time)
+{
+  __disable_irq();
+
+  *acquisitions = g_stats_acquisitions;
+  *live_time    = g_stats_live_time;
+
+  g_stats_acquisitions = 0;
+  g_stats_live_time    = 0;
+
+  __enable_irq();
+}
+
 //-----------------------------------------------------------------------------
 int capture_get_state(void)
 {
+  // Deep record is complete only after the flash writer catches up
+  if (g_deep_size && DEEP_STATE_WRITE == deep_get_state())
+    return CAPTURE_STATE_TRIG;
+
   if (g_stopped)
     return CAPTURE_STATE_STOP;
   else if (g_triggered)
@@ -669,6 +1137,12 @@ int capture_get_state(void)
 //-----------------------------------------------------------------------------
 bool capture_buffer_updated(void)
 {
+  if (g_deep_pending && DEEP_STATE_DONE == deep_get_state())
+  {
+    g_deep_pending = false;
+    return true;
+  }
+
   return g_storage_buffer_info.valid;
 }
 
@@ -799,11 +1273,9 @@ static int clamp_index(BufferInfo *info, int index)
   if (index > info->max_index)
     index = info->max_index;
 
-  index = info->trigger + index;
+  index = info->offset + (index - info->min_index);
 
-  if (index < 0)
-    index += info->size;
-  else if (index >= info->size)
+  if (index >= info->size)
     index -= info->size;
 
   return index;
@@ -832,53 +1304,115 @@ static bool find_min_max(BufferInfo *info, int index0, int index1, int *vmin, in
 }
 
 //---------------------------------------------------------------------
-static int calc_frequency(BufferInfo *info)
+static bool measure_enabled(void)
 {
-  int pn, pa, pb, level, index;
-  bool low;
+  return config.measure_display || TREND_OFF != config.trend || config.histogram ||
+      JITTER_OFF != config.jitter || EYE_OFF != config.eye_rate;
+}
+
+//-----------------------------------------------------------------------------
+// Measurements and the edge index are built once per record, view changes
+// reuse them
+static void update_measurements(BufferInfo *info, bool summary)
+{
+  if (!measure_enabled() || summary)
+  {
+    memset(&g_measure, 0, sizeof(Measurements));
+    g_measure_info = NULL;
+    return;
+  }
 
-  if (!config.measure_display)
-    return 0;
+  if (info == g_measure_info && g_record_id == g_measure_record_id)
+    return;
 
-  index = info->offset;
-  low = (info->data[index] < g_trigger_level);
-  level = g_trigger_level + (low ? MEASURE_HYSTERESIS : -MEASURE_HYSTERESIS);
-  pn = 0;
+  g_measure_info      = info;
+  g_measure_record_id = g_record_id;
+
+  measure_calc(info->data, info->size, info->offset, info->period, info->vs_mult, info->vpos, &g_measure);
+}
 
-  for (int i = 0; i < info->size; i++)
+//---------------------------------------------------------------------
+static bool deep_record_valid(void)
+{
+  return g_stopped && !g_recalled && g_deep_size && DEEP_STATE_DONE == deep_get_state() && deep_get_size() > 0;
+}
+
+//---------------------------------------------------------------------
+// Narrow windows of the deep record are read back from the flash into
+// the capture buffer, wide windows are drawn from the per-page min/max summary
+// in the storage buffer.
+static BufferInfo *get_deep_info(DataBuffer *db)
+{
+  BufferInfo *capture_info = (BufferInfo *)&g_capture_buffer_info;
+  BufferInfo *storage_info = (BufferInfo *)&g_storage_buffer_info;
+  int64_t window = (int64_t)config.horizontal_period * db->size;
+  int period = capture_info->period;
+  int size = deep_get_size();
+  int min_index = (int)(deep_get_start() - g_trigger_time);
+  int count = window / period + 2;
+  int index, read_size;
+
+  if (count > CAPTURE_BUFFER_SIZE)
   {
-    bool toggle = (low && (info->data[index] > level)) || (!low && (info->data[index] < level));
+    int step = FLASH_PAGE_SIZE / 2;
+
+    storage_info->period    = period * step;
+    storage_info->offset    = 0;
+    storage_info->size      = (size / FLASH_PAGE_SIZE) * 2;
+    storage_info->min_index = (min_index < 0) ? -((step - 1 - min_index) / step) : (min_index / step);
+    storage_info->max_index = storage_info->min_index + storage_info->size - 1;
+    storage_info->trigger   = -storage_info->min_index;
+    storage_info->vpos      = capture_info->vpos;
+    storage_info->vs_mult   = capture_info->vs_mult;
+
+    return storage_info;
+  }
 
-    if (toggle)
-    {
-      if (low)
-      {
-        if (pn == 0)
-          pa = i;
-        else
-          pb = i;
-
-        pn++;
-        low = false;
-        level = g_trigger_level - MEASURE_HYSTERESIS;
-      }
-      else
-      {
-        low = true;
-        level = g_trigger_level + MEASURE_HYSTERESIS;
-      }
-    }
+  index = (config.horizontal_position - window/2) / period - 1 - min_index;
+
+  // Locked buffer is being saved, the view is limited to what is already read
+  if (!g_locked && (g_deep_read_size == 0 || index < g_deep_read_index ||
+      (index + count) > (g_deep_read_index + g_deep_read_size)))
+  {
+    // Read the whole buffer around the window, so it can be moved a bit
+    // without reading the flash again
+    read_size = (size < CAPTURE_BUFFER_SIZE) ? size : CAPTURE_BUFFER_SIZE;
+    index = index + count/2 - read_size/2;
 
-    index++;
+    if (index > (size - read_size))
+      index = size - read_size;
 
-    if (index == info->size)
+    if (index < 0)
       index = 0;
+
+    deep_read(index, (uint8_t *)g_capture_buffer, read_size);
+    history_clear();
+
+    g_deep_read_index = index;
+    g_deep_read_size  = read_size;
+    g_record_id++;
   }
 
-  if (pn < 2)
-    return 0;
+  capture_info->offset    = 0;
+  capture_info->size      = g_deep_read_size;
+  capture_info->min_index = min_index + g_deep_read_index;
+  capture_info->max_index = capture_info->min_index + g_deep_read_size - 1;
+  capture_info->trigger   = -capture_info->min_index;
+  capture_info->valid     = true;
 
-  return ((uint64_t)(pn-1) * (uint64_t)1e9) / ((pb - pa) * info->period);
+  return capture_info;
+}
+
+//---------------------------------------------------------------------
+static void get_record(BufferInfo *info, CaptureRecord *record)
+{
+  record->period    = info->period;
+  record->size      = info->size;
+  record->offset    = info->offset;
+  record->min_index = info->min_index;
+  record->vpos      = info->vpos;
+  record->vs_mult   = info->vs_mult;
+  record->data      = info->data;
 }
 
 //---------------------------------------------------------------------
@@ -891,11 +1425,17 @@ void capture_get_data(DataBuffer *db)
   int istart, dx, min_value, max_value, flags;
   int64_t offs;
 
-  if (g_stopped && capture_info->valid)
+  if (g_stopped && g_playback)
+    info = &g_playback_buffer_info;
+  else if (deep_record_valid())
+    info = get_deep_info(db);
+  else if (g_stopped && capture_info->valid)
     info = capture_info;
   else
     info = storage_info;
 
+  g_view_info = info;
+
   offs = config.horizontal_position - (int64_t)config.horizontal_period * (db->size/2 - 1) -
       info->period/2 - config.horizontal_period/2;
 
@@ -912,13 +1452,6 @@ void capture_get_data(DataBuffer *db)
     error += info->period;
   }
 
-  if (info->trigger > info->offset)
-    info->min_index = info->offset - info->trigger;
-  else
-    info->min_index = info->offset - info->trigger - info->size;
-
-  info->max_index = info->size + info->min_index - 1;
-
   if (index_inc == 0)
   {
     for (istart = 0; (error + istart * error_inc) > 0; istart--);
@@ -998,11 +1531,109 @@ void capture_get_data(DataBuffer *db)
     error = next_error;
   }
 
-  db->frequency = calc_frequency(info);
+  // Deep record summary holds min/max pairs, not the samples
+  update_measurements(info, info == storage_info && deep_record_valid());
+  db->measure = g_measure;
+
+  // Copy is made before the storage buffer is released to the capture
+  if (info == storage_info && storage_info->valid && !deep_record_valid())
+  {
+    CaptureRecord record;
+
+    get_record(storage_info, &record);
+    history_add(&record);
+
+    // Failed record stays locked until it is saved
+    if (storage_info->anomaly)
+      anomaly_save();
+  }
 
   g_storage_buffer_info.valid = false;
 }
 
+//---------------------------------------------------------------------
+// While locked, the buffer returned by capture_get_record() stays intact.
+// Acquisition keeps running, but the storage buffer is not updated and
+// capture_start() is deferred until the lock is released.
+void capture_lock(bool lock)
+{
+  g_locked = lock;
+
+  if (!lock && g_start_pending)
+  {
+    g_start_pending = false;
+    capture_start();
+  }
+}
+
+//---------------------------------------------------------------------
+// Returns the record shown by the last capture_get_data() call
+bool capture_get_record(CaptureRecord *record)
+{
+  if (NULL == g_view_info)
+    return false;
+
+  get_record((BufferInfo *)g_view_info, record);
+
+  return true;
+}
+
+//---------------------------------------------------------------------
+uint8_t *capture_get_buffer(void)
+{
+  return (uint8_t *)g_capture_buffer;
+}
+
+//---------------------------------------------------------------------
+// Shows a record placed into the capture buffer until the next capture_start()
+void capture_set_record(CaptureRecord *record)
+{
+  capture_stop();
+
+  g_capture_buffer_info.period    = record->period;
+  g_capture_buffer_info.offset    = record->offset;
+  g_capture_buffer_info.size      = record->size;
+  g_capture_buffer_info.min_index = record->min_index;
+  g_capture_buffer_info.max_index = record->min_index + record->size - 1;
+  g_capture_buffer_info.trigger   = -record->min_index;
+  g_capture_buffer_info.vpos      = record->vpos;
+  g_capture_buffer_info.vs_mult   = record->vs_mult;
+  g_capture_buffer_info.valid     = true;
+
+  g_deep_read_size = 0;
+  g_recalled = true;
+  g_playback = false;
+  g_record_id++;
+
+  history_clear();
+}
+
+//---------------------------------------------------------------------
+// Shows a record from outside of the capture buffer while the capture is
+// stopped, NULL returns to the captured record
+void capture_show_record(CaptureRecord *record)
+{
+  BufferInfo *info = &g_playback_buffer_info;
+
+  g_playback = (NULL != record);
+
+  if (!g_playback)
+    return;
+
+  info->period    = record->period;
+  info->offset    = record->offset;
+  info->size      = record->size;
+  info->data      = record->data;
+  info->min_index = record->min_index;
+  info->max_index = record->min_index + record->size - 1;
+  info->trigger   = -record->min_index;
+  info->vpos      = record->vpos;
+  info->vs_mult   = record->vs_mult;
+  info->valid     = true;
+
+  g_record_id++;
+}
+
 //---------------------------------------------------------------------
 void capture_get_raw_data(int *raw, int size)
 {
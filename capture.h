@@ -29,11 +29,15 @@
 #ifndef _CAPTURE_H_
 #define _CAPTURE_H_
 
+/*- Includes ----------------------------------------------------------------*/
+#include "measure.h"
+
 /*- Definitions -------------------------------------------------------------*/
 #define BASE_SAMPLE_RATE       125e6
 #define BASE_SAMPLE_PERIOD     (1e9 / BASE_SAMPLE_RATE)
 #define CAPTURE_BUFFER_SIZE    (128 * 1024)
 #define TRIGGER_MARGIN_SAMPLES 1024
+#define DEEP_MAX_PRE_TRIGGER   (CAPTURE_BUFFER_SIZE / 2)
 #define DATA_BUFFER_SIZE       300
 
 /*- Types -------------------------------------------------------------------*/
@@ -43,26 +47,51 @@ typedef struct
   int      min_value;
   int      max_value;
   int      vertical_position;
-  int      frequency;
+  Measurements measure;
   int      min[DATA_BUFFER_SIZE];
   int      max[DATA_BUFFER_SIZE];
   uint8_t  flags[DATA_BUFFER_SIZE];
 } DataBuffer;
 
+typedef struct
+{
+  int      period;
+  int      size;
+  int      offset;     // Index of the oldest sample in the data buffer
+  int      min_index;  // Position of the oldest sample relative to the trigger
+  int      vpos;
+  int      vs_mult;
+  uint8_t  *data;
+} CaptureRecord;
+
 /*- Prototypes --------------------------------------------------------------*/
 void capture_init(void);
 void capture_disable_clock(void);
 void capture_start(void);
 void capture_stop(void);
 void capture_set_vertical_parameters(void);
-void capture_set_horizontal_parameters(int sr_divider, int trigger_offset);
+void capture_set_horizontal_parameters(int sr_divider, int record_size, int trigger_offset);
 void capture_set_trigger_level(int level);
 void capture_set_trigger_edge(int edge);
+void capture_set_trigger_type(int type);
+void capture_set_uart_trigger(int baud, bool inverted, int value, int mask);
+void capture_set_video_trigger(int standard, int sync, int line);
 void capture_set_trigger_mode(int mode);
+void capture_set_anomaly(bool enable, int margin);
+void capture_set_logger(bool enable);
+void capture_set_meter(bool enable);
+void capture_set_counter(bool enable);
+void capture_reset_measurements(void);
 int capture_get_state(void);
+void capture_get_stats(int *acquisitions, int64_t *live_time);
 bool capture_buffer_updated(void);
 void capture_get_data(DataBuffer *db);
 void capture_get_raw_data(int *raw, int size);
+void capture_lock(bool lock);
+bool capture_get_record(CaptureRecord *record);
+uint8_t *capture_get_buffer(void);
+void capture_set_record(CaptureRecord *record);
+void capture_show_record(CaptureRecord *record);
 
 #endif // _CAPTURE_H_
 
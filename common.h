@@ -80,6 +80,84 @@ enum // Vertical Scale
   VS_COUNT,
 };
 
+enum
+{
+  RECORD_LENGTH_AUTO,
+  RECORD_LENGTH_4K,
+  RECORD_LENGTH_16K,
+  RECORD_LENGTH_32K,
+  RECORD_LENGTH_128K,
+  RECORD_LENGTH_LAST = RECORD_LENGTH_128K,
+};
+
+enum
+{
+  DEEP_LENGTH_OFF,
+  DEEP_LENGTH_512K,
+  DEEP_LENGTH_1M,
+  DEEP_LENGTH_2M,
+  DEEP_LENGTH_4M,
+  DEEP_LENGTH_LAST = DEEP_LENGTH_4M,
+};
+
+enum
+{
+  TREND_OFF,
+  TREND_VPP,
+  TREND_FREQUENCY,
+  TREND_RMS,
+  TREND_DUTY,
+  TREND_LAST = TREND_DUTY,
+};
+
+enum
+{
+  FFT_WINDOW_HANN,
+  FFT_WINDOW_FLAT_TOP,
+  FFT_WINDOW_BLACKMAN,
+};
+
+enum
+{
+  JITTER_OFF,
+  JITTER_TIE,
+  JITTER_PERIOD,
+};
+
+enum
+{
+  EYE_OFF,
+  EYE_AUTO, // Fixed rates follow
+};
+
+enum
+{
+  FREQUENCY_SOURCE_EDGES,
+  FREQUENCY_SOURCE_AUTOCORR,
+};
+
+enum
+{
+  TRIGGER_TYPE_EDGE,
+  TRIGGER_TYPE_UART,
+  TRIGGER_TYPE_VIDEO,
+};
+
+enum
+{
+  VIDEO_STANDARD_PAL,
+  VIDEO_STANDARD_NTSC,
+};
+
+enum
+{
+  VIDEO_SYNC_FIELD_ANY,
+  VIDEO_SYNC_FIELD_1,
+  VIDEO_SYNC_FIELD_2,
+  VIDEO_SYNC_LINE,
+  VIDEO_SYNC_ALL_LINES,
+};
+
 enum
 {
   TRIGGER_EDGE_RISE,
@@ -110,6 +188,11 @@ enum
   SAMPLE_FLAG_CLIP_H = (1 << 3),
 };
 
+#define REFERENCE_COUNT        4
+
+#define VIDEO_PAL_LINES        625
+#define VIDEO_NTSC_LINES       525
+
 /*- Prototypes  -------------------------------------------------------------*/
 void error(char *text);
 
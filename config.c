@@ -29,6 +29,8 @@
 /*- Includes ----------------------------------------------------------------*/
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
 #include "gd32f4xx.h"
 #include "timer.h"
 #include "utils.h"
@@ -37,7 +39,7 @@
 
 /*- Definitions -------------------------------------------------------------*/
 #define MAGIC              0x78656c41
-#define VERSION            1
+#define VERSION            2 // Layout and size differ from version 1
 
 #define FLASH_START        0x08000000
 #define ENTRY_SIZE         (1024)
@@ -53,6 +55,17 @@
 
 #define TIMER_INTERVAL     1000
 
+// The struct may end with alignment padding after the CRC
+#define CRC_SIZE           offsetof(Config, crc)
+#define CALIB_SIZE         (CRC_SIZE - offsetof(Config, calib_channel_delta))
+
+// Version 1 entries end with the measurement display flag, followed by
+// 31 reserved words and the calibration
+#define V1_VERSION         1
+#define V1_FIELDS_SIZE     offsetof(Config, trigger_type)
+#define V1_CALIB_OFFSET    (V1_FIELDS_SIZE + 31 * sizeof(uint32_t))
+#define V1_SIZE            (V1_CALIB_OFFSET + CALIB_SIZE + sizeof(uint32_t))
+
 #define FMC_KEY_KEY1       0x45670123
 #define FMC_KEY_KEY2       0xcdef89ab
 
@@ -75,7 +88,7 @@ static uint32_t g_flash_write_size = 0;
 //-----------------------------------------------------------------------------
 static inline Config *get_entry(int index)
 {
-  return (Config *)(STORAGE_START + index * ENTRY_SIZE);
+  return (Config *)(uintptr_t)(STORAGE_START + index * ENTRY_SIZE);
 }
 
 //-----------------------------------------------------------------------------
@@ -162,16 +175,20 @@ static bool flash_write_task(void)
 //-----------------------------------------------------------------------------
 static bool is_entry_valid(Config *entry)
 {
-  if (entry->magic != MAGIC)
-    return false;
+  uint32_t *data = (uint32_t *)entry;
+  int crc_size;
 
-  if (entry->version != VERSION)
+  if (entry->magic != MAGIC)
     return false;
 
-  if (entry->size != sizeof(Config))
+  if (entry->version == VERSION && entry->size == sizeof(Config))
+    crc_size = CRC_SIZE;
+  else if (entry->version == V1_VERSION && entry->size == V1_SIZE)
+    crc_size = V1_SIZE - sizeof(uint32_t);
+  else
     return false;
 
-  if (crc32_calc((uint32_t *)entry, sizeof(Config) - sizeof(uint32_t)) != entry->crc)
+  if (crc32_calc(data, crc_size) != data[crc_size / sizeof(uint32_t)])
     return false;
 
   return true;
@@ -200,10 +217,26 @@ static int find_last_entry(void)
   return index;
 }
 
+//-----------------------------------------------------------------------------
+// Fields added since version 1 keep their defaults, the reserved words of
+// the old entry are always zero and are not copied. The calibration is
+// copied from the end of the old entry. The entry is saved in the new
+// format by the next config_task().
+static void config_migrate(Config *entry)
+{
+  config_reset();
+
+  memcpy(&config, entry, V1_FIELDS_SIZE);
+  memcpy(&config.calib_channel_delta, (uint8_t *)entry + V1_CALIB_OFFSET, CALIB_SIZE);
+
+  config.size    = sizeof(Config);
+  config.version = VERSION;
+}
+
 //-----------------------------------------------------------------------------
 static bool config_changed(void)
 {
-  return crc32_calc((uint32_t *)&config, sizeof(Config) - sizeof(uint32_t)) != config.crc;
+  return crc32_calc((uint32_t *)&config, CRC_SIZE) != config.crc;
 }
 
 //-----------------------------------------------------------------------------
@@ -217,11 +250,11 @@ static void config_save(void)
     flash_erase(SECTOR_1_INDEX);
 
   config.count++;
-  config.crc = crc32_calc((uint32_t *)&config, sizeof(Config) - sizeof(uint32_t));
+  config.crc = crc32_calc((uint32_t *)&config, CRC_SIZE);
 
   g_config_copy = config;
 
-  flash_write((uint32_t *)(STORAGE_START + g_entry_offset),
+  flash_write((uint32_t *)(uintptr_t)(STORAGE_START + g_entry_offset),
       (uint32_t *)&g_config_copy, sizeof(Config));
 }
 
@@ -247,7 +280,12 @@ void config_init(void)
   else
   {
     Config *entry = get_entry(index);
-    config = *entry;
+
+    if (entry->version == VERSION)
+      config = *entry;
+    else
+      config_migrate(entry);
+
     g_entry_offset = index * ENTRY_SIZE;
   }
 
@@ -291,6 +329,44 @@ void config_reset(void)
 
   config.measure_display        = false;
 
+  config.trigger_type           = TRIGGER_TYPE_EDGE;
+
+  config.uart_baud              = 7; // 115200
+  config.uart_inverted          = false;
+  config.uart_value             = 0x55;
+  config.uart_mask              = 0xff;
+
+  config.video_standard         = VIDEO_STANDARD_PAL;
+  config.video_sync             = VIDEO_SYNC_FIELD_ANY;
+  config.video_line             = 0;
+
+  config.record_length          = RECORD_LENGTH_AUTO;
+  config.deep_length            = DEEP_LENGTH_OFF;
+
+  for (int i = 0; i < REFERENCE_COUNT; i++)
+    config.reference[i] = 0;
+
+  config.anomaly_capture        = false;
+  config.anomaly_margin         = 8;
+
+  config.mask_test              = false;
+  config.mask_margin            = 4;
+  config.mask_stop              = false;
+  config.mask_id                = 0;
+
+  config.logger_interval        = 0; // Off
+  config.trend                  = TREND_OFF;
+  config.meter                  = false;
+  config.counter_gate           = 0; // Off
+  config.frequency_source       = FREQUENCY_SOURCE_EDGES;
+  config.fft_size               = 0; // Off
+  config.fft_window             = FFT_WINDOW_HANN;
+  config.fft_average            = 0; // Off
+  config.harmonics              = false;
+  config.histogram              = false;
+  config.jitter                 = JITTER_OFF;
+  config.eye_rate               = EYE_OFF;
+
   for (int i = 0; i < ARRAY_SIZE(config.padding); i++)
     config.padding[i] = 0;
 
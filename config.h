@@ -72,7 +72,47 @@ typedef struct
 
   bool     measure_display;
 
-  uint32_t padding[31];
+  int      trigger_type;
+
+  int      uart_baud;
+  int      uart_inverted;
+  int      uart_value;
+  int      uart_mask;
+
+  int      video_standard;
+  int      video_sync;
+  int      video_line;
+
+  int      record_length;
+  int      deep_length;
+
+  int      reference[REFERENCE_COUNT]; // Saved waveform IDs, 0 if not used
+
+  int      anomaly_capture;
+  int      anomaly_margin; // ADC counts
+
+  int      mask_test;
+  int      mask_margin; // px
+  int      mask_stop;
+  int      mask_id; // Saved mask ID, 0 if there is none
+
+  int      logger_interval;
+  int      trend;
+  int      meter;
+  int      counter_gate;
+  int      frequency_source;
+  int      fft_size;
+  int      fft_window;
+  int      fft_average;
+  int      harmonics;
+  int      histogram;
+  int      jitter;
+  int      eye_rate;
+
+  // New fields take their words from here while the entry size stays the
+  // same. Version 2 outgrew the 31 words of version 1 and changed the size
+  // from 296 to 424 bytes, any larger change needs a new version as well.
+  uint32_t padding[30];
 
   int      calib_channel_delta;
   int      calib_dac_zero;
@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include "gd32f4xx.h"
+#include "edges.h"
+#include "counter.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define COUNTER_HYSTERESIS     3    // ADC counts around the trigger level
+#define COUNTER_MIN_TIMEOUT    2000 // ms
+
+/*- Variables ---------------------------------------------------------------*/
+static volatile bool g_active = false;
+static int g_sample_period; // ns
+static uint64_t g_gate;     // 24.8 samples
+static uint64_t g_timeout;  // 24.8 samples
+
+// Times are sample counts since the start with 8 fractional bits. The sample
+// clock is the free-running timebase, so no separate timer is needed.
+static uint64_t g_time;       // Start of the current block
+static uint64_t g_gate_start; // First edge of the gate or the last reset
+static uint64_t g_first;
+static int g_edges;
+static int g_state;           // 1 - above, -1 - below, 0 - unknown
+static int g_last_sample;
+
+static volatile int g_total;
+static volatile int g_result_periods;
+static volatile uint64_t g_result_span;
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+// Gate is in ms, sample period is in ns
+void counter_start(int gate, int sample_period)
+{
+  int timeout = (2 * gate < COUNTER_MIN_TIMEOUT) ? COUNTER_MIN_TIMEOUT : 2 * gate;
+
+  __disable_irq();
+
+  g_sample_period  = sample_period;
+  g_gate           = ((uint64_t)gate * 1000000 / sample_period) << 8;
+  g_timeout        = ((uint64_t)timeout * 1000000 / sample_period) << 8;
+  g_time           = 0;
+  g_gate_start     = 0;
+  g_edges          = 0;
+  g_state          = 0;
+  g_total          = 0;
+  g_result_periods = 0;
+  g_result_span    = 0;
+  g_active         = true;
+
+  __enable_irq();
+}
+
+//-----------------------------------------------------------------------------
+void counter_stop(void)
+{
+  g_active = false;
+}
+
+//-----------------------------------------------------------------------------
+static void publish(int periods, uint64_t span)
+{
+  g_result_periods = periods;
+  g_result_span    = span;
+  g_total++;
+}
+
+//-----------------------------------------------------------------------------
+// Edge at 'index' is the first sample above the upper threshold. The level
+// crossing is found by walking back and interpolating between the two
+// samples around it, the sample before the block is kept for the first one.
+static uint64_t crossing_time(const uint8_t *data, int index, int level)
+{
+  int v0, v1;
+
+  while (index > 0 && data[index-1] > level)
+    index--;
+
+  v0 = (index > 0) ? data[index-1] : g_last_sample;
+  v1 = data[index];
+
+  if (v0 > level)
+    return (g_time + index) << 8;
+
+  return ((g_time + index - 1) << 8) + (((level - v0) << 8) + (v1 - v0) / 2) / (v1 - v0);
+}
+
+//-----------------------------------------------------------------------------
+// Reciprocal counting, gates start and end on the rising edges, so the
+// count is exact and only the edge times contribute to the error. The next
+// gate starts at the edge that ended the previous one, there is no dead time.
+static void add_edge(uint64_t t)
+{
+  if (0 == g_edges)
+  {
+    g_first      = t;
+    g_gate_start = t;
+    g_edges      = 1;
+  }
+  else
+  {
+    g_edges++;
+
+    if ((t - g_first) >= g_gate)
+    {
+      publish(g_edges - 1, t - g_first);
+
+      g_first      = t;
+      g_gate_start = t;
+      g_edges      = 1;
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Called from the DMA interrupt for every block. Only the edges are
+// searched for, so the cost is bound by the number of words in the block
+// plus the number of edges.
+void counter_update(const uint8_t *data, int size, int level)
+{
+  int low = level - COUNTER_HYSTERESIS;
+  int high = level + COUNTER_HYSTERESIS;
+  uint32_t low4 = (uint32_t)low * 0x01010101;
+  uint32_t high4 = (uint32_t)high * 0x01010101;
+  int index = 0;
+
+  if (!g_active)
+    return;
+
+  if (0 == g_state)
+    g_state = (data[0] > level) ? 1 : -1;
+
+  while (index < size)
+  {
+    int found = edges_find(data, index, size, low4, high4, g_state < 0);
+
+    if (found < 0)
+      break;
+
+    if (g_state < 0)
+      add_edge(crossing_time(data, found, level));
+
+    g_state = -g_state;
+    index = found + 1;
+  }
+
+  g_time += size;
+  g_last_sample = data[size-1];
+
+  if (((g_time << 8) - g_gate_start) > g_timeout)
+  {
+    publish(0, 0);
+
+    g_gate_start = g_time << 8;
+    g_edges      = 0;
+  }
+}
+
+//-----------------------------------------------------------------------------
+int counter_get_total(void)
+{
+  return g_total;
+}
+
+//-----------------------------------------------------------------------------
+// Returns false if no gate has completed yet
+bool counter_get(CounterResult *result)
+{
+  uint64_t span, rate, a;
+  int periods, total;
+
+  __disable_irq();
+  total   = g_total;
+  periods = g_result_periods;
+  span    = g_result_span;
+  __enable_irq();
+
+  if (0 == total)
+    return false;
+
+  result->periods   = periods;
+  result->frequency = 0;
+  result->period    = 0;
+
+  if (0 == periods)
+    return true;
+
+  // Division is split, so that the intermediate values fit into 64 bits
+  // at the lowest sample rates and the longest gates
+  rate = 1000000000000ull / g_sample_period; // mHz
+  a = (uint64_t)periods * rate;
+
+  result->frequency = (a / span) * 256 + ((a % span) * 256 + span / 2) / span;
+  result->period    = ((span * g_sample_period) / periods + 128) >> 8;
+
+  return true;
+}
@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "gd32f4xx.h"
+#include "common.h"
+#include "flash.h"
+#include "deep.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define DEEP_FLASH_OFFSET      0
+
+/*- Variables ---------------------------------------------------------------*/
+// NOTE: The record position is tracked using the absolute sample indexes
+//       maintained by the capture interrupt handler.
+static volatile int g_state = DEEP_STATE_IDLE;
+static volatile uint8_t *g_ring;
+static volatile int g_ring_size;
+static volatile uint8_t *g_summary;
+static volatile int g_guard;
+static volatile int g_size;
+static volatile uint32_t g_start;     // Index of the first sample of the record
+static volatile uint32_t g_available; // Index of the first sample not yet in the ring
+static volatile uint32_t g_write_pos; // Index of the next sample to be written
+static volatile bool g_overrun;
+static FlashRequest g_request;
+static bool g_request_active = false;
+static int g_erase_addr;
+static int g_erase_size;
+static uint32_t g_page_time;
+static bool g_page_backlog;
+static uint64_t g_busy_cycles;
+static int g_busy_bytes;
+static int g_write_rate = 0;
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+void deep_init(void)
+{
+  // Cycle counter is used for the write throughput measurement
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+//-----------------------------------------------------------------------------
+bool deep_available(void)
+{
+  return flash_present();
+}
+
+//-----------------------------------------------------------------------------
+void deep_arm(int size, uint8_t *ring, int ring_size, uint8_t *summary)
+{
+  int erase_size = (size + FLASH_BLOCK_SIZE - 1) & ~(FLASH_BLOCK_SIZE - 1);
+
+  if (!flash_present())
+    return;
+
+  g_ring      = ring;
+  g_ring_size = ring_size;
+  g_summary   = summary;
+  g_size      = size;
+
+  if ((DEEP_STATE_ERASE == g_state || DEEP_STATE_READY == g_state) && erase_size <= g_erase_size)
+    return;
+
+  // Erase is started from the main loop once the flash is not busy
+  g_erase_addr = 0;
+  g_erase_size = erase_size;
+  g_state      = DEEP_STATE_ERASE;
+}
+
+//-----------------------------------------------------------------------------
+void deep_stop(void)
+{
+  int size = (g_available - g_start) & ~(FLASH_PAGE_SIZE - 1);
+
+  if (DEEP_STATE_WRITE == g_state)
+  {
+    // Samples already in the ring are still written out
+    if (size < g_size)
+      g_size = size;
+  }
+  else if (DEEP_STATE_ERASE == g_state || DEEP_STATE_READY == g_state)
+  {
+    g_erase_size = 0;
+    g_state = DEEP_STATE_IDLE;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Called from the capture interrupt handler. Record starts on a page
+// boundary, so the pre-trigger part may be slightly shorter than requested.
+bool deep_start(uint32_t start, int guard)
+{
+  if (DEEP_STATE_READY != g_state)
+    return false;
+
+  start = (start + FLASH_PAGE_SIZE - 1) & ~(FLASH_PAGE_SIZE - 1);
+
+  g_start        = start;
+  g_available    = start;
+  g_write_pos    = start;
+  g_guard        = guard;
+  g_overrun      = false;
+  g_erase_size   = 0;
+  g_page_backlog = false;
+  g_busy_cycles  = 0;
+  g_busy_bytes   = 0;
+  g_state        = DEEP_STATE_WRITE;
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// Called from the capture interrupt handler with the index of the first sample
+// that is not in the ring yet. Returns false when the capture must be stopped.
+// DMA may overwrite 'guard' samples past that point before the next call.
+bool deep_update(uint32_t end)
+{
+  int written = g_write_pos - g_start - FLASH_PAGE_SIZE; // Page in progress may be incomplete
+
+  if (DEEP_STATE_WRITE != g_state)
+    return false;
+
+  g_available = end;
+
+  if ((int)(end + g_guard - g_ring_size - g_start) > written)
+  {
+    g_size    = (written < 0) ? 0 : written;
+    g_overrun = true;
+    return false;
+  }
+
+  return (int)(end - g_start) < g_size;
+}
+
+//-----------------------------------------------------------------------------
+static void update_summary(int page, uint8_t *data)
+{
+  uint32_t *words = (uint32_t *)data;
+  uint32_t min = 0xffffffff;
+  uint32_t max = 0;
+  int vmin = 255;
+  int vmax = 0;
+
+  for (int i = 0; i < FLASH_PAGE_SIZE / 4; i++)
+  {
+    uint32_t w = words[i];
+
+    __USUB8(min, w);
+    min = __SEL(w, min);
+
+    __USUB8(max, w);
+    max = __SEL(max, w);
+  }
+
+  for (int i = 0; i < 4; i++)
+  {
+    int bmin = (min >> (i * 8)) & 0xff;
+    int bmax = (max >> (i * 8)) & 0xff;
+
+    if (bmin < vmin)
+      vmin = bmin;
+
+    if (bmax > vmax)
+      vmax = bmax;
+  }
+
+  g_summary[page * 2]     = vmin;
+  g_summary[page * 2 + 1] = vmax;
+}
+
+//-----------------------------------------------------------------------------
+static void write_task(void)
+{
+  uint32_t pos = g_write_pos;
+  int index = pos - g_start;
+  uint32_t time;
+  uint8_t *page;
+
+  if (index >= g_size)
+  {
+    if (g_busy_cycles > 0)
+      g_write_rate = ((uint64_t)g_busy_bytes * F_CPU) / g_busy_cycles;
+
+    g_state = DEEP_STATE_DONE;
+    return;
+  }
+
+  if ((int)(g_available - pos) < FLASH_PAGE_SIZE)
+    return;
+
+  page = (uint8_t *)g_ring + (pos % g_ring_size);
+
+  g_request.command = FLASH_CMD_PROGRAM;
+  g_request.addr    = DEEP_FLASH_OFFSET + index;
+  g_request.data    = page;
+  g_request.size    = FLASH_PAGE_SIZE;
+
+  if (!flash_submit(&g_request))
+    return;
+
+  g_request_active = true;
+
+  // Only the time spent on a backlog counts towards the throughput, otherwise
+  // the writer is limited by the sample rate
+  time = DWT->CYCCNT;
+
+  if (g_page_backlog)
+  {
+    g_busy_cycles += (uint32_t)(time - g_page_time);
+    g_busy_bytes  += FLASH_PAGE_SIZE;
+  }
+
+  g_page_time    = time;
+  g_page_backlog = ((int)(g_available - pos) >= FLASH_PAGE_SIZE * 2);
+
+  update_summary(index / FLASH_PAGE_SIZE, page);
+
+  g_write_pos = pos + FLASH_PAGE_SIZE;
+}
+
+//-----------------------------------------------------------------------------
+void deep_task(void)
+{
+  if (g_request_active)
+  {
+    if (!g_request.done)
+      return;
+
+    g_request_active = false;
+  }
+
+  if (DEEP_STATE_ERASE == g_state)
+  {
+    // Region may grow while it is erased, then only the rest is erased
+    if (g_erase_addr < g_erase_size)
+    {
+      g_request.command = FLASH_CMD_ERASE_BLOCK;
+      g_request.addr    = DEEP_FLASH_OFFSET + g_erase_addr;
+      g_request.data    = NULL;
+      g_request.size    = g_erase_size - g_erase_addr;
+      g_request_active  = flash_submit(&g_request);
+
+      if (g_request_active)
+        g_erase_addr = g_erase_size;
+    }
+    else
+    {
+      g_state = DEEP_STATE_READY;
+    }
+  }
+  else if (DEEP_STATE_WRITE == g_state)
+  {
+    write_task();
+  }
+}
+
+//-----------------------------------------------------------------------------
+int deep_get_state(void)
+{
+  return g_state;
+}
+
+//-----------------------------------------------------------------------------
+uint32_t deep_get_start(void)
+{
+  return g_start;
+}
+
+//-----------------------------------------------------------------------------
+int deep_get_size(void)
+{
+  return g_size;
+}
+
+//-----------------------------------------------------------------------------
+bool deep_get_overrun(void)
+{
+  return g_overrun;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the sustained write throughput in bytes (samples) per second
+// measured during the last record, or 0 if it is not known yet.
+int deep_get_write_rate(void)
+{
+  return g_write_rate;
+}
+
+//-----------------------------------------------------------------------------
+void deep_read(int index, uint8_t *data, int size)
+{
+  FlashRequest req;
+
+  req.command = FLASH_CMD_READ;
+  req.addr    = DEEP_FLASH_OFFSET + index;
+  req.data    = data;
+  req.size    = size;
+
+  flash_execute(&req);
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _DEEP_H_
+#define _DEEP_H_
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+
+/*- Definitions -------------------------------------------------------------*/
+#define DEEP_MAX_SIZE          (4 * 1024 * 1024)
+
+enum
+{
+  DEEP_STATE_IDLE,
+  DEEP_STATE_ERASE,
+  DEEP_STATE_READY,
+  DEEP_STATE_WRITE,
+  DEEP_STATE_DONE,
+};
+
+/*- Prototypes --------------------------------------------------------------*/
+void deep_init(void);
+void deep_task(void);
+bool deep_available(void);
+void deep_arm(int size, uint8_t *ring, int ring_size, uint8_t *summary);
+void deep_stop(void);
+bool deep_start(uint32_t start, int guard);
+bool deep_update(uint32_t end);
+int deep_get_state(void);
+uint32_t deep_get_start(void);
+int deep_get_size(void);
+bool deep_get_overrun(void);
+int deep_get_write_rate(void);
+void deep_read(int index, uint8_t *data, int size);
+
+#endif // _DEEP_H_
+
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include "gd32f4xx.h"
+#include "edges.h"
+#include "overlay.h"
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+// Returns the index of the first sample in [index, end) that is above 'high'
+// (if 'above' is set) or below 'low', or -1 if there is none. Levels are
+// replicated into all 4 bytes. Aligned parts of the range are checked
+// 4 samples at a time.
+int edges_find(const uint8_t *buf, int index, int end, uint32_t low, uint32_t high, bool above)
+{
+  while (index < end && (index & 3))
+  {
+    if (above ? (buf[index] > (high & 0xff)) : (buf[index] < (low & 0xff)))
+      return index;
+
+    index++;
+  }
+
+  while (index + 4 <= end)
+  {
+    uint32_t word = *(const uint32_t *)&buf[index];
+    uint32_t t = above ? __UQSUB8(word, high) : __UQSUB8(low, word);
+
+    if (t)
+      return index + (__CLZ(__RBIT(t)) >> 3);
+
+    index += 4;
+  }
+
+  while (index < end)
+  {
+    if (above ? (buf[index] > (high & 0xff)) : (buf[index] < (low & 0xff)))
+      return index;
+
+    index++;
+  }
+
+  return -1;
+}
+
+//-----------------------------------------------------------------------------
+// Single pass over the ring of 'size' samples with the oldest one at
+// 'offset'. The signal is high once it goes above 'high' and low once it
+// goes below 'low'. The initial state is not an edge.
+const EdgeIndex *edges_build(const uint8_t *data, int size, int offset, int low, int high)
+{
+  return edges_build_from(data, size, offset, low, high, 0);
+}
+
+//-----------------------------------------------------------------------------
+// Same as edges_build(), but the samples before 'start' (counted from the
+// oldest one) are skipped. A full index is continued from its last edge.
+const EdgeIndex *edges_build_from(const uint8_t *data, int size, int offset, int low, int high,
+    int start)
+{
+  uint32_t low4 = (uint32_t)(low & 0xff) * 0x01010101;
+  uint32_t high4 = (uint32_t)(high & 0xff) * 0x01010101;
+  int known = 0; // 0 - unknown, 1 - high, -1 - low
+  EdgeIndex *result = &overlay.scratch.edges;
+
+  result->count    = 0;
+  result->rising   = false;
+  result->overflow = false;
+
+  // Ring is split into two linear segments, oldest samples first
+  for (int seg = 0; seg < 2; seg++)
+  {
+    int index = seg ? 0 : offset;
+    int end = seg ? offset : size;
+    int base = seg ? (size - offset) : -offset;
+
+    if (index + base < start)
+      index = start - base;
+
+    while (index < end)
+    {
+      int found;
+
+      if (0 == known)
+      {
+        int a = edges_find(data, index, end, low4, high4, true);
+        int b = edges_find(data, index, (a < 0) ? end : a, low4, high4, false);
+
+        if (a < 0 && b < 0)
+          break;
+
+        known = (b < 0) ? 1 : -1;
+        index = (known > 0 ? a : b) + 1;
+        continue;
+      }
+
+      found = edges_find(data, index, end, low4, high4, known < 0);
+
+      if (found < 0)
+        break;
+
+      if (result->count == EDGE_INDEX_SIZE)
+      {
+        result->overflow = true;
+        return result;
+      }
+
+      if (0 == result->count)
+        result->rising = (known < 0);
+
+      result->position[result->count++] = found + base;
+      known = -known;
+      index = found + 1;
+    }
+  }
+
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+const EdgeIndex *edges_get(void)
+{
+  return &overlay.scratch.edges;
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _EDGES_H_
+#define _EDGES_H_
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+
+/*- Definitions -------------------------------------------------------------*/
+#define EDGE_INDEX_SIZE        512
+
+/*- Types -------------------------------------------------------------------*/
+// Edges alternate because of the hysteresis, so only the direction of the
+// first one is stored. Positions are the first samples past the threshold,
+// counted from the oldest sample of the record.
+typedef struct
+{
+  int      count;
+  bool     rising;   // First edge is rising
+  bool     overflow; // Index is full, the later edges are missing
+  uint32_t position[EDGE_INDEX_SIZE];
+} EdgeIndex;
+
+/*- Prototypes --------------------------------------------------------------*/
+const EdgeIndex *edges_build(const uint8_t *data, int size, int offset, int low, int high);
+const EdgeIndex *edges_build_from(const uint8_t *data, int size, int offset, int low, int high,
+    int start);
+const EdgeIndex *edges_get(void);
+int edges_find(const uint8_t *buf, int index, int end, uint32_t low, uint32_t high, bool above);
+
+#endif // _EDGES_H_
+
@@ -0,0 +1,413 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "gd32f4xx.h"
+#include "utils.h"
+#include "config.h"
+#include "edges.h"
+#include "eye.h"
+#include "overlay.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define EYE_MIN_AMPLITUDE      8    // ADC counts
+#define EYE_MIN_HYSTERESIS     3    // ADC counts
+#define EYE_MIN_EDGES          16   // Transitions needed for the bit rate detection
+#define EYE_MIN_INTERVAL       3    // Samples, shorter intervals can't be told apart
+#define EYE_MAX_SHORT          1024 // Up to 1/1024 of the intervals may be shorter
+#define EYE_MIN_UI             (2 << 16) // Samples, 16 fractional bits
+#define EYE_UI_TOLERANCE       50   // Detected UI may drift by 1/50 before a restart
+#define EYE_LOCK_EDGES         8    // Crossings before the samples are folded
+#define EYE_PHASE_SHIFT        3    // Clock recovery loop gains
+#define EYE_FREQ_SHIFT         8
+#define EYE_FREQ_RANGE         16   // Recovered clock stays within 1/16 of the nominal
+#define EYE_CENTER_WINDOW      (1 << 28) // 1/16 UI on each side of the eye center
+
+#define PHASE_HALF_UI          0x40000000u // Full turn of the phase is 2 UI
+
+/*- Variables ---------------------------------------------------------------*/
+static int g_vs_mult;
+static int g_period;  // Sample period of the accumulated data, ns
+static int64_t g_ui;  // Samples, 16 fractional bits
+static int g_records;
+
+// Crossing phases are relative to the recovered clock, 1/65536 UI units.
+// Levels are the samples at the eye center, below and above the middle.
+static uint32_t g_cross_count;
+static int64_t g_cross_sum;
+static uint64_t g_cross_sum_sq;
+static uint32_t g_level_count[2];
+static uint64_t g_level_sum[2];
+static uint64_t g_level_sum_sq[2];
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+static void clear(void)
+{
+  memset(overlay.mode.eye.hits, 0, sizeof(overlay.mode.eye.hits));
+  g_records      = 0;
+  g_cross_count  = 0;
+  g_cross_sum    = 0;
+  g_cross_sum_sq = 0;
+
+  for (int i = 0; i < 2; i++)
+  {
+    g_level_count[i]  = 0;
+    g_level_sum[i]    = 0;
+    g_level_sum_sq[i] = 0;
+  }
+}
+
+//-----------------------------------------------------------------------------
+void eye_reset(void)
+{
+  clear();
+  g_vs_mult = 0;
+  g_period  = 0;
+  g_ui      = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Rows map the sample values to the rows of cells, EYE_NO_ROW if they are
+// off the screen. The accumulation starts over when the mapping changes.
+void eye_set_rows(const uint8_t *rows, int vs_mult)
+{
+  if (vs_mult == g_vs_mult && 0 == memcmp(rows, overlay.mode.eye.rows, 256))
+    return;
+
+  memcpy(overlay.mode.eye.rows, rows, 256);
+  g_vs_mult = vs_mult;
+  clear();
+}
+
+//-----------------------------------------------------------------------------
+// Intervals between the transitions are whole numbers of UI. The shortest
+// ones that can be told apart give the first estimate. It is refined with the runs of up to 2 UI,
+// where the counts of UI can't be wrong yet. Then the UI between the first and
+// the last transition in the same direction are counted, so the result is
+// averaged over the whole record. The index is continued from its last
+// transition when it is full.
+static int64_t detect_ui(const uint8_t *data, int size, int offset, int low, int high)
+{
+  const EdgeIndex *index = edges_build(data, size, offset, low, high);
+  int last = (index->count - 1) & ~1;
+  int min = INT32_MAX;
+  int shorter = 0;
+  int n = 1; // Transitions counted over the record
+  int64_t ui, sum = 0, units = 0, span_units = 0;
+  uint32_t first, prev, span = 0;
+
+  if (index->count < EYE_MIN_EDGES)
+    return 0;
+
+  for (int i = 1; i <= last; i++)
+  {
+    int d = index->position[i] - index->position[i-1];
+
+    if (d >= EYE_MIN_INTERVAL && d < min)
+      min = d;
+  }
+
+  if (INT32_MAX == min)
+    return 0;
+
+  for (int i = 1; i <= last; i++)
+  {
+    int d = index->position[i] - index->position[i-1];
+
+    if (d >= min && 2 * d < 3 * min)
+    {
+      sum += d;
+      units++;
+    }
+  }
+
+  ui = (sum << 16) / units;
+  sum = 0;
+  units = 0;
+
+  for (int i = 1; i <= last; i++)
+  {
+    int64_t d = (int64_t)(index->position[i] - index->position[i-1]) << 16;
+    int64_t n = (d + ui / 2) / ui;
+
+    if (n <= 2)
+    {
+      sum += d;
+      units += n;
+    }
+  }
+
+  ui = sum / units;
+  units = 0;
+  first = index->position[0];
+  prev = first;
+
+  for (int i = 1; ; i++, n++)
+  {
+    int64_t d;
+
+    if (i == index->count)
+    {
+      if (!index->overflow)
+        break;
+
+      index = edges_build_from(data, size, offset, low, high, prev);
+      i = 0;
+
+      if (0 == index->count)
+        break;
+    }
+
+    if (index->position[i] - prev < EYE_MIN_INTERVAL)
+      shorter++;
+
+    d = (int64_t)(index->position[i] - prev) << 16;
+    units += (d + ui / 2) / ui;
+    prev = index->position[i];
+
+    if (0 == (n & 1))
+    {
+      span = prev - first;
+      span_units = units;
+    }
+  }
+
+  // Jitter makes a few intervals short, many of them mean the samples are
+  // too sparse for the detection
+  if (shorter * EYE_MAX_SHORT > n)
+    return 0;
+
+  return ((int64_t)span << 16) / span_units;
+}
+
+//-----------------------------------------------------------------------------
+// Phase of the recovered clock is kept for every sample, the full turn is
+// 2 UI and the crossings are expected at 1/2 UI. Each crossing corrects the
+// phase and the frequency of the clock by a fraction of its error. Samples
+// are folded into the cells after the clock has settled, so only the
+// crossings and the samples close to the eye center need more work.
+static void fold(const uint8_t *data, int size, int offset, int low, int mid, int high)
+{
+  uint32_t nominal = (1ull << 47) / g_ui;
+  uint32_t step = nominal;
+  uint32_t phase = 0;
+  int state = 0, edges = 0, time = 0, last = 0;
+  int prev = data[offset];
+
+  for (int part = 0; part < 2; part++)
+  {
+    const uint8_t *ptr = part ? data : data + offset;
+    int count = part ? offset : size - offset;
+
+    for (int i = 0; i < count; i++, time++, phase += step)
+    {
+      int v = ptr[i];
+      int frac = -1;
+
+      // Crossings are interpolated between the samples, 8 fractional bits
+      if (state < 0 && v >= mid)
+        frac = ((mid - prev) << 8) / (v - prev);
+      else if (state > 0 && v < mid)
+        frac = ((prev - mid) << 8) / (prev - v);
+
+      if (frac >= 0)
+      {
+        uint32_t at = phase - (256 - frac) * (step >> 8);
+        int32_t error = (int32_t)((at << 1) - 2 * PHASE_HALF_UI) >> 1;
+
+        if (edges >= EYE_LOCK_EDGES)
+        {
+          int e = error >> 15;
+
+          g_cross_sum    += e;
+          g_cross_sum_sq += (int64_t)e * e;
+          g_cross_count++;
+        }
+
+        if (0 == edges)
+        {
+          phase -= error;
+        }
+        else
+        {
+          phase -= error >> EYE_PHASE_SHIFT;
+          step  -= (error / (time - last)) >> EYE_FREQ_SHIFT;
+
+          if (step > nominal + nominal / EYE_FREQ_RANGE)
+            step = nominal + nominal / EYE_FREQ_RANGE;
+          else if (step < nominal - nominal / EYE_FREQ_RANGE)
+            step = nominal - nominal / EYE_FREQ_RANGE;
+        }
+
+        state = 0;
+        last  = time;
+        edges++;
+      }
+
+      if (v < low)
+        state = -1;
+      else if (v > high)
+        state = 1;
+
+      prev = v;
+
+      if (edges > EYE_LOCK_EDGES)
+      {
+        int row = overlay.mode.eye.rows[v];
+        int32_t center = (int32_t)(phase << 1);
+
+        if (row != EYE_NO_ROW)
+        {
+          uint8_t *cell = &overlay.mode.eye.hits[row][((phase >> 16) * EYE_WIDTH) >> 16];
+
+          if (*cell < 255)
+            (*cell)++;
+        }
+
+        if (center < EYE_CENTER_WINDOW && center > -EYE_CENTER_WINDOW)
+        {
+          int level = (v > mid);
+
+          g_level_count[level]++;
+          g_level_sum[level]    += v;
+          g_level_sum_sq[level] += v * v;
+        }
+      }
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Top and base are the levels in ADC counts, rate is in bps or 0 for the
+// automatic detection. Data is a ring of 'size' samples with the oldest one
+// at 'offset'. Returns false if the record can't be folded.
+bool eye_add(const uint8_t *data, int size, int offset, int period, int base, int top, int rate)
+{
+  int amp = top - base;
+  int mid = (top + base) / 2;
+  int hyst = amp / 10;
+  int64_t ui;
+
+  if (amp < EYE_MIN_AMPLITUDE)
+    return false;
+
+  if (hyst < EYE_MIN_HYSTERESIS)
+    hyst = EYE_MIN_HYSTERESIS;
+
+  if (rate > 0)
+  {
+    ui = ((int64_t)1000000000 << 16) / ((int64_t)rate * period);
+  }
+  else
+  {
+    ui = detect_ui(data, size, offset, mid - hyst, mid + hyst);
+
+    // Small changes of the estimate are followed by the clock recovery
+    if (period == g_period && ui > g_ui - g_ui / EYE_UI_TOLERANCE &&
+        ui < g_ui + g_ui / EYE_UI_TOLERANCE)
+      ui = g_ui;
+  }
+
+  if (ui < EYE_MIN_UI)
+    return false;
+
+  if (period != g_period || ui != g_ui)
+  {
+    clear();
+    g_period = period;
+    g_ui     = ui;
+  }
+
+  fold(data, size, offset, mid - hyst, mid, mid + hyst);
+  g_records++;
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// Eye width is the UI less 3 deviations of the crossings on each side, eye
+// height is the distance between the levels at the eye center less 3
+// deviations of each one. Returns false if there is not enough data.
+bool eye_get(EyeResult *result)
+{
+  int64_t mean, variance, width, height;
+  int64_t level[2];
+
+  result->records = g_records;
+  result->rate    = 0;
+  result->ui      = 0;
+  result->width   = 0;
+  result->height  = 0;
+
+  if (0 == g_records)
+    return false;
+
+  result->rate = ((int64_t)1000000000 << 16) / (g_ui * g_period);
+  result->ui   = (g_ui * g_period * 1000) >> 16;
+
+  if (g_cross_count < 2 || 0 == g_level_count[0] || 0 == g_level_count[1])
+    return false;
+
+  mean     = g_cross_sum / (int64_t)g_cross_count;
+  variance = (int64_t)(g_cross_sum_sq / g_cross_count) - mean * mean;
+  width    = 65536 - 6 * (int64_t)((variance > 0) ? isqrt(variance) : 0);
+
+  if (width < 0)
+    width = 0;
+
+  result->width = (width * result->ui) >> 16;
+
+  // Means and deviations have 8 fractional bits
+  for (int i = 0; i < 2; i++)
+  {
+    mean     = (int64_t)(g_level_sum[i] << 8) / g_level_count[i];
+    variance = (int64_t)((g_level_sum_sq[i] << 8) / g_level_count[i] << 8) - mean * mean;
+    level[i] = mean + (i ? -3 : 3) * (int64_t)((variance > 0) ? isqrt(variance) : 0);
+  }
+
+  height = level[1] - level[0];
+
+  if (height < 0)
+    height = 0;
+
+  result->height = ((height * g_vs_mult * 1000) / CALIB_MULTIPLIER) >> 8;
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// Hit counts saturate at 255, rows are from the top of the grid
+const uint8_t *eye_get_hits(void)
+{
+  return &overlay.mode.eye.hits[0][0];
+}
@@ -0,0 +1,391 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include "gd32f4xx.h"
+#include "common.h"
+#include "fft.h"
+#include "overlay.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define FFT_CIRCLE             FFT_MAX_SIZE // Angle units in a full turn
+#define FFT_QUARTER            (FFT_CIRCLE / 4)
+#define FFT_WINDOW_TERMS       5
+
+#define ZERO_POINT             0x80
+
+/*- Constants ---------------------------------------------------------------*/
+// sin(2 * pi * i / FFT_CIRCLE) in Q15 for the first quarter of the turn
+static const int16_t fft_sine[FFT_QUARTER + 1] =
+{
+  0, 50, 101, 151, 201, 251, 302, 352, 402, 452, 503, 553,
+  603, 653, 704, 754, 804, 854, 905, 955, 1005, 1055, 1106, 1156,
+  1206, 1256, 1307, 1357, 1407, 1457, 1507, 1558, 1608, 1658, 1708, 1758,
+  1809, 1859, 1909, 1959, 2009, 2059, 2110, 2160, 2210, 2260, 2310, 2360,
+  2410, 2461, 2511, 2561, 2611, 2661, 2711, 2761, 2811, 2861, 2911, 2962,
+  3012, 3062, 3112, 3162, 3212, 3262, 3312, 3362, 3412, 3462, 3512, 3562,
+  3612, 3662, 3712, 3761, 3811, 3861, 3911, 3961, 4011, 4061, 4111, 4161,
+  4210, 4260, 4310, 4360, 4410, 4460, 4509, 4559, 4609, 4659, 4708, 4758,
+  4808, 4858, 4907, 4957, 5007, 5056, 5106, 5156, 5205, 5255, 5305, 5354,
+  5404, 5453, 5503, 5552, 5602, 5651, 5701, 5750, 5800, 5849, 5899, 5948,
+  5998, 6047, 6096, 6146, 6195, 6245, 6294, 6343, 6393, 6442, 6491, 6540,
+  6590, 6639, 6688, 6737, 6786, 6836, 6885, 6934, 6983, 7032, 7081, 7130,
+  7179, 7228, 7277, 7326, 7375, 7424, 7473, 7522, 7571, 7620, 7669, 7718,
+  7767, 7815, 7864, 7913, 7962, 8010, 8059, 8108, 8157, 8205, 8254, 8303,
+  8351, 8400, 8448, 8497, 8545, 8594, 8642, 8691, 8739, 8788, 8836, 8885,
+  8933, 8981, 9030, 9078, 9126, 9175, 9223, 9271, 9319, 9367, 9416, 9464,
+  9512, 9560, 9608, 9656, 9704, 9752, 9800, 9848, 9896, 9944, 9992, 10039,
+  10087, 10135, 10183, 10231, 10278, 10326, 10374, 10421, 10469, 10517, 10564, 10612,
+  10659, 10707, 10754, 10802, 10849, 10897, 10944, 10992, 11039, 11086, 11133, 11181,
+  11228, 11275, 11322, 11370, 11417, 11464, 11511, 11558, 11605, 11652, 11699, 11746,
+  11793, 11840, 11886, 11933, 11980, 12027, 12074, 12120, 12167, 12214, 12260, 12307,
+  12353, 12400, 12446, 12493, 12539, 12586, 12632, 12679, 12725, 12771, 12817, 12864,
+  12910, 12956, 13002, 13048, 13094, 13141, 13187, 13233, 13279, 13324, 13370, 13416,
+  13462, 13508, 13554, 13599, 13645, 13691, 13736, 13782, 13828, 13873, 13919, 13964,
+  14010, 14055, 14101, 14146, 14191, 14236, 14282, 14327, 14372, 14417, 14462, 14507,
+  14553, 14598, 14643, 14688, 14732, 14777, 14822, 14867, 14912, 14956, 15001, 15046,
+  15090, 15135, 15180, 15224, 15269, 15313, 15358, 15402, 15446, 15491, 15535, 15579,
+  15623, 15667, 15712, 15756, 15800, 15844, 15888, 15932, 15976, 16019, 16063, 16107,
+  16151, 16195, 16238, 16282, 16325, 16369, 16413, 16456, 16499, 16543, 16586, 16630,
+  16673, 16716, 16759, 16802, 16846, 16889, 16932, 16975, 17018, 17061, 17104, 17146,
+  17189, 17232, 17275, 17317, 17360, 17403, 17445, 17488, 17530, 17573, 17615, 17657,
+  17700, 17742, 17784, 17827, 17869, 17911, 17953, 17995, 18037, 18079, 18121, 18163,
+  18204, 18246, 18288, 18330, 18371, 18413, 18454, 18496, 18537, 18579, 18620, 18661,
+  18703, 18744, 18785, 18826, 18868, 18909, 18950, 18991, 19032, 19072, 19113, 19154,
+  19195, 19236, 19276, 19317, 19357, 19398, 19438, 19479, 19519, 19560, 19600, 19640,
+  19680, 19721, 19761, 19801, 19841, 19881, 19921, 19961, 20000, 20040, 20080, 20120,
+  20159, 20199, 20238, 20278, 20317, 20357, 20396, 20436, 20475, 20514, 20553, 20592,
+  20631, 20670, 20709, 20748, 20787, 20826, 20865, 20904, 20942, 20981, 21019, 21058,
+  21096, 21135, 21173, 21212, 21250, 21288, 21326, 21364, 21403, 21441, 21479, 21516,
+  21554, 21592, 21630, 21668, 21705, 21743, 21781, 21818, 21856, 21893, 21930, 21968,
+  22005, 22042, 22079, 22116, 22154, 22191, 22227, 22264, 22301, 22338, 22375, 22411,
+  22448, 22485, 22521, 22558, 22594, 22631, 22667, 22703, 22739, 22776, 22812, 22848,
+  22884, 22920, 22956, 22991, 23027, 23063, 23099, 23134, 23170, 23205, 23241, 23276,
+  23311, 23347, 23382, 23417, 23452, 23487, 23522, 23557, 23592, 23627, 23662, 23697,
+  23731, 23766, 23801, 23835, 23870, 23904, 23938, 23973, 24007, 24041, 24075, 24109,
+  24143, 24177, 24211, 24245, 24279, 24312, 24346, 24380, 24413, 24447, 24480, 24514,
+  24547, 24580, 24613, 24647, 24680, 24713, 24746, 24779, 24811, 24844, 24877, 24910,
+  24942, 24975, 25007, 25040, 25072, 25105, 25137, 25169, 25201, 25233, 25265, 25297,
+  25329, 25361, 25393, 25425, 25456, 25488, 25519, 25551, 25582, 25614, 25645, 25676,
+  25708, 25739, 25770, 25801, 25832, 25863, 25893, 25924, 25955, 25986, 26016, 26047,
+  26077, 26108, 26138, 26168, 26198, 26229, 26259, 26289, 26319, 26349, 26378, 26408,
+  26438, 26468, 26497, 26527, 26556, 26586, 26615, 26644, 26674, 26703, 26732, 26761,
+  26790, 26819, 26848, 26876, 26905, 26934, 26962, 26991, 27019, 27048, 27076, 27104,
+  27133, 27161, 27189, 27217, 27245, 27273, 27300, 27328, 27356, 27384, 27411, 27439,
+  27466, 27493, 27521, 27548, 27575, 27602, 27629, 27656, 27683, 27710, 27737, 27764,
+  27790, 27817, 27843, 27870, 27896, 27923, 27949, 27975, 28001, 28027, 28053, 28079,
+  28105, 28131, 28157, 28182, 28208, 28234, 28259, 28284, 28310, 28335, 28360, 28385,
+  28411, 28436, 28460, 28485, 28510, 28535, 28560, 28584, 28609, 28633, 28658, 28682,
+  28706, 28730, 28755, 28779, 28803, 28827, 28850, 28874, 28898, 28922, 28945, 28969,
+  28992, 29016, 29039, 29062, 29085, 29108, 29131, 29154, 29177, 29200, 29223, 29246,
+  29268, 29291, 29313, 29336, 29358, 29380, 29403, 29425, 29447, 29469, 29491, 29513,
+  29534, 29556, 29578, 29599, 29621, 29642, 29664, 29685, 29706, 29728, 29749, 29770,
+  29791, 29812, 29832, 29853, 29874, 29894, 29915, 29936, 29956, 29976, 29997, 30017,
+  30037, 30057, 30077, 30097, 30117, 30136, 30156, 30176, 30195, 30215, 30234, 30253,
+  30273, 30292, 30311, 30330, 30349, 30368, 30387, 30406, 30424, 30443, 30462, 30480,
+  30498, 30517, 30535, 30553, 30571, 30589, 30607, 30625, 30643, 30661, 30679, 30696,
+  30714, 30731, 30749, 30766, 30783, 30800, 30818, 30835, 30852, 30868, 30885, 30902,
+  30919, 30935, 30952, 30968, 30985, 31001, 31017, 31033, 31050, 31066, 31082, 31097,
+  31113, 31129, 31145, 31160, 31176, 31191, 31206, 31222, 31237, 31252, 31267, 31282,
+  31297, 31312, 31327, 31341, 31356, 31371, 31385, 31400, 31414, 31428, 31442, 31456,
+  31470, 31484, 31498, 31512, 31526, 31539, 31553, 31567, 31580, 31593, 31607, 31620,
+  31633, 31646, 31659, 31672, 31685, 31698, 31710, 31723, 31736, 31748, 31760, 31773,
+  31785, 31797, 31809, 31821, 31833, 31845, 31857, 31869, 31880, 31892, 31903, 31915,
+  31926, 31937, 31949, 31960, 31971, 31982, 31993, 32004, 32014, 32025, 32036, 32046,
+  32057, 32067, 32077, 32087, 32098, 32108, 32118, 32128, 32137, 32147, 32157, 32166,
+  32176, 32185, 32195, 32204, 32213, 32223, 32232, 32241, 32250, 32258, 32267, 32276,
+  32285, 32293, 32302, 32310, 32318, 32327, 32335, 32343, 32351, 32359, 32367, 32375,
+  32382, 32390, 32397, 32405, 32412, 32420, 32427, 32434, 32441, 32448, 32455, 32462,
+  32469, 32476, 32482, 32489, 32495, 32502, 32508, 32514, 32521, 32527, 32533, 32539,
+  32545, 32550, 32556, 32562, 32567, 32573, 32578, 32584, 32589, 32594, 32599, 32604,
+  32609, 32614, 32619, 32624, 32628, 32633, 32637, 32642, 32646, 32650, 32655, 32659,
+  32663, 32667, 32671, 32674, 32678, 32682, 32685, 32689, 32692, 32696, 32699, 32702,
+  32705, 32708, 32711, 32714, 32717, 32720, 32722, 32725, 32728, 32730, 32732, 32735,
+  32737, 32739, 32741, 32743, 32745, 32747, 32748, 32750, 32752, 32753, 32755, 32756,
+  32757, 32758, 32759, 32760, 32761, 32762, 32763, 32764, 32765, 32765, 32766, 32766,
+  32766, 32767, 32767, 32767, 32767,
+};
+
+// Cosine series a0 - a1 * cos(x) + a2 * cos(2x) - ..., Q15
+static const int16_t fft_window_terms[][FFT_WINDOW_TERMS] =
+{
+  [FFT_WINDOW_HANN]     = { 16384, 16384, 0, 0, 0 },
+  [FFT_WINDOW_FLAT_TOP] = { 7064, 13652, 9085, 2739, 228 },
+  [FFT_WINDOW_BLACKMAN] = { 13763, 16384, 2621, 0, 0 },
+};
+
+/*- Variables ---------------------------------------------------------------*/
+// Real input is packed as N/2 complex values in overlay.fft.buffer, the
+// transform is done in place, and the bin powers replace the complex values.
+// The buffer is shared, the powers are read right after the transform.
+static int g_size;   // Complex points
+static bool g_split; // Radix-2 stage splits the transform into two halves
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+static inline int fft_cos(int angle)
+{
+  angle &= (FFT_CIRCLE - 1);
+
+  if (angle < FFT_QUARTER)
+    return fft_sine[FFT_QUARTER - angle];
+  else if (angle < 2 * FFT_QUARTER)
+    return -fft_sine[angle - FFT_QUARTER];
+  else if (angle < 3 * FFT_QUARTER)
+    return -fft_sine[3 * FFT_QUARTER - angle];
+  else
+    return fft_sine[angle - 3 * FFT_QUARTER];
+}
+
+//-----------------------------------------------------------------------------
+// Packed cos(a) in the low and sin(a) in the high halfword
+static inline uint32_t twiddle(int angle)
+{
+  return __PKHBT(fft_cos(angle), fft_cos(angle - FFT_QUARTER), 16);
+}
+
+//-----------------------------------------------------------------------------
+// x * (cos(a) - j * sin(a)), Q15
+static inline uint32_t cmul(uint32_t x, uint32_t w)
+{
+  int re = (int32_t)__SMUAD(x, w) >> 15;
+  int im = (int32_t)__SMUSDX(w, x) >> 15;
+
+  return __PKHBT(re, im, 16);
+}
+
+//-----------------------------------------------------------------------------
+static inline uint32_t conjugate(uint32_t x)
+{
+  return __PKHBT(x, __QSUB16(0, x), 0);
+}
+
+//-----------------------------------------------------------------------------
+// Decimation in frequency, every stage is scaled by 1/4, so the values
+// can't overflow. Results are in the base 4 digit reversed order.
+static void radix4(uint32_t *x, int size)
+{
+  for (int span = size; span >= 4; span /= 4)
+  {
+    int quarter = span / 4;
+    int step = FFT_CIRCLE / span;
+
+    for (int n = 0; n < quarter; n++)
+    {
+      uint32_t w1 = twiddle(n * step);
+      uint32_t w2 = twiddle(2 * n * step);
+      uint32_t w3 = twiddle(3 * n * step);
+
+      for (int i = n; i < size; i += span)
+      {
+        uint32_t x0 = x[i];
+        uint32_t x1 = x[i + quarter];
+        uint32_t x2 = x[i + 2 * quarter];
+        uint32_t x3 = x[i + 3 * quarter];
+        uint32_t a = __SHADD16(x0, x2);
+        uint32_t b = __SHSUB16(x0, x2);
+        uint32_t c = __SHADD16(x1, x3);
+        uint32_t d = __SHSUB16(x1, x3);
+
+        x[i]               = __SHADD16(a, c);
+        x[i + quarter]     = cmul(__SHSAX(b, d), w1); // (b - jd) / 2
+        x[i + 2 * quarter] = cmul(__SHSUB16(a, c), w2);
+        x[i + 3 * quarter] = cmul(__SHASX(b, d), w3); // (b + jd) / 2
+      }
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Sizes that are not powers of 4 get one radix-2 stage first, then each
+// half is a power of 4
+static void transform(uint32_t *x, int size)
+{
+  int half = size / 2;
+  int step = FFT_CIRCLE / size;
+
+  g_size  = size;
+  g_split = (__CLZ(size) & 1) == 0;
+
+  if (!g_split)
+  {
+    radix4(x, size);
+    return;
+  }
+
+  for (int n = 0; n < half; n++)
+  {
+    uint32_t a = x[n];
+    uint32_t b = x[n + half];
+
+    x[n]        = __SHADD16(a, b);
+    x[n + half] = cmul(__SHSUB16(a, b), twiddle(n * step));
+  }
+
+  radix4(x, half);
+  radix4(x + half, half);
+}
+
+//-----------------------------------------------------------------------------
+// Reverses the order of the base 4 digits of the index, 'size' is a power of 4
+static inline int digit_reverse(int index, int size)
+{
+  uint32_t r = __RBIT(index) >> __CLZ(size - 1);
+
+  return ((r & 0x55555555) << 1) | ((r >> 1) & 0x55555555);
+}
+
+//-----------------------------------------------------------------------------
+// Position of the complex bin in the transformed buffer
+static inline int position(int bin)
+{
+  if (!g_split)
+    return digit_reverse(bin, g_size);
+
+  return (bin & 1) * (g_size / 2) + digit_reverse(bin >> 1, g_size / 2);
+}
+
+//-----------------------------------------------------------------------------
+// Spectrum of the real signal is recovered from the N/2 point complex
+// transform. Bins k and N/2-k are computed from the same pair of values,
+// so their powers can replace them in place.
+static void split(void)
+{
+  uint32_t *buffer = overlay.fft.buffer;
+  int size = g_size;
+  int step = FFT_CIRCLE / (2 * size);
+
+  for (int k = 0; k <= size / 2; k++)
+  {
+    int pa = position(k);
+    int pb = position((size - k) & (size - 1));
+    uint32_t a = buffer[pa];
+    uint32_t b = conjugate(buffer[pb]);
+    uint32_t e = __SHADD16(a, b);
+    uint32_t t = cmul(__SHSUB16(a, b), twiddle(k * step));
+    uint32_t xa = __SHSAX(e, t); // (e - jt) / 2
+    uint32_t xb = __SHASX(e, t); // (e + jt) / 2
+
+    buffer[pa] = __SMUAD(xa, xa);
+
+    if (pb != pa)
+      buffer[pb] = __SMUAD(xb, xb);
+  }
+}
+
+//-----------------------------------------------------------------------------
+static int window_value(int index, int n, int window)
+{
+  const int16_t *terms = fft_window_terms[window];
+  int angle = index * (FFT_CIRCLE / n);
+  int value = terms[0];
+
+  for (int i = 1; i < FFT_WINDOW_TERMS && terms[i]; i++)
+  {
+    int term = (terms[i] * fft_cos(i * angle)) >> 15;
+
+    value += (i & 1) ? -term : term;
+  }
+
+  return value;
+}
+
+//-----------------------------------------------------------------------------
+// Data is a ring of 'size' samples with the oldest one at 'offset', 'n'
+// samples starting at 'start' (counted from the oldest one) are windowed
+// and transformed. 'n' is a power of 2 between FFT_MIN_SIZE and
+// FFT_MAX_SIZE. Bin powers are 1/N scaled, a full scale sine has the power
+// of (window gain / 4)^2.
+void fft_calc(const uint8_t *data, int size, int offset, int start, int n, int window)
+{
+  int16_t *x = (int16_t *)overlay.fft.buffer;
+  int index = offset + start;
+
+  if (index >= size)
+    index -= size;
+
+  for (int i = 0; i < n; i++)
+  {
+    int v = (data[index] - ZERO_POINT) << 7;
+
+    x[i] = (v * window_value(i, n, window)) >> 15;
+
+    if (++index == size)
+      index = 0;
+  }
+
+  transform(overlay.fft.buffer, n / 2);
+  split();
+}
+
+//-----------------------------------------------------------------------------
+// Bins are 0 to N/2-1, spaced by the sample rate / N
+uint32_t fft_get_power(int bin)
+{
+  return overlay.fft.buffer[position(bin)];
+}
+
+//-----------------------------------------------------------------------------
+// Returns 10 * log10(value) in 1/256 dB. Fraction of log2 is approximated
+// by x * (1.3466 - 0.3466 * x) on 8 bits of x, the error is below 0.05 dB.
+int fft_db(uint32_t value)
+{
+  int lz, x, log2;
+
+  if (0 == value)
+    value = 1;
+
+  lz = __CLZ(value);
+  x = ((value << lz) >> 23) & 0xff;
+  log2 = (31 - lz) * 256 + ((x * (345 - ((89 * x) >> 8))) >> 8);
+
+  return (log2 * 12330) >> 12;
+}
+
+//-----------------------------------------------------------------------------
+// Coherent gain of the window, Q15
+int fft_window_gain(int window)
+{
+  return fft_window_terms[window][0];
+}
+
+//-----------------------------------------------------------------------------
+// Half width of the main lobe in bins, one bin more than the number of
+// cosine terms of the window
+int fft_window_width(int window)
+{
+  int width = 1;
+
+  for (int i = 1; i < FFT_WINDOW_TERMS && fft_window_terms[window][i]; i++)
+    width++;
+
+  return width;
+}
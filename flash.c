@@ -27,6 +27,7 @@
  */
 
 /*- Includes ----------------------------------------------------------------*/
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include "gd32f4xx.h"
@@ -41,11 +42,39 @@ HAL_GPIO_PIN(CLK,      A, 5)
 HAL_GPIO_PIN(MISO,     A, 6)
 HAL_GPIO_PIN(MOSI,     A, 7)
 
+#define STATUS_BUSY          (1 << 0)
+
+#define FLASH_QUEUE_SIZE     8
+#define FLASH_SECTOR_SIZE    4096
+
+#define TCM_START            0x10000000
+#define TCM_END              0x10010000
+
 enum
 {
+  CMD_WRITE_ENABLE     = 0x06,
+  CMD_READ_STATUS_1    = 0x05,
+  CMD_PAGE_PROGRAM     = 0x02,
+  CMD_FAST_READ        = 0x0b,
+  CMD_SECTOR_ERASE_4K  = 0x20,
+  CMD_BLOCK_ERASE_64K  = 0xd8,
   CMD_READ_JEDEC_ID    = 0x9f,
 };
 
+/*- Variables ---------------------------------------------------------------*/
+// NOTE: DMA can't access TCM, so the dummy transmit byte is placed in
+//       the program memory. Buffers located in TCM are transferred by the CPU.
+static const uint8_t g_dummy = 0xff;
+static bool g_present = false;
+static bool g_transfer_active = false;
+static bool g_transfer_rx = false;
+static bool g_write_active = false;
+static FlashRequest *g_queue[FLASH_QUEUE_SIZE];
+static int g_queue_head = 0;
+static int g_queue_count = 0;
+static FlashRequest *g_request = NULL;
+static int g_request_offset;
+
 /*- Implementations ---------------------------------------------------------*/
 
 //-----------------------------------------------------------------------------
@@ -71,6 +100,255 @@ static bool flash_test(void)
   return (id0 == 0xef && id1 == 0x40 && id2 == 0x17);
 }
 
+//-----------------------------------------------------------------------------
+static void send_command(int cmd, uint32_t addr)
+{
+  HAL_GPIO_CS_clr();
+  spi_write(cmd);
+  spi_write((addr >> 16) & 0xff);
+  spi_write((addr >> 8) & 0xff);
+  spi_write(addr & 0xff);
+}
+
+//-----------------------------------------------------------------------------
+static void write_enable(void)
+{
+  HAL_GPIO_CS_clr();
+  spi_write(CMD_WRITE_ENABLE);
+  HAL_GPIO_CS_set();
+}
+
+//-----------------------------------------------------------------------------
+static int read_status(void)
+{
+  int status;
+
+  HAL_GPIO_CS_clr();
+  spi_write(CMD_READ_STATUS_1);
+  status = spi_write(0);
+  HAL_GPIO_CS_set();
+
+  return status;
+}
+
+//-----------------------------------------------------------------------------
+static void dma_transfer(const uint8_t *tx, uint8_t *rx, int size)
+{
+  DMA1->INTC0 = DMA1_INTC0_FTFIFC0_Msk | DMA1_INTC0_FTFIFC3_Msk;
+
+  if (rx)
+  {
+    DMA1->CH0PADDR  = (uint32_t)&SPI0->DATA;
+    DMA1->CH0M0ADDR = (uint32_t)rx;
+    DMA1->CH0CNT    = size;
+    DMA1->CH0CTL    = (0/*P2M*/ << DMA1_CH0CTL_TM_Pos) | DMA1_CH0CTL_MNAGA_Msk |
+        (2/*High*/ << DMA1_CH0CTL_PRIO_Pos) | (3/*SPI0_RX*/ << DMA1_CH0CTL_PERIEN_Pos) |
+        DMA1_CH0CTL_CHEN_Msk;
+  }
+
+  DMA1->CH3PADDR  = (uint32_t)&SPI0->DATA;
+  DMA1->CH3M0ADDR = (uint32_t)(tx ? tx : &g_dummy);
+  DMA1->CH3CNT    = size;
+  DMA1->CH3CTL    = (1/*M2P*/ << DMA1_CH3CTL_TM_Pos) | (tx ? DMA1_CH3CTL_MNAGA_Msk : 0) |
+      (2/*High*/ << DMA1_CH3CTL_PRIO_Pos) | (3/*SPI0_TX*/ << DMA1_CH3CTL_PERIEN_Pos) |
+      DMA1_CH3CTL_CHEN_Msk;
+
+  g_transfer_active = true;
+  g_transfer_rx     = (rx != NULL);
+
+  SPI0->CTL1 = (rx ? SPI0_CTL1_DMAREN_Msk : 0) | SPI0_CTL1_DMATEN_Msk;
+}
+
+//-----------------------------------------------------------------------------
+static bool dma_transfer_done(void)
+{
+  if (g_transfer_rx)
+    return (DMA1->INTF0 & DMA1_INTF0_FTFIF0_Msk);
+
+  return (DMA1->INTF0 & DMA1_INTF0_FTFIF3_Msk) && SPI0->STAT_b.TBE && !SPI0->STAT_b.TRANS;
+}
+
+//-----------------------------------------------------------------------------
+static void dma_transfer_finish(void)
+{
+  SPI0->CTL1   = 0;
+  DMA1->CH0CTL = 0;
+  DMA1->CH3CTL = 0;
+
+  // Received data is ignored during the transmit only transfers,
+  // so the overrun flag has to be cleared
+  (void)SPI0->DATA;
+  (void)SPI0->STAT;
+
+  HAL_GPIO_CS_set();
+
+  g_transfer_active = false;
+}
+
+//-----------------------------------------------------------------------------
+static void transfer(const uint8_t *tx, uint8_t *rx, int size)
+{
+  uint32_t addr = (uint32_t)(tx ? tx : rx);
+
+  if (addr < TCM_START || addr >= TCM_END)
+  {
+    dma_transfer(tx, rx, size);
+    return;
+  }
+
+  for (int i = 0; i < size; i++)
+  {
+    int value = spi_write(tx ? tx[i] : 0);
+
+    if (rx)
+      rx[i] = value;
+  }
+
+  HAL_GPIO_CS_set();
+}
+
+//-----------------------------------------------------------------------------
+static bool flash_busy(void)
+{
+  if (g_transfer_active)
+  {
+    if (!dma_transfer_done())
+      return true;
+
+    dma_transfer_finish();
+  }
+
+  if (g_write_active)
+  {
+    if (read_status() & STATUS_BUSY)
+      return true;
+
+    g_write_active = false;
+  }
+
+  return false;
+}
+
+//-----------------------------------------------------------------------------
+// Starts the next part of the request. Reads are split into the chunks DMA
+// can handle, programming is split at the page boundaries and erase covers
+// one sector or block at a time.
+static void request_start(FlashRequest *req)
+{
+  uint32_t addr = req->addr + g_request_offset;
+  uint8_t *data = req->data + g_request_offset;
+  int size = req->size - g_request_offset;
+
+  if (FLASH_CMD_READ == req->command)
+  {
+    if (size > FLASH_MAX_TRANSFER)
+      size = FLASH_MAX_TRANSFER;
+
+    send_command(CMD_FAST_READ, addr);
+    spi_write(0); // Dummy cycles
+    transfer(NULL, data, size);
+  }
+  else if (FLASH_CMD_PROGRAM == req->command)
+  {
+    int space = FLASH_PAGE_SIZE - (addr & (FLASH_PAGE_SIZE - 1));
+
+    if (size > space)
+      size = space;
+
+    write_enable();
+    send_command(CMD_PAGE_PROGRAM, addr);
+    transfer(data, NULL, size);
+    g_write_active = true;
+  }
+  else
+  {
+    bool sector = (FLASH_CMD_ERASE_SECTOR == req->command);
+
+    size = sector ? FLASH_SECTOR_SIZE : FLASH_BLOCK_SIZE;
+
+    write_enable();
+    send_command(sector ? CMD_SECTOR_ERASE_4K : CMD_BLOCK_ERASE_64K, addr);
+    HAL_GPIO_CS_set();
+    g_write_active = true;
+  }
+
+  g_request_offset += size;
+}
+
+//-----------------------------------------------------------------------------
+bool flash_present(void)
+{
+  return g_present;
+}
+
+//-----------------------------------------------------------------------------
+// Request is owned by the caller and must stay valid until it is done.
+// Returns false if the queue is full or there is no flash.
+bool flash_submit(FlashRequest *req)
+{
+  if (!g_present || g_queue_count == FLASH_QUEUE_SIZE)
+    return false;
+
+  req->done = false;
+
+  g_queue[(g_queue_head + g_queue_count) % FLASH_QUEUE_SIZE] = req;
+  g_queue_count++;
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// Blocking version for the short transfers. Returns false if there is no flash.
+bool flash_execute(FlashRequest *req)
+{
+  while (!flash_submit(req))
+  {
+    if (!g_present)
+      return false;
+
+    flash_task();
+  }
+
+  while (!req->done)
+    flash_task();
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+bool flash_idle(void)
+{
+  return (NULL == g_request && 0 == g_queue_count);
+}
+
+//-----------------------------------------------------------------------------
+void flash_task(void)
+{
+  if (NULL == g_request)
+  {
+    if (0 == g_queue_count)
+      return;
+
+    g_request = g_queue[g_queue_head];
+    g_request_offset = 0;
+
+    g_queue_head = (g_queue_head + 1) % FLASH_QUEUE_SIZE;
+    g_queue_count--;
+  }
+
+  if (flash_busy())
+    return;
+
+  if (g_request_offset < g_request->size)
+  {
+    request_start(g_request);
+    return;
+  }
+
+  g_request->done = true;
+  g_request = NULL;
+}
+
 //-----------------------------------------------------------------------------
 void flash_init(void)
 {
@@ -80,6 +358,7 @@ void flash_init(void)
   HAL_GPIO_MISO_alt(5);
   HAL_GPIO_MOSI_alt(5);
 
+  RCU->AHB1EN_b.DMA1EN = 1;
   RCU->APB2EN_b.SPI0EN = 1;
 
   SPI0->CTL0 = SPI0_CTL0_SPIEN_Msk | SPI0_CTL0_MSTMOD_Msk | (1/*PCLK/4*/ << SPI0_CTL0_PSC_Pos) |
@@ -87,7 +366,8 @@ void flash_init(void)
 
   delay_cycles(100);
 
-  if (!flash_test())
-    error("Flash error");
+  // Scope is still usable without the flash, only the features that rely
+  // on it are disabled
+  g_present = flash_test();
 }
 
@@ -29,8 +29,41 @@
 #ifndef _FLASH_H_
 #define _FLASH_H_
 
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+
+/*- Definitions -------------------------------------------------------------*/
+#define FLASH_SIZE             (8 * 1024 * 1024)
+#define FLASH_BLOCK_SIZE       (64 * 1024)
+#define FLASH_PAGE_SIZE        256
+#define FLASH_MAX_TRANSFER     (32 * 1024)
+
+enum
+{
+  FLASH_CMD_READ,
+  FLASH_CMD_PROGRAM,
+  FLASH_CMD_ERASE_SECTOR,
+  FLASH_CMD_ERASE_BLOCK,
+};
+
+/*- Types -------------------------------------------------------------------*/
+typedef struct
+{
+  int           command;
+  uint32_t      addr;
+  uint8_t       *data;
+  int           size;  // For erase commands, a multiple of the sector or block size
+  volatile bool done;
+} FlashRequest;
+
 /*- Prototypes --------------------------------------------------------------*/
 void flash_init(void);
+bool flash_present(void);
+bool flash_submit(FlashRequest *req);
+bool flash_execute(FlashRequest *req);
+bool flash_idle(void);
+void flash_task(void);
 
 #endif // _FLASH_H_
 
@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include "gd32f4xx.h"
+#include "utils.h"
+#include "config.h"
+#include "harmonics.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define HARMONICS_MIN_PERIODS  2
+#define HARMONICS_MAX_LENGTH   4096 // Decimated samples
+#define HARMONICS_MIN_STEP     (1u << 24) // 1/256 turn per decimated sample
+#define HARMONICS_MAX_STEP     1932735283u // 0.45 turn per sample
+
+#define ONE                    (1 << 30)
+#define TWO_PI                 3373259426ll // Q29
+
+#define ZERO_POINT             0x80
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+// Angle is in Q32 turns, results are in Q30. Taylor series are evaluated
+// for 1/16 of the angle, then the angle is doubled 4 times.
+static void sin_cos(uint32_t angle, int32_t *sine, int32_t *cosine)
+{
+  int64_t x = ((int64_t)(int32_t)angle * TWO_PI) >> 35;
+  int64_t x2 = (x * x) >> 30;
+  int64_t s, c;
+
+  s = ONE - x2 / 42;
+  s = ONE - ((x2 * s) >> 30) / 20;
+  s = ONE - ((x2 * s) >> 30) / 6;
+  s = (x * s) >> 30;
+
+  c = ONE - x2 / 56;
+  c = ONE - ((x2 * c) >> 30) / 30;
+  c = ONE - ((x2 * c) >> 30) / 12;
+  c = ONE - ((x2 * c) >> 30) / 2;
+
+  for (int i = 0; i < 4; i++)
+  {
+    int64_t t = (s * c) >> 29;
+
+    c = ONE - ((s * s) >> 29);
+    s = t;
+  }
+
+  *sine   = s;
+  *cosine = c;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the angle in 0.01 degree units. Arc tangent is approximated by
+// 45 * z + 15.64 * z * (1 - z), the error is below 0.25 degree.
+static int phase(int64_t re, int64_t im)
+{
+  uint64_t a = (re < 0) ? -re : re;
+  uint64_t b = (im < 0) ? -im : im;
+  int z, angle;
+
+  if (0 == a && 0 == b)
+    return 0;
+
+  if (b > a)
+    z = (a << 15) / b;
+  else
+    z = (b << 15) / a;
+
+  angle = ((z * 4500) >> 15) + ((((z * 1564) >> 15) * (32768 - z)) >> 15);
+
+  if (b > a)
+    angle = 9000 - angle;
+
+  if (re < 0)
+    angle = 18000 - angle;
+
+  return (im < 0) ? -angle : angle;
+}
+
+//-----------------------------------------------------------------------------
+// Harmonics of the known fundamental frequency (mHz) are found by a bank of
+// Goertzel filters running over a whole number of periods in one pass.
+// Long periods are decimated by a box filter to 128-256 samples per period,
+// this keeps the filter states within 32 bits and the cost within
+// HARMONICS_MAX_LENGTH iterations. Box filter response is compensated.
+bool harmonics_calc(const uint8_t *data, int size, int offset, int64_t frequency, int period,
+    int vs_mult, Harmonics *h)
+{
+  int32_t coef[HARMONICS_COUNT];
+  int32_t s1[HARMONICS_COUNT];
+  int32_t s2[HARMONICS_COUNT];
+  int64_t amplitude[HARMONICS_COUNT] = { 0 }; // ADC counts, Q16
+  uint64_t sum = 0;
+  uint32_t step, step_d;
+  int decimation = 1;
+  int periods, length, count, index;
+  int base = 0;
+
+  h->count = 0;
+
+  if (frequency <= 0)
+    return false;
+
+  // Fundamental frequency in Q32 turns per sample
+  step = (((uint64_t)frequency * period) << 20) / 244140625; // 1e12 / 2^12
+
+  if (0 == step || step > HARMONICS_MAX_STEP)
+    return false;
+
+  while ((uint64_t)step * decimation < HARMONICS_MIN_STEP)
+    decimation *= 2;
+
+  step_d = step * decimation;
+
+  periods = ((uint64_t)size * step) >> 32;
+
+  if ((uint64_t)HARMONICS_MAX_LENGTH * step_d < ((uint64_t)periods << 32))
+    periods = ((uint64_t)HARMONICS_MAX_LENGTH * step_d) >> 32;
+
+  if (periods < HARMONICS_MIN_PERIODS)
+    return false;
+
+  length = (((uint64_t)periods << 32) + step_d / 2) / step_d;
+
+  if (length * decimation > size)
+    length--;
+
+  count = HARMONICS_MAX_STEP / step_d;
+
+  if (count > HARMONICS_COUNT)
+    count = HARMONICS_COUNT;
+
+  for (int i = 0; i < count; i++)
+  {
+    int32_t s;
+
+    sin_cos(step_d * (i + 1), &s, &coef[i]);
+    s1[i] = 0;
+    s2[i] = 0;
+  }
+
+  index = offset;
+
+  for (int n = 0; n < length; n++)
+  {
+    int x = -ZERO_POINT * decimation;
+
+    for (int i = 0; i < decimation; i++)
+    {
+      x += data[index];
+
+      if (++index == size)
+        index = 0;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+      int32_t s = x + (int32_t)(((int64_t)coef[i] * s1[i]) >> 29) - s2[i];
+
+      s2[i] = s1[i];
+      s1[i] = s;
+    }
+  }
+
+  // Phases are relative to the last sample, which is the same point in time
+  // for all harmonics
+  for (int i = 0; i < count; i++)
+  {
+    int32_t sine, cosine;
+    int64_t re, im, response = 1 << 16;
+    int angle;
+
+    sin_cos(step_d * (i + 1), &sine, &cosine);
+
+    re = s1[i] - (((int64_t)s2[i] * cosine) >> 30);
+    im = ((int64_t)s2[i] * sine) >> 30;
+
+    // Box filter of N samples has the response of sin(N * w / 2) / sin(w / 2)
+    if (decimation > 1)
+    {
+      int32_t num, den, unused;
+
+      sin_cos((step_d * (i + 1)) / 2, &num, &unused);
+      sin_cos((step * (i + 1)) / 2, &den, &unused);
+      response = ((int64_t)num << 16) / den;
+    }
+
+    amplitude[i] = ((int64_t)isqrt(re * re + im * im) << 33) / response / length;
+
+    angle = phase(re, im);
+
+    if (0 == i)
+    {
+      base = angle;
+      h->phase[0] = 0;
+    }
+    else
+    {
+      angle = (angle - (i + 1) * base) % 36000;
+
+      if (angle > 18000)
+        angle -= 36000;
+      else if (angle <= -18000)
+        angle += 36000;
+
+      h->phase[i] = (angle + ((angle < 0) ? -50 : 50)) / 100;
+    }
+
+    h->rms[i] = (amplitude[i] * vs_mult * 707107) / ((int64_t)CALIB_MULTIPLIER * 1000 << 16);
+  }
+
+  if (0 == amplitude[0])
+    return false;
+
+  // Relative levels are in 1e-6 units for the sum
+  for (int i = 0; i < count; i++)
+  {
+    int64_t level = (amplitude[i] * 1000000) / amplitude[0];
+
+    h->level[i] = (level + 50) / 100;
+
+    if (i > 0)
+      sum += level * level;
+  }
+
+  h->thd   = (isqrt(sum) + 50) / 100;
+  h->count = count;
+
+  return true;
+}
@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "capture.h"
+#include "wave.h"
+#include "history.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define HISTORY_MAX_ENTRIES    128
+#define HISTORY_TASK_BLOCKS    4 // Per history_task() call
+
+#define ZERO_POINT             0x80
+
+/*- Types -------------------------------------------------------------------*/
+typedef struct
+{
+  int      data_size;
+  int      period;
+  int      size;
+  int      min_index;
+  int      vpos;
+  int      vs_mult;
+} EntryHeader;
+
+/*- Variables ---------------------------------------------------------------*/
+static uint8_t *g_area = NULL;
+static int g_area_size = 0;
+static uint8_t *g_staging;
+static int g_staging_size = 0;
+static uint8_t *g_ring;
+static int g_ring_size = 0;
+
+static int g_offsets[HISTORY_MAX_ENTRIES];
+static int g_first;
+static int g_count;
+static int g_head;
+
+static bool g_encoding = false;
+static CaptureRecord g_record;
+static int g_entry;
+static int g_index;
+static int g_data_size;
+static uint8_t g_prev;
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+static int entry_size(int samples)
+{
+  int blocks = (samples + WAVE_BLOCK_SIZE - 1) / WAVE_BLOCK_SIZE;
+
+  return (sizeof(EntryHeader) + samples + blocks + 3) & ~3;
+}
+
+//-----------------------------------------------------------------------------
+// Part of the capture buffer not used by the current record is available for
+// the history. The first part of the area holds an uncompressed copy of
+// the record being compressed, the rest is a ring of compressed records.
+void history_set_area(uint8_t *area, int size, int record_size)
+{
+  if (area == g_area && size == g_area_size && record_size == g_staging_size)
+    return;
+
+  g_area         = area;
+  g_area_size    = size;
+  g_staging      = area;
+  g_staging_size = record_size;
+  g_ring         = area + record_size;
+  g_ring_size    = size - record_size;
+
+  // Space for the worst case is reserved, but only the compressed size is used
+  if (NULL == area || g_ring_size < entry_size(record_size))
+    g_ring_size = 0;
+
+  history_clear();
+}
+
+//-----------------------------------------------------------------------------
+void history_clear(void)
+{
+  g_first    = 0;
+  g_count    = 0;
+  g_head     = 0;
+  g_encoding = false;
+}
+
+//-----------------------------------------------------------------------------
+static void drop_oldest(void)
+{
+  g_first = (g_first + 1) % HISTORY_MAX_ENTRIES;
+  g_count--;
+}
+
+//-----------------------------------------------------------------------------
+// Entries are placed one after another, so the entries past the head are
+// always the oldest ones.
+static int allocate_entry(int size)
+{
+  if ((g_head + size) > g_ring_size)
+  {
+    while (g_count && g_offsets[g_first] >= g_head)
+      drop_oldest();
+
+    g_head = 0;
+  }
+
+  while (g_count && (HISTORY_MAX_ENTRIES == g_count ||
+      (g_offsets[g_first] >= g_head && g_offsets[g_first] < (g_head + size))))
+    drop_oldest();
+
+  return g_head;
+}
+
+//-----------------------------------------------------------------------------
+// Only the copy is made here, compression is done later by history_task(),
+// so the capture is not delayed. Records coming in while the previous one is
+// still being compressed are skipped.
+void history_add(CaptureRecord *record)
+{
+  int index = record->offset;
+  int sz = record->size - index;
+
+  if (0 == g_ring_size || g_encoding || record->size > g_staging_size)
+    return;
+
+  memcpy(g_staging, &record->data[index], sz);
+  memcpy(&g_staging[sz], record->data, index);
+
+  g_record        = *record;
+  g_record.offset = 0;
+  g_record.data   = g_staging;
+
+  g_entry     = allocate_entry(entry_size(record->size));
+  g_index     = 0;
+  g_data_size = 0;
+  g_prev      = ZERO_POINT;
+  g_encoding  = true;
+}
+
+//-----------------------------------------------------------------------------
+void history_task(void)
+{
+  EntryHeader header;
+  uint8_t *data;
+
+  if (!g_encoding)
+    return;
+
+  data = &g_ring[g_entry + sizeof(EntryHeader)];
+
+  for (int i = 0; i < HISTORY_TASK_BLOCKS && g_index < g_record.size; i++)
+  {
+    int count = g_record.size - g_index;
+
+    if (count > WAVE_BLOCK_SIZE)
+      count = WAVE_BLOCK_SIZE;
+
+    g_data_size += wave_encode_block(&g_staging[g_index], count, &g_prev, &data[g_data_size]);
+    g_index += count;
+  }
+
+  if (g_index < g_record.size)
+    return;
+
+  header.data_size = g_data_size;
+  header.period    = g_record.period;
+  header.size      = g_record.size;
+  header.min_index = g_record.min_index;
+  header.vpos      = g_record.vpos;
+  header.vs_mult   = g_record.vs_mult;
+
+  memcpy(&g_ring[g_entry], &header, sizeof(EntryHeader));
+
+  g_offsets[(g_first + g_count) % HISTORY_MAX_ENTRIES] = g_entry;
+  g_count++;
+
+  g_head = g_entry + ((sizeof(EntryHeader) + g_data_size + 3) & ~3);
+  g_encoding = false;
+}
+
+//-----------------------------------------------------------------------------
+int history_get_count(void)
+{
+  return g_count;
+}
+
+//-----------------------------------------------------------------------------
+// Decodes the record into the staging area, index 0 is the newest record
+bool history_get(int index, CaptureRecord *record)
+{
+  EntryHeader header;
+  uint8_t *data;
+  uint8_t prev = ZERO_POINT;
+  int used = 0;
+
+  while (g_encoding)
+    history_task();
+
+  if (index < 0 || index >= g_count)
+    return false;
+
+  data = &g_ring[g_offsets[(g_first + g_count - 1 - index) % HISTORY_MAX_ENTRIES]];
+
+  memcpy(&header, data, sizeof(EntryHeader));
+  data += sizeof(EntryHeader);
+
+  for (int i = 0; i < header.size; i += WAVE_BLOCK_SIZE)
+  {
+    int count = header.size - i;
+
+    if (count > WAVE_BLOCK_SIZE)
+      count = WAVE_BLOCK_SIZE;
+
+    int sz = wave_decode_block(&data[used], header.data_size - used, &g_staging[i], count, &prev);
+
+    if (sz < 0)
+      return false;
+
+    used += sz;
+  }
+
+  record->period    = header.period;
+  record->size      = header.size;
+  record->offset    = 0;
+  record->min_index = header.min_index;
+  record->vpos      = header.vpos;
+  record->vs_mult   = header.vs_mult;
+  record->data      = g_staging;
+
+  return true;
+}
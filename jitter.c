@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "gd32f4xx.h"
+#include "utils.h"
+#include "jitter.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define JITTER_MAX_VALUE       (1 << 20) // 24.8 samples, larger values are clipped
+#define JITTER_MAX_COUNT       (1 << 22) // Accumulation stops here
+
+/*- Variables ---------------------------------------------------------------*/
+// Bins are centered at zero, bin width is (1 << g_shift) in 1/256 of a sample
+static uint32_t g_bins[JITTER_BINS];
+static int g_shift;
+static int g_period; // Sample period of the accumulated values, ns
+static int g_records;
+static uint32_t g_count;
+static int64_t g_sum;
+static uint64_t g_sum_sq;
+static int g_min;
+static int g_max;
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+void jitter_reset(void)
+{
+  memset(g_bins, 0, sizeof(g_bins));
+  g_shift   = 0;
+  g_period  = 0;
+  g_records = 0;
+  g_count   = 0;
+  g_sum     = 0;
+  g_sum_sq  = 0;
+  g_min     = 0;
+  g_max     = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Called before the values of each record. Values taken at a different
+// sample period can't be merged, the accumulation starts over.
+void jitter_start(int period)
+{
+  if (period != g_period)
+  {
+    jitter_reset();
+    g_period = period;
+  }
+
+  if (g_count < JITTER_MAX_COUNT)
+    g_records++;
+}
+
+//-----------------------------------------------------------------------------
+// Bin width is doubled and the pairs of bins are merged, so the histogram
+// follows the spread without keeping the values. Pairs move towards the
+// center, they are merged in place going outwards from it, so each bin is
+// read before it is written.
+static void widen(void)
+{
+  for (int i = JITTER_BINS/2 - 1; i >= JITTER_BINS/4; i--)
+    g_bins[i] = g_bins[2*i - JITTER_BINS/2] + g_bins[2*i - JITTER_BINS/2 + 1];
+
+  for (int i = JITTER_BINS/2; i < JITTER_BINS*3/4; i++)
+    g_bins[i] = g_bins[2*i - JITTER_BINS/2] + g_bins[2*i - JITTER_BINS/2 + 1];
+
+  for (int i = 0; i < JITTER_BINS/4; i++)
+  {
+    g_bins[i] = 0;
+    g_bins[JITTER_BINS*3/4 + i] = 0;
+  }
+
+  g_shift++;
+}
+
+//-----------------------------------------------------------------------------
+// Value is in samples with 8 fractional bits
+void jitter_add(int value)
+{
+  int bin;
+
+  if (g_count >= JITTER_MAX_COUNT)
+    return;
+
+  if (value > JITTER_MAX_VALUE)
+    value = JITTER_MAX_VALUE;
+  else if (value < -JITTER_MAX_VALUE)
+    value = -JITTER_MAX_VALUE;
+
+  while (1)
+  {
+    bin = (value >> g_shift) + JITTER_BINS/2;
+
+    if (bin >= 0 && bin < JITTER_BINS)
+      break;
+
+    widen();
+  }
+
+  g_bins[bin]++;
+
+  if (0 == g_count || value < g_min)
+    g_min = value;
+
+  if (0 == g_count || value > g_max)
+    g_max = value;
+
+  g_sum    += value;
+  g_sum_sq += (int64_t)value * value;
+  g_count++;
+}
+
+//-----------------------------------------------------------------------------
+// Returns false if there are not enough values for the deviation
+bool jitter_get(Jitter *j)
+{
+  int64_t mean, variance;
+
+  j->count     = g_count;
+  j->records   = g_records;
+  j->rms       = 0;
+  j->peak      = 0;
+  j->bin_width = ((int64_t)g_period * 1000 << g_shift) >> 8;
+
+  if (g_count < 2)
+    return false;
+
+  // Variance has 16 fractional bits, the square root of the shifted value
+  // keeps 16 of them for the deviation
+  mean     = g_sum / (int64_t)g_count;
+  variance = (int64_t)(g_sum_sq / g_count) - mean * mean;
+
+  if (variance > 0)
+    j->rms = ((int64_t)isqrt((uint64_t)variance << 16) * g_period * 1000) >> 16;
+
+  j->peak = ((int64_t)(g_max - g_min) * g_period * 1000) >> 8;
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// Bin 'JITTER_BINS/2' starts at zero
+const uint32_t *jitter_get_bins(void)
+{
+  return g_bins;
+}
@@ -418,4 +418,63 @@ void lcd_puts(int x, int y, const char *str)
   }
 }
 
+//-----------------------------------------------------------------------------
+// Each font pixel becomes a square of scale x scale pixels
+static void lcd_putc_scaled(int x, int y, char ch, int scale)
+{
+  int width = lcd_font->width;
+  const uint8_t *bitmap;
+
+  lcd_set_rect(x, y, width * scale, lcd_font->height * scale);
+
+  HAL_GPIO_LCD_CS_clr();
+  lcd_command_write(ST7789_RAMWR);
+
+  if (ch < FONT_FIRST_CHAR || ch > FONT_LAST_CHAR)
+    ch = '?';
+
+  bitmap = lcd_font->data + (ch - FONT_FIRST_CHAR) * lcd_font->pitch;
 
+  for (int row = 0; row < lcd_font->height * scale; row++)
+  {
+    for (int col = 0; col < width * scale; col++)
+    {
+      int i = (row / scale) * width + col / scale;
+      int pixel = (bitmap[i / 8] >> (i % 8)) & 1;
+
+      if (pixel)
+      {
+        lcd_data_write(fg_color[0]);
+        lcd_data_write(fg_color[1]);
+      }
+      else
+      {
+        lcd_data_write(bg_color[0]);
+        lcd_data_write(bg_color[1]);
+      }
+    }
+  }
+
+  HAL_GPIO_LCD_CS_set();
+}
+
+//-----------------------------------------------------------------------------
+void lcd_puts_scaled(int x, int y, const char *str, int scale)
+{
+  while (*str)
+  {
+    if (FONT_HALF_SPACE == *str)
+    {
+      int color = (bg_color[0] << 8) | bg_color[1];
+      lcd_fill_rect(x, y, lcd_font->width * scale / 2, lcd_font->height * scale, color);
+      x += lcd_font->width * scale / 2;
+    }
+    else
+    {
+      lcd_putc_scaled(x, y, *str, scale);
+      x += lcd_font->width * scale;
+    }
+
+    str++;
+  }
+}
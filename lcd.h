@@ -62,6 +62,7 @@ void lcd_set_font(const Font *font);
 void lcd_set_color(int bg, int fg);
 void lcd_putc(int x, int y, char ch);
 void lcd_puts(int x, int y, const char *str);
+void lcd_puts_scaled(int x, int y, const char *str, int scale);
 
 #endif // _LCD_H_
 
@@ -0,0 +1,379 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "gd32f4xx.h"
+#include "utils.h"
+#include "timer.h"
+#include "config.h"
+#include "storage.h"
+#include "logger.h"
+#include "overlay.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define LOGGER_MAGIC           0x52474f4c // "LOGR"
+#define LOGGER_VERSION         1
+#define LOGGER_SEGMENT_RECORDS 10000 // Segment fits into one storage block
+#define LOGGER_OUT_SIZE        64
+
+#define ZERO_POINT             0x80
+
+/*- Types -------------------------------------------------------------------*/
+// Each segment is a separate storage object, so old segments can be reclaimed
+// while the logger keeps running. Records follow the header, record N covers
+// the interval starting at 'time' + N * 'interval'.
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t interval; // ms
+  uint32_t time;     // Uptime at the start of the first record, ms
+  int32_t  vpos;
+  int32_t  vs_mult;
+  uint32_t reserved;
+  uint32_t crc;
+} LogHeader;
+
+typedef struct
+{
+  uint32_t min; // 4 lanes
+  uint32_t max; // 4 lanes
+  uint64_t sum;
+  uint64_t sum_sq;
+  uint32_t count;
+} Accumulator;
+
+/*- Variables ---------------------------------------------------------------*/
+static volatile Accumulator g_acc;
+static bool g_active = false;
+static uint32_t g_interval;
+static uint32_t g_interval_start;
+
+static LogHeader g_header;
+static int g_segment_count = -1; // Records in the current segment
+static int g_segment_id;
+static bool g_open = false;
+static bool g_closing = false;
+static bool g_full = false;
+static uint8_t g_out[LOGGER_OUT_SIZE];
+static int g_out_size = 0;
+
+// Chart records are kept in overlay.mode.logger while the logger is active
+static int g_history_count;
+static int g_history_head;
+static int g_total;
+static int g_lost;
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+static void reset_accumulator(void)
+{
+  g_acc.min    = 0xffffffff;
+  g_acc.max    = 0;
+  g_acc.sum    = 0;
+  g_acc.sum_sq = 0;
+  g_acc.count  = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Interval is in seconds
+void logger_start(int interval)
+{
+  logger_stop();
+
+  __disable_irq();
+  reset_accumulator();
+  __enable_irq();
+
+  g_interval       = interval * 1000;
+  g_interval_start = timer_get_uptime();
+  g_history_count  = 0;
+  g_total          = 0;
+  g_lost           = 0;
+  g_full           = false;
+  g_active         = true;
+}
+
+//-----------------------------------------------------------------------------
+// Current segment is closed in the background
+void logger_stop(void)
+{
+  g_active = false;
+
+  if (g_segment_count >= 0)
+    g_closing = true;
+}
+
+//-----------------------------------------------------------------------------
+// Called from the DMA interrupt for every block, samples are reduced to
+// the running min/max/sum/sum of squares and never stored. Blocks are word
+// aligned and at most 16K samples long, so per-block sums fit into 32 bits.
+void logger_update(const uint8_t *data, int size)
+{
+  const uint32_t *words = (const uint32_t *)data;
+  uint32_t min = g_acc.min;
+  uint32_t max = g_acc.max;
+  uint32_t sum = 0;
+  uint32_t sum_sq = 0;
+
+  for (int i = 0; i < size / 4; i++)
+  {
+    uint32_t w = words[i];
+    uint32_t even = __UXTB16(w);
+    uint32_t odd = __UXTB16(__ROR(w, 8));
+
+    __USUB8(min, w);
+    min = __SEL(w, min);
+
+    __USUB8(max, w);
+    max = __SEL(max, w);
+
+    sum = __USADA8(w, 0, sum);
+    sum_sq = __SMLAD(even, even, sum_sq);
+    sum_sq = __SMLAD(odd, odd, sum_sq);
+  }
+
+  g_acc.min     = min;
+  g_acc.max     = max;
+  g_acc.sum    += sum;
+  g_acc.sum_sq += sum_sq;
+  g_acc.count  += size;
+}
+
+//-----------------------------------------------------------------------------
+static bool make_record(LogRecord *record)
+{
+  Accumulator acc;
+  uint64_t sum_sq;
+  int vmin = 255;
+  int vmax = 0;
+
+  __disable_irq();
+  acc = *(Accumulator *)&g_acc;
+  reset_accumulator();
+  __enable_irq();
+
+  // Capture was stopped for the whole interval
+  if (0 == acc.count)
+    return false;
+
+  for (int i = 0; i < 4; i++)
+  {
+    int bmin = (acc.min >> (i * 8)) & 0xff;
+    int bmax = (acc.max >> (i * 8)) & 0xff;
+
+    if (bmin < vmin)
+      vmin = bmin;
+
+    if (bmax > vmax)
+      vmax = bmax;
+  }
+
+  // Sum of squares relative to the zero point
+  sum_sq = acc.sum_sq - 2 * ZERO_POINT * acc.sum + (uint64_t)ZERO_POINT * ZERO_POINT * acc.count;
+
+  record->min = vmin;
+  record->max = vmax;
+  record->avg = (acc.sum << 8) / acc.count;
+  record->rms = isqrt((sum_sq << 16) / acc.count);
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+static void queue(const void *data, int size)
+{
+  memcpy(&g_out[g_out_size], data, size);
+  g_out_size += size;
+}
+
+//-----------------------------------------------------------------------------
+static void append_record(LogRecord *record)
+{
+  int vpos = config.vertical_position_mv;
+  int vs_mult = config.calib_vs_mult[config.vertical_scale];
+
+  // Previous segment is still being closed
+  if (g_closing)
+  {
+    g_lost++;
+    return;
+  }
+
+  // Records are only valid with the vertical settings from the header
+  if (g_segment_count >= 0 && (g_header.vpos != vpos || g_header.vs_mult != vs_mult))
+  {
+    g_closing = true;
+    g_history_count = 0;
+    g_lost++;
+    return;
+  }
+
+  if (g_segment_count < 0)
+  {
+    g_header.magic    = LOGGER_MAGIC;
+    g_header.version  = LOGGER_VERSION;
+    g_header.interval = g_interval;
+    g_header.time     = g_interval_start - g_interval;
+    g_header.vpos     = vpos;
+    g_header.vs_mult  = vs_mult;
+    g_header.reserved = 0;
+    g_header.crc = crc32_calc((uint32_t *)&g_header, sizeof(LogHeader) - sizeof(uint32_t));
+
+    g_out_size = 0;
+    queue(&g_header, sizeof(LogHeader));
+    g_segment_count = 0;
+  }
+
+  // A gap would break the timing of the following records, so they go into
+  // a new segment
+  if ((g_out_size + (int)sizeof(LogRecord)) > LOGGER_OUT_SIZE)
+  {
+    g_closing = true;
+    g_lost++;
+    return;
+  }
+
+  queue(record, sizeof(LogRecord));
+
+  if (++g_segment_count == LOGGER_SEGMENT_RECORDS)
+    g_closing = true;
+}
+
+//-----------------------------------------------------------------------------
+static void flush(void)
+{
+  // Storage is full and there are no old segments to reclaim, records of
+  // the segment are lost and logging stops
+  if (g_open && storage_failed(g_segment_id))
+  {
+    g_lost         += g_segment_count;
+    g_out_size      = 0;
+    g_open          = false;
+    g_closing       = false;
+    g_segment_count = -1;
+    g_active        = false;
+    g_full          = true;
+  }
+
+  if (!g_open && g_out_size > 0)
+  {
+    if (!storage_ready() || storage_busy())
+      return;
+
+    g_segment_id = storage_create(STORAGE_TYPE_LOG, true);
+
+    if (g_segment_id < 0)
+      return;
+
+    g_open = true;
+  }
+
+  if (g_out_size > 0)
+  {
+    int size = storage_write(g_out, g_out_size);
+
+    memmove(g_out, &g_out[size], g_out_size - size);
+    g_out_size -= size;
+  }
+
+  if (g_closing && 0 == g_out_size)
+  {
+    if (g_open)
+      storage_close();
+
+    g_open          = false;
+    g_closing       = false;
+    g_segment_count = -1;
+  }
+}
+
+//-----------------------------------------------------------------------------
+void logger_task(void)
+{
+  LogRecord record;
+
+  flush();
+
+  if (!g_active || (timer_get_uptime() - g_interval_start) < g_interval)
+    return;
+
+  g_interval_start += g_interval;
+
+  // Records with no samples are skipped, so the segment timing is broken
+  if (!make_record(&record))
+  {
+    if (g_segment_count >= 0)
+      g_closing = true;
+
+    return;
+  }
+
+  overlay.mode.logger[g_history_head] = record;
+  g_history_head = (g_history_head + 1) % LOGGER_HISTORY;
+
+  if (g_history_count < LOGGER_HISTORY)
+    g_history_count++;
+
+  g_total++;
+
+  append_record(&record);
+}
+
+//-----------------------------------------------------------------------------
+int logger_get_total(void)
+{
+  return g_total;
+}
+
+//-----------------------------------------------------------------------------
+int logger_get_lost(void)
+{
+  return g_lost;
+}
+
+//-----------------------------------------------------------------------------
+// Logging was stopped because the storage is full
+bool logger_full(void)
+{
+  return g_full;
+}
+
+//-----------------------------------------------------------------------------
+// Index 0 is the newest record, returns NULL if there is no such record
+const LogRecord *logger_get(int index)
+{
+  if (index >= g_history_count)
+    return NULL;
+
+  return &overlay.mode.logger[(g_history_head - 1 - index + LOGGER_HISTORY) % LOGGER_HISTORY];
+}
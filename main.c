@@ -38,6 +38,11 @@
 #include "lcd.h"
 #include "utils.h"
 #include "flash.h"
+#include "deep.h"
+#include "storage.h"
+#include "wave.h"
+#include "history.h"
+#include "logger.h"
 #include "timer.h"
 #include "config.h"
 #include "buttons.h"
@@ -211,11 +216,13 @@ int main(void)
   timer_init();
   lcd_init();
   crc32_init();
-  //flash_init();
+  flash_init();
+  deep_init();
   config_init();
   buttons_init();
   battery_init();
   capture_init();
+  storage_init();
 
   lcd_set_font(FONT_LARGE);
   lcd_set_color(LCD_BLACK_COLOR, LCD_WHITE_COLOR);
@@ -235,6 +242,12 @@ int main(void)
     battery_task();
     buttons_task();
     config_task();
+    deep_task();
+    history_task();
+    wave_task();
+    logger_task();
+    storage_task();
+    flash_task();
   }
 
   return 0;
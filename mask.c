@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdalign.h>
+#include "gd32f4xx.h"
+#include "utils.h"
+#include "common.h"
+#include "storage.h"
+#include "mask.h"
+#include "overlay.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define MASK_MAGIC             0x4b53414d // "MASK"
+#define MASK_ANY_TOP           0
+#define MASK_ANY_BOTTOM        255
+
+/*- Variables ---------------------------------------------------------------*/
+static alignas(4) MaskData g_golden;
+static alignas(4) uint8_t g_top[GRID_WIDTH];
+static alignas(4) uint8_t g_bottom[GRID_WIDTH];
+static int g_margin = 0;
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+static void update_limits(void)
+{
+  uint32_t margin = g_margin * 0x01010101;
+
+  for (int i = 0; i < GRID_WIDTH; i += 4)
+  {
+    *(uint32_t *)&g_top[i]    = __UQSUB8(*(uint32_t *)&g_golden.top[i], margin);
+    *(uint32_t *)&g_bottom[i] = __UQADD8(*(uint32_t *)&g_golden.bottom[i], margin);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Golden waveform is taken from the display buffer, columns without data
+// accept any value. The mask is saved into the flash, returns its ID or -1.
+int mask_create(const uint8_t *top, const uint8_t *bottom, const uint8_t *flags)
+{
+  int id;
+
+  for (int i = 0; i < GRID_WIDTH; i++)
+  {
+    bool valid = flags[i] & SAMPLE_FLAG_VALID;
+
+    g_golden.top[i]    = valid ? top[i] : MASK_ANY_TOP;
+    g_golden.bottom[i] = valid ? bottom[i] : MASK_ANY_BOTTOM;
+  }
+
+  g_golden.magic = MASK_MAGIC;
+  g_golden.crc   = crc32_calc((uint32_t *)&g_golden, sizeof(MaskData) - sizeof(uint32_t));
+
+  update_limits();
+
+  if (!storage_ready() || storage_busy())
+    return -1;
+
+  id = storage_create(STORAGE_TYPE_MASK, false);
+
+  if (id < 0)
+    return -1;
+
+  // Whole mask fits into the empty write buffer
+  storage_write((uint8_t *)&g_golden, sizeof(MaskData));
+  storage_close();
+
+  return id;
+}
+
+//-----------------------------------------------------------------------------
+bool mask_load(int id)
+{
+  MaskData *data = &overlay.scratch.mask;
+
+  if (id <= 0 || storage_read(id, 0, (uint8_t *)data, sizeof(MaskData)) != sizeof(MaskData))
+    return false;
+
+  if (data->magic != MASK_MAGIC ||
+      data->crc != crc32_calc((uint32_t *)data, sizeof(MaskData) - sizeof(uint32_t)))
+    return false;
+
+  g_golden = *data;
+  update_limits();
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+void mask_set_margin(int margin)
+{
+  g_margin = margin;
+  update_limits();
+}
+
+//-----------------------------------------------------------------------------
+// Display coordinates grow downwards, so the trace passes if its top is not
+// above the mask top and its bottom is not below the mask bottom. Saturating
+// subtraction leaves non-zero bytes only for the columns out of the limits,
+// and invalid columns are masked out by the flags, so 4 columns are checked
+// at a time with no branches. Non-zero bytes in 'fail' mark failed columns.
+// All arrays must be word aligned. Returns true if any of the columns failed.
+bool mask_check(const uint8_t *top, const uint8_t *bottom, const uint8_t *flags, uint8_t *fail)
+{
+  uint32_t any = 0;
+
+  for (int i = 0; i < GRID_WIDTH; i += 4)
+  {
+    uint32_t valid = (*(uint32_t *)&flags[i] & (SAMPLE_FLAG_VALID * 0x01010101)) * 0xff;
+    uint32_t f = __UQSUB8(*(uint32_t *)&g_top[i], *(uint32_t *)&top[i]) |
+        __UQSUB8(*(uint32_t *)&bottom[i], *(uint32_t *)&g_bottom[i]);
+
+    f &= valid;
+    *(uint32_t *)&fail[i] = f;
+    any |= f;
+  }
+
+  return any != 0;
+}
+
+//-----------------------------------------------------------------------------
+const uint8_t *mask_get_top(void)
+{
+  return g_top;
+}
+
+//-----------------------------------------------------------------------------
+const uint8_t *mask_get_bottom(void)
+{
+  return g_bottom;
+}
@@ -0,0 +1,604 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "gd32f4xx.h"
+#include "utils.h"
+#include "config.h"
+#include "edges.h"
+#include "autocorr.h"
+#include "jitter.h"
+#include "measure.h"
+#include "overlay.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define ZERO_POINT             0x80
+#define MEASURE_HYSTERESIS     3  // Minimum, ADC counts
+#define MEASURE_MIN_AMPLITUDE  8  // ADC counts, timing is not measured below
+#define MEASURE_MODE_FRACTION  20 // Histogram peak must have 1/20 of the half
+
+/*- Types -------------------------------------------------------------------*/
+typedef struct
+{
+  int      min;
+  int      max;
+  uint64_t sum;
+  uint64_t sum_sq;
+} Levels;
+
+// Crossing times are 24.8 fixed point, sums are for the least squares fit
+// of the time against the crossing number
+typedef struct
+{
+  int      count;
+  int64_t  last;
+  int64_t  sum_t;
+  int64_t  sum_kt;
+} Edges;
+
+typedef struct
+{
+  const uint8_t *data;
+  int      size;
+  int      offset;
+  int      sign; // Samples are negated for the falling edges
+} Ring;
+
+typedef struct
+{
+  uint32_t count;
+  int64_t  mean;     // 24.8 fixed point
+  int64_t  variance; // 16.16 fixed point
+} Cluster;
+
+/*- Variables ---------------------------------------------------------------*/
+static uint32_t g_histogram[256];
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+// Min, max, sum, sum of squares and the histogram in one pass, 4 samples at
+// a time. Order of the samples does not matter here. Sums of squares are
+// flushed every 16K samples, so 32-bit accumulators don't overflow. Each
+// byte lane of the words has its own histogram in the scratch, so the
+// consecutive increments never hit the same counter. A lane gets at most
+// 32K samples, the lane histograms are merged at the end.
+static void scan_levels(const uint8_t *data, int size, Levels *l)
+{
+  uint16_t (*lanes)[256] = overlay.scratch.lanes;
+  const uint32_t *words = (const uint32_t *)data;
+  uint32_t min = 0xffffffff;
+  uint32_t max = 0;
+  uint32_t sum = 0;
+  uint32_t sum_sq = 0;
+
+  memset(overlay.scratch.lanes, 0, sizeof(overlay.scratch.lanes));
+
+  l->sum    = 0;
+  l->sum_sq = 0;
+
+  for (int i = 0; i < size / 4; i++)
+  {
+    uint32_t w = words[i];
+    uint32_t even = __UXTB16(w);
+    uint32_t odd = __UXTB16(__ROR(w, 8));
+
+    __USUB8(min, w);
+    min = __SEL(w, min);
+
+    __USUB8(max, w);
+    max = __SEL(max, w);
+
+    sum = __USADA8(w, 0, sum);
+    sum_sq = __SMLAD(even, even, sum_sq);
+    sum_sq = __SMLAD(odd, odd, sum_sq);
+
+    lanes[0][w & 0xff]++;
+    lanes[1][(w >> 8) & 0xff]++;
+    lanes[2][(w >> 16) & 0xff]++;
+    lanes[3][w >> 24]++;
+
+    if ((i & 0xfff) == 0xfff)
+    {
+      l->sum_sq += sum_sq;
+      sum_sq = 0;
+    }
+  }
+
+  l->sum    += sum;
+  l->sum_sq += sum_sq;
+
+  for (int i = 0; i < 256; i++)
+    g_histogram[i] = lanes[0][i] + lanes[1][i] + lanes[2][i] + lanes[3][i];
+  l->min     = 255;
+  l->max     = 0;
+
+  for (int i = 0; i < 4; i++)
+  {
+    int bmin = (min >> (i * 8)) & 0xff;
+    int bmax = (max >> (i * 8)) & 0xff;
+
+    if (bmin < l->min)
+      l->min = bmin;
+
+    if (bmax > l->max)
+      l->max = bmax;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Most common value in the range, or -1 if the peak is not prominent
+static int find_mode(int first, int last)
+{
+  uint32_t total = 0;
+  uint32_t peak = 0;
+  int mode = -1;
+
+  for (int i = first; i <= last; i++)
+  {
+    total += g_histogram[i];
+
+    if (g_histogram[i] > peak)
+    {
+      peak = g_histogram[i];
+      mode = i;
+    }
+  }
+
+  if (peak * MEASURE_MODE_FRACTION < total)
+    return -1;
+
+  return mode;
+}
+
+//-----------------------------------------------------------------------------
+// Mean and variance of the samples in the range of the histogram. Sums are
+// exact and relative to the first value, so there is no cancellation.
+static void find_cluster(int first, int last, Cluster *c)
+{
+  uint64_t n = 0;
+  uint64_t sum = 0;
+  uint64_t sum_sq = 0;
+
+  for (int i = first; i <= last; i++)
+  {
+    n      += g_histogram[i];
+    sum    += (uint64_t)g_histogram[i] * (i - first);
+    sum_sq += (uint64_t)g_histogram[i] * (i - first) * (i - first);
+  }
+
+  c->count    = n;
+  c->mean     = first << 8;
+  c->variance = 0;
+
+  if (0 == n)
+    return;
+
+  c->mean    += (sum << 8) / n;
+  c->variance = (((n * sum_sq - sum * sum) / n) << 16) / n;
+}
+
+//-----------------------------------------------------------------------------
+// Position of the level crossing between samples 'index-1' and 'index',
+// 24.8 fixed point
+static inline int64_t cross_time(int index, int v0, int v1, int level)
+{
+  return ((int64_t)(index - 1) << 8) + ((level - v0) << 8) / (v1 - v0);
+}
+
+//-----------------------------------------------------------------------------
+static void add_edge(Edges *edges, int64_t time)
+{
+  edges->last    = time;
+  edges->sum_t  += time;
+  edges->sum_kt += edges->count * time;
+  edges->count++;
+}
+
+//-----------------------------------------------------------------------------
+// Slope of the least squares line through all crossings, in samples with
+// 16 fractional bits. Unlike the first to last difference, the noise of
+// every crossing is averaged out.
+static int64_t fit_period(const Edges *edges)
+{
+  int64_t n = edges->count;
+  int64_t sum_k = n * (n - 1) / 2;
+  int64_t sum_kk = (n - 1) * n * (2 * n - 1) / 6;
+  int64_t num = n * edges->sum_kt - sum_k * edges->sum_t;
+  int64_t den = n * sum_kk - sum_k * sum_k;
+
+  // Numerator already has 8 fractional bits, the remainder gives 8 more
+  return ((num / den) << 8) + ((num % den) << 8) / den;
+}
+
+//-----------------------------------------------------------------------------
+// Period is in samples with 16 fractional bits
+static void set_period(Measurements *m, int64_t fine, int period)
+{
+  m->period    = (fine * period + 0x8000) >> 16;
+  m->frequency = (((int64_t)1000000000000 << 16) + fine * period / 2) / (fine * period);
+  m->frequency_valid = true;
+}
+
+//-----------------------------------------------------------------------------
+// Negated samples let the same comparisons work for the edges in both
+// directions
+static inline int ring_sample(const Ring *ring, int time)
+{
+  int index = ring->offset + time;
+
+  if (index >= ring->size)
+    index -= ring->size;
+
+  return ring->sign * ring->data[index];
+}
+
+//-----------------------------------------------------------------------------
+// Crossing of the level before the index position, the walk back stops at
+// the previous edge. Returns the first sample past the crossing.
+static int find_crossing(const Ring *ring, int pos, int prev, int level, int64_t *time)
+{
+  int t = pos;
+
+  while (t > prev && ring_sample(ring, t-1) > level)
+    t--;
+
+  if (t > prev)
+    *time = cross_time(t, ring_sample(ring, t-1), ring_sample(ring, t), level);
+  else
+    *time = (int64_t)t << 8;
+
+  return t;
+}
+
+//-----------------------------------------------------------------------------
+// Second pass over the edges of the period fit. Time interval error is the
+// distance of each crossing from the fitted line, period jitter is the
+// difference of each interval from the fitted period. Crossings are found
+// again instead of being stored, so the cost is the same as the first pass.
+static void scan_jitter(const uint8_t *data, int size, int offset, int mid,
+    const EdgeIndex *index, bool rising, const Edges *edges, int64_t fine)
+{
+  Ring ring = { data, size, offset, rising ? 1 : -1 };
+  int64_t n = edges->count;
+  int64_t origin = ((edges->sum_t << 8) - fine * (n * (n - 1) / 2)) / n;
+  int64_t last = 0;
+  int k = 0;
+
+  for (int i = (index->rising == rising) ? 0 : 1; i < index->count; i += 2, k++)
+  {
+    int prev = (i > 0) ? (int)index->position[i-1] : 0;
+    int64_t time;
+
+    find_crossing(&ring, index->position[i], prev, ring.sign * mid, &time);
+
+    // Fit and the values have 16 fractional bits, the histogram takes 8
+    time <<= 8;
+
+    if (JITTER_TIE == config.jitter)
+      jitter_add((time - origin - fine * k + 0x80) >> 8);
+    else if (k > 0)
+      jitter_add((time - last - fine + 0x80) >> 8);
+
+    last = time;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Timing values are derived from the edge index, so only the transitions
+// themselves are looked at. Edges are detected at the middle level with
+// hysteresis, the exact crossings are found by walking back from the index
+// position. Rise and fall times are measured between 10% and 90% levels.
+static void scan_timing(const uint8_t *data, int size, int offset, int base, int top,
+    int period, Measurements *m)
+{
+  int amp = top - base;
+  int mid = (top + base) / 2;
+  int lo = base + amp / 10;
+  int hi = top - amp / 10;
+  int hyst = amp / 10;
+  Edges rises = { 0 }, falls = { 0 };
+  int64_t pwidth = 0, nwidth = 0, rise = 0, fall = 0;
+  int npwidth = 0, nnwidth = 0, nrise = 0, nfall = 0;
+  const EdgeIndex *index;
+  int64_t fine;
+  bool rising;
+
+  if (hyst < MEASURE_HYSTERESIS)
+    hyst = MEASURE_HYSTERESIS;
+
+  index  = edges_build(data, size, offset, mid - hyst, mid + hyst);
+  rising = index->rising;
+
+  for (int i = 0; i < index->count; i++, rising = !rising)
+  {
+    Ring ring = { data, size, offset, rising ? 1 : -1 };
+    int pos = index->position[i];
+    int prev = (i > 0) ? (int)index->position[i-1] : 0;
+    int next = (i < index->count-1) ? (int)index->position[i+1] : size;
+    int level_mid = ring.sign * mid;
+    int level_start = ring.sign * (rising ? lo : hi);
+    int level_end = ring.sign * (rising ? hi : lo);
+    int64_t t_mid, t_start, t_end;
+    int t = find_crossing(&ring, pos, prev, level_mid, &t_mid);
+
+    if (rising)
+    {
+      if (falls.count > 0)
+      {
+        nwidth += t_mid - falls.last;
+        nnwidth++;
+      }
+
+      add_edge(&rises, t_mid);
+    }
+    else
+    {
+      if (rises.count > 0)
+      {
+        pwidth += t_mid - rises.last;
+        npwidth++;
+      }
+
+      add_edge(&falls, t_mid);
+    }
+
+    // Transition must start beyond one of the 10% levels after the previous
+    // edge and reach the other one before the next edge
+    while (t > prev && ring_sample(&ring, t-1) > level_start)
+      t--;
+
+    if (t == prev)
+      continue;
+
+    t_start = cross_time(t, ring_sample(&ring, t-1), ring_sample(&ring, t), level_start);
+
+    for (t = pos; t < next && ring_sample(&ring, t) < level_end; t++);
+
+    if (t == next)
+      continue;
+
+    t_end = cross_time(t, ring_sample(&ring, t-1), ring_sample(&ring, t), level_end);
+
+    if (rising)
+    {
+      rise += t_end - t_start;
+      nrise++;
+    }
+    else
+    {
+      fall += t_end - t_start;
+      nfall++;
+    }
+  }
+
+  if (rises.count < 2 && falls.count < 2)
+    return;
+
+  fine = fit_period((rises.count >= 2) ? &rises : &falls);
+  set_period(m, fine, period);
+
+  if (JITTER_OFF != config.jitter)
+  {
+    jitter_start(period);
+    scan_jitter(data, size, offset, mid, index, rises.count >= 2,
+        (rises.count >= 2) ? &rises : &falls, fine);
+  }
+
+  if (npwidth && nnwidth)
+  {
+    pwidth /= npwidth;
+    nwidth /= nnwidth;
+
+    m->pwidth = (pwidth * period) >> 8;
+    m->nwidth = (nwidth * period) >> 8;
+    m->duty   = (pwidth * 1000) / (pwidth + nwidth);
+    m->timing_valid = true;
+  }
+
+  if (nrise)
+  {
+    m->rise = ((rise / nrise) * period) >> 8;
+    m->rise_valid = true;
+  }
+
+  if (nfall)
+  {
+    m->fall = ((fall / nfall) * period) >> 8;
+    m->fall_valid = true;
+  }
+}
+
+//-----------------------------------------------------------------------------
+static inline int to_mv(int raw, int vs_mult, int vpos)
+{
+  return ((raw - ZERO_POINT) * vs_mult + vs_mult/2) / CALIB_MULTIPLIER - vpos;
+}
+
+//-----------------------------------------------------------------------------
+// Samples around the histogram peak, the window is narrowed down to 3
+// deviations, so the edges and the overshoots don't move the level. Noise
+// is centered on the level, the mean must be within one deviation (plus a
+// half of a step) from the peak. Peaks at the extremes of the sine and
+// similar signals are one-sided.
+static bool find_level(int mode, int first, int last, Cluster *c)
+{
+  int64_t offset, limit;
+  int width;
+
+  find_cluster(first, last, c);
+
+  offset = c->mean - (mode << 8);
+  limit  = isqrt(c->variance) + 128;
+
+  if ((offset * offset) > (limit * limit))
+    return false;
+
+  width = ((3 * isqrt(c->variance)) >> 8) + 1;
+
+  if (mode - width > first)
+    first = mode - width;
+
+  if (mode + width < last)
+    last = mode + width;
+
+  find_cluster(first, last, c);
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// Value is in 24.8 fixed point
+static inline int to_mv_fine(int64_t raw, int vs_mult, int vpos)
+{
+  return ((raw - (ZERO_POINT << 8)) * vs_mult + (vs_mult << 7)) / (CALIB_MULTIPLIER << 8) - vpos;
+}
+
+//-----------------------------------------------------------------------------
+// Flat top and base are refined to the means of the samples around the
+// histogram peaks, the noise is their pooled deviation. Signals without
+// the flat levels have no noise value, unless the whole signal is flat.
+static void measure_levels(int min, int max, int top, int base, int vs_mult, int vpos,
+    Measurements *m)
+{
+  int half = (top - base) / 4;
+  Cluster t, b;
+  int64_t variance;
+
+  if ((max - min) < MEASURE_MIN_AMPLITUDE ||
+      (top >= 0 && base >= 0 && (top - base) < MEASURE_MIN_AMPLITUDE))
+  {
+    find_cluster(min, max, &t);
+    variance = t.variance;
+  }
+  else if (top >= 0 && base >= 0)
+  {
+    if (!find_level(top, top - half, (top + half < max) ? (top + half) : max, &t) ||
+        !find_level(base, (base - half > min) ? (base - half) : min, base + half, &b))
+      return;
+
+    m->vtop  = to_mv_fine(t.mean, vs_mult, vpos);
+    m->vbase = to_mv_fine(b.mean, vs_mult, vpos);
+    m->vamp  = m->vtop - m->vbase;
+
+    variance = (t.variance * t.count + b.variance * b.count) / (t.count + b.count);
+  }
+  else
+  {
+    return;
+  }
+
+  m->noise = ((int64_t)isqrt(variance) * vs_mult * 1000) / (CALIB_MULTIPLIER << 8);
+  m->noise_valid = true;
+}
+
+//-----------------------------------------------------------------------------
+// Data is a ring of 'size' samples with the oldest one at 'offset'. Size
+// must be a multiple of 4. Period is the sample period in ns.
+void measure_calc(const uint8_t *data, int size, int offset, int period, int vs_mult,
+    int vpos, Measurements *m)
+{
+  Levels l;
+  int top, base, mid, amp, top_mode, base_mode;
+  int64_t mean, mean_sq, ms;
+
+  memset(m, 0, sizeof(Measurements));
+
+  if (size < 4)
+    return;
+
+  scan_levels(data, size, &l);
+
+  // Flat top and base are the histogram peaks in the upper and lower halves,
+  // extremes are used for the signals without them
+  mid  = (l.min + l.max) / 2;
+  top_mode  = find_mode(mid + 1, l.max);
+  base_mode = find_mode(l.min, mid);
+
+  top  = (top_mode < 0 || l.max == l.min) ? l.max : top_mode;
+  base = (base_mode < 0) ? l.min : base_mode;
+
+  amp = top - base;
+
+  m->vmax  = to_mv(l.max, vs_mult, vpos);
+  m->vmin  = to_mv(l.min, vs_mult, vpos);
+  m->vpp   = m->vmax - m->vmin;
+  m->vtop  = to_mv(top, vs_mult, vpos);
+  m->vbase = to_mv(base, vs_mult, vpos);
+  m->vamp  = m->vtop - m->vbase;
+
+  measure_levels(l.min, l.max, top_mode, base_mode, vs_mult, vpos, m);
+
+  if (amp > 0)
+  {
+    m->overshoot = ((l.max - top) * 1000) / amp;
+    m->preshoot  = ((base - l.min) * 1000) / amp;
+  }
+
+  // Means are in 24.8 fixed point, relative to the zero point
+  mean    = (((int64_t)l.sum - (int64_t)ZERO_POINT * size) << 8) / size;
+  mean_sq = (((int64_t)l.sum_sq - 2 * ZERO_POINT * (int64_t)l.sum +
+      (int64_t)ZERO_POINT * ZERO_POINT * size) << 8) / size;
+
+  m->vavg = ((mean * vs_mult) >> 8) / CALIB_MULTIPLIER - vpos;
+
+  ms = (((int64_t)vs_mult * vs_mult * mean_sq) >> 8) / (CALIB_MULTIPLIER * CALIB_MULTIPLIER) -
+      ((2 * (int64_t)vs_mult * vpos * mean) >> 8) / CALIB_MULTIPLIER +
+      (int64_t)vpos * vpos;
+
+  m->vrms  = (ms > 0) ? isqrt(ms) : 0;
+  m->valid = true;
+
+  if (amp >= MEASURE_MIN_AMPLITUDE)
+    scan_timing(data, size, offset, base, top, period, m);
+
+  // Autocorrelation replaces the edge based period, it does not depend on
+  // the crossings, so it works for the noisy signals and the signals with
+  // several crossings per period
+  if (FREQUENCY_SOURCE_AUTOCORR == config.frequency_source)
+  {
+    int64_t fine = autocorr_period(data, size, offset);
+
+    m->period          = 0;
+    m->frequency       = 0;
+    m->frequency_valid = false;
+
+    if (fine)
+      set_period(m, fine, period);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Histogram of the raw sample values of the last measured record
+const uint32_t *measure_get_histogram(void)
+{
+  return g_histogram;
+}
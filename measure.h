@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _MEASURE_H_
+#define _MEASURE_H_
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+
+/*- Types -------------------------------------------------------------------*/
+// Voltages are in mV, times are in ns, ratios are in 0.1% units
+typedef struct
+{
+  bool     valid;        // Amplitude values
+  bool     frequency_valid; // Period and frequency
+  bool     timing_valid;    // Widths and duty cycle
+  bool     rise_valid;
+  bool     fall_valid;
+  bool     noise_valid;
+
+  int      vmax;
+  int      vmin;
+  int      vpp;
+  int      vtop;
+  int      vbase;
+  int      vamp;
+  int      vavg;
+  int      vrms;
+  int      overshoot;
+  int      preshoot;
+  int      noise; // uV, RMS deviation from the flat levels
+
+  int64_t  frequency; // mHz
+  int      period;
+  int      pwidth;
+  int      nwidth;
+  int      duty;
+  int      rise;
+  int      fall;
+} Measurements;
+
+/*- Prototypes --------------------------------------------------------------*/
+void measure_calc(const uint8_t *data, int size, int offset, int period, int vs_mult,
+    int vpos, Measurements *m);
+const uint32_t *measure_get_histogram(void);
+
+#endif // _MEASURE_H_
+
@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "lcd.h"
+#include "buttons.h"
+#include "scope.h"
+#include "menu.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define MENU_ROWS              12
+#define MENU_ROW_HEIGHT        16
+#define MENU_LEFT              (GRID_LEFT + 1)
+#define MENU_TOP               (GRID_TOP + 4)
+#define MENU_WIDTH             (GRID_WIDTH - 1)
+#define MENU_NAME_X            (MENU_LEFT + 8)
+#define MENU_VALUE_X           (MENU_LEFT + 176)
+
+#define MENU_FAST_STEP         10
+
+#define MENU_BG_COLOR          LCD_COLOR(0, 0, 0)
+#define MENU_NAME_COLOR        LCD_COLOR(200, 200, 200)
+#define MENU_VALUE_COLOR       LCD_COLOR(255, 255, 0)
+#define MENU_SELECT_COLOR      LCD_COLOR(0, 0, 160)
+
+/*- Variables ---------------------------------------------------------------*/
+static const MenuItem *g_menu_items = NULL;
+static int g_menu_count = 0;
+static int g_menu_index = 0;
+static int g_menu_top = 0;
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+static char *format_value(int value)
+{
+  static char buf[12];
+  char *ptr = buf + sizeof(buf) - 1;
+  bool negative = (value < 0);
+
+  if (negative)
+    value = -value;
+
+  *ptr = 0;
+
+  do
+  {
+    *(--ptr) = '0' + (value % 10);
+    value /= 10;
+  } while (value > 0);
+
+  if (negative)
+    *(--ptr) = '-';
+
+  return ptr;
+}
+
+//-----------------------------------------------------------------------------
+static void draw_item(int index)
+{
+  const MenuItem *item = &g_menu_items[index];
+  int y = MENU_TOP + (index - g_menu_top) * MENU_ROW_HEIGHT;
+  int bg = (index == g_menu_index) ? MENU_SELECT_COLOR : MENU_BG_COLOR;
+  int value = *item->value;
+  const char *str;
+
+  if (item->labels)
+    str = item->labels[value - item->min];
+  else if (item->format)
+    str = item->format(value);
+  else
+    str = format_value(value);
+
+  lcd_fill_rect(MENU_LEFT, y, MENU_WIDTH, MENU_ROW_HEIGHT, bg);
+
+  lcd_set_color(bg, MENU_NAME_COLOR);
+  lcd_puts(MENU_NAME_X, y, item->name);
+
+  lcd_set_color(bg, MENU_VALUE_COLOR);
+  lcd_puts(MENU_VALUE_X, y, str);
+}
+
+//-----------------------------------------------------------------------------
+static void draw_menu(void)
+{
+  int rows = g_menu_count - g_menu_top;
+
+  if (rows > MENU_ROWS)
+    rows = MENU_ROWS;
+
+  lcd_fill_rect(GRID_LEFT+1, GRID_TOP+1, GRID_WIDTH-1, GRID_HEIGHT-1, MENU_BG_COLOR);
+
+  for (int i = 0; i < rows; i++)
+    draw_item(g_menu_top + i);
+}
+
+//-----------------------------------------------------------------------------
+static void select_item(int delta)
+{
+  int prev = g_menu_index;
+
+  g_menu_index += delta;
+
+  if (g_menu_index < 0)
+    g_menu_index = g_menu_count - 1;
+  else if (g_menu_index >= g_menu_count)
+    g_menu_index = 0;
+
+  if (g_menu_index < g_menu_top)
+  {
+    g_menu_top = g_menu_index;
+    draw_menu();
+  }
+  else if (g_menu_index >= (g_menu_top + MENU_ROWS))
+  {
+    g_menu_top = g_menu_index - MENU_ROWS + 1;
+    draw_menu();
+  }
+  else
+  {
+    draw_item(prev);
+    draw_item(g_menu_index);
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void change_value(int delta)
+{
+  const MenuItem *item = &g_menu_items[g_menu_index];
+  int value = *item->value + delta;
+
+  if (value < item->min)
+    value = item->min;
+  else if (value > item->max)
+    value = item->max;
+
+  if (value == *item->value)
+    return;
+
+  *item->value = value;
+
+  if (item->changed)
+    item->changed();
+
+  draw_item(g_menu_index);
+}
+
+//-----------------------------------------------------------------------------
+void menu_open(const MenuItem *items, int count)
+{
+  g_menu_items = items;
+  g_menu_count = count;
+
+  if (g_menu_index >= count)
+    g_menu_index = 0;
+
+  if (g_menu_top > g_menu_index || (g_menu_index - g_menu_top) >= MENU_ROWS)
+    g_menu_top = g_menu_index;
+
+  draw_menu();
+}
+
+//-----------------------------------------------------------------------------
+void menu_close(void)
+{
+  g_menu_items = NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Redraws the values after the changed() handler has adjusted other items
+void menu_update(void)
+{
+  if (g_menu_items)
+    draw_menu();
+}
+
+//-----------------------------------------------------------------------------
+bool menu_active(void)
+{
+  return (g_menu_items != NULL);
+}
+
+//-----------------------------------------------------------------------------
+void menu_buttons_handler(int buttons)
+{
+  int step = (buttons & BTN_SHIFT) ? MENU_FAST_STEP : 1;
+
+  if (buttons & BTN_UP)
+    select_item(-1);
+  else if (buttons & BTN_DOWN)
+    select_item(1);
+  else if (buttons & BTN_LEFT)
+    change_value(-step);
+  else if (buttons & BTN_RIGHT)
+    change_value(step);
+}
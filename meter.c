@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include "gd32f4xx.h"
+#include "utils.h"
+#include "config.h"
+#include "meter.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define METER_AVERAGE          16 // Acquisitions
+#define METER_CHUNK_SIZE       (16 * 1024) // Sum of squares fits into 32 bits
+
+#define ZERO_POINT             0x80
+
+/*- Types -------------------------------------------------------------------*/
+typedef struct
+{
+  uint32_t sum;
+  uint64_t sum_sq;
+  uint32_t count;
+} MeterSums;
+
+/*- Variables ---------------------------------------------------------------*/
+static MeterSums g_sums[METER_AVERAGE];
+static int g_head;
+static int g_count;
+static volatile int g_total;
+static int g_vs_mult;
+static int g_vpos;
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+void meter_reset(void)
+{
+  __disable_irq();
+  g_head  = 0;
+  g_count = 0;
+  __enable_irq();
+}
+
+//-----------------------------------------------------------------------------
+// Sums of the raw sample values and their squares, 4 samples at a time.
+// Size must be a multiple of 4 and not exceed METER_CHUNK_SIZE.
+static void sum_chunk(const uint32_t *words, int size, uint32_t *sum, uint32_t *sum_sq)
+{
+  uint32_t s = 0;
+  uint32_t sq = 0;
+
+  for (int i = 0; i < size / 4; i++)
+  {
+    uint32_t w = words[i];
+    uint32_t even = __UXTB16(w);
+    uint32_t odd = __UXTB16(__ROR(w, 8));
+
+    s  = __USADA8(w, 0, s);
+    sq = __SMLAD(even, even, sq);
+    sq = __SMLAD(odd, odd, sq);
+  }
+
+  *sum    = s;
+  *sum_sq = sq;
+}
+
+//-----------------------------------------------------------------------------
+// Called from the DMA interrupt for every complete record. The whole record
+// is reduced, the order of the samples does not matter.
+void meter_update(const uint8_t *data, int size, int vs_mult, int vpos)
+{
+  MeterSums *sums = &g_sums[g_head];
+
+  // Sums taken with different vertical settings can't be combined
+  if (vs_mult != g_vs_mult || vpos != g_vpos)
+  {
+    g_head    = 0;
+    g_count   = 0;
+    g_vs_mult = vs_mult;
+    g_vpos    = vpos;
+    sums      = &g_sums[0];
+  }
+
+  sums->sum    = 0;
+  sums->sum_sq = 0;
+  sums->count  = size;
+
+  for (int i = 0; i < size; i += METER_CHUNK_SIZE)
+  {
+    int chunk = (size - i) < METER_CHUNK_SIZE ? (size - i) : METER_CHUNK_SIZE;
+    uint32_t sum, sum_sq;
+
+    sum_chunk((const uint32_t *)&data[i], chunk, &sum, &sum_sq);
+
+    sums->sum    += sum;
+    sums->sum_sq += sum_sq;
+  }
+
+  g_head = (g_head + 1) % METER_AVERAGE;
+
+  if (g_count < METER_AVERAGE)
+    g_count++;
+
+  g_total++;
+}
+
+//-----------------------------------------------------------------------------
+int meter_get_total(void)
+{
+  return g_total;
+}
+
+//-----------------------------------------------------------------------------
+// Values are averaged over the last METER_AVERAGE acquisitions, which gives
+// a resolution better than one ADC count
+bool meter_get(MeterValues *values)
+{
+  uint64_t sum = 0;
+  uint64_t sum_sq = 0;
+  uint64_t count = 0;
+  int64_t sx, sxx, mean, var, dc, ac;
+  int vs_mult, vpos;
+
+  __disable_irq();
+
+  for (int i = 0; i < g_count; i++)
+  {
+    sum    += g_sums[i].sum;
+    sum_sq += g_sums[i].sum_sq;
+    count  += g_sums[i].count;
+  }
+
+  vs_mult = g_vs_mult;
+  vpos    = g_vpos;
+
+  __enable_irq();
+
+  if (0 == count)
+    return false;
+
+  // Sums relative to the zero point
+  sx  = (int64_t)sum - ZERO_POINT * count;
+  sxx = (int64_t)sum_sq - 2 * ZERO_POINT * (int64_t)sum + ZERO_POINT * ZERO_POINT * (int64_t)count;
+
+  // Mean and variance in ADC counts, 16.16 fixed point
+  mean = (sx * 65536) / (int64_t)count;
+  var  = (sxx << 16) / (int64_t)count - ((mean * mean) >> 16);
+
+  if (var < 0)
+    var = 0;
+
+  dc = ((mean * vs_mult * 1000) / CALIB_MULTIPLIER >> 16) - (int64_t)vpos * 1000;
+  ac = ((int64_t)isqrt(var << 16) * vs_mult * 1000) / CALIB_MULTIPLIER >> 16;
+
+  values->dc  = dc;
+  values->ac  = ac;
+  values->rms = isqrt(dc * dc + ac * ac);
+
+  return true;
+}
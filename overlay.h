@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _OVERLAY_H_
+#define _OVERLAY_H_
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include "scope.h"
+#include "logger.h"
+#include "fft.h"
+#include "edges.h"
+#include "autocorr.h"
+#include "eye.h"
+#include "reference.h"
+#include "mask.h"
+#include "wave.h"
+
+/*- Types -------------------------------------------------------------------*/
+// Buffers that are never in use at the same time share the TCM. Analysis
+// modes replace each other, so only the active one keeps its data in the
+// mode buffers, and it starts over when it is selected again. References
+// are only drawn over the trace, without any analysis mode. Scratch
+// buffers live for one call, the eye folds the edges found in the scratch
+// into its hits, so the two don't overlap. The FFT buffer is filled and
+// read inside one call, the levels are kept.
+typedef union
+{
+  struct
+  {
+    union
+    {
+      EdgeIndex edges;
+      uint16_t  lanes[4][256];
+
+      struct
+      {
+        int16_t samples[AUTOCORR_SIZE];
+        int32_t corr[AUTOCORR_SIZE/2 + 1];
+      } autocorr;
+
+      MaskData  mask;
+
+      struct
+      {
+        uint8_t in[WAVE_INPUT_SIZE];
+        uint8_t out[WAVE_BLOCK_SIZE];
+      } wave;
+    } scratch;
+
+    union
+    {
+      struct
+      {
+        uint8_t hits[EYE_HEIGHT][EYE_WIDTH];
+        uint8_t rows[256];
+      } eye;
+
+      struct
+      {
+        uint8_t       min[REFERENCE_COUNT][GRID_WIDTH];
+        uint8_t       max[REFERENCE_COUNT][GRID_WIDTH];
+        DisplayBuffer display[REFERENCE_COUNT];
+      } reference;
+
+      int       trend[TREND_WIDTH];
+      LogRecord logger[LOGGER_HISTORY];
+    } mode;
+  };
+
+  struct
+  {
+    uint32_t  buffer[FFT_MAX_SIZE / 2];
+    uint32_t  power[FFT_WIDTH];
+    uint8_t   level[FFT_WIDTH];
+  } fft;
+} Overlay;
+
+/*- Variables ---------------------------------------------------------------*/
+extern Overlay overlay;
+
+#endif // _OVERLAY_H_
@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "common.h"
+#include "scope.h"
+#include "wave.h"
+#include "reference.h"
+#include "overlay.h"
+
+/*- Variables ---------------------------------------------------------------*/
+static Reference g_references[REFERENCE_COUNT];
+static bool g_dirty[REFERENCE_COUNT];
+static int64_t g_position;
+static int g_period = 0;
+
+static Reference *g_ref;
+static int64_t g_col;
+static int g_rem;
+static bool g_first;
+static int64_t g_prev_col;
+static int g_prev_value;
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+// Returns false if the saved waveform can't be used, the slot is then cleared.
+// Column data is built by the next reference_update() call.
+bool reference_set(int index, int id)
+{
+  Reference *ref = &g_references[index];
+
+  ref->id    = id;
+  ref->valid = (id > 0) && wave_get_info(id, &ref->info);
+  ref->min   = overlay.mode.reference.min[index];
+  ref->max   = overlay.mode.reference.max[index];
+
+  g_dirty[index] = true;
+
+  return ref->valid || id <= 0;
+}
+
+//-----------------------------------------------------------------------------
+static inline void add_to_column(int64_t col, int value)
+{
+  if (col < 0 || col >= GRID_WIDTH)
+    return;
+
+  if (value < g_ref->min[col])
+    g_ref->min[col] = value;
+
+  if (value > g_ref->max[col])
+    g_ref->max[col] = value;
+}
+
+//-----------------------------------------------------------------------------
+// Samples are assigned to the columns the same way capture_get_data() does it.
+// Columns between the samples are filled by the linear interpolation.
+static bool column_handler(const uint8_t *data, int count)
+{
+  for (int i = 0; i < count; i++)
+  {
+    int value = data[i];
+
+    if (!g_first && g_prev_col >= GRID_WIDTH)
+      return false;
+
+    add_to_column(g_col, value);
+
+    if (!g_first && (g_col - g_prev_col) > 1 && g_col > 0)
+    {
+      int64_t dx = g_col - g_prev_col;
+      int first = (g_prev_col < 0) ? 0 : (g_prev_col + 1);
+      int last = (g_col > GRID_WIDTH) ? GRID_WIDTH : g_col;
+
+      for (int col = first; col < last; col++)
+        add_to_column(col, g_prev_value + ((value - g_prev_value) * (col - g_prev_col)) / dx);
+    }
+
+    g_first      = false;
+    g_prev_col   = g_col;
+    g_prev_value = value;
+
+    g_rem += g_ref->info.period;
+
+    if (g_rem >= g_period)
+    {
+      g_col += g_rem / g_period;
+      g_rem %= g_period;
+    }
+  }
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+static void build_columns(Reference *ref)
+{
+  int64_t left = g_position - (int64_t)g_period * (GRID_WIDTH/2 - 1) - g_period/2;
+  int64_t t = (int64_t)ref->info.min_index * ref->info.period + ref->info.period/2 - left;
+  int64_t col = t / g_period;
+
+  if (t < 0 && (t % g_period))
+    col--;
+
+  memset(ref->min, 0xff, GRID_WIDTH);
+  memset(ref->max, 0, GRID_WIDTH);
+
+  // Record is completely outside of the screen
+  if (col >= GRID_WIDTH || (t + (int64_t)(ref->info.size - 1) * ref->info.period) < 0)
+    return;
+
+  g_ref   = ref;
+  g_col   = col;
+  g_rem   = t - col * g_period;
+  g_first = true;
+
+  // Column cache is only built on the view changes, so a slow read of
+  // the flash is acceptable here
+  if (!wave_load(ref->id, column_handler))
+    ref->valid = false;
+}
+
+//-----------------------------------------------------------------------------
+// Columns are kept in the overlay only while the trace is shown, the next
+// reference_update() call builds all of them again
+void reference_reset(void)
+{
+  for (int i = 0; i < REFERENCE_COUNT; i++)
+    g_dirty[i] = true;
+}
+
+//-----------------------------------------------------------------------------
+// Returns true if any of the references has changed
+bool reference_update(int64_t position, int period)
+{
+  bool all = (position != g_position || period != g_period);
+  bool changed = false;
+
+  g_position = position;
+  g_period   = period;
+
+  for (int i = 0; i < REFERENCE_COUNT; i++)
+  {
+    if (!all && !g_dirty[i])
+      continue;
+
+    if (g_references[i].valid)
+      build_columns(&g_references[i]);
+
+    changed |= g_dirty[i] || g_references[i].valid;
+    g_dirty[i] = false;
+  }
+
+  return changed;
+}
+
+//-----------------------------------------------------------------------------
+const Reference *reference_get(int index)
+{
+  return g_references[index].valid ? &g_references[index] : NULL;
+}
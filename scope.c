@@ -29,6 +29,8 @@
 /*- Includes ----------------------------------------------------------------*/
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdalign.h>
+#include <string.h>
 #include "gd32f4xx.h"
 #include "hal_gpio.h"
 #include "utils.h"
@@ -39,32 +41,39 @@
 #include "config.h"
 #include "buttons.h"
 #include "capture.h"
+#include "deep.h"
+#include "storage.h"
+#include "wave.h"
+#include "reference.h"
+#include "history.h"
+#include "anomaly.h"
+#include "mask.h"
+#include "logger.h"
+#include "meter.h"
+#include "counter.h"
+#include "fft.h"
+#include "harmonics.h"
+#include "jitter.h"
+#include "eye.h"
+#include "overlay.h"
+#include "menu.h"
 #include "scope.h"
 
 /*- Definitions -------------------------------------------------------------*/
 #define ZERO_POINT             0x80
 
-#define GRID_CENTER_X          160
-#define GRID_CENTER_Y          120
-#define GRID_LEFT              10
-#define GRID_RIGHT             310
-#define GRID_TOP               20
-#define GRID_BOTTOM            220
-#define GRID_WIDTH             300
-#define GRID_HEIGHT            200
-#define GRID_DIV_PX            25
-#define GRID_DIVS_H            12
-#define GRID_DIVS_V            10
-
-#define STATUS_LINE_Y          223
-#define STATUS_LINE_HEIGHT     16
-
 #define MINIVIEW_WIDTH         160
 
 #define CALIB_AREA_LEFT        140
 #define CALIB_AREA_WIDTH       (LCD_WIDTH - CALIB_AREA_LEFT)
 
 #define MAX_SAMPLE_RATE_LIMIT  13
+#define UART_MIN_SR_DIVIDER    4
+#define VIDEO_MIN_SR_DIVIDER   1
+#define DEEP_MIN_SR_DIVIDER    9
+#define LOGGER_SR_DIVIDER      6
+#define METER_SR_DIVIDER       7 // Record covers 6-8 periods of the mains
+#define COUNTER_SR_DIVIDER     5 // Signals up to ~1.5 MHz
 
 #define TOAST_TIMEOUT          1500
 #define TOAST_COLOR            LCD_COLOR(255, 255, 0)
@@ -76,6 +85,27 @@
 #define TRACE_FILLED_COLOR     LCD_COLOR(0, 255, 0)
 #define TRACE_CLIP_COLOR       LCD_COLOR(255, 0, 0)
 #define TRACE_INVALID_COLOR    LCD_COLOR(255, 0, 0)
+#define TRACE_FAIL_COLOR       LCD_COLOR(255, 0, 128)
+#define MASK_COLOR             LCD_COLOR(0, 90, 180)
+#define TREND_COLOR            LCD_COLOR(0, 230, 255)
+#define FFT_COLOR              LCD_COLOR(0, 200, 0)
+#define FFT_MARKER_COLOR       LCD_COLOR(255, 0, 255)
+#define HARMONICS_BAR_COLOR    LCD_COLOR(0, 200, 0)
+#define HISTOGRAM_COLOR        LCD_COLOR(255, 128, 0)
+#define JITTER_COLOR           LCD_COLOR(0, 200, 0)
+#define JITTER_MARKER_COLOR    LCD_COLOR(255, 0, 255)
+#define EYE_COLOR_0            LCD_COLOR(0, 0, 140)
+#define EYE_COLOR_1            LCD_COLOR(0, 0, 255)
+#define EYE_COLOR_2            LCD_COLOR(0, 140, 255)
+#define EYE_COLOR_3            LCD_COLOR(0, 255, 255)
+#define EYE_COLOR_4            LCD_COLOR(0, 255, 0)
+#define EYE_COLOR_5            LCD_COLOR(255, 255, 0)
+#define EYE_COLOR_6            LCD_COLOR(255, 128, 0)
+#define EYE_COLOR_7            LCD_COLOR(255, 0, 0)
+#define REFERENCE_COLOR_0      LCD_COLOR(255, 0, 255)
+#define REFERENCE_COLOR_1      LCD_COLOR(0, 160, 255)
+#define REFERENCE_COLOR_2      LCD_COLOR(255, 128, 0)
+#define REFERENCE_COLOR_3      LCD_COLOR(255, 255, 255)
 #define GRID_BG_COLOR          LCD_COLOR(0, 0, 0)
 #define GRID_FG_COLOR          LCD_COLOR(200, 200, 200)
 #define MV_FRAME_COLOR         LCD_COLOR(230, 230, 230)
@@ -91,6 +121,14 @@
 #define MEASURE_VOLTAGE_COLOR  LCD_COLOR(255, 255, 0)
 #define MEASURE_FREQ_COLOR     LCD_COLOR(255, 255, 255)
 
+#define METER_LABEL_COLOR      LCD_COLOR(50, 255, 255)
+#define METER_VALUE_COLOR      LCD_COLOR(255, 255, 0)
+#define METER_SCALE            2 // Font magnification
+
+#define PAGE_LABEL_COLOR       LCD_COLOR(50, 255, 255)
+#define PAGE_VALUE_COLOR       LCD_COLOR(255, 255, 255)
+#define PAGE_ROW_HEIGHT        21
+
 #define CAPTURE_STOP_COLOR     LCD_COLOR(255, 0, 0)
 #define CAPTURE_WAIT_COLOR     LCD_COLOR(255, 180, 50)
 #define CAPTURE_TRIG_COLOR     LCD_COLOR(0, 255, 0)
@@ -109,6 +147,26 @@
 
 #define MEASURE_UPDATE_TIMEOUT 100
 
+#define STATS_UPDATE_TIMEOUT   1000
+
+#define FFT_DB_PER_DIV         10
+#define FFT_PEAKS              3
+#define FFT_PEAK_SPACING       8 // px
+#define FFT_MARKER_SIZE        4 // px
+
+#define HARMONICS_BAR_WIDTH    10
+#define HARMONICS_BAR_HEIGHT   120
+#define HARMONICS_DB_RANGE     60
+
+#define HISTOGRAM_WIDTH        60 // px
+
+#define JITTER_BAR_WIDTH       2 // px
+#define JITTER_BAR_HEIGHT      120
+
+#define EYE_CELL_WIDTH         2 // px
+#define EYE_CELL_HEIGHT        4 // px
+#define EYE_GRADES             8
+
 enum
 {
   CALIB_ZERO,
@@ -117,13 +175,18 @@ enum
   CALIB_OFFSET,
 };
 
-/*- Types -------------------------------------------------------------------*/
-typedef struct
+enum
 {
-  uint8_t  min[GRID_WIDTH];
-  uint8_t  max[GRID_WIDTH];
-  uint8_t  flags[GRID_WIDTH];
-} DisplayBuffer;
+  ANALYSIS_OFF,
+  ANALYSIS_LOGGER,
+  ANALYSIS_METER,
+  ANALYSIS_COUNTER,
+  ANALYSIS_FFT,
+  ANALYSIS_HARMONICS,
+  ANALYSIS_JITTER,
+  ANALYSIS_EYE,
+  ANALYSIS_TREND,
+};
 
 /*- Constants ---------------------------------------------------------------*/
 static const char *hs_str[HS_COUNT] =
@@ -162,6 +225,90 @@ static const int vs_px_value[VS_COUNT] =
   2, 4, 8, 20, 40, 80, 200, 400,
 };
 
+static const int record_length_value[] =
+{
+  0, 4 * 1024, 16 * 1024, 32 * 1024, CAPTURE_BUFFER_SIZE,
+};
+
+static const char *record_length_str[] =
+{
+  "Auto", "4K", "16K", "32K", "128K",
+};
+
+static const int deep_length_value[] =
+{
+  0, 512 * 1024, 1024 * 1024, 2048 * 1024, DEEP_MAX_SIZE,
+};
+
+static const char *deep_length_str[] =
+{
+  "Off", "512K", "1M", "2M", "4M",
+};
+
+static const uint16_t reference_color[REFERENCE_COUNT] =
+{
+  REFERENCE_COLOR_0, REFERENCE_COLOR_1, REFERENCE_COLOR_2, REFERENCE_COLOR_3,
+};
+
+static const uint16_t eye_color[EYE_GRADES] =
+{
+  EYE_COLOR_0, EYE_COLOR_1, EYE_COLOR_2, EYE_COLOR_3,
+  EYE_COLOR_4, EYE_COLOR_5, EYE_COLOR_6, EYE_COLOR_7,
+};
+
+static const int logger_interval_value[] =
+{
+  0, 1, 2, 5, 10, 30, 60, 120, 300, 600,
+};
+
+static const char *logger_interval_str[] =
+{
+  "Off", "1 s", "2 s", "5 s", "10 s", "30 s", "1 min", "2 min", "5 min", "10 min",
+};
+
+static const char *off_on_str[] = { "Off", "On" };
+
+static const int counter_gate_value[] = { 0, 100, 1000, 10000 };
+
+static const char *counter_gate_str[] = { "Off", "0.1 s", "1 s", "10 s" };
+
+static const char *frequency_source_str[] = { "Edges", "Autocorr" };
+
+static const int fft_size_value[] = { 0, 1024, 2048, 4096 };
+
+static const char *fft_size_str[] = { "Off", "1024", "2048", "4096" };
+
+static const char *fft_window_str[] = { "Hann", "Flat top", "Blackman" };
+
+static const char *fft_average_str[] = { "Off", "4", "16" };
+
+static const char *jitter_str[] = { "Off", "TIE", "Period" };
+
+static const char *harmonic_str[HARMONICS_COUNT] =
+{
+  "H1", "H2", "H3", "H4", "H5", "H6", "H7", "H8", "H9", "H10",
+};
+
+static const char *trend_str[] = { "Off", "Vpp", "Frequency", "RMS", "Duty" };
+
+static const char *trigger_type_str[] = { "Edge", "UART", "Video" };
+
+static const char *uart_polarity_str[] = { "Normal", "Inverted" };
+
+static const char *video_standard_str[] = { "PAL", "NTSC" };
+
+static const char *video_sync_str[] = { "Any field", "Field 1", "Field 2", "Line", "All lines" };
+
+static const int uart_baud_value[] =
+{
+  1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600,
+};
+
+static const char *uart_baud_str[ARRAY_SIZE(uart_baud_value)] =
+{
+  "1200", "2400", "4800", "9600", "19200", "38400", "57600", "115200", "230400", "460800", "921600",
+};
+
 /*- Variables ---------------------------------------------------------------*/
 static uint16_t *g_grid_data[GRID_WIDTH];
 static uint16_t g_grid_column_0[240];
@@ -171,13 +318,58 @@ static uint16_t g_grid_column_3[240];
 static uint16_t g_grid_column_4[240];
 
 static DataBuffer g_data_buffer;
-static DisplayBuffer g_display_buffer;
+static alignas(4) DisplayBuffer g_display_buffer;
+static bool g_reference_shown = false;
+static bool g_reference_active[REFERENCE_COUNT];
+static int g_reference_id[REFERENCE_COUNT];
+static int g_reference_scale = -1;
+static int g_reference_position;
+
+static bool g_mask_active = false;
+static bool g_mask_failed = false;
+static alignas(4) uint8_t g_mask_fail[GRID_WIDTH];
+static int g_mask_total = 0;
+static int g_mask_fails = 0;
+
+static bool g_logger_active = false;
+static int g_logger_total = 0;
+static bool g_logger_full = false;
+
+static bool g_measure_page = false;
+
+static bool g_meter_active = false;
+static int g_meter_total = 0;
+
+static bool g_counter_active = false;
+static int g_counter_total = 0;
+
+static bool g_trend_active = false;
+static int g_trend_count = 0;
+static int g_trend_top;
+static int g_trend_bottom;
+
+static bool g_fft_active = false;
+static int g_fft_peaks[FFT_PEAKS];
+static int g_fft_count = 0;
+
+static bool g_harmonics_active = false;
+static Harmonics g_harmonics;
+
+static uint8_t g_histogram_bars[GRID_HEIGHT-1];
+
+static bool g_jitter_active = false;
+
+static bool g_eye_active = false;
+static int g_eye_grade_shift; // Bit length of the highest hit count
 
 static int g_trace_column = (GRID_WIDTH-1);
 
 static bool g_toast_active = false;
 static int g_toast_timer = TIMER_DISABLE;
 
+static bool g_wave_saving = false;
+static int g_history_index = -1;
+
 static int g_state = -1;
 static int g_state_timer = TIMER_DISABLE;
 
@@ -187,6 +379,11 @@ static int g_calibration_parameter = CALIB_ZERO;
 
 static int g_measure_timer = TIMER_DISABLE;
 
+static int g_stats_timer = TIMER_DISABLE;
+static uint32_t g_stats_time;
+static int g_stats_rate = 0;
+static int64_t g_stats_blind_time = 0;
+
 /*- Implementations ---------------------------------------------------------*/
 
 //-----------------------------------------------------------------------------
@@ -253,6 +450,16 @@ static void toast_show(void)
   g_toast_timer = TOAST_TIMEOUT;
 }
 
+//-----------------------------------------------------------------------------
+static void draw_message(char *str)
+{
+  if (g_toast_active)
+    lcd_fill_rect(GRID_LEFT, GRID_BOTTOM+1, GRID_WIDTH+1, STATUS_LINE_HEIGHT, BG_COLOR);
+
+  toast_show();
+  lcd_puts(GRID_LEFT, STATUS_LINE_Y, str);
+}
+
 //-----------------------------------------------------------------------------
 static bool trace_ready(void)
 {
@@ -262,7 +469,8 @@ static bool trace_ready(void)
 //-----------------------------------------------------------------------------
 static void redraw_trace(void)
 {
-  if (trace_ready())
+  // Trend chart is not affected by the view changes
+  if (trace_ready() && !g_trend_active)
     g_trace_column = 0;
 }
 
@@ -292,7 +500,9 @@ static void update_from_display_buffer(uint16_t *column, DisplayBuffer *db)
 
   if (db->flags[g_trace_column] & SAMPLE_FLAG_VALID)
   {
-    if (clip_h || clip_l)
+    if (g_mask_active && g_mask_fail[g_trace_column])
+      color = TRACE_FAIL_COLOR;
+    else if (clip_h || clip_l)
       color = TRACE_CLIP_COLOR;
     else if (db->flags[g_trace_column] & SAMPLE_FLAG_FILLED)
       color = TRACE_FILLED_COLOR;
@@ -321,660 +531,2346 @@ static void update_from_display_buffer(uint16_t *column, DisplayBuffer *db)
 }
 
 //-----------------------------------------------------------------------------
-static void draw_trace(void)
+// Histogram panel is drawn over the trace, the bars grow from the right edge
+static void update_from_histogram(uint16_t *column)
 {
-  uint16_t column[GRID_HEIGHT];
+  int x = (GRID_WIDTH-1) - g_trace_column;
 
-  if (trace_ready())
+  if (x > HISTOGRAM_WIDTH)
     return;
 
-  for (int i = 0; i < GRID_HEIGHT; i++)
-    column[i] = g_grid_data[g_trace_column][i];
-
-  update_from_display_buffer(column, &g_display_buffer);
-
-  if (config.horizontal_position_px < -(GRID_WIDTH/2-1))
+  for (int y = 0; y < GRID_HEIGHT-1; y++)
   {
-    update_column_from_image(g_trace_column, column, GRID_WIDTH-1, 1, &image_trigger_offset_right);
-  }
-  else if (config.horizontal_position_px > (GRID_WIDTH/2-1))
-  {
-    update_column_from_image(g_trace_column, column, 1, 1, &image_trigger_offset_left);
+    if (g_histogram_bars[y] >= x)
+      column[y] = HISTOGRAM_COLOR;
   }
-  else
+}
+
+//-----------------------------------------------------------------------------
+static void update_from_references(uint16_t *column)
+{
+  for (int i = 0; i < REFERENCE_COUNT; i++)
   {
-    int pos = GRID_WIDTH/2 - config.horizontal_position_px;
-    update_column_from_image(g_trace_column, column, pos, 0, &image_trigger_offset);
-  }
+    DisplayBuffer *db = &overlay.mode.reference.display[i];
 
-  lcd_draw_buf(GRID_LEFT+1 + g_trace_column, GRID_TOP+1, 1, GRID_HEIGHT-1, column);
+    if (!g_reference_active[i] || !(db->flags[g_trace_column] & SAMPLE_FLAG_VALID))
+      continue;
 
-  g_trace_column++;
+    for (int y = db->min[g_trace_column]; y <= db->max[g_trace_column]; y++)
+      column[y] = reference_color[i];
+  }
 }
 
 //-----------------------------------------------------------------------------
-static void draw_grid_frame(void)
+// Only the mask edges are drawn, so the grid stays visible
+static void update_from_mask(uint16_t *column)
 {
-  lcd_vline(10, 20, 220, GRID_FG_COLOR);
-  lcd_vline(310, 20, 220, GRID_FG_COLOR);
-  lcd_hline(10, 310, 20, GRID_FG_COLOR);
-  lcd_hline(10, 310, 220, GRID_FG_COLOR);
+  int top = mask_get_top()[g_trace_column];
+  int bottom = mask_get_bottom()[g_trace_column];
+
+  if (top > 0 && top < GRID_HEIGHT-1)
+    column[top-1] = MASK_COLOR;
+
+  if (bottom < GRID_HEIGHT-2)
+    column[bottom+1] = MASK_COLOR;
 }
 
 //-----------------------------------------------------------------------------
-static void draw_ac_dc(void)
+static int trend_y(int value)
 {
-  if (g_toast_active)
-    return;
+  int64_t range = (int64_t)g_trend_top - g_trend_bottom;
 
-  lcd_draw_image(54, STATUS_LINE_Y, config.ac_coupling ? &image_ac : &image_dc);
+  return (GRID_HEIGHT-2) - ((int64_t)(value - g_trend_bottom) * (GRID_HEIGHT-2)) / range;
 }
 
 //-----------------------------------------------------------------------------
-static void draw_horizontal_scale(void)
+// Chart is drawn as a sweep, the column after the newest one is left empty
+// to show the position
+static void update_from_trend(uint16_t *column, int x)
 {
-  if (g_toast_active)
+  int newest = (g_trend_count - 1) % TREND_WIDTH;
+  int gap = (g_trend_count >= TREND_WIDTH) ? ((newest + 1) % TREND_WIDTH) : -1;
+  int y, prev;
+
+  if (0 == g_trend_count || x == gap || (g_trend_count < TREND_WIDTH && x > newest))
     return;
 
-  lcd_set_color(BG_COLOR, HSCALE_COLOR);
-  lcd_puts(82, STATUS_LINE_Y, hs_str[config.horizontal_scale]);
+  y = trend_y(overlay.mode.trend[x]);
+  prev = y;
+
+  if (x > 0 && (x-1) != gap)
+    prev = trend_y(overlay.mode.trend[x-1]);
+
+  if (prev > y)
+  {
+    int t = prev;
+    prev = y;
+    y = t;
+  }
+
+  for (int i = prev; i <= y; i++)
+    column[i] = TREND_COLOR;
 }
 
 //-----------------------------------------------------------------------------
-static void draw_horizontal_position(void)
+static void draw_trend_column(int x)
 {
-  char *str;
+  uint16_t column[GRID_HEIGHT];
 
-  if (g_toast_active || g_calibration_mode || config.measure_display)
-    return;
+  for (int i = 0; i < GRID_HEIGHT; i++)
+    column[i] = g_grid_data[x][i];
 
-  str = format_time(config.horizontal_position, true);
-  lcd_set_color(BG_COLOR, HPOS_COLOR);
-  lcd_puts(236, STATUS_LINE_Y, str);
+  update_from_trend(column, x);
+
+  lcd_draw_buf(GRID_LEFT+1 + x, GRID_TOP+1, 1, GRID_HEIGHT-1, column);
 }
 
 //-----------------------------------------------------------------------------
-static void draw_vertical_position(bool toast)
+// Spectrum is drawn as bars from the bottom of the grid, the peaks are marked
+// above the bars
+static void draw_fft_column(int x)
 {
-  int y = GRID_CENTER_Y - config.vertical_position;
-
-  lcd_fill_rect(0, GRID_TOP-4, 9, GRID_HEIGHT+9, BG_COLOR);
+  uint16_t column[GRID_HEIGHT];
+  int level = overlay.fft.level[x];
 
-  if (y < GRID_TOP)
-    lcd_draw_image(GRID_LEFT-5, GRID_TOP, &image_reference_level_up);
-  else if (y > GRID_BOTTOM)
-    lcd_draw_image(GRID_LEFT-5, GRID_BOTTOM, &image_reference_level_down);
-  else
-    lcd_draw_image(GRID_LEFT-2, y, &image_reference_level);
+  for (int i = 0; i < GRID_HEIGHT; i++)
+    column[i] = g_grid_data[x][i];
 
-  if (toast)
+  if (g_fft_count > 0)
   {
-    char *str;
+    for (int i = level; i < GRID_HEIGHT-1; i++)
+      column[i] = FFT_COLOR;
 
-    toast_show();
+    for (int i = 0; i < FFT_PEAKS; i++)
+    {
+      if (x != g_fft_peaks[i] || level <= FFT_MARKER_SIZE)
+        continue;
 
-    lcd_puts(GRID_LEFT, STATUS_LINE_Y, "Vertical position");
+      for (int j = level - 1 - FFT_MARKER_SIZE; j < level - 1; j++)
+        column[j] = FFT_MARKER_COLOR;
+    }
+  }
 
-    str = format_divisions((config.vertical_position * 100) / GRID_DIV_PX, true);
-    lcd_puts(GRID_LEFT + 140, STATUS_LINE_Y, str);
+  lcd_draw_buf(GRID_LEFT+1 + x, GRID_TOP+1, 1, GRID_HEIGHT-1, column);
+}
 
-    str = format_voltage(config.vertical_position_mv, true);
-    lcd_puts(GRID_LEFT + 226, STATUS_LINE_Y, str);
+//-----------------------------------------------------------------------------
+// Intensity grades are logarithmic, each one covers twice the hit counts
+// of the previous one up to the highest count
+static void draw_eye_column(int x)
+{
+  uint16_t column[GRID_HEIGHT];
+  const uint8_t *hits = eye_get_hits() + x / EYE_CELL_WIDTH;
+
+  for (int i = 0; i < GRID_HEIGHT; i++)
+    column[i] = g_grid_data[x][i];
+
+  if (x < EYE_WIDTH * EYE_CELL_WIDTH)
+  {
+    for (int i = 0; i < EYE_HEIGHT * EYE_CELL_HEIGHT; i++)
+    {
+      int count = hits[(i / EYE_CELL_HEIGHT) * EYE_WIDTH];
+      int grade;
+
+      if (0 == count)
+        continue;
+
+      grade = EYE_GRADES - 1 - g_eye_grade_shift + (32 - __CLZ(count));
+
+      column[i] = eye_color[(grade < 0) ? 0 : grade];
+    }
   }
+
+  lcd_draw_buf(GRID_LEFT+1 + x, GRID_TOP+1, 1, GRID_HEIGHT-1, column);
 }
 
 //-----------------------------------------------------------------------------
-static void draw_vertical_scale(void)
+static void draw_meter(void)
 {
-  if (g_toast_active)
+  static const char *labels[] = { "DC", "AC", "DC+AC" };
+  MeterValues values;
+  int value[3];
+
+  g_meter_total = meter_get_total();
+
+  if (!meter_get(&values))
     return;
 
-  lcd_set_color(BG_COLOR, VSCALE_COLOR);
-  lcd_puts(10, STATUS_LINE_Y, vs_str[config.vertical_scale]);
+  value[0] = values.dc;
+  value[1] = values.ac;
+  value[2] = values.rms;
+
+  for (int i = 0; i < 3; i++)
+  {
+    int y = GRID_TOP + 24 + i * 60;
+
+    lcd_set_color(BG_COLOR, METER_LABEL_COLOR);
+    lcd_puts(GRID_LEFT + 10, y + 8, labels[i]);
+
+    lcd_set_color(BG_COLOR, METER_VALUE_COLOR);
+    lcd_puts_scaled(GRID_LEFT + 64, y, format_voltage_uv(value[i], 0 == i), METER_SCALE);
+  }
 }
 
 //-----------------------------------------------------------------------------
-static void draw_trigger_level(void)
+static char *append_number(char *buf, int value)
 {
-  char *str;
+  int n = 0;
 
-  lcd_fill_rect(GRID_RIGHT+2, GRID_TOP-4, 8, GRID_HEIGHT+9, BG_COLOR);
-  lcd_draw_image(GRID_RIGHT+2, GRID_CENTER_Y - config.trigger_level,
-      &image_trigger_level);
+  for (int v = value; v; v /= 10)
+    n++;
 
-  if (g_toast_active || g_calibration_mode || config.measure_display)
-    return;
+  if (0 == n)
+    n = 1;
 
-  str = format_voltage(config.trigger_level_mv - config.vertical_position_mv, true);
-  lcd_set_color(BG_COLOR, TRIGGER_LEVEL_COLOR);
-  lcd_puts(148, STATUS_LINE_Y, str);
+  buf[n] = 0;
+
+  do
+  {
+    buf[--n] = '0' + value % 10;
+    value /= 10;
+  } while (n);
+
+  return buf;
 }
 
 //-----------------------------------------------------------------------------
-static void draw_trigger_edge(void)
+// Counts may get shorter after a restart, the old digits are overwritten
+// with spaces
+static char *format_count(char *buf, int value)
 {
-  if (g_toast_active || g_calibration_mode || config.measure_display)
-    return;
+  int n = strlen(append_number(buf, value));
 
-  if (TRIGGER_EDGE_RISE == config.trigger_edge)
-    lcd_draw_image(140, STATUS_LINE_Y, &image_trigger_edge_rise);
-  else if (TRIGGER_EDGE_FALL == config.trigger_edge)
-    lcd_draw_image(140, STATUS_LINE_Y, &image_trigger_edge_fall);
-  else
-    lcd_draw_image(140, STATUS_LINE_Y, &image_trigger_edge_both);
+  while (n < 9)
+    buf[n++] = ' ';
+
+  buf[n] = 0;
+
+  return buf;
 }
 
 //-----------------------------------------------------------------------------
-static void draw_trigger_mode(void)
+static void draw_counter(void)
 {
+  static char buf[16];
+  CounterResult result;
+  bool valid;
   char *str;
 
-  if (TRIGGER_MODE_AUTO == config.trigger_mode)
-    str = "AUTO";
-  else if (TRIGGER_MODE_NORMAL == config.trigger_mode)
-    str = "NORM";
-  else
-    str = "SNGL";
+  g_counter_total = counter_get_total();
 
-  lcd_set_color(BG_COLOR, TRIGGER_MODE_COLOR);
-  lcd_puts(10, 4, str);
+  if (!counter_get(&result))
+    return;
+
+  valid = (result.periods > 0);
+
+  lcd_set_color(BG_COLOR, METER_LABEL_COLOR);
+  lcd_puts(GRID_LEFT + 10, GRID_TOP + 32, "Freq");
+  lcd_puts(GRID_LEFT + 10, GRID_TOP + 92, "Period");
+  lcd_puts(GRID_LEFT + 10, GRID_TOP + 152, "Gate");
+  lcd_puts(GRID_LEFT + 150, GRID_TOP + 152, "Periods");
+
+  lcd_set_color(BG_COLOR, METER_VALUE_COLOR);
+  str = valid ? format_frequency_counter(result.frequency) : "  No signal ";
+  lcd_puts_scaled(GRID_LEFT + 64, GRID_TOP + 24, str, METER_SCALE);
+
+  str = valid ? format_time(result.period, false) : "     ---  ";
+  lcd_puts_scaled(GRID_LEFT + 64, GRID_TOP + 84, str, METER_SCALE);
+
+  lcd_puts(GRID_LEFT + 64, GRID_TOP + 152, counter_gate_str[config.counter_gate]);
+  lcd_puts(GRID_LEFT + 222, GRID_TOP + 152, format_count(buf, result.periods));
 }
 
 //-----------------------------------------------------------------------------
-static void draw_measure(void)
+static void draw_page_item(int column, int row, const char *label, const char *value)
 {
-  int vmin, vmax, vpp;
-  char *str;
+  int x = GRID_LEFT + 6 + column * 148;
+  int y = GRID_TOP + 6 + row * PAGE_ROW_HEIGHT;
 
-  if (g_toast_active || g_calibration_mode || !config.measure_display)
-    return;
+  lcd_set_color(BG_COLOR, PAGE_LABEL_COLOR);
+  lcd_puts(x, y, label);
 
-  vmin = g_data_buffer.min_value;
-  vmax = g_data_buffer.max_value;
+  lcd_set_color(BG_COLOR, PAGE_VALUE_COLOR);
+  lcd_puts(x + 48, y, value ? value : "     ---  ");
+}
 
-  if (vmax > 0 && vmin < 0)
-    vpp = vmax - vmin;
-  else
-    vpp = vmax - vmin;
+//-----------------------------------------------------------------------------
+// Each value is formatted right before it is drawn, formatting functions
+// share the same buffer
+static void draw_measure_page(void)
+{
+  Measurements *m = &g_data_buffer.measure;
+  bool v = m->valid;
+  bool f = m->frequency_valid;
+  bool t = m->timing_valid;
+
+  draw_page_item(0, 0, "Vmax",   v ? format_voltage(m->vmax, true) : NULL);
+  draw_page_item(0, 1, "Vmin",   v ? format_voltage(m->vmin, true) : NULL);
+  draw_page_item(0, 2, "Vpp",    v ? format_voltage(m->vpp, false) : NULL);
+  draw_page_item(0, 3, "Vtop",   v ? format_voltage(m->vtop, true) : NULL);
+  draw_page_item(0, 4, "Vbase",  v ? format_voltage(m->vbase, true) : NULL);
+  draw_page_item(0, 5, "Vamp",   v ? format_voltage(m->vamp, false) : NULL);
+  draw_page_item(0, 6, "Vavg",   v ? format_voltage(m->vavg, true) : NULL);
+  draw_page_item(0, 7, "Vrms",   v ? format_voltage(m->vrms, false) : NULL);
+  draw_page_item(0, 8, "Over",   v ? format_percent(m->overshoot) : NULL);
+
+  draw_page_item(1, 0, "Freq",   f ? format_frequency_fine(m->frequency) : NULL);
+  draw_page_item(1, 1, "Period", f ? format_time(m->period, false) : NULL);
+  draw_page_item(1, 2, "+Width", t ? format_time(m->pwidth, false) : NULL);
+  draw_page_item(1, 3, "-Width", t ? format_time(m->nwidth, false) : NULL);
+  draw_page_item(1, 4, "Duty",   t ? format_percent(m->duty) : NULL);
+  draw_page_item(1, 5, "Rise",   m->rise_valid ? format_time(m->rise, false) : NULL);
+  draw_page_item(1, 6, "Fall",   m->fall_valid ? format_time(m->fall, false) : NULL);
+  draw_page_item(1, 7, "Noise",  m->noise_valid ? format_voltage_uv(m->noise, false) : NULL);
+  draw_page_item(1, 8, "Pre",    v ? format_percent(m->preshoot) : NULL);
+}
 
-  lcd_set_color(BG_COLOR, MEASURE_MODE_COLOR);
-  lcd_putc(140, STATUS_LINE_Y, 'M');
+//-----------------------------------------------------------------------------
+// Level and phase of a harmonic share the value column
+static char *format_harmonic(int level, int phase)
+{
+  static char buf[24];
+  char digits[8];
+  char *str = format_percent_fine(level);
+  int n = 0;
+  int len;
 
-  str = format_voltage(vpp, false);
-  lcd_set_color(BG_COLOR, MEASURE_VOLTAGE_COLOR);
-  lcd_puts(148, STATUS_LINE_Y, str);
+  while (*str)
+    buf[n++] = *str++;
 
-  str = format_frequency(g_data_buffer.frequency);
-  lcd_set_color(BG_COLOR, MEASURE_FREQ_COLOR);
-  lcd_puts(236, STATUS_LINE_Y, str);
+  len = strlen(append_number(digits, (phase < 0) ? -phase : phase)) + (phase < 0);
+
+  while (len++ < 4)
+    buf[n++] = ' ';
+
+  if (phase < 0)
+    buf[n++] = '-';
+
+  strcpy(&buf[n], digits);
+
+  return buf;
 }
 
 //-----------------------------------------------------------------------------
-static void draw_capture_state(void)
+static void calc_harmonics(void)
 {
-  int state = capture_get_state();
-  int color = BG_COLOR;
-  char *str = "";
+  Measurements *m = &g_data_buffer.measure;
+  CaptureRecord record;
 
-  if (g_state == state)
+  g_harmonics.count = 0;
+
+  if (!m->frequency_valid || !capture_get_record(&record))
     return;
 
-  if (CAPTURE_STATE_STOP == state)
+  harmonics_calc(record.data, record.size, record.offset, m->frequency, record.period,
+      record.vs_mult, &g_harmonics);
+}
+
+//-----------------------------------------------------------------------------
+// Bars below the readings show the harmonic levels from 0 to
+// -HARMONICS_DB_RANGE dB relative to the fundamental
+static void draw_harmonics(void)
+{
+  Harmonics *h = &g_harmonics;
+  bool v = (h->count > 0);
+  int top = GRID_BOTTOM - 4 - HARMONICS_BAR_HEIGHT;
+
+  draw_page_item(0, 0, "THD",  v ? format_percent_fine(h->thd) : NULL);
+  draw_page_item(0, 1, "Freq", v ? format_frequency_fine(g_data_buffer.measure.frequency) : NULL);
+  draw_page_item(0, 2, "Vrms", v ? format_voltage_uv(h->rms[0], false) : NULL);
+
+  for (int i = 1; i < HARMONICS_COUNT; i++)
+    draw_page_item(1, i-1, harmonic_str[i], (i < h->count) ? format_harmonic(h->level[i], h->phase[i]) : NULL);
+
+  for (int i = 0; i < HARMONICS_COUNT; i++)
+  {
+    int x = GRID_LEFT + 8 + i * (HARMONICS_BAR_WIDTH + 3);
+    int db = 2 * (fft_db(h->level[i]) - fft_db(h->level[0]));
+    int height = 0;
+
+    if (i < h->count)
+      height = ((HARMONICS_DB_RANGE * 256 + db) * HARMONICS_BAR_HEIGHT) / (HARMONICS_DB_RANGE * 256);
+
+    if (height < 0)
+      height = 0;
+
+    if (height < HARMONICS_BAR_HEIGHT)
+      lcd_fill_rect(x, top, HARMONICS_BAR_WIDTH, HARMONICS_BAR_HEIGHT - height, BG_COLOR);
+
+    if (height > 0)
+      lcd_fill_rect(x, top + HARMONICS_BAR_HEIGHT - height, HARMONICS_BAR_WIDTH, height,
+          HARMONICS_BAR_COLOR);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Histogram below the readings is scaled to its highest bin, the marker
+// under it is at zero deviation
+static void draw_jitter(void)
+{
+  static char buf[16];
+  const uint32_t *bins = jitter_get_bins();
+  int top = GRID_BOTTOM - 4 - JITTER_BAR_HEIGHT;
+  int left = GRID_LEFT + (GRID_WIDTH - JITTER_BINS * JITTER_BAR_WIDTH) / 2;
+  uint32_t max = 0;
+  Jitter j;
+  bool v = jitter_get(&j);
+
+  draw_page_item(0, 0, "RMS",   v ? format_time_fine(j.rms) : NULL);
+  draw_page_item(0, 1, "Pk-pk", v ? format_time_fine(j.peak) : NULL);
+  draw_page_item(0, 2, "Bin",   v ? format_time_fine(j.bin_width) : NULL);
+  draw_page_item(1, 0, "Edges", format_count(buf, j.count));
+  draw_page_item(1, 1, "Acq",   format_count(buf, j.records));
+
+  for (int i = 0; i < JITTER_BINS; i++)
+  {
+    if (bins[i] > max)
+      max = bins[i];
+  }
+
+  for (int i = 0; i < JITTER_BINS; i++)
+  {
+    int x = left + i * JITTER_BAR_WIDTH;
+    int height = max ? ((uint64_t)bins[i] * JITTER_BAR_HEIGHT + max - 1) / max : 0;
+
+    if (height < JITTER_BAR_HEIGHT)
+      lcd_fill_rect(x, top, JITTER_BAR_WIDTH, JITTER_BAR_HEIGHT - height, BG_COLOR);
+
+    if (height > 0)
+      lcd_fill_rect(x, top + JITTER_BAR_HEIGHT - height, JITTER_BAR_WIDTH, height, JITTER_COLOR);
+  }
+
+  lcd_fill_rect(left + JITTER_BINS/2 * JITTER_BAR_WIDTH, GRID_BOTTOM - 3, 1, 2, JITTER_MARKER_COLOR);
+}
+
+//-----------------------------------------------------------------------------
+static void draw_trace(void)
+{
+  uint16_t column[GRID_HEIGHT];
+
+  if (trace_ready())
+    return;
+
+  // Meter, counter, harmonics, jitter and the measurement page have no
+  // trace, the grid area is cleared once for the readings
+  if (g_meter_active || g_counter_active || g_measure_page || g_harmonics_active ||
+      g_jitter_active)
+  {
+    lcd_fill_rect(GRID_LEFT+1, GRID_TOP+1, GRID_WIDTH-1, GRID_HEIGHT-1, BG_COLOR);
+    g_trace_column = GRID_WIDTH-1;
+
+    if (g_meter_active)
+      draw_meter();
+    else if (g_counter_active)
+      draw_counter();
+    else if (g_measure_page)
+      draw_measure_page();
+    else if (g_harmonics_active)
+      draw_harmonics();
+    else
+      draw_jitter();
+
+    return;
+  }
+
+  if (g_trend_active)
+  {
+    draw_trend_column(g_trace_column++);
+    return;
+  }
+
+  if (g_fft_active)
+  {
+    draw_fft_column(g_trace_column++);
+    return;
+  }
+
+  if (g_eye_active)
+  {
+    draw_eye_column(g_trace_column++);
+    return;
+  }
+
+  for (int i = 0; i < GRID_HEIGHT; i++)
+    column[i] = g_grid_data[g_trace_column][i];
+
+  if (g_mask_active)
+    update_from_mask(column);
+
+  update_from_references(column);
+  update_from_display_buffer(column, &g_display_buffer);
+
+  if (config.histogram)
+    update_from_histogram(column);
+
+  if (config.horizontal_position_px < -(GRID_WIDTH/2-1))
+  {
+    update_column_from_image(g_trace_column, column, GRID_WIDTH-1, 1, &image_trigger_offset_right);
+  }
+  else if (config.horizontal_position_px > (GRID_WIDTH/2-1))
+  {
+    update_column_from_image(g_trace_column, column, 1, 1, &image_trigger_offset_left);
+  }
+  else
+  {
+    int pos = GRID_WIDTH/2 - config.horizontal_position_px;
+    update_column_from_image(g_trace_column, column, pos, 0, &image_trigger_offset);
+  }
+
+  lcd_draw_buf(GRID_LEFT+1 + g_trace_column, GRID_TOP+1, 1, GRID_HEIGHT-1, column);
+
+  g_trace_column++;
+}
+
+//-----------------------------------------------------------------------------
+static void draw_grid_frame(void)
+{
+  lcd_vline(10, 20, 220, GRID_FG_COLOR);
+  lcd_vline(310, 20, 220, GRID_FG_COLOR);
+  lcd_hline(10, 310, 20, GRID_FG_COLOR);
+  lcd_hline(10, 310, 220, GRID_FG_COLOR);
+}
+
+//-----------------------------------------------------------------------------
+static void draw_ac_dc(void)
+{
+  if (g_toast_active)
+    return;
+
+  lcd_draw_image(54, STATUS_LINE_Y, config.ac_coupling ? &image_ac : &image_dc);
+}
+
+//-----------------------------------------------------------------------------
+static void draw_horizontal_scale(void)
+{
+  if (g_toast_active)
+    return;
+
+  lcd_set_color(BG_COLOR, HSCALE_COLOR);
+  lcd_puts(82, STATUS_LINE_Y, hs_str[config.horizontal_scale]);
+}
+
+//-----------------------------------------------------------------------------
+static void draw_horizontal_position(void)
+{
+  char *str;
+
+  if (g_toast_active || g_calibration_mode || config.measure_display)
+    return;
+
+  str = format_time(config.horizontal_position, true);
+  lcd_set_color(BG_COLOR, HPOS_COLOR);
+  lcd_puts(236, STATUS_LINE_Y, str);
+}
+
+//-----------------------------------------------------------------------------
+static void draw_vertical_position(bool toast)
+{
+  int y = GRID_CENTER_Y - config.vertical_position;
+
+  lcd_fill_rect(0, GRID_TOP-4, 9, GRID_HEIGHT+9, BG_COLOR);
+
+  if (y < GRID_TOP)
+    lcd_draw_image(GRID_LEFT-5, GRID_TOP, &image_reference_level_up);
+  else if (y > GRID_BOTTOM)
+    lcd_draw_image(GRID_LEFT-5, GRID_BOTTOM, &image_reference_level_down);
+  else
+    lcd_draw_image(GRID_LEFT-2, y, &image_reference_level);
+
+  if (toast)
+  {
+    char *str;
+
+    toast_show();
+
+    lcd_puts(GRID_LEFT, STATUS_LINE_Y, "Vertical position");
+
+    str = format_divisions((config.vertical_position * 100) / GRID_DIV_PX, true);
+    lcd_puts(GRID_LEFT + 140, STATUS_LINE_Y, str);
+
+    str = format_voltage(config.vertical_position_mv, true);
+    lcd_puts(GRID_LEFT + 226, STATUS_LINE_Y, str);
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void draw_vertical_scale(void)
+{
+  if (g_toast_active)
+    return;
+
+  lcd_set_color(BG_COLOR, VSCALE_COLOR);
+  lcd_puts(10, STATUS_LINE_Y, vs_str[config.vertical_scale]);
+}
+
+//-----------------------------------------------------------------------------
+static void draw_trigger_level(void)
+{
+  char *str;
+
+  lcd_fill_rect(GRID_RIGHT+2, GRID_TOP-4, 8, GRID_HEIGHT+9, BG_COLOR);
+  lcd_draw_image(GRID_RIGHT+2, GRID_CENTER_Y - config.trigger_level,
+      &image_trigger_level);
+
+  if (g_toast_active || g_calibration_mode || config.measure_display)
+    return;
+
+  str = format_voltage(config.trigger_level_mv - config.vertical_position_mv, true);
+  lcd_set_color(BG_COLOR, TRIGGER_LEVEL_COLOR);
+  lcd_puts(148, STATUS_LINE_Y, str);
+}
+
+//-----------------------------------------------------------------------------
+static void draw_trigger_edge(void)
+{
+  if (g_toast_active || g_calibration_mode || config.measure_display)
+    return;
+
+  if (TRIGGER_TYPE_UART == config.trigger_type)
+  {
+    lcd_set_color(BG_COLOR, TRIGGER_LEVEL_COLOR);
+    lcd_putc(140, STATUS_LINE_Y, 'U');
+  }
+  else if (TRIGGER_TYPE_VIDEO == config.trigger_type)
+  {
+    lcd_set_color(BG_COLOR, TRIGGER_LEVEL_COLOR);
+    lcd_putc(140, STATUS_LINE_Y, 'V');
+  }
+  else if (TRIGGER_EDGE_RISE == config.trigger_edge)
+    lcd_draw_image(140, STATUS_LINE_Y, &image_trigger_edge_rise);
+  else if (TRIGGER_EDGE_FALL == config.trigger_edge)
+    lcd_draw_image(140, STATUS_LINE_Y, &image_trigger_edge_fall);
+  else
+    lcd_draw_image(140, STATUS_LINE_Y, &image_trigger_edge_both);
+}
+
+//-----------------------------------------------------------------------------
+static void draw_trigger_mode(void)
+{
+  char *str;
+
+  if (TRIGGER_MODE_AUTO == config.trigger_mode)
+    str = "AUTO";
+  else if (TRIGGER_MODE_NORMAL == config.trigger_mode)
+    str = "NORM";
+  else
+    str = "SNGL";
+
+  lcd_set_color(BG_COLOR, TRIGGER_MODE_COLOR);
+  lcd_puts(10, 4, str);
+}
+
+//-----------------------------------------------------------------------------
+static void draw_measure(void)
+{
+  int vmin, vmax, vpp;
+  char *str;
+
+  if (g_toast_active || g_calibration_mode || g_trend_active || g_meter_active ||
+      g_counter_active || g_fft_active || g_eye_active || !config.measure_display)
+    return;
+
+  vmin = g_data_buffer.min_value;
+  vmax = g_data_buffer.max_value;
+
+  if (vmax > 0 && vmin < 0)
+    vpp = vmax - vmin;
+  else
+    vpp = vmax - vmin;
+
+  lcd_set_color(BG_COLOR, MEASURE_MODE_COLOR);
+  lcd_putc(140, STATUS_LINE_Y, 'M');
+
+  str = format_voltage(vpp, false);
+  lcd_set_color(BG_COLOR, MEASURE_VOLTAGE_COLOR);
+  lcd_puts(148, STATUS_LINE_Y, str);
+
+  str = format_frequency(g_data_buffer.measure.frequency / 1000);
+  lcd_set_color(BG_COLOR, MEASURE_FREQ_COLOR);
+  lcd_puts(236, STATUS_LINE_Y, str);
+}
+
+//-----------------------------------------------------------------------------
+static void update_stats(void)
+{
+  uint32_t time = timer_get_uptime();
+  int64_t elapsed = (int64_t)(time - g_stats_time) * 1000000; // ns
+  int64_t live_time;
+  int acquisitions;
+
+  capture_get_stats(&acquisitions, &live_time);
+
+  g_stats_time = time;
+
+  if (elapsed == 0)
+    return;
+
+  g_stats_rate = ((int64_t)acquisitions * 1000000000) / elapsed;
+
+  if (acquisitions > 0 && elapsed > live_time)
+    g_stats_blind_time = (elapsed - live_time) / acquisitions;
+  else
+    g_stats_blind_time = 0;
+}
+
+//-----------------------------------------------------------------------------
+static bool deep_enabled(void)
+{
+  return !g_calibration_mode && DEEP_LENGTH_OFF != config.deep_length && deep_available();
+}
+
+//-----------------------------------------------------------------------------
+static void draw_fail_stats(int failed, int total, char *label, int value)
+{
+  static char buf[24];
+  char *ptr;
+
+  ptr = append_number(buf, failed);
+  ptr += strlen(ptr);
+  *ptr++ = '/';
+  append_number(ptr, total);
+
+  lcd_puts(GRID_LEFT, STATUS_LINE_Y, "Failed");
+  lcd_puts(GRID_LEFT + 56, STATUS_LINE_Y, buf);
+
+  lcd_puts(GRID_LEFT + 150, STATUS_LINE_Y, label);
+  lcd_puts(GRID_LEFT + 198, STATUS_LINE_Y, append_number(buf, value));
+}
+
+//-----------------------------------------------------------------------------
+static void draw_stats(void)
+{
+  static char buf[16];
+
+  toast_show();
+
+  if (g_logger_active)
+  {
+    lcd_puts(GRID_LEFT, STATUS_LINE_Y, "Records");
+    lcd_puts(GRID_LEFT + 64, STATUS_LINE_Y, append_number(buf, logger_get_total()));
+
+    lcd_puts(GRID_LEFT + 150, STATUS_LINE_Y, "Lost");
+    lcd_puts(GRID_LEFT + 198, STATUS_LINE_Y, append_number(buf, logger_get_lost()));
+    return;
+  }
+
+  if (g_mask_active)
+  {
+    draw_fail_stats(g_mask_fails, g_mask_total, "Passed", g_mask_total - g_mask_fails);
+    return;
+  }
+
+  if (config.anomaly_capture)
+  {
+    int total, failed, saved;
+
+    anomaly_get_stats(&total, &failed, &saved);
+    draw_fail_stats(failed, total, "Saved", saved);
+    return;
+  }
+
+  // Flash write throughput determines the maximum streaming sample rate
+  if (deep_enabled())
+  {
+    lcd_puts(GRID_LEFT, STATUS_LINE_Y, "Flash");
+    lcd_puts(GRID_LEFT + 48, STATUS_LINE_Y, format_sps(deep_get_write_rate()));
+    lcd_puts(GRID_LEFT + 96, STATUS_LINE_Y, "S/s");
+
+    if (deep_get_overrun())
+      lcd_puts(GRID_LEFT + 150, STATUS_LINE_Y, "Overrun");
+
+    return;
+  }
+
+  lcd_puts(GRID_LEFT, STATUS_LINE_Y, "Rate");
+  lcd_puts(GRID_LEFT + 40, STATUS_LINE_Y, format_frequency(g_stats_rate));
+
+  lcd_puts(GRID_LEFT + 150, STATUS_LINE_Y, "Blind");
+  lcd_puts(GRID_LEFT + 198, STATUS_LINE_Y, format_time(g_stats_blind_time, false));
+}
+
+//-----------------------------------------------------------------------------
+static void draw_capture_state(void)
+{
+  int state = capture_get_state();
+  int color = BG_COLOR;
+  char *str = "";
+
+  if (g_state == state)
+    return;
+
+  if (CAPTURE_STATE_STOP == state)
+  {
+    color = CAPTURE_STOP_COLOR;
+    str = "STOP";
+  }
+  else if (CAPTURE_STATE_WAIT == state)
+  {
+    color = CAPTURE_WAIT_COLOR;
+    str = "WAIT";
+  }
+  else if (CAPTURE_STATE_TRIG == state)
+  {
+    color = CAPTURE_TRIG_COLOR;
+    str = "TRIG";
+  }
+
+  lcd_set_color(BG_COLOR, color);
+  lcd_puts(46, 4, str);
+
+  g_state = state;
+}
+
+//-----------------------------------------------------------------------------
+static void draw_miniview(int trigger_offset, int window_offset, int window_width)
+{
+  static const uint8_t wave_pattern[8] = { 1, 0, 0, 1, 2, 3, 3, 2 };
+  uint16_t buf[8];
+
+  for (int x = -MINIVIEW_WIDTH/2+1; x < MINIVIEW_WIDTH/2; x++)
+  {
+    bool inside = ((x > window_offset) && (x < (window_offset + window_width)));
+    bool edge = ((x == window_offset) || (x == (window_offset + window_width - 1)));
+
+    if (edge)
+    {
+      for (int i = 0; i < 8; i++)
+        buf[i] = MV_FRAME_COLOR;
+    }
+    else
+    {
+      for (int i = 0; i < 8; i++)
+        buf[i] = BG_COLOR;
+
+      buf[2 + wave_pattern[x % sizeof(wave_pattern)]] = inside ? TRACE_COLOR : MV_FRAME_COLOR;
+
+      if (inside)
+      {
+        buf[0] = MV_FRAME_COLOR;
+        buf[7] = MV_FRAME_COLOR;
+      }
+    }
+
+    lcd_draw_buf(GRID_CENTER_X + x, 7, 1, 8, buf);
+  }
+
+#define LEFT   (GRID_CENTER_X - MINIVIEW_WIDTH/2)
+#define RIGHT  (GRID_CENTER_X + MINIVIEW_WIDTH/2)
+
+  lcd_fill_rect(LEFT - image_trigger_mv.width/2, 1, MINIVIEW_WIDTH + image_trigger_mv.width,
+      image_trigger_mv.height, BG_COLOR);
+  lcd_draw_image(GRID_CENTER_X + trigger_offset, 5, &image_trigger_mv);
+
+  lcd_vline(LEFT, 6, 15, MV_FRAME_COLOR);
+  lcd_hline(LEFT, LEFT+2, 6, MV_FRAME_COLOR);
+  lcd_hline(LEFT, LEFT+2, 15, MV_FRAME_COLOR);
+
+  lcd_vline(RIGHT, 6, 15, MV_FRAME_COLOR);
+  lcd_hline(RIGHT-2, RIGHT, 6, MV_FRAME_COLOR);
+  lcd_hline(RIGHT-2, RIGHT, 15, MV_FRAME_COLOR);
+
+#undef LEFT
+#undef RIGHT
+}
+
+//-----------------------------------------------------------------------------
+static void draw_sample_rates(int sample_rate_limit, int sample_rate)
+{
+  char *str;
+
+  lcd_set_font(FONT_SMALL);
+
+  str = format_sps(sample_rate_limit);
+  lcd_set_color(BG_COLOR, SR_LIMIT_COLOR);
+  lcd_puts(252, 2, str);
+
+  str = format_sps(sample_rate);
+  lcd_set_color(BG_COLOR, SR_COLOR);
+  lcd_puts(252, 10, str);
+
+  lcd_set_font(FONT_LARGE);
+}
+
+//-----------------------------------------------------------------------------
+static int get_min_sr_divider(void)
+{
+  if (g_calibration_mode)
+    return 0;
+
+  // Flash can't keep up with the higher sample rates
+  if (deep_enabled())
+    return DEEP_MIN_SR_DIVIDER;
+
+  // UART decoder needs a single channel and a few samples per bit
+  if (TRIGGER_TYPE_UART == config.trigger_type)
+    return UART_MIN_SR_DIVIDER;
+
+  // Video decoder needs a single channel
+  if (TRIGGER_TYPE_VIDEO == config.trigger_type)
+    return VIDEO_MIN_SR_DIVIDER;
+
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+static int get_record_size(int64_t required_time, int64_t period)
+{
+  if (deep_enabled())
+    return deep_length_value[config.deep_length];
+
+  if (RECORD_LENGTH_AUTO != config.record_length)
+    return record_length_value[config.record_length];
+
+  // Shortest record that covers the window and the trigger margin
+  for (int i = RECORD_LENGTH_4K; i < RECORD_LENGTH_LAST; i++)
+  {
+    if (required_time < (int64_t)record_length_value[i] * period)
+      return record_length_value[i];
+  }
+
+  return record_length_value[RECORD_LENGTH_LAST];
+}
+
+//-----------------------------------------------------------------------------
+static void update_sample_rate(void)
+{
+  int64_t hp_abs = (config.horizontal_position < 0) ? -config.horizontal_position : config.horizontal_position;
+  int64_t window_time = (int64_t)hs_div_value[config.horizontal_scale] * GRID_DIVS_H;
+  int64_t period = BASE_SAMPLE_PERIOD;
+  int64_t trigger_margin, trigger_offset;
+  int64_t buffer_time, required_time;
+  int64_t window_offset;
+  int64_t denom;
+  int sample_rate = BASE_SAMPLE_RATE;
+  int sample_rate_limit;
+  int record_size;
+  bool delayed = false;
+  int trigger_offset_px, window_offset_px, window_width_px;
+  int sr_divider = config.sample_rate_limit;
+
+  for (int i = 0; i < config.sample_rate_limit; i++)
+  {
+    period *= 2;
+    sample_rate /= 2;
+  }
+
+  sample_rate_limit = sample_rate;
+
+  // Logger reduces every sample in the interrupt, so the rate is fixed at
+  // the level the interrupt handler can easily keep up with
+  if (g_logger_active)
+  {
+    capture_set_horizontal_parameters(LOGGER_SR_DIVIDER, CAPTURE_BUFFER_SIZE, CAPTURE_BUFFER_SIZE/2);
+    draw_sample_rates(sample_rate_limit, BASE_SAMPLE_RATE / (1 << LOGGER_SR_DIVIDER));
+    return;
+  }
+
+  // Meter sums the whole capture buffer, the rate does not depend on the view
+  if (g_meter_active)
+  {
+    capture_set_horizontal_parameters(METER_SR_DIVIDER, CAPTURE_BUFFER_SIZE, CAPTURE_BUFFER_SIZE/2);
+    draw_sample_rates(sample_rate_limit, BASE_SAMPLE_RATE / (1 << METER_SR_DIVIDER));
+    return;
+  }
+
+  // Counter resolution is set by the gate time, the rate only limits the
+  // highest frequency
+  if (g_counter_active)
+  {
+    capture_set_horizontal_parameters(COUNTER_SR_DIVIDER, CAPTURE_BUFFER_SIZE, CAPTURE_BUFFER_SIZE/2);
+    draw_sample_rates(sample_rate_limit, BASE_SAMPLE_RATE / (1 << COUNTER_SR_DIVIDER));
+    return;
+  }
+
+  while (sr_divider < get_min_sr_divider())
+  {
+    sr_divider++;
+    period *= 2;
+    sample_rate /= 2;
+  }
+
+  while (1)
+  {
+    trigger_margin = period * TRIGGER_MARGIN_SAMPLES;
+    required_time = trigger_margin + hp_abs + window_time/2;
+
+    if (required_time < window_time)
+      required_time = window_time;
+
+    record_size = get_record_size(required_time, period);
+    buffer_time = (int64_t)record_size * period;
+
+    if (required_time < buffer_time)
+      break;
+
+    // Window after the trigger may be captured with a delay instead, then
+    // the record only needs to cover the window itself
+    required_time = window_time + trigger_margin * 2;
+
+    if (config.horizontal_position > 0)
+    {
+      record_size = get_record_size(required_time, period);
+      buffer_time = (int64_t)record_size * period;
+
+      if (required_time < buffer_time)
+      {
+        delayed = true;
+        break;
+      }
+    }
+
+    sr_divider++;
+    period *= 2;
+    sample_rate /= 2;
+  }
+
+  g_calibration_dual_channel = (sr_divider == 0);
+
+  if (delayed)
+  {
+    trigger_offset = -config.horizontal_position;
+  }
+  else
+  {
+    denom = buffer_time - window_time/2 - trigger_margin;
+    trigger_offset = -config.horizontal_position * (buffer_time/2 - trigger_margin) / denom;
+  }
+
+  // Pre-trigger part of a deep record has to fit into the capture buffer
+  if (record_size > CAPTURE_BUFFER_SIZE && (record_size/2 + trigger_offset / period) > DEEP_MAX_PRE_TRIGGER)
+    trigger_offset = (int64_t)(DEEP_MAX_PRE_TRIGGER - record_size/2) * period;
+
+  window_offset = trigger_offset + config.horizontal_position;
+
+  capture_set_horizontal_parameters(sr_divider, record_size, record_size/2 + trigger_offset / period);
+
+  denom = period * record_size;
+
+  trigger_offset_px = (trigger_offset * MINIVIEW_WIDTH) / denom;
+  window_offset_px  = ((window_offset - window_time/2) * MINIVIEW_WIDTH) / denom;
+  window_width_px   = (window_time * MINIVIEW_WIDTH) / denom;
+
+  if (window_offset_px == 0)
+    window_offset_px = -1;
+
+  if (window_width_px < 3)
+    window_width_px = 3;
+
+  // Trigger is before the start of the delayed record
+  if (trigger_offset_px < -MINIVIEW_WIDTH/2)
+    trigger_offset_px = -MINIVIEW_WIDTH/2;
+
+  draw_miniview(trigger_offset_px, window_offset_px, window_width_px);
+  draw_sample_rates(sample_rate_limit, sample_rate);
+}
+
+//-----------------------------------------------------------------------------
+static int clip_for_display(int value)
+{
+  value = GRID_HEIGHT/2-1 - value;
+
+  if (value > (GRID_HEIGHT-2))
+    value = (GRID_HEIGHT-2);
+  else if (value < 0)
+    value = 0;
+
+  return value;
+}
+
+//---------------------------------------------------------------------
+static void close_gaps(DisplayBuffer *db)
+{
+  for (int i = 0; i < GRID_WIDTH-1; i++)
+  {
+    if ((db->flags[i] & SAMPLE_FLAG_VALID) && (db->flags[i+1] & SAMPLE_FLAG_VALID))
+    {
+      if (db->max[i] < (db->min[i+1]-1))
+      {
+        int avg = (db->max[i] + db->min[i+1]) / 2;
+        db->max[i] = avg;
+        db->min[i+1] = avg+1;
+      }
+      else if (db->min[i] > (db->max[i+1] + 1))
+      {
+        int avg = (db->min[i] + db->max[i+1]) / 2;
+        db->min[i] = avg;
+        db->max[i+1] = avg-1;
+      }
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Reference columns are rebuilt from the saved waveforms only when
+// the horizontal view changes, conversion to the screen coordinates only
+// when the vertical settings change.
+static void update_references(void)
+{
+  int scale = vs_px_value[config.vertical_scale];
+  bool changed;
+
+  if (!g_reference_shown)
+    return;
+
+  changed = reference_update(config.horizontal_position, config.horizontal_period);
+
+  if (!changed && g_reference_scale == config.vertical_scale &&
+      g_reference_position == config.vertical_position)
+    return;
+
+  g_reference_scale    = config.vertical_scale;
+  g_reference_position = config.vertical_position;
+
+  for (int i = 0; i < REFERENCE_COUNT; i++)
+  {
+    const Reference *ref = reference_get(i);
+    DisplayBuffer *db = &overlay.mode.reference.display[i];
+
+    g_reference_active[i] = (ref != NULL);
+
+    if (!ref)
+      continue;
+
+    for (int j = 0; j < GRID_WIDTH; j++)
+    {
+      int min, max;
+
+      if (ref->min[j] > ref->max[j])
+      {
+        db->flags[j] = SAMPLE_FLAG_NONE;
+        continue;
+      }
+
+      min = ((ref->min[j] - ZERO_POINT) * ref->info.vs_mult + ref->info.vs_mult/2) / CALIB_MULTIPLIER;
+      max = ((ref->max[j] - ZERO_POINT) * ref->info.vs_mult + ref->info.vs_mult/2) / CALIB_MULTIPLIER;
+
+      min = (min - ref->info.vpos) / scale + config.vertical_position;
+      max = (max - ref->info.vpos) / scale + config.vertical_position;
+
+      db->min[j]   = clip_for_display(max);
+      db->max[j]   = clip_for_display(min);
+      db->flags[j] = SAMPLE_FLAG_VALID;
+    }
+
+    close_gaps(db);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Strip chart of the logged min/max values, the newest record is on the right
+static void update_logger_display(void)
+{
+  int scale = vs_px_value[config.vertical_scale];
+  int vs_mult = config.calib_vs_mult[config.vertical_scale];
+
+  g_logger_total = logger_get_total();
+
+  for (int i = 0; i < GRID_WIDTH; i++)
+  {
+    const LogRecord *record = logger_get(GRID_WIDTH-1 - i);
+    int min, max, flags;
+
+    if (!record)
+    {
+      g_display_buffer.flags[i] = SAMPLE_FLAG_NONE;
+      continue;
+    }
+
+    flags = SAMPLE_FLAG_VALID | SAMPLE_FLAG_FILLED;
+
+    if (record->min == 0)
+      flags |= SAMPLE_FLAG_CLIP_L;
+
+    if (record->max == 255)
+      flags |= SAMPLE_FLAG_CLIP_H;
+
+    min = ((record->min - ZERO_POINT) * vs_mult + vs_mult/2) / CALIB_MULTIPLIER;
+    max = ((record->max - ZERO_POINT) * vs_mult + vs_mult/2) / CALIB_MULTIPLIER;
+
+    min = (min - config.vertical_position_mv) / scale + config.vertical_position;
+    max = (max - config.vertical_position_mv) / scale + config.vertical_position;
+
+    g_display_buffer.min[i]   = clip_for_display(max);
+    g_display_buffer.max[i]   = clip_for_display(min);
+    g_display_buffer.flags[i] = flags;
+  }
+
+  close_gaps(&g_display_buffer);
+  redraw_trace();
+}
+
+//-----------------------------------------------------------------------------
+// Histogram of the whole record is mapped onto the screen rows with the same
+// scale as the trace, the bars are scaled to the most populated row
+static void build_histogram_bars(void)
+{
+  const uint32_t *histogram = measure_get_histogram();
+  int scale = vs_px_value[config.vertical_scale];
+  uint32_t rows[GRID_HEIGHT-1];
+  uint32_t max = 0;
+  CaptureRecord record;
+
+  memset(g_histogram_bars, 0, sizeof(g_histogram_bars));
+
+  if (!capture_get_record(&record))
+    return;
+
+  memset(rows, 0, sizeof(rows));
+
+  for (int i = 0; i < 256; i++)
+  {
+    int mv = ((i - ZERO_POINT) * record.vs_mult + record.vs_mult/2) / CALIB_MULTIPLIER;
+    int y = GRID_HEIGHT/2-1 - ((mv - g_data_buffer.vertical_position) / scale + config.vertical_position);
+
+    if (y >= 0 && y < GRID_HEIGHT-1)
+      rows[y] += histogram[i];
+  }
+
+  for (int y = 0; y < GRID_HEIGHT-1; y++)
+  {
+    if (rows[y] > max)
+      max = rows[y];
+  }
+
+  if (0 == max)
+    return;
+
+  // Rounded up, so the rare values are still visible
+  for (int y = 0; y < GRID_HEIGHT-1; y++)
+    g_histogram_bars[y] = ((uint64_t)rows[y] * HISTOGRAM_WIDTH + max - 1) / max;
+}
+
+//-----------------------------------------------------------------------------
+static void update_display(void)
+{
+  int scale = vs_px_value[config.vertical_scale];
+
+  if (g_logger_active)
+  {
+    update_logger_display();
+    return;
+  }
+
+  if (g_meter_active)
+  {
+    draw_meter();
+    return;
+  }
+
+  if (g_counter_active)
+  {
+    draw_counter();
+    return;
+  }
+
+  update_references();
+
+  g_data_buffer.size = GRID_WIDTH;
+  capture_get_data(&g_data_buffer);
+
+  for (int i = 0; i < GRID_WIDTH; i++)
+  {
+    int min = (g_data_buffer.min[i] - g_data_buffer.vertical_position) / scale + config.vertical_position;
+    int max = (g_data_buffer.max[i] - g_data_buffer.vertical_position) / scale + config.vertical_position;
+
+    g_display_buffer.min[i]   = clip_for_display(max);
+    g_display_buffer.max[i]   = clip_for_display(min);
+    g_display_buffer.flags[i] = g_data_buffer.flags[i];
+  }
+
+  close_gaps(&g_display_buffer);
+
+  if (g_mask_active)
+  {
+    g_mask_failed = mask_check(g_display_buffer.min, g_display_buffer.max,
+        g_display_buffer.flags, g_mask_fail);
+  }
+
+  if (g_harmonics_active)
+    calc_harmonics();
+
+  if (config.histogram)
+    build_histogram_bars();
+
+  if (g_measure_page)
+    draw_measure_page();
+  else if (g_harmonics_active)
+    draw_harmonics();
+  else if (g_jitter_active)
+    draw_jitter();
+  else
+    redraw_trace();
+}
+
+//-----------------------------------------------------------------------------
+static void change_horizontal_scale(int delta)
+{
+  if ((delta < 0 && config.horizontal_scale == 0) ||
+      (delta > 0 && config.horizontal_scale == HS_LAST))
+    return;
+
+  config.horizontal_scale += delta;
+  config.horizontal_position_px = config.horizontal_position / hs_px_value[config.horizontal_scale];
+  config.horizontal_period = hs_px_value[config.horizontal_scale];
+
+  draw_horizontal_scale();
+  draw_horizontal_position();
+  update_sample_rate();
+  update_display();
+}
+
+//-----------------------------------------------------------------------------
+static void change_horizontal_position(int delta)
+{
+  int div = hs_px_value[config.horizontal_scale];
+
+  if ((delta < 0 && config.horizontal_position <= MIN_HORIZONTAL_POSITION) ||
+      (delta > 0 && config.horizontal_position >= MAX_HORIZONTAL_POSITION))
+    return;
+
+  config.horizontal_position_px = config.horizontal_position / div + delta;
+  config.horizontal_position = (int64_t)config.horizontal_position_px * div;
+
+  draw_horizontal_position();
+  update_sample_rate();
+  update_display();
+}
+
+//-----------------------------------------------------------------------------
+static void change_vertical_scale(int delta)
+{
+  if ((delta < 0 && config.vertical_scale == 0) ||
+      (delta > 0 && config.vertical_scale == VS_LAST))
+    return;
+
+  config.vertical_scale += delta;
+  config.vertical_mult = config.calib_vs_mult[config.vertical_scale];
+  config.vertical_position_mv = config.vertical_position * vs_px_value[config.vertical_scale];
+
+  config.trigger_level_mv = config.trigger_level * vs_px_value[config.vertical_scale];
+
+  capture_set_vertical_parameters();
+  capture_set_trigger_level(config.trigger_level_mv);
+  draw_vertical_scale();
+  draw_trigger_level();
+  update_display();
+}
+
+//-----------------------------------------------------------------------------
+static void change_vertical_position(int delta)
+{
+  if ((delta < 0 && config.vertical_position <= MIN_VERTICAL_POSITION) ||
+      (delta > 0 && config.vertical_position >= MAX_VERTICAL_POSITION))
+    return;
+
+  config.vertical_position += delta;
+  config.vertical_position_mv = config.vertical_position * vs_px_value[config.vertical_scale];
+
+  capture_set_vertical_parameters();
+  draw_vertical_position(true);
+  draw_trigger_level();
+  update_display();
+}
+
+//-----------------------------------------------------------------------------
+static void change_trigger_level(int delta)
+{
+  if ((delta < 0 && config.trigger_level == MIN_TRIGGER_LEVEL) ||
+      (delta > 0 && config.trigger_level == MAX_TRIGGER_LEVEL))
+    return;
+
+  config.trigger_level += delta;
+  config.trigger_level_mv = config.trigger_level * vs_px_value[config.vertical_scale];
+
+  capture_set_trigger_level(config.trigger_level_mv);
+  draw_trigger_level();
+}
+
+//-----------------------------------------------------------------------------
+static void change_sample_rate_limit(int delta)
+{
+  if ((delta < 0 && config.sample_rate_limit == 0) ||
+      (delta > 0 && config.sample_rate_limit == MAX_SAMPLE_RATE_LIMIT))
+    return;
+
+  config.sample_rate_limit += delta;
+
+  update_sample_rate();
+}
+
+//-----------------------------------------------------------------------------
+static void change_calibration_value(int delta, bool shift)
+{
+  if (shift)
   {
-    color = CAPTURE_STOP_COLOR;
-    str = "STOP";
+    if (g_calibration_parameter == CALIB_OFFSET)
+      g_calibration_parameter = CALIB_ZERO;
+    else
+      g_calibration_parameter++;
+
+    lcd_fill_rect(CALIB_AREA_LEFT, GRID_BOTTOM+1, CALIB_AREA_WIDTH, STATUS_LINE_HEIGHT, BG_COLOR);
+
+    return;
   }
-  else if (CAPTURE_STATE_WAIT == state)
+
+  if (g_calibration_parameter == CALIB_ZERO)
   {
-    color = CAPTURE_WAIT_COLOR;
-    str = "WAIT";
+    config.calib_dac_zero += delta;
+
+    if (config.calib_dac_zero < 1900)
+      config.calib_dac_zero = 1900;
+    else if (config.calib_dac_zero > 2200)
+      config.calib_dac_zero = 2200;
   }
-  else if (CAPTURE_STATE_TRIG == state)
+  else if (g_calibration_parameter == CALIB_DELTA)
   {
-    color = CAPTURE_TRIG_COLOR;
-    str = "TRIG";
+    config.calib_channel_delta += delta;
+
+    if (config.calib_channel_delta < -64)
+      config.calib_channel_delta = -64;
+    else if (config.calib_channel_delta > 64)
+      config.calib_channel_delta = 64;
   }
+  else if (g_calibration_parameter == CALIB_SCALE)
+  {
+    config.calib_vs_mult[config.vertical_scale] += delta;
 
-  lcd_set_color(BG_COLOR, color);
-  lcd_puts(46, 4, str);
+    if (config.calib_vs_mult[config.vertical_scale] < 0)
+      config.calib_vs_mult[config.vertical_scale] = 0;
+    else if (config.calib_vs_mult[config.vertical_scale] > 4000000)
+      config.calib_vs_mult[config.vertical_scale] = 4000000;
+  }
+  else if (g_calibration_parameter == CALIB_OFFSET)
+  {
+    config.calib_dac_mult[config.vertical_scale] += delta;
+
+    if (config.calib_dac_mult[config.vertical_scale] < 0)
+      config.calib_dac_mult[config.vertical_scale] = 0;
+    else if (config.calib_dac_mult[config.vertical_scale] > 100000)
+      config.calib_dac_mult[config.vertical_scale] = 100000;
+  }
+
+  capture_set_vertical_parameters();
+}
+
+//-----------------------------------------------------------------------------
+static void draw_calibration_info(void)
+{
+  static const char *labels[] = { "Z", "D", "S", "O" };
+  char *str;
+
+  lcd_set_color(BG_COLOR, LCD_WHITE_COLOR);
+
+  if (!g_toast_active)
+    lcd_puts(CALIB_AREA_LEFT, STATUS_LINE_Y, labels[g_calibration_parameter]);
+
+  g_data_buffer.size = GRID_WIDTH;
+
+  if (g_calibration_parameter == CALIB_ZERO || g_calibration_parameter == CALIB_DELTA)
+  {
+    if ((g_calibration_parameter == CALIB_ZERO) == g_calibration_dual_channel)
+      lcd_set_color(BG_COLOR, LCD_RED_COLOR);
+
+    capture_get_raw_data(g_data_buffer.max, GRID_WIDTH/2);
+
+    if (g_calibration_dual_channel)
+    {
+      for (int i = 1; i < GRID_WIDTH/2; i += 2)
+        g_data_buffer.max[i] = rbit8(g_data_buffer.max[i]) + config.calib_channel_delta;
+    }
+
+    if (!g_toast_active)
+    {
+      str = format_raw_data(g_data_buffer.max, 4);
+      lcd_puts(CALIB_AREA_LEFT + 24, STATUS_LINE_Y, str);
+    }
+
+    #define PIXEL_SIZE 15
+    for (int i = 0; i < GRID_WIDTH/2; i++)
+    {
+      g_data_buffer.max[i] -= ZERO_POINT;
+      g_data_buffer.min[i] = g_data_buffer.max[i];
+
+      if (0 == i % PIXEL_SIZE)
+      {
+        g_data_buffer.max[GRID_WIDTH/2 + i] = 0;
+        g_data_buffer.min[GRID_WIDTH/2 + i] = 0;
+      }
+      else
+      {
+        int value = g_data_buffer.max[i / PIXEL_SIZE] * PIXEL_SIZE;
+        g_data_buffer.max[GRID_WIDTH/2 + i] = value + PIXEL_SIZE/2;
+        g_data_buffer.min[GRID_WIDTH/2 + i] = value - PIXEL_SIZE/2;
+      }
+    }
+
+    for (int i = 0; i < GRID_WIDTH; i++)
+    {
+      g_display_buffer.min[i]   = clip_for_display(g_data_buffer.max[i]);
+      g_display_buffer.max[i]   = clip_for_display(g_data_buffer.min[i]);
+      g_display_buffer.flags[i] = SAMPLE_FLAG_VALID;
+    }
+
+    redraw_trace();
+  }
+  else // if (g_calibration_parameter == CALIB_SCALE || g_calibration_parameter == CALIB_OFFSET)
+  {
+    update_display();
+
+    int vmin = g_data_buffer.min_value;
+    int vmax = g_data_buffer.max_value;
+    int vpos = g_data_buffer.vertical_position;
+
+    if (!g_toast_active)
+    {
+      str = format_voltage(vmin - vpos, true);
+      lcd_puts(CALIB_AREA_LEFT + 12, STATUS_LINE_Y, str);
+
+      str = format_voltage(vmax - vpos, true);
+      lcd_puts(CALIB_AREA_LEFT + 96, STATUS_LINE_Y, str);
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void show_history(int index)
+{
+  static char buf[32] = "History ";
+  CaptureRecord record;
+  char *ptr;
+
+  if (!history_get(index, &record))
+    return;
+
+  g_history_index = index;
+  capture_show_record(&record);
+  update_display();
+
+  ptr = append_number(&buf[8], index + 1);
+  ptr += strlen(ptr);
+  *ptr++ = '/';
+  append_number(ptr, history_get_count());
+
+  draw_message(buf);
+}
+
+//-----------------------------------------------------------------------------
+static void toggle_history(void)
+{
+  if (capture_get_state() != CAPTURE_STATE_STOP)
+    return;
+
+  if (g_history_index < 0)
+  {
+    if (history_get_count() > 0)
+      show_history(0);
+    else
+      draw_message("History is empty");
+  }
+  else
+  {
+    g_history_index = -1;
+    capture_show_record(NULL);
+    update_display();
+    draw_message("History off");
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void save_waveform(void)
+{
+  if (!wave_save(false))
+  {
+    draw_message("Storage is not ready");
+    return;
+  }
+
+  g_wave_saving = true;
+  draw_message("Saving waveform");
+}
+
+//-----------------------------------------------------------------------------
+static void recall_waveform(void)
+{
+  int id = storage_get_last(STORAGE_TYPE_WAVEFORM);
+
+  if (id < 0)
+  {
+    draw_message("No saved waveforms");
+    return;
+  }
+
+  if (wave_busy())
+  {
+    draw_message("Storage is busy");
+    return;
+  }
+
+  if (!wave_recall(id))
+  {
+    draw_message("Waveform is corrupted");
+    return;
+  }
+
+  g_history_index = -1;
+
+  config.horizontal_period = hs_px_value[config.horizontal_scale];
+  config.horizontal_position_px = config.horizontal_position / config.horizontal_period;
+  config.vertical_mult = config.calib_vs_mult[config.vertical_scale];
+  config.vertical_position_mv = config.vertical_position * vs_px_value[config.vertical_scale];
+  config.trigger_level_mv = config.trigger_level * vs_px_value[config.vertical_scale];
+
+  capture_set_vertical_parameters();
+  capture_set_trigger_level(config.trigger_level_mv);
+  draw_vertical_position(false);
+  update_sample_rate();
+  update_display();
+
+  draw_message("Waveform recalled");
+}
+
+//-----------------------------------------------------------------------------
+static void draw_status_line(void)
+{
+  lcd_fill_rect(GRID_LEFT, GRID_BOTTOM+1, GRID_WIDTH+1, STATUS_LINE_HEIGHT, BG_COLOR);
+
+  draw_vertical_scale();
+  draw_ac_dc();
+  draw_horizontal_scale();
+  draw_horizontal_position();
+  draw_trigger_level();
+  draw_trigger_edge();
+  draw_measure();
+}
+
+//-----------------------------------------------------------------------------
+static char *format_hex_byte(int value)
+{
+  static char buf[5] = "0x00";
+  static const char hex[] = "0123456789abcdef";
+
+  buf[2] = hex[(value >> 4) & 0xf];
+  buf[3] = hex[value & 0xf];
+
+  return buf;
+}
+
+//-----------------------------------------------------------------------------
+static void update_trigger_type(void)
+{
+  capture_set_trigger_type(config.trigger_type);
+  update_sample_rate();
+}
+
+//-----------------------------------------------------------------------------
+static void update_uart_trigger(void)
+{
+  capture_set_uart_trigger(uart_baud_value[config.uart_baud], config.uart_inverted,
+      config.uart_value, config.uart_mask);
+}
+
+//-----------------------------------------------------------------------------
+static char *format_video_line(int value)
+{
+  static char buf[4];
+  int line = value + 1;
+
+  buf[0] = '0' + line / 100;
+  buf[1] = '0' + (line / 10) % 10;
+  buf[2] = '0' + line % 10;
+  buf[3] = 0;
+
+  return buf;
+}
+
+//-----------------------------------------------------------------------------
+// Lines past the end of an NTSC frame may be left from the PAL setting
+static void update_video_trigger(void)
+{
+  int lines = (VIDEO_STANDARD_NTSC == config.video_standard) ? VIDEO_NTSC_LINES : VIDEO_PAL_LINES;
+
+  if (config.video_line >= lines)
+  {
+    config.video_line = lines - 1;
+    menu_update();
+  }
+
+  capture_set_video_trigger(config.video_standard, config.video_sync, config.video_line + 1);
+}
 
-  g_state = state;
+//-----------------------------------------------------------------------------
+// Fixed rates are the same as for the UART trigger
+static char *format_eye_rate(int value)
+{
+  if (EYE_OFF == value)
+    return "Off";
+  else if (EYE_AUTO == value)
+    return "Auto";
+  else
+    return (char *)uart_baud_str[value - EYE_AUTO - 1];
 }
 
 //-----------------------------------------------------------------------------
-static void draw_miniview(int trigger_offset, int window_offset, int window_width)
+static char *format_reference(int value)
 {
-  static const uint8_t wave_pattern[8] = { 1, 0, 0, 1, 2, 3, 3, 2 };
-  uint16_t buf[8];
+  static char buf[16] = "Wave ";
 
-  for (int x = -MINIVIEW_WIDTH/2+1; x < MINIVIEW_WIDTH/2; x++)
+  if (0 == value)
+    return "Off";
+
+  append_number(&buf[5], value);
+
+  return buf;
+}
+
+//-----------------------------------------------------------------------------
+// Menu steps through the saved waveforms, not through the raw IDs
+static void update_references_selection(void)
+{
+  for (int i = 0; i < REFERENCE_COUNT; i++)
   {
-    bool inside = ((x > window_offset) && (x < (window_offset + window_width)));
-    bool edge = ((x == window_offset) || (x == (window_offset + window_width - 1)));
+    int prev = g_reference_id[i];
+    int id = config.reference[i];
 
-    if (edge)
+    if (id == prev)
+      continue;
+
+    if (0 == prev)
     {
-      for (int i = 0; i < 8; i++)
-        buf[i] = MV_FRAME_COLOR;
+      id = storage_get_last(STORAGE_TYPE_WAVEFORM);
     }
-    else
+    else if (id > prev)
     {
-      for (int i = 0; i < 8; i++)
-        buf[i] = BG_COLOR;
-
-      buf[2 + wave_pattern[x % sizeof(wave_pattern)]] = inside ? TRACE_COLOR : MV_FRAME_COLOR;
+      id = prev;
 
-      if (inside)
-      {
-        buf[0] = MV_FRAME_COLOR;
-        buf[7] = MV_FRAME_COLOR;
-      }
+      for (int n = storage_get_last(STORAGE_TYPE_WAVEFORM); n > prev; n = storage_get_prev(STORAGE_TYPE_WAVEFORM, n))
+        id = n;
+    }
+    else
+    {
+      id = storage_get_prev(STORAGE_TYPE_WAVEFORM, prev);
     }
 
-    lcd_draw_buf(GRID_CENTER_X + x, 7, 1, 8, buf);
+    if (id < 0)
+      id = 0;
+
+    config.reference[i] = id;
+    g_reference_id[i] = id;
+    reference_set(i, id);
   }
+}
 
-#define LEFT   (GRID_CENTER_X - MINIVIEW_WIDTH/2)
-#define RIGHT  (GRID_CENTER_X + MINIVIEW_WIDTH/2)
+//-----------------------------------------------------------------------------
+static void update_anomaly_capture(void)
+{
+  capture_set_anomaly(config.anomaly_capture, config.anomaly_margin);
+}
 
-  lcd_fill_rect(LEFT - image_trigger_mv.width/2, 1, MINIVIEW_WIDTH + image_trigger_mv.width,
-      image_trigger_mv.height, BG_COLOR);
-  lcd_draw_image(GRID_CENTER_X + trigger_offset, 5, &image_trigger_mv);
+//-----------------------------------------------------------------------------
+// Analysis modes replace each other, the first one enabled in this order is
+// the active one
+static int get_analysis_mode(void)
+{
+  if (config.logger_interval > 0)
+    return ANALYSIS_LOGGER;
+  else if (config.meter)
+    return ANALYSIS_METER;
+  else if (config.counter_gate > 0)
+    return ANALYSIS_COUNTER;
+  else if (config.fft_size > 0)
+    return ANALYSIS_FFT;
+  else if (config.harmonics)
+    return ANALYSIS_HARMONICS;
+  else if (JITTER_OFF != config.jitter)
+    return ANALYSIS_JITTER;
+  else if (EYE_OFF != config.eye_rate)
+    return ANALYSIS_EYE;
+  else if (TREND_OFF != config.trend)
+    return ANALYSIS_TREND;
+  else
+    return ANALYSIS_OFF;
+}
 
-  lcd_vline(LEFT, 6, 15, MV_FRAME_COLOR);
-  lcd_hline(LEFT, LEFT+2, 6, MV_FRAME_COLOR);
-  lcd_hline(LEFT, LEFT+2, 15, MV_FRAME_COLOR);
+//-----------------------------------------------------------------------------
+// Reference columns share the memory with the analysis modes, they are
+// built again when the trace is shown
+static void update_reference_view(void)
+{
+  g_reference_shown = (ANALYSIS_OFF == get_analysis_mode());
 
-  lcd_vline(RIGHT, 6, 15, MV_FRAME_COLOR);
-  lcd_hline(RIGHT-2, RIGHT, 6, MV_FRAME_COLOR);
-  lcd_hline(RIGHT-2, RIGHT, 15, MV_FRAME_COLOR);
+  for (int i = 0; i < REFERENCE_COUNT; i++)
+    g_reference_active[i] = false;
 
-#undef LEFT
-#undef RIGHT
+  reference_reset();
 }
 
 //-----------------------------------------------------------------------------
-static void draw_sample_rates(int sample_rate_limit, int sample_rate)
+static void update_trend(void)
 {
-  char *str;
-
-  lcd_set_font(FONT_SMALL);
-
-  str = format_sps(sample_rate_limit);
-  lcd_set_color(BG_COLOR, SR_LIMIT_COLOR);
-  lcd_puts(252, 2, str);
+  g_trend_active = (ANALYSIS_TREND == get_analysis_mode());
+  g_trend_count  = 0;
 
-  str = format_sps(sample_rate);
-  lcd_set_color(BG_COLOR, SR_COLOR);
-  lcd_puts(252, 10, str);
+  update_reference_view();
+}
 
-  lcd_set_font(FONT_LARGE);
+//-----------------------------------------------------------------------------
+static void update_histogram(void)
+{
+  capture_reset_measurements();
+  g_trace_column = 0;
 }
 
 //-----------------------------------------------------------------------------
-static void update_sample_rate(void)
+// Any change of the bit rate restarts the accumulation
+static void update_eye(void)
 {
-  int64_t hp_abs = (config.horizontal_position < 0) ? -config.horizontal_position : config.horizontal_position;
-  int64_t window_time = (int64_t)hs_div_value[config.horizontal_scale] * GRID_DIVS_H;
-  int64_t period = BASE_SAMPLE_PERIOD;
-  int64_t trigger_margin, trigger_offset;
-  int64_t buffer_time, required_time;
-  int64_t window_offset;
-  int64_t denom;
-  int sample_rate = BASE_SAMPLE_RATE;
-  int sample_rate_limit;
-  int trigger_offset_px, window_offset_px, window_width_px;
-  int sr_divider = config.sample_rate_limit;
+  g_eye_active = (ANALYSIS_EYE == get_analysis_mode());
+  g_eye_grade_shift = 0;
+  g_trace_column = 0;
 
-  for (int i = 0; i < config.sample_rate_limit; i++)
-  {
-    period *= 2;
-    sample_rate /= 2;
-  }
+  // Hits share the memory with the other modes
+  if (g_eye_active)
+    eye_reset();
 
-  sample_rate_limit = sample_rate;
+  capture_reset_measurements();
 
-  while (1)
-  {
-    trigger_margin = period * TRIGGER_MARGIN_SAMPLES;
-    required_time = trigger_margin + hp_abs + window_time/2;
-    buffer_time = (int64_t)CAPTURE_BUFFER_SIZE * period;
+  update_sample_rate();
+  update_trend();
+}
 
-    if (required_time < window_time)
-      required_time = window_time;
+//-----------------------------------------------------------------------------
+// Any change of the jitter mode restarts the accumulation
+static void update_jitter(void)
+{
+  g_jitter_active = (ANALYSIS_JITTER == get_analysis_mode());
+  g_trace_column = 0;
 
-    if (required_time < buffer_time)
-      break;
+  jitter_reset();
+  capture_reset_measurements();
 
-    sr_divider++;
-    period *= 2;
-    sample_rate /= 2;
-  }
+  update_eye();
+}
 
-  g_calibration_dual_channel = (sr_divider == 0);
+//-----------------------------------------------------------------------------
+static void update_harmonics(void)
+{
+  g_harmonics_active = (ANALYSIS_HARMONICS == get_analysis_mode());
+  g_harmonics.count  = 0;
+  g_trace_column = 0;
 
-  denom = buffer_time - window_time/2 - trigger_margin;
-  trigger_offset = -config.horizontal_position * (buffer_time/2 - trigger_margin) / denom;
-  window_offset = trigger_offset + config.horizontal_position;
+  update_jitter();
+}
 
-  capture_set_horizontal_parameters(sr_divider, CAPTURE_BUFFER_SIZE/2 + trigger_offset / period);
+//-----------------------------------------------------------------------------
+// Any change of the FFT settings restarts the averaging
+static void update_fft(void)
+{
+  g_fft_active = (ANALYSIS_FFT == get_analysis_mode());
+  g_fft_count  = 0;
+  g_trace_column = 0;
 
-  denom = period * CAPTURE_BUFFER_SIZE;
+  update_harmonics();
+}
 
-  trigger_offset_px = (trigger_offset * MINIVIEW_WIDTH) / denom;
-  window_offset_px  = ((window_offset - window_time/2) * MINIVIEW_WIDTH) / denom;
-  window_width_px   = (window_time * MINIVIEW_WIDTH) / denom;
+//-----------------------------------------------------------------------------
+static void update_counter(void)
+{
+  g_counter_active = (ANALYSIS_COUNTER == get_analysis_mode());
 
-  if (window_offset_px == 0)
-    window_offset_px = -1;
+  if (g_logger_active || g_meter_active || g_counter_active)
+    g_measure_page = false;
 
-  if (window_width_px < 3)
-    window_width_px = 3;
+  if (g_counter_active)
+    counter_start(counter_gate_value[config.counter_gate], BASE_SAMPLE_PERIOD * (1 << COUNTER_SR_DIVIDER));
+  else
+    counter_stop();
 
-  draw_miniview(trigger_offset_px, window_offset_px, window_width_px);
-  draw_sample_rates(sample_rate_limit, sample_rate);
+  capture_set_counter(g_counter_active);
+  update_fft();
 }
 
 //-----------------------------------------------------------------------------
-static int clip_for_display(int value)
+static void update_meter(void)
 {
-  value = GRID_HEIGHT/2-1 - value;
-
-  if (value > (GRID_HEIGHT-2))
-    value = (GRID_HEIGHT-2);
-  else if (value < 0)
-    value = 0;
+  g_meter_active = (ANALYSIS_METER == get_analysis_mode());
 
-  return value;
+  capture_set_meter(g_meter_active);
+  update_counter();
 }
 
-//---------------------------------------------------------------------
-static void close_gaps(DisplayBuffer *db)
+//-----------------------------------------------------------------------------
+static void update_logger(void)
 {
-  for (int i = 0; i < GRID_WIDTH-1; i++)
-  {
-    if ((db->flags[i] & SAMPLE_FLAG_VALID) && (db->flags[i+1] & SAMPLE_FLAG_VALID))
-    {
-      if (db->max[i] < (db->min[i+1]-1))
-      {
-        int avg = (db->max[i] + db->min[i+1]) / 2;
-        db->max[i] = avg;
-        db->min[i+1] = avg+1;
-      }
-      else if (db->min[i] > (db->max[i+1] + 1))
-      {
-        int avg = (db->min[i] + db->max[i+1]) / 2;
-        db->min[i] = avg;
-        db->max[i+1] = avg-1;
-      }
-    }
-  }
+  g_logger_active = (ANALYSIS_LOGGER == get_analysis_mode());
+  g_logger_full   = false;
+
+  if (g_logger_active)
+    logger_start(logger_interval_value[config.logger_interval]);
+  else
+    logger_stop();
+
+  capture_set_logger(g_logger_active);
+  update_meter();
 }
 
 //-----------------------------------------------------------------------------
-static void update_display(void)
+// Displayed trace becomes the golden waveform. If it can't be saved, it is
+// used until the next start and the saved mask is kept.
+static bool create_mask(void)
 {
-  int scale = vs_px_value[config.vertical_scale];
+  int id = mask_create(g_display_buffer.min, g_display_buffer.max, g_display_buffer.flags);
+  int old;
 
-  g_data_buffer.size = GRID_WIDTH;
-  capture_get_data(&g_data_buffer);
+  config.mask_test = true;
 
-  for (int i = 0; i < GRID_WIDTH; i++)
-  {
-    int min = (g_data_buffer.min[i] - g_data_buffer.vertical_position) / scale + config.vertical_position;
-    int max = (g_data_buffer.max[i] - g_data_buffer.vertical_position) / scale + config.vertical_position;
+  g_mask_active = true;
+  g_mask_total  = 0;
+  g_mask_fails  = 0;
 
-    g_display_buffer.min[i]   = clip_for_display(max);
-    g_display_buffer.max[i]   = clip_for_display(min);
-    g_display_buffer.flags[i] = g_data_buffer.flags[i];
-  }
+  if (id < 0)
+    return false;
 
-  close_gaps(&g_display_buffer);
-  redraw_trace();
+  // Masks left behind by a reset to defaults are deleted as well
+  while ((old = storage_get_prev(STORAGE_TYPE_MASK, id)) > 0)
+    storage_delete(old);
+
+  config.mask_id = id;
+
+  return true;
 }
 
 //-----------------------------------------------------------------------------
-static void change_horizontal_scale(int delta)
+static void update_mask_test(void)
 {
-  if ((delta < 0 && config.horizontal_scale == 0) ||
-      (delta > 0 && config.horizontal_scale == HS_LAST))
-    return;
+  g_mask_total = 0;
+  g_mask_fails = 0;
 
-  config.horizontal_scale += delta;
-  config.horizontal_position_px = config.horizontal_position / hs_px_value[config.horizontal_scale];
-  config.horizontal_period = hs_px_value[config.horizontal_scale];
+  if (config.mask_test && !mask_load(config.mask_id))
+    create_mask();
 
-  draw_horizontal_scale();
-  draw_horizontal_position();
-  update_sample_rate();
-  update_display();
+  g_mask_active = config.mask_test;
 }
 
 //-----------------------------------------------------------------------------
-static void change_horizontal_position(int delta)
+static void update_mask_margin(void)
 {
-  int div = hs_px_value[config.horizontal_scale];
-
-  if ((delta < 0 && config.horizontal_position <= MIN_HORIZONTAL_POSITION) ||
-      (delta > 0 && config.horizontal_position >= MAX_HORIZONTAL_POSITION))
-    return;
+  mask_set_margin(config.mask_margin);
+}
 
-  config.horizontal_position_px = config.horizontal_position / div + delta;
-  config.horizontal_position = (int64_t)config.horizontal_position_px * div;
+//-----------------------------------------------------------------------------
+static void new_mask(void)
+{
+  if (create_mask())
+    draw_message("Mask saved");
+  else
+    draw_message("Mask not saved");
 
-  draw_horizontal_position();
-  update_sample_rate();
   update_display();
 }
 
 //-----------------------------------------------------------------------------
-static void change_vertical_scale(int delta)
+static void update_mask_result(void)
 {
-  if ((delta < 0 && config.vertical_scale == 0) ||
-      (delta > 0 && config.vertical_scale == VS_LAST))
+  g_mask_total++;
+
+  if (!g_mask_failed)
     return;
 
-  config.vertical_scale += delta;
-  config.vertical_mult = config.calib_vs_mult[config.vertical_scale];
-  config.vertical_position_mv = config.vertical_position * vs_px_value[config.vertical_scale];
+  g_mask_fails++;
 
-  config.trigger_level_mv = config.trigger_level * vs_px_value[config.vertical_scale];
+  if (config.mask_stop)
+  {
+    capture_stop();
+    draw_message("Mask test failed");
+  }
+}
 
-  capture_set_vertical_parameters();
-  capture_set_trigger_level(config.trigger_level_mv);
-  draw_vertical_scale();
-  draw_trigger_level();
-  update_display();
+//-----------------------------------------------------------------------------
+static int get_trend_value(void)
+{
+  Measurements *m = &g_data_buffer.measure;
+
+  if (TREND_VPP == config.trend)
+    return m->vpp;
+  else if (TREND_FREQUENCY == config.trend)
+    return m->frequency / 1000;
+  else if (TREND_RMS == config.trend)
+    return m->vrms;
+  else
+    return m->duty;
 }
 
 //-----------------------------------------------------------------------------
-static void change_vertical_position(int delta)
+static char *format_trend_value(int value)
 {
-  if ((delta < 0 && config.vertical_position <= MIN_VERTICAL_POSITION) ||
-      (delta > 0 && config.vertical_position >= MAX_VERTICAL_POSITION))
-    return;
+  if (TREND_FREQUENCY == config.trend)
+    return format_frequency(value);
+  else if (TREND_DUTY == config.trend)
+    return format_percent(value);
+  else
+    return format_voltage(value, false);
+}
 
-  config.vertical_position += delta;
-  config.vertical_position_mv = config.vertical_position * vs_px_value[config.vertical_scale];
+//-----------------------------------------------------------------------------
+static void update_trend_range(void)
+{
+  int count = (g_trend_count < TREND_WIDTH) ? g_trend_count : TREND_WIDTH;
+  int min = INT32_MAX;
+  int max = INT32_MIN;
+  int pad;
 
-  capture_set_vertical_parameters();
-  draw_vertical_position(true);
-  draw_trigger_level();
-  update_display();
+  for (int i = 0; i < count; i++)
+  {
+    if (overlay.mode.trend[i] < min)
+      min = overlay.mode.trend[i];
+
+    if (overlay.mode.trend[i] > max)
+      max = overlay.mode.trend[i];
+  }
+
+  pad = (max - min) / 8 + 1;
+
+  g_trend_bottom = min - pad;
+  g_trend_top    = max + pad;
 }
 
 //-----------------------------------------------------------------------------
-static void change_trigger_level(int delta)
+// Only the newest column and the gap after it are redrawn, unless the value
+// does not fit into the current range
+static void add_trend_sample(void)
 {
-  if ((delta < 0 && config.trigger_level == MIN_TRIGGER_LEVEL) ||
-      (delta > 0 && config.trigger_level == MAX_TRIGGER_LEVEL))
+  int value = get_trend_value();
+  int x = g_trend_count % TREND_WIDTH;
+
+  overlay.mode.trend[x] = value;
+  g_trend_count++;
+
+  // Points are still collected while the measurement page is shown
+  if (1 == g_trend_count || value <= g_trend_bottom || value >= g_trend_top)
+  {
+    update_trend_range();
+
+    if (!g_measure_page)
+      g_trace_column = 0;
+  }
+  else if (!g_measure_page)
+  {
+    draw_trend_column(x);
+    draw_trend_column((x + 1) % TREND_WIDTH);
+  }
+
+  if (g_toast_active)
     return;
 
-  config.trigger_level += delta;
-  config.trigger_level_mv = config.trigger_level * vs_px_value[config.vertical_scale];
+  lcd_set_color(BG_COLOR, MEASURE_MODE_COLOR);
+  lcd_putc(140, STATUS_LINE_Y, 'T');
+
+  lcd_set_color(BG_COLOR, MEASURE_VOLTAGE_COLOR);
+  lcd_puts(148, STATUS_LINE_Y, format_trend_value(value));
+}
 
-  capture_set_trigger_level(config.trigger_level_mv);
-  draw_trigger_level();
+//-----------------------------------------------------------------------------
+static int fft_first_bin(int x, int bins)
+{
+  return (x * bins) / FFT_WIDTH;
 }
 
 //-----------------------------------------------------------------------------
-static void change_sample_rate_limit(int delta)
+// Peaks are the strongest local maximums outside of the DC lobe, at least
+// FFT_PEAK_SPACING columns apart
+static void find_fft_peaks(int bins)
 {
-  if ((delta < 0 && config.sample_rate_limit == 0) ||
-      (delta > 0 && config.sample_rate_limit == MAX_SAMPLE_RATE_LIMIT))
-    return;
+  int width = fft_window_width(config.fft_window);
 
-  config.sample_rate_limit += delta;
+  for (int i = 0; i < FFT_PEAKS; i++)
+  {
+    int best = -1;
 
-  update_sample_rate();
+    for (int x = 1; x < FFT_WIDTH-1; x++)
+    {
+      uint32_t power = overlay.fft.power[x];
+      bool near = false;
+
+      if (fft_first_bin(x, bins) <= width || overlay.fft.level[x] >= GRID_HEIGHT-2 ||
+          power < overlay.fft.power[x-1] || power < overlay.fft.power[x+1])
+        continue;
+
+      for (int j = 0; j < i; j++)
+        near |= (g_fft_peaks[j] >= 0 && x > g_fft_peaks[j] - FFT_PEAK_SPACING &&
+            x < g_fft_peaks[j] + FFT_PEAK_SPACING);
+
+      if (!near && (best < 0 || power > overlay.fft.power[best]))
+        best = x;
+    }
+
+    g_fft_peaks[i] = best;
+  }
 }
 
 //-----------------------------------------------------------------------------
-static void change_calibration_value(int delta, bool shift)
+// Each column holds the strongest bin of its range, so the narrow peaks are
+// not lost when there are more bins than columns. Levels are relative to a
+// full scale sine at the top of the grid.
+static void add_fft_sample(void)
 {
-  if (shift)
-  {
-    if (g_calibration_parameter == CALIB_OFFSET)
-      g_calibration_parameter = CALIB_ZERO;
-    else
-      g_calibration_parameter++;
+  CaptureRecord record;
+  int n = fft_size_value[config.fft_size];
+  int shift = (g_fft_count > 0) ? config.fft_average * 2 : 0;
+  int gain = fft_window_gain(config.fft_window);
+  int full_scale = 2 * fft_db(gain / 4);
+  int bins, start, peak, bin;
+  uint32_t max;
+
+  if (!capture_get_record(&record))
+    return;
 
-    lcd_fill_rect(CALIB_AREA_LEFT, GRID_BOTTOM+1, CALIB_AREA_WIDTH, STATUS_LINE_HEIGHT, BG_COLOR);
+  while (n > record.size)
+    n /= 2;
 
+  if (n < FFT_MIN_SIZE)
     return;
-  }
 
-  if (g_calibration_parameter == CALIB_ZERO)
-  {
-    config.calib_dac_zero += delta;
+  // Window is centered on the trigger point when possible
+  start = -record.min_index - n/2;
 
-    if (config.calib_dac_zero < 1900)
-      config.calib_dac_zero = 1900;
-    else if (config.calib_dac_zero > 2200)
-      config.calib_dac_zero = 2200;
-  }
-  else if (g_calibration_parameter == CALIB_DELTA)
-  {
-    config.calib_channel_delta += delta;
+  if (start > record.size - n)
+    start = record.size - n;
 
-    if (config.calib_channel_delta < -64)
-      config.calib_channel_delta = -64;
-    else if (config.calib_channel_delta > 64)
-      config.calib_channel_delta = 64;
-  }
-  else if (g_calibration_parameter == CALIB_SCALE)
-  {
-    config.calib_vs_mult[config.vertical_scale] += delta;
+  if (start < 0)
+    start = 0;
 
-    if (config.calib_vs_mult[config.vertical_scale] < 0)
-      config.calib_vs_mult[config.vertical_scale] = 0;
-    else if (config.calib_vs_mult[config.vertical_scale] > 4000000)
-      config.calib_vs_mult[config.vertical_scale] = 4000000;
-  }
-  else if (g_calibration_parameter == CALIB_OFFSET)
+  capture_lock(true);
+  fft_calc(record.data, record.size, record.offset, start, n, config.fft_window);
+  capture_lock(false);
+
+  bins = n / 2;
+
+  for (int x = 0; x < FFT_WIDTH; x++)
   {
-    config.calib_dac_mult[config.vertical_scale] += delta;
+    int first = fft_first_bin(x, bins);
+    int last = fft_first_bin(x + 1, bins);
+    int level;
 
-    if (config.calib_dac_mult[config.vertical_scale] < 0)
-      config.calib_dac_mult[config.vertical_scale] = 0;
-    else if (config.calib_dac_mult[config.vertical_scale] > 100000)
-      config.calib_dac_mult[config.vertical_scale] = 100000;
+    max = 0;
+
+    for (int i = first; i < last || i == first; i++)
+    {
+      uint32_t power = fft_get_power(i);
+
+      if (power > max)
+        max = power;
+    }
+
+    overlay.fft.power[x] += (int32_t)(max - overlay.fft.power[x]) >> shift;
+
+    level = ((full_scale - fft_db(overlay.fft.power[x])) * GRID_DIV_PX) / (FFT_DB_PER_DIV * 256);
+
+    if (level < 0)
+      level = 0;
+    else if (level > GRID_HEIGHT-2)
+      level = GRID_HEIGHT-2;
+
+    overlay.fft.level[x] = level;
   }
 
-  capture_set_vertical_parameters();
-}
+  g_fft_count++;
 
-//-----------------------------------------------------------------------------
-static void draw_calibration_info(void)
-{
-  static const char *labels[] = { "Z", "D", "S", "O" };
-  char *str;
+  find_fft_peaks(bins);
 
-  lcd_set_color(BG_COLOR, LCD_WHITE_COLOR);
+  if (!g_measure_page)
+    g_trace_column = 0;
 
-  if (!g_toast_active)
-    lcd_puts(CALIB_AREA_LEFT, STATUS_LINE_Y, labels[g_calibration_parameter]);
+  if (g_toast_active)
+    return;
 
-  g_data_buffer.size = GRID_WIDTH;
+  lcd_set_color(BG_COLOR, MEASURE_MODE_COLOR);
+  lcd_putc(140, STATUS_LINE_Y, 'F');
 
-  if (g_calibration_parameter == CALIB_ZERO || g_calibration_parameter == CALIB_DELTA)
+  peak = g_fft_peaks[0];
+
+  if (peak < 0)
   {
-    if ((g_calibration_parameter == CALIB_ZERO) == g_calibration_dual_channel)
-      lcd_set_color(BG_COLOR, LCD_RED_COLOR);
+    lcd_set_color(BG_COLOR, MEASURE_FREQ_COLOR);
+    lcd_puts(148, STATUS_LINE_Y, "     ---   ");
+    lcd_set_color(BG_COLOR, MEASURE_VOLTAGE_COLOR);
+    lcd_puts(236, STATUS_LINE_Y, "   ---    ");
+    return;
+  }
 
-    capture_get_raw_data(g_data_buffer.max, GRID_WIDTH/2);
+  // Frequency is the center of the strongest bin of the peak column
+  bin = fft_first_bin(peak, bins);
+  max = 0;
 
-    if (g_calibration_dual_channel)
+  for (int i = bin; i < fft_first_bin(peak + 1, bins); i++)
+  {
+    if (fft_get_power(i) > max)
     {
-      for (int i = 1; i < GRID_WIDTH/2; i += 2)
-        g_data_buffer.max[i] = rbit8(g_data_buffer.max[i]) + config.calib_channel_delta;
+      max = fft_get_power(i);
+      bin = i;
     }
+  }
 
-    if (!g_toast_active)
-    {
-      str = format_raw_data(g_data_buffer.max, 4);
-      lcd_puts(CALIB_AREA_LEFT + 24, STATUS_LINE_Y, str);
-    }
+  lcd_set_color(BG_COLOR, MEASURE_FREQ_COLOR);
+  lcd_puts(148, STATUS_LINE_Y, format_frequency_fine((bin * 1000000000000LL) /
+      ((int64_t)record.period * n)));
 
-    #define PIXEL_SIZE 15
-    for (int i = 0; i < GRID_WIDTH/2; i++)
-    {
-      g_data_buffer.max[i] -= ZERO_POINT;
-      g_data_buffer.min[i] = g_data_buffer.max[i];
+  // RMS voltage of a sine with this peak power is
+  // sqrt(power) * 512 * vs_mult / (gain * CALIB_MULTIPLIER * 1000 * sqrt(2)) V
+  lcd_set_color(BG_COLOR, MEASURE_VOLTAGE_COLOR);
+  lcd_puts(236, STATUS_LINE_Y, format_dbv(((fft_db(overlay.fft.power[peak]) +
+      2 * fft_db(record.vs_mult) - 2 * fft_db(gain * 2828)) * 10) / 256));
+}
 
-      if (0 == i % PIXEL_SIZE)
-      {
-        g_data_buffer.max[GRID_WIDTH/2 + i] = 0;
-        g_data_buffer.min[GRID_WIDTH/2 + i] = 0;
-      }
-      else
-      {
-        int value = g_data_buffer.max[i / PIXEL_SIZE] * PIXEL_SIZE;
-        g_data_buffer.max[GRID_WIDTH/2 + i] = value + PIXEL_SIZE/2;
-        g_data_buffer.min[GRID_WIDTH/2 + i] = value - PIXEL_SIZE/2;
-      }
-    }
+//-----------------------------------------------------------------------------
+// Rows of the cells follow the vertical scale of the trace. Levels of the
+// crossings are the top and base measurements converted back to ADC counts.
+static void add_eye_sample(void)
+{
+  static char buf[24] = "Bit rate ";
+  Measurements *m = &g_data_buffer.measure;
+  int scale = vs_px_value[config.vertical_scale];
+  int rate = (config.eye_rate > EYE_AUTO) ? uart_baud_value[config.eye_rate - EYE_AUTO - 1] : 0;
+  uint8_t rows[256];
+  const uint8_t *hits = eye_get_hits();
+  CaptureRecord record;
+  EyeResult result;
+  int top, base, max = 0;
+  bool valid;
+
+  if (!m->valid || !capture_get_record(&record))
+    return;
 
-    for (int i = 0; i < GRID_WIDTH; i++)
-    {
-      g_display_buffer.min[i]   = clip_for_display(g_data_buffer.max[i]);
-      g_display_buffer.max[i]   = clip_for_display(g_data_buffer.min[i]);
-      g_display_buffer.flags[i] = SAMPLE_FLAG_VALID;
-    }
+  for (int i = 0; i < 256; i++)
+  {
+    int mv = ((i - ZERO_POINT) * record.vs_mult + record.vs_mult/2) / CALIB_MULTIPLIER;
+    int y = GRID_HEIGHT/2-1 - ((mv - g_data_buffer.vertical_position) / scale + config.vertical_position);
 
-    redraw_trace();
+    rows[i] = (y >= 0 && y < EYE_HEIGHT * EYE_CELL_HEIGHT) ? y / EYE_CELL_HEIGHT : EYE_NO_ROW;
   }
-  else // if (g_calibration_parameter == CALIB_SCALE || g_calibration_parameter == CALIB_OFFSET)
+
+  top  = ((m->vtop + record.vpos) * CALIB_MULTIPLIER) / record.vs_mult + ZERO_POINT;
+  base = ((m->vbase + record.vpos) * CALIB_MULTIPLIER) / record.vs_mult + ZERO_POINT;
+
+  capture_lock(true);
+  eye_set_rows(rows, record.vs_mult);
+  eye_add(record.data, record.size, record.offset, record.period, base, top, rate);
+  capture_lock(false);
+
+  for (int i = 0; i < EYE_WIDTH * EYE_HEIGHT; i++)
   {
-    update_display();
+    if (hits[i] > max)
+      max = hits[i];
+  }
 
-    int vmin = g_data_buffer.min_value;
-    int vmax = g_data_buffer.max_value;
-    int vpos = g_data_buffer.vertical_position;
+  g_eye_grade_shift = 32 - __CLZ(max);
 
-    if (!g_toast_active)
-    {
-      str = format_voltage(vmin - vpos, true);
-      lcd_puts(CALIB_AREA_LEFT + 12, STATUS_LINE_Y, str);
+  if (!g_measure_page)
+    g_trace_column = 0;
 
-      str = format_voltage(vmax - vpos, true);
-      lcd_puts(CALIB_AREA_LEFT + 96, STATUS_LINE_Y, str);
-    }
+  valid = eye_get(&result);
+
+  // Detected rate is shown every time the accumulation starts over
+  if (0 == rate && 1 == result.records)
+  {
+    append_number(&buf[9], result.rate);
+    strcat(buf, " bps");
+    draw_message(buf);
   }
+
+  if (g_toast_active)
+    return;
+
+  lcd_set_color(BG_COLOR, MEASURE_MODE_COLOR);
+  lcd_putc(140, STATUS_LINE_Y, 'E');
+
+  lcd_set_color(BG_COLOR, MEASURE_VOLTAGE_COLOR);
+  lcd_puts(148, STATUS_LINE_Y, valid ? format_voltage(result.height / 1000, false) : "   ---    ");
+
+  lcd_set_color(BG_COLOR, MEASURE_FREQ_COLOR);
+  lcd_puts(236, STATUS_LINE_Y, valid ? format_time_fine(result.width) : "   ---    ");
 }
 
 //-----------------------------------------------------------------------------
-static void draw_status_line(void)
+static const MenuItem g_menu_items[] =
 {
-  lcd_fill_rect(GRID_LEFT, GRID_BOTTOM+1, GRID_WIDTH+1, STATUS_LINE_HEIGHT, BG_COLOR);
+  { "Record length",  &config.record_length,  RECORD_LENGTH_AUTO, RECORD_LENGTH_LAST,
+      record_length_str, NULL, update_sample_rate },
+  { "Deep memory",    &config.deep_length,    DEEP_LENGTH_OFF, DEEP_LENGTH_LAST,
+      deep_length_str, NULL, update_sample_rate },
+  { "Reference 1",    &config.reference[0],   0, INT32_MAX,
+      NULL, format_reference, update_references_selection },
+  { "Reference 2",    &config.reference[1],   0, INT32_MAX,
+      NULL, format_reference, update_references_selection },
+  { "Reference 3",    &config.reference[2],   0, INT32_MAX,
+      NULL, format_reference, update_references_selection },
+  { "Reference 4",    &config.reference[3],   0, INT32_MAX,
+      NULL, format_reference, update_references_selection },
+  { "Change capture", &config.anomaly_capture, 0, 1,
+      off_on_str, NULL, update_anomaly_capture },
+  { "Change margin",  &config.anomaly_margin,  0, 64,
+      NULL, NULL, update_anomaly_capture },
+  { "Mask test",      &config.mask_test,       0, 1,
+      off_on_str, NULL, update_mask_test },
+  { "Mask margin",    &config.mask_margin,     0, 50,
+      NULL, NULL, update_mask_margin },
+  { "Stop on fail",   &config.mask_stop,       0, 1,
+      off_on_str, NULL, NULL },
+  { "Logger",         &config.logger_interval, 0, ARRAY_SIZE(logger_interval_value)-1,
+      logger_interval_str, NULL, update_logger },
+  { "Freq source",    &config.frequency_source, FREQUENCY_SOURCE_EDGES, FREQUENCY_SOURCE_AUTOCORR,
+      frequency_source_str, NULL, capture_reset_measurements },
+  { "Trend",          &config.trend,           TREND_OFF, TREND_LAST,
+      trend_str, NULL, update_trend },
+  { "Meter",          &config.meter,           0, 1,
+      off_on_str, NULL, update_meter },
+  { "Counter",        &config.counter_gate,    0, ARRAY_SIZE(counter_gate_value)-1,
+      counter_gate_str, NULL, update_counter },
+  { "FFT",            &config.fft_size,        0, ARRAY_SIZE(fft_size_value)-1,
+      fft_size_str, NULL, update_fft },
+  { "FFT window",     &config.fft_window,      FFT_WINDOW_HANN, FFT_WINDOW_BLACKMAN,
+      fft_window_str, NULL, update_fft },
+  { "FFT average",    &config.fft_average,     0, ARRAY_SIZE(fft_average_str)-1,
+      fft_average_str, NULL, update_fft },
+  { "Harmonics",      &config.harmonics,       0, 1,
+      off_on_str, NULL, update_harmonics },
+  { "Histogram",      &config.histogram,       0, 1,
+      off_on_str, NULL, update_histogram },
+  { "Jitter",         &config.jitter,          JITTER_OFF, JITTER_PERIOD,
+      jitter_str, NULL, update_jitter },
+  { "Eye bit rate",   &config.eye_rate,        EYE_OFF, EYE_AUTO + ARRAY_SIZE(uart_baud_value),
+      NULL, format_eye_rate, update_eye },
+  { "Trigger type",   &config.trigger_type,   TRIGGER_TYPE_EDGE, TRIGGER_TYPE_VIDEO,
+      trigger_type_str, NULL, update_trigger_type },
+  { "UART baud",      &config.uart_baud,      0, ARRAY_SIZE(uart_baud_value)-1,
+      uart_baud_str, NULL, update_uart_trigger },
+  { "UART polarity",  &config.uart_inverted,  0, 1,
+      uart_polarity_str, NULL, update_uart_trigger },
+  { "UART value",     &config.uart_value,     0, 0xff,
+      NULL, format_hex_byte, update_uart_trigger },
+  { "UART mask",      &config.uart_mask,      0, 0xff,
+      NULL, format_hex_byte, update_uart_trigger },
+  { "Video standard", &config.video_standard, VIDEO_STANDARD_PAL, VIDEO_STANDARD_NTSC,
+      video_standard_str, NULL, update_video_trigger },
+  { "Video sync",     &config.video_sync,     VIDEO_SYNC_FIELD_ANY, VIDEO_SYNC_ALL_LINES,
+      video_sync_str, NULL, update_video_trigger },
+  { "Video line",     &config.video_line,     0, VIDEO_PAL_LINES-1,
+      NULL, format_video_line, update_video_trigger },
+};
 
-  draw_vertical_scale();
-  draw_ac_dc();
-  draw_horizontal_scale();
-  draw_horizontal_position();
-  draw_trigger_level();
-  draw_trigger_edge();
-  draw_measure();
+//-----------------------------------------------------------------------------
+static void toggle_menu(void)
+{
+  if (menu_active())
+  {
+    menu_close();
+    g_trace_column = 0;
+    draw_status_line();
+    update_display();
+  }
+  else
+  {
+    menu_open(g_menu_items, ARRAY_SIZE(g_menu_items));
+  }
 }
 
 //-----------------------------------------------------------------------------
@@ -983,6 +2879,20 @@ void scope_buttons_handler(int buttons)
   bool shift  = (buttons & BTN_SHIFT);
   bool repeat = (buttons & BTN_REPEAT);
 
+  if (buttons & BTN_MENU)
+  {
+    if (!repeat && !g_calibration_mode)
+      toggle_menu();
+
+    return;
+  }
+
+  if (menu_active())
+  {
+    menu_buttons_handler(buttons);
+    return;
+  }
+
   if ((buttons & BTN_UP) && (buttons & BTN_DOWN))
   {
     config.vertical_position = 0;
@@ -1020,6 +2930,8 @@ void scope_buttons_handler(int buttons)
   {
     if (shift)
       change_horizontal_scale(-1);
+    else if (g_history_index >= 0)
+      show_history(g_history_index + 1);
     else
       change_horizontal_position(1);
   }
@@ -1027,6 +2939,8 @@ void scope_buttons_handler(int buttons)
   {
     if (shift)
       change_horizontal_scale(1);
+    else if (g_history_index >= 0)
+      show_history(g_history_index - 1);
     else
       change_horizontal_position(-1);
   }
@@ -1090,18 +3004,57 @@ void scope_buttons_handler(int buttons)
 
   else if (buttons & BTN_MODE)
   {
-    config.measure_display = !config.measure_display;
+    // Trigger parameters -> measurements -> measurement page
+    if (!config.measure_display)
+    {
+      config.measure_display = true;
+    }
+    else if (!g_measure_page && !g_logger_active && !g_meter_active && !g_counter_active &&
+        !g_calibration_mode)
+    {
+      g_measure_page = true;
+    }
+    else
+    {
+      config.measure_display = false;
+      g_measure_page = false;
+    }
+
     g_measure_timer = config.measure_display ? MEASURE_UPDATE_TIMEOUT : TIMER_DISABLE;
+    g_trace_column = 0;
     draw_status_line();
   }
 
   else if (buttons & BTN_SAVE)
   {
+    if (repeat || g_calibration_mode)
+      return;
+
+    if (shift)
+      recall_waveform();
+    else
+      save_waveform();
+  }
+
+  else if (buttons & BTN_F1)
+  {
+    if (repeat || g_calibration_mode)
+      return;
+
+    if (shift)
+      new_mask();
+    else
+      draw_stats();
   }
 
   else if (buttons & BTN_STOP)
   {
-    if (capture_get_state() == CAPTURE_STATE_STOP)
+    if (shift)
+    {
+      if (!repeat && !g_calibration_mode)
+        toggle_history();
+    }
+    else if (capture_get_state() == CAPTURE_STATE_STOP)
       capture_start();
     else
       capture_stop();
@@ -1116,6 +3069,13 @@ void scope_init(bool calibration_mode)
   config.horizontal_period = hs_px_value[config.horizontal_scale];
   config.vertical_mult = config.calib_vs_mult[config.vertical_scale];
 
+  // Settings saved with the removed rates above 921600
+  if (config.uart_baud >= ARRAY_SIZE(uart_baud_value))
+    config.uart_baud = ARRAY_SIZE(uart_baud_value) - 1;
+
+  if (config.eye_rate > EYE_AUTO + ARRAY_SIZE(uart_baud_value))
+    config.eye_rate = EYE_AUTO + ARRAY_SIZE(uart_baud_value);
+
   grid_init();
   draw_grid_frame();
   draw_vertical_position(false);
@@ -1135,11 +3095,65 @@ void scope_init(bool calibration_mode)
     capture_set_trigger_edge(config.trigger_edge);
     capture_set_trigger_mode(config.trigger_mode);
     capture_set_trigger_level(config.trigger_level_mv);
+    capture_set_uart_trigger(uart_baud_value[config.uart_baud], config.uart_inverted,
+        config.uart_value, config.uart_mask);
+    update_video_trigger();
+    capture_set_trigger_type(config.trigger_type);
+    capture_set_anomaly(config.anomaly_capture, config.anomaly_margin);
+  }
+
+  // Saved mask may be gone since the last run
+  mask_set_margin(config.mask_margin);
+  g_mask_active = !g_calibration_mode && config.mask_test && mask_load(config.mask_id);
+
+  if (!g_calibration_mode)
+    config.mask_test = g_mask_active;
+
+  // Logging is resumed after a restart, records go into a new segment
+  if (!g_calibration_mode && ANALYSIS_LOGGER == get_analysis_mode())
+  {
+    g_logger_active = true;
+    logger_start(logger_interval_value[config.logger_interval]);
+    capture_set_logger(true);
+  }
+
+  if (!g_calibration_mode)
+  {
+    int mode = get_analysis_mode();
+
+    g_meter_active     = (ANALYSIS_METER == mode);
+    g_counter_active   = (ANALYSIS_COUNTER == mode);
+    g_fft_active       = (ANALYSIS_FFT == mode);
+    g_harmonics_active = (ANALYSIS_HARMONICS == mode);
+    g_jitter_active    = (ANALYSIS_JITTER == mode);
+    g_eye_active       = (ANALYSIS_EYE == mode);
+    g_trend_active     = (ANALYSIS_TREND == mode);
+    g_reference_shown  = (ANALYSIS_OFF == mode);
+
+    capture_set_meter(g_meter_active);
+
+    if (g_counter_active)
+      counter_start(counter_gate_value[config.counter_gate], BASE_SAMPLE_PERIOD * (1 << COUNTER_SR_DIVIDER));
+
+    capture_set_counter(g_counter_active);
+  }
+
+  for (int i = 0; i < REFERENCE_COUNT; i++)
+  {
+    // Saved waveform may be gone since the last run
+    if (!g_calibration_mode && !reference_set(i, config.reference[i]))
+      config.reference[i] = 0;
+
+    g_reference_id[i] = config.reference[i];
   }
 
   timer_add(&g_toast_timer);
   timer_add(&g_state_timer);
   timer_add(&g_measure_timer);
+  timer_add(&g_stats_timer);
+
+  g_stats_timer = STATS_UPDATE_TIMEOUT;
+  g_stats_time  = timer_get_uptime();
 
   g_measure_timer = config.measure_display ? MEASURE_UPDATE_TIMEOUT : TIMER_DISABLE;
 
@@ -1151,18 +3165,52 @@ void scope_init(bool calibration_mode)
 //-----------------------------------------------------------------------------
 void scope_task(void)
 {
-  if (trace_ready())
+  if (!menu_active())
   {
-    if (capture_buffer_updated())
+    if (trace_ready())
     {
-      if (g_calibration_mode)
-        draw_calibration_info();
-      else
-        update_display();
+      if (g_logger_active)
+      {
+        if (logger_get_total() != g_logger_total)
+          update_display();
+      }
+      else if (g_meter_active)
+      {
+        if (meter_get_total() != g_meter_total)
+          draw_meter();
+      }
+      else if (g_counter_active)
+      {
+        if (counter_get_total() != g_counter_total)
+          draw_counter();
+      }
+      else if (capture_buffer_updated())
+      {
+        if (g_calibration_mode)
+        {
+          draw_calibration_info();
+        }
+        else
+        {
+          update_display();
+
+          if (g_mask_active)
+            update_mask_result();
+
+          if (g_trend_active)
+            add_trend_sample();
+
+          if (g_fft_active)
+            add_fft_sample();
+
+          if (g_eye_active)
+            add_eye_sample();
+        }
+      }
     }
-  }
 
-  draw_trace();
+    draw_trace();
+  }
 
   if (CAPTURE_STATE_WAIT == capture_get_state())
   {
@@ -1192,6 +3240,28 @@ void scope_task(void)
     }
   }
 
+  // Capture was started, the history view is gone
+  if (g_history_index >= 0 && CAPTURE_STATE_STOP != capture_get_state())
+    g_history_index = -1;
+
+  if (g_wave_saving && !wave_busy())
+  {
+    g_wave_saving = false;
+    draw_message(wave_failed() ? "Storage is full" : "Waveform saved");
+  }
+
+  if (g_logger_active && !g_logger_full && logger_full())
+  {
+    g_logger_full = true;
+    draw_message("Storage full, logger stopped");
+  }
+
+  if (g_stats_timer == 0)
+  {
+    g_stats_timer = STATS_UPDATE_TIMEOUT;
+    update_stats();
+  }
+
   if (config.measure_display)
   {
     if (g_measure_timer == 0)
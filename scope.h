@@ -29,6 +29,37 @@
 #ifndef _SCOPE_H_
 #define _SCOPE_H_
 
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+
+/*- Definitions -------------------------------------------------------------*/
+#define GRID_CENTER_X          160
+#define GRID_CENTER_Y          120
+#define GRID_LEFT              10
+#define GRID_RIGHT             310
+#define GRID_TOP               20
+#define GRID_BOTTOM            220
+#define GRID_WIDTH             300
+#define GRID_HEIGHT            200
+#define GRID_DIV_PX            25
+#define GRID_DIVS_H            12
+#define GRID_DIVS_V            10
+
+#define TREND_WIDTH            (GRID_WIDTH-1) // Same as the trace
+#define FFT_WIDTH              (GRID_WIDTH-1)
+
+#define STATUS_LINE_Y          223
+#define STATUS_LINE_HEIGHT     16
+
+/*- Types -------------------------------------------------------------------*/
+typedef struct
+{
+  uint8_t  min[GRID_WIDTH];
+  uint8_t  max[GRID_WIDTH];
+  uint8_t  flags[GRID_WIDTH];
+} DisplayBuffer;
+
 /*- Prototypes --------------------------------------------------------------*/
 void scope_init(bool calibration_mode);
 void scope_buttons_handler(int buttons);
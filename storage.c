@@ -0,0 +1,720 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "gd32f4xx.h"
+#include "utils.h"
+#include "flash.h"
+#include "storage.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define STORAGE_FLASH_OFFSET   (4 * 1024 * 1024) // Lower half is used by the deep memory
+#define STORAGE_BLOCK_COUNT    ((FLASH_SIZE - STORAGE_FLASH_OFFSET) / FLASH_BLOCK_SIZE)
+#define STORAGE_MARKER_OFFSET  FLASH_PAGE_SIZE
+#define STORAGE_DATA_OFFSET    (FLASH_PAGE_SIZE * 2)
+#define STORAGE_DATA_SIZE      (FLASH_BLOCK_SIZE - STORAGE_DATA_OFFSET)
+#define STORAGE_MIN_FREE       2
+#define STORAGE_BUFFER_SIZE    (4 * FLASH_PAGE_SIZE)
+
+#define ERASE_HEADER_MAGIC     0x4b4c4253 // "SBLK"
+#define OBJECT_HEADER_MAGIC    0x4a424f53 // "SOBJ"
+
+enum
+{
+  BLOCK_DIRTY,
+  BLOCK_ERASED,
+  BLOCK_FREE,
+  BLOCK_OPEN,
+  BLOCK_USED,
+};
+
+enum
+{
+  OP_NONE,
+  OP_ERASE,
+  OP_ERASE_HEADER,
+  OP_MARKER,
+  OP_DATA,
+  OP_OBJECT_HEADER,
+};
+
+/*- Types -------------------------------------------------------------------*/
+// Block layout:
+//   page 0  - erase header, written right after the block is erased
+//   page 1  - allocation marker (first byte), written before any data, and
+//             object header (at offset 16), written once the block is full
+//             or the object is closed
+//   page 2+ - object data
+typedef struct
+{
+  uint32_t magic;
+  uint32_t erase_count;
+  uint32_t crc;
+} EraseHeader;
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t id;
+  uint32_t type;
+  uint32_t part;
+  uint32_t size;
+  uint32_t last;
+  uint32_t reclaim;
+  uint32_t crc;
+} ObjectHeader;
+
+typedef struct
+{
+  uint8_t      marker[16];
+  ObjectHeader header;
+} MarkerPage;
+
+typedef struct
+{
+  uint32_t erase_count;
+  uint32_t id;
+  uint16_t size;
+  uint8_t  state;
+  uint8_t  type;
+  uint8_t  part;
+  uint8_t  last;
+  uint8_t  reclaim;
+} BlockInfo;
+
+/*- Variables ---------------------------------------------------------------*/
+static const uint8_t g_marker = 0;
+static bool g_ready = false;
+static BlockInfo g_blocks[STORAGE_BLOCK_COUNT];
+static uint32_t g_next_id;
+static uint32_t g_failed_id;
+
+static FlashRequest g_request;
+static int g_op = OP_NONE;
+static int g_op_block;
+static int g_op_size;
+static EraseHeader g_erase_header;
+static ObjectHeader g_object_header;
+
+static bool g_writer_active = false;
+static bool g_writer_closing;
+static uint32_t g_writer_id;
+static int g_writer_type;
+static bool g_writer_reclaim;
+static int g_writer_block;
+static int g_writer_part;
+static int g_writer_offset;
+static uint8_t g_buffer[STORAGE_BUFFER_SIZE];
+static int g_buffer_read;
+static int g_buffer_count;
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+static uint32_t block_addr(int block)
+{
+  return STORAGE_FLASH_OFFSET + block * FLASH_BLOCK_SIZE;
+}
+
+//-----------------------------------------------------------------------------
+static void read_data(uint32_t addr, void *data, int size)
+{
+  FlashRequest req;
+
+  req.command = FLASH_CMD_READ;
+  req.addr    = addr;
+  req.data    = data;
+  req.size    = size;
+
+  flash_execute(&req);
+}
+
+//-----------------------------------------------------------------------------
+static void submit(int op, int block, int command, uint32_t addr, const void *data, int size)
+{
+  g_request.command = command;
+  g_request.addr    = addr;
+  g_request.data    = (uint8_t *)data;
+  g_request.size    = size;
+
+  // Queue is full, the operation will be retried on the next call
+  if (!flash_submit(&g_request))
+    return;
+
+  g_op       = op;
+  g_op_block = block;
+  g_op_size  = size;
+}
+
+//-----------------------------------------------------------------------------
+// Parts of the object being written are not visible until it is closed
+static bool block_visible(BlockInfo *b)
+{
+  return BLOCK_USED == b->state && !(g_writer_active && b->id == g_writer_id);
+}
+
+//-----------------------------------------------------------------------------
+static bool object_complete(uint32_t id)
+{
+  int parts = 0;
+  int last = -1;
+
+  for (int i = 0; i < STORAGE_BLOCK_COUNT; i++)
+  {
+    if (BLOCK_USED != g_blocks[i].state || g_blocks[i].id != id)
+      continue;
+
+    parts++;
+
+    if (g_blocks[i].last)
+      last = g_blocks[i].part;
+  }
+
+  return (last >= 0 && parts == (last + 1));
+}
+
+//-----------------------------------------------------------------------------
+static int find_block(uint32_t id, int part)
+{
+  for (int i = 0; i < STORAGE_BLOCK_COUNT; i++)
+  {
+    if (block_visible(&g_blocks[i]) && g_blocks[i].id == id && g_blocks[i].part == part)
+      return i;
+  }
+
+  return -1;
+}
+
+//-----------------------------------------------------------------------------
+static void mount(void)
+{
+  EraseHeader eh;
+  MarkerPage mp;
+
+  g_next_id = 1;
+
+  for (int i = 0; i < STORAGE_BLOCK_COUNT; i++)
+  {
+    BlockInfo *b = &g_blocks[i];
+    uint32_t crc;
+
+    read_data(block_addr(i), &eh, sizeof(EraseHeader));
+    read_data(block_addr(i) + STORAGE_MARKER_OFFSET, &mp, sizeof(MarkerPage));
+
+    crc = crc32_calc((uint32_t *)&eh, sizeof(EraseHeader) - sizeof(uint32_t));
+
+    if (ERASE_HEADER_MAGIC != eh.magic || crc != eh.crc)
+    {
+      // Erase count is lost, but this only happens on a new device
+      b->erase_count = 0;
+      b->state = BLOCK_DIRTY;
+      continue;
+    }
+
+    b->erase_count = eh.erase_count;
+
+    if (0xff == mp.marker[0])
+    {
+      b->state = BLOCK_FREE;
+      continue;
+    }
+
+    crc = crc32_calc((uint32_t *)&mp.header, sizeof(ObjectHeader) - sizeof(uint32_t));
+
+    // Block was being written when the power was lost
+    if (OBJECT_HEADER_MAGIC != mp.header.magic || crc != mp.header.crc)
+    {
+      b->state = BLOCK_DIRTY;
+      continue;
+    }
+
+    b->state   = BLOCK_USED;
+    b->id      = mp.header.id;
+    b->type    = mp.header.type;
+    b->part    = mp.header.part;
+    b->size    = mp.header.size;
+    b->last    = mp.header.last;
+    b->reclaim = mp.header.reclaim;
+
+    if (b->id >= g_next_id)
+      g_next_id = b->id + 1;
+  }
+
+  for (int i = 0; i < STORAGE_BLOCK_COUNT; i++)
+  {
+    if (BLOCK_USED == g_blocks[i].state && !object_complete(g_blocks[i].id))
+      g_blocks[i].state = BLOCK_DIRTY;
+  }
+}
+
+//-----------------------------------------------------------------------------
+void storage_init(void)
+{
+  g_ready         = false;
+  g_writer_active = false;
+  g_failed_id     = 0;
+  g_op            = OP_NONE;
+
+  if (!flash_present())
+    return;
+
+  mount();
+
+  g_ready = true;
+}
+
+//-----------------------------------------------------------------------------
+bool storage_ready(void)
+{
+  return g_ready;
+}
+
+//-----------------------------------------------------------------------------
+static void write_object_header(int block, bool last)
+{
+  g_object_header.magic   = OBJECT_HEADER_MAGIC;
+  g_object_header.id      = g_writer_id;
+  g_object_header.type    = g_writer_type;
+  g_object_header.part    = g_writer_part;
+  g_object_header.size    = g_writer_offset;
+  g_object_header.last    = last;
+  g_object_header.reclaim = g_writer_reclaim;
+  g_object_header.crc     = crc32_calc((uint32_t *)&g_object_header, sizeof(ObjectHeader) - sizeof(uint32_t));
+
+  submit(OP_OBJECT_HEADER, block, FLASH_CMD_PROGRAM, block_addr(block) + STORAGE_MARKER_OFFSET +
+      offsetof(MarkerPage, header), &g_object_header, sizeof(ObjectHeader));
+}
+
+//-----------------------------------------------------------------------------
+// Free block with the lowest erase count is used first, so the wear is spread
+// evenly over the whole area.
+static int allocate_block(void)
+{
+  int block = -1;
+
+  for (int i = 0; i < STORAGE_BLOCK_COUNT; i++)
+  {
+    if (BLOCK_FREE != g_blocks[i].state)
+      continue;
+
+    if (block < 0 || g_blocks[i].erase_count < g_blocks[block].erase_count)
+      block = i;
+  }
+
+  return block;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the ID of the oldest object that may be deleted to make room for
+// the object being written or 0 if there is none. Reclaimable objects only
+// replace the older objects of their own type, so the logger does not eat
+// the change captures and the other way around.
+static uint32_t find_reclaimable(void)
+{
+  uint32_t id = 0;
+
+  for (int i = 0; i < STORAGE_BLOCK_COUNT; i++)
+  {
+    BlockInfo *b = &g_blocks[i];
+
+    if (!block_visible(b) || !b->reclaim || (g_writer_reclaim && b->type != g_writer_type))
+      continue;
+
+    if (0 == id || b->id < id)
+      id = b->id;
+  }
+
+  return id;
+}
+
+//-----------------------------------------------------------------------------
+// Space is on the way if a block is waiting for the erase or an object can
+// be reclaimed
+static bool space_pending(void)
+{
+  for (int i = 0; i < STORAGE_BLOCK_COUNT; i++)
+  {
+    if (BLOCK_DIRTY == g_blocks[i].state || BLOCK_ERASED == g_blocks[i].state)
+      return true;
+  }
+
+  return find_reclaimable() > 0;
+}
+
+//-----------------------------------------------------------------------------
+// Parts written so far are erased in the background
+static void drop_object(void)
+{
+  for (int i = 0; i < STORAGE_BLOCK_COUNT; i++)
+  {
+    if (BLOCK_USED == g_blocks[i].state && g_blocks[i].id == g_writer_id)
+      g_blocks[i].state = BLOCK_DIRTY;
+  }
+
+  g_writer_active = false;
+  g_failed_id     = g_writer_id;
+}
+
+//-----------------------------------------------------------------------------
+static bool writer_task(void)
+{
+  int block = g_writer_block;
+  int size;
+
+  if (!g_writer_active)
+    return false;
+
+  if (block < 0)
+  {
+    if (g_writer_closing && 0 == g_buffer_count)
+    {
+      g_writer_active = false; // Nothing was written
+      return false;
+    }
+
+    if (g_buffer_count < FLASH_PAGE_SIZE && !g_writer_closing)
+      return false;
+
+    block = allocate_block();
+
+    // Wait for the erase, the object is dropped if there is nothing to erase
+    if (block < 0)
+    {
+      if (!space_pending())
+        drop_object();
+
+      return false;
+    }
+
+    submit(OP_MARKER, block, FLASH_CMD_PROGRAM, block_addr(block) + STORAGE_MARKER_OFFSET, &g_marker, 1);
+    return true;
+  }
+
+  // Full block is closed once it is known if there is more data
+  if (g_writer_offset == STORAGE_DATA_SIZE)
+  {
+    if (0 == g_buffer_count && !g_writer_closing)
+      return false;
+
+    write_object_header(block, 0 == g_buffer_count);
+    return true;
+  }
+
+  if (g_buffer_count >= FLASH_PAGE_SIZE)
+    size = FLASH_PAGE_SIZE;
+  else if (g_writer_closing && g_buffer_count > 0)
+    size = g_buffer_count;
+  else if (g_writer_closing)
+    size = 0;
+  else
+    return false;
+
+  if (size)
+  {
+    submit(OP_DATA, block, FLASH_CMD_PROGRAM, block_addr(block) + STORAGE_DATA_OFFSET + g_writer_offset,
+        &g_buffer[g_buffer_read], size);
+  }
+  else
+  {
+    write_object_header(block, true);
+  }
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+static void erase_task(void)
+{
+  int dirty = -1;
+  int free = 0;
+
+  for (int i = 0; i < STORAGE_BLOCK_COUNT; i++)
+  {
+    BlockInfo *b = &g_blocks[i];
+
+    if (BLOCK_ERASED == b->state)
+    {
+      g_erase_header.magic       = ERASE_HEADER_MAGIC;
+      g_erase_header.erase_count = b->erase_count;
+      g_erase_header.crc         = crc32_calc((uint32_t *)&g_erase_header, sizeof(EraseHeader) - sizeof(uint32_t));
+
+      submit(OP_ERASE_HEADER, i, FLASH_CMD_PROGRAM, block_addr(i), &g_erase_header, sizeof(EraseHeader));
+      return;
+    }
+
+    if (BLOCK_DIRTY == b->state && dirty < 0)
+      dirty = i;
+
+    if (BLOCK_FREE == b->state)
+      free++;
+  }
+
+  if (dirty >= 0)
+  {
+    submit(OP_ERASE, dirty, FLASH_CMD_ERASE_BLOCK, block_addr(dirty), NULL, FLASH_BLOCK_SIZE);
+  }
+  else if (free < STORAGE_MIN_FREE && g_writer_active)
+  {
+    uint32_t id = find_reclaimable();
+
+    if (id)
+      storage_delete(id);
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void operation_done(int op)
+{
+  BlockInfo *b = &g_blocks[g_op_block];
+
+  if (OP_ERASE == op)
+  {
+    b->erase_count++;
+    b->state = BLOCK_ERASED;
+  }
+  else if (OP_ERASE_HEADER == op)
+  {
+    b->state = BLOCK_FREE;
+  }
+  else if (OP_MARKER == op)
+  {
+    b->state = BLOCK_OPEN;
+    g_writer_block  = g_op_block;
+    g_writer_offset = 0;
+    g_writer_part++;
+  }
+  else if (OP_DATA == op)
+  {
+    g_writer_offset += g_op_size;
+    g_buffer_count  -= g_op_size;
+    g_buffer_read    = (g_buffer_read + g_op_size) % STORAGE_BUFFER_SIZE;
+  }
+  else if (OP_OBJECT_HEADER == op)
+  {
+    b->state   = BLOCK_USED;
+    b->id      = g_object_header.id;
+    b->type    = g_object_header.type;
+    b->part    = g_object_header.part;
+    b->size    = g_object_header.size;
+    b->last    = g_object_header.last;
+    b->reclaim = g_object_header.reclaim;
+
+    g_writer_block = -1;
+
+    if (b->last)
+      g_writer_active = false;
+  }
+}
+
+//-----------------------------------------------------------------------------
+void storage_task(void)
+{
+  if (!g_ready)
+    return;
+
+  if (OP_NONE != g_op)
+  {
+    int op = g_op;
+
+    if (!g_request.done)
+      return;
+
+    g_op = OP_NONE;
+    operation_done(op);
+  }
+
+  if (!writer_task())
+    erase_task();
+}
+
+//-----------------------------------------------------------------------------
+// Returns the ID of the new object or -1 if there is another object
+// being written. Only the objects created with 'reclaim' set are deleted
+// automatically when the space runs out, other objects stay until they are
+// deleted explicitly. Reclaimable objects only make room by deleting older
+// objects of the same type.
+int storage_create(int type, bool reclaim)
+{
+  if (!g_ready || g_writer_active)
+    return -1;
+
+  g_writer_active  = true;
+  g_writer_closing = false;
+  g_writer_id      = g_next_id++;
+  g_writer_type    = type;
+  g_writer_reclaim = reclaim;
+  g_writer_block   = -1;
+  g_writer_part    = -1;
+  g_writer_offset  = 0;
+  g_buffer_read    = 0;
+  g_buffer_count   = 0;
+
+  return g_writer_id;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the number of bytes accepted, the rest has to be written again
+// once the buffered data is programmed.
+int storage_write(const uint8_t *data, int size)
+{
+  int written = 0;
+
+  if (!g_writer_active || g_writer_closing)
+    return 0;
+
+  while (size > 0 && g_buffer_count < STORAGE_BUFFER_SIZE)
+  {
+    int index = (g_buffer_read + g_buffer_count) % STORAGE_BUFFER_SIZE;
+    int sz = STORAGE_BUFFER_SIZE - index;
+
+    if (sz > (STORAGE_BUFFER_SIZE - g_buffer_count))
+      sz = STORAGE_BUFFER_SIZE - g_buffer_count;
+
+    if (sz > size)
+      sz = size;
+
+    memcpy(&g_buffer[index], data, sz);
+
+    g_buffer_count += sz;
+    written += sz;
+    data += sz;
+    size -= sz;
+  }
+
+  return written;
+}
+
+//-----------------------------------------------------------------------------
+void storage_close(void)
+{
+  g_writer_closing = true;
+}
+
+//-----------------------------------------------------------------------------
+bool storage_busy(void)
+{
+  return g_writer_active;
+}
+
+//-----------------------------------------------------------------------------
+// Object was dropped because there was no space left, data written after
+// that is ignored
+bool storage_failed(int id)
+{
+  return id > 0 && (uint32_t)id == g_failed_id;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the ID of the newest object of the given type or -1 if there is none
+int storage_get_last(int type)
+{
+  return storage_get_prev(type, INT32_MAX);
+}
+
+//-----------------------------------------------------------------------------
+// Returns the ID of the newest object of the given type older than 'id'
+// or -1 if there is none
+int storage_get_prev(int type, int id)
+{
+  int res = -1;
+
+  for (int i = 0; i < STORAGE_BLOCK_COUNT; i++)
+  {
+    BlockInfo *b = &g_blocks[i];
+
+    if (block_visible(b) && 0 == b->part && b->type == type && (int)b->id < id && (int)b->id > res)
+      res = b->id;
+  }
+
+  return res;
+}
+
+//-----------------------------------------------------------------------------
+int storage_get_size(int id)
+{
+  int size = -1;
+
+  for (int i = 0; i < STORAGE_BLOCK_COUNT; i++)
+  {
+    if (block_visible(&g_blocks[i]) && (int)g_blocks[i].id == id)
+      size = ((size < 0) ? 0 : size) + g_blocks[i].size;
+  }
+
+  return size;
+}
+
+//-----------------------------------------------------------------------------
+// Blocking read, returns the number of bytes read
+int storage_read(int id, int offset, uint8_t *data, int size)
+{
+  int res = 0;
+
+  for (int part = 0; size > 0; part++)
+  {
+    int block = find_block(id, part);
+    int sz;
+
+    if (block < 0)
+      break;
+
+    if (offset >= (int)g_blocks[block].size)
+    {
+      offset -= g_blocks[block].size;
+      continue;
+    }
+
+    sz = g_blocks[block].size - offset;
+
+    if (sz > size)
+      sz = size;
+
+    read_data(block_addr(block) + STORAGE_DATA_OFFSET + offset, data, sz);
+
+    offset = 0;
+    data += sz;
+    size -= sz;
+    res  += sz;
+  }
+
+  return res;
+}
+
+//-----------------------------------------------------------------------------
+// Blocks are erased in the background
+void storage_delete(int id)
+{
+  for (int i = 0; i < STORAGE_BLOCK_COUNT; i++)
+  {
+    if (block_visible(&g_blocks[i]) && (int)g_blocks[i].id == id)
+      g_blocks[i].state = BLOCK_DIRTY;
+  }
+}
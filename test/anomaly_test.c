@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "anomaly.h"
+#include "test.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define SIZE                   4096
+#define START                  (-SIZE / 2) // Trigger index of the envelope start
+#define MARGIN                 8
+#define NO_GLITCH              INT32_MAX
+
+/*- Variables ---------------------------------------------------------------*/
+static uint8_t g_ring[SIZE + 1];
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+// Sine with +/-2 counts of noise. Samples are placed into the ring, so that
+// the trigger relative index 'min_index + i' is at '(offset + i) % SIZE'.
+// Ring start is moved by one byte at random to cover the unaligned paths.
+static uint8_t *make_record(int offset, int min_index, int glitch)
+{
+  uint8_t *ring = &g_ring[rand() & 1];
+
+  for (int i = 0; i < SIZE; i++)
+  {
+    int j = min_index + i;
+    int v = 128 + 80 * sin(j * 2 * M_PI / 512.0) + (rand() % 5 - 2);
+
+    if (j == glitch)
+      v = (v > 128) ? 20 : 240;
+
+    ring[(offset + i) % SIZE] = v;
+  }
+
+  return ring;
+}
+
+//-----------------------------------------------------------------------------
+// Records start up to 8 samples after the envelope start, as the trigger
+// position jitters
+static bool check_record(int glitch)
+{
+  int offset = rand() % SIZE;
+  int min_index = START + rand() % 8;
+  uint8_t *ring = make_record(offset, min_index, glitch);
+
+  return anomaly_check(ring, SIZE, offset, min_index, START);
+}
+
+//-----------------------------------------------------------------------------
+static void test_detection(void)
+{
+  int total, failed, saved;
+  int fails = 0;
+
+  anomaly_setup(MARGIN);
+
+  for (int i = 0; i < 16; i++)
+    check(!check_record(NO_GLITCH));
+
+  for (int i = 0; i < 2000; i++)
+    fails += check_record(NO_GLITCH);
+
+  check(0 == fails);
+
+  // Single sample glitches anywhere in the part covered by all records
+  for (int i = 0; i < 2000; i++)
+    fails += check_record(START + 8 + rand() % (SIZE - 16));
+
+  check(2000 == fails);
+
+  anomaly_get_stats(&total, &failed, &saved);
+  check(4000 == total && 2000 == failed && 0 == saved);
+
+  printf("detection: ok\n");
+}
+
+//-----------------------------------------------------------------------------
+// Envelope is learned again after a reset, stats are kept
+static void test_reset(void)
+{
+  int total, failed, saved;
+
+  anomaly_reset();
+
+  // The glitch becomes a part of the envelope
+  for (int i = 0; i < 16; i++)
+    check(!check_record(START + 100));
+
+  check(!check_record(START + 100));
+
+  anomaly_get_stats(&total, &failed, &saved);
+  check(4001 == total && 2000 == failed);
+
+  anomaly_setup(MARGIN);
+  anomaly_get_stats(&total, &failed, &saved);
+  check(0 == total && 0 == failed);
+
+  printf("reset: ok\n");
+}
+
+//-----------------------------------------------------------------------------
+int main(void)
+{
+  srand(1);
+
+  test_detection();
+  test_reset();
+
+  return 0;
+}
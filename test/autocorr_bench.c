@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Accuracy and cost of the autocorrelation period estimator over random
+// records. Cost is counted in SMLAD steps of the emulated intrinsics, on
+// the device each step is about 3 cycles.
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdalign.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "gd32f4xx.h"
+#include "autocorr.h"
+#include "test.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define MAX_SIZE               (32 * 1024)
+#define RECORDS                50
+
+enum
+{
+  SIGNAL_SINE,
+  SIGNAL_SQUARE,
+  SIGNAL_HARMONIC,
+  SIGNAL_PULSE,
+  SIGNAL_NOISE,
+};
+
+/*- Variables ---------------------------------------------------------------*/
+static alignas(4) uint8_t g_record[MAX_SIZE];
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+static double noise(void)
+{
+  double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+  double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+  return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+//-----------------------------------------------------------------------------
+static void make_record(int type, double period, double sigma, int size, int offset)
+{
+  double phase = rand() / (double)RAND_MAX * 2.0 * M_PI;
+
+  for (int i = 0; i < size; i++)
+  {
+    double t = 2.0 * M_PI * i / period + phase;
+    double v = 0.0;
+
+    if (SIGNAL_SINE == type)
+      v = 60 * sin(t);
+    else if (SIGNAL_SQUARE == type)
+      v = (sin(t) > 0) ? 40 : -40;
+    else if (SIGNAL_HARMONIC == type)
+      v = 50 * sin(t) + 45 * sin(3 * t + 1);
+    else if (SIGNAL_PULSE == type)
+      v = (fmod(t, 2.0 * M_PI) < 0.6) ? 40 : -4;
+
+    v += 128 + sigma * noise();
+    g_record[(offset + i) % size] = (v < 0) ? 0 : ((v > 255) ? 255 : (int)v);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Returns the number of failed records
+static int bench(const char *name, int type, double period, double sigma, int size, double max_error)
+{
+  double sum_error = 0.0, worst = 0.0, time = 0.0;
+  uint64_t macs = 0;
+  int fails = 0;
+
+  for (int n = 0; n < RECORDS; n++)
+  {
+    int offset = rand() % size;
+    struct timespec start, end;
+    int64_t res;
+    double error;
+
+    make_record(type, period, sigma, size, offset);
+
+    host_mac_count = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    res = autocorr_period(g_record, size, offset);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    macs += host_mac_count;
+    time += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+    if (0 == res)
+    {
+      fails++;
+      continue;
+    }
+
+    error = fabs(res / 65536.0 - period) / period;
+    sum_error += error;
+    worst = fmax(worst, error);
+  }
+
+  printf("%-20s %9.3f  fails %2d  mean error %.1e  max error %.1e  %7llu SMLAD  %5.2f ms\n",
+      name, period, fails, (fails < RECORDS) ? sum_error / (RECORDS - fails) : 0.0, worst,
+      (unsigned long long)(macs / RECORDS), time / RECORDS * 1000.0);
+
+  check(worst <= max_error);
+
+  return fails;
+}
+
+//-----------------------------------------------------------------------------
+int main(void)
+{
+  srand(1);
+
+  check(0 == bench("sine", SIGNAL_SINE, 1234.567, 1, MAX_SIZE, 1e-4));
+  check(0 == bench("noisy sine", SIGNAL_SINE, 1234.567, 40, MAX_SIZE, 2e-3));
+  check(0 == bench("noisy square", SIGNAL_SQUARE, 777.7, 40, MAX_SIZE, 2e-3));
+  check(0 == bench("3rd harmonic", SIGNAL_HARMONIC, 2000.3, 10, MAX_SIZE, 1e-3));
+  check(0 == bench("10% pulse", SIGNAL_PULSE, 3001.1, 15, MAX_SIZE, 2e-3));
+  check(0 == bench("fast sine", SIGNAL_SINE, 13.37, 5, MAX_SIZE, 1e-4));
+  check(0 == bench("mid sine", SIGNAL_SINE, 97.3, 20, MAX_SIZE, 1e-3));
+  // About two periods in the record, only reported
+  bench("slow sine", SIGNAL_SINE, 15000, 10, MAX_SIZE, 1.0);
+  check(0 == bench("short record", SIGNAL_SINE, 50.5, 5, 2048, 1e-3));
+  check(RECORDS == bench("noise only", SIGNAL_NOISE, 100, 20, MAX_SIZE, 0.0));
+
+  return 0;
+}
@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "gd32f4xx.h"
+#include "utils.h"
+#include "common.h"
+#include "config.h"
+#include "test.h"
+
+/*- Definitions -------------------------------------------------------------*/
+// Config storage of config.c
+#define STORAGE_START          0x08040000
+#define STORAGE_SIZE           (256 * 1024)
+#define ENTRY_SIZE             1024
+
+// Layout saved by the builds before the trigger types: fields up to the
+// measurement display flag, 31 reserved zero words, calibration and CRC
+#define V1_SIZE                296
+#define V1_FIELDS_SIZE         offsetof(Config, trigger_type)
+#define V1_CALIB_OFFSET        220
+#define CALIB_SIZE             (offsetof(Config, crc) - offsetof(Config, calib_channel_delta))
+
+/*- Variables ---------------------------------------------------------------*/
+static uint8_t *g_flash;
+static int *g_timer;
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+void timer_add(int *timer)
+{
+  g_timer = timer;
+}
+
+//-----------------------------------------------------------------------------
+static void erase(void)
+{
+  memset(g_flash, 0xff, STORAGE_SIZE);
+}
+
+//-----------------------------------------------------------------------------
+static void save(void)
+{
+  *g_timer = 0;
+
+  for (int i = 0; i < 1000; i++)
+    config_task();
+}
+
+//-----------------------------------------------------------------------------
+static Config *entry(int index)
+{
+  return (Config *)&g_flash[index * ENTRY_SIZE];
+}
+
+//-----------------------------------------------------------------------------
+// Writes 'c' in the version 1 format, fields newer than the measurement
+// display flag are lost the same way as with the builds that saved it
+static void write_v1(int index, Config *c)
+{
+  uint32_t data[V1_SIZE / sizeof(uint32_t)] = {0};
+
+  c->size    = V1_SIZE;
+  c->version = 1;
+
+  memcpy(data, c, V1_FIELDS_SIZE);
+  memcpy((uint8_t *)data + V1_CALIB_OFFSET, &c->calib_channel_delta, CALIB_SIZE);
+  data[V1_SIZE / sizeof(uint32_t) - 1] = crc32_calc(data, V1_SIZE - sizeof(uint32_t));
+
+  memcpy(entry(index), data, V1_SIZE);
+}
+
+//-----------------------------------------------------------------------------
+static void check_calib(int dac_zero, int vs_mult)
+{
+  check(-5 == config.calib_channel_delta);
+  check(dac_zero == config.calib_dac_zero);
+  check(5630 == config.calib_dac_mult[VS_10_V]);
+  check(vs_mult == config.calib_vs_mult[VS_10_V]);
+}
+
+//-----------------------------------------------------------------------------
+static void test_blank(void)
+{
+  erase();
+
+  config_init();
+  check(sizeof(Config) == config.size);
+  check(1 == config.power_cycles);
+  check(EYE_OFF == config.eye_rate);
+  check_calib(2010, 386029);
+
+  save();
+  check(1 == entry(1)->count);
+
+  config_init();
+  check(2 == config.power_cycles);
+  check(1 == config.count);
+
+  printf("blank storage: ok, %d byte entries\n", (int)sizeof(Config));
+}
+
+//-----------------------------------------------------------------------------
+// Settings and calibration of a version 1 entry are kept, newer fields get
+// their defaults and the entry is saved in the new format
+static void test_migration(void)
+{
+  Config c;
+  int version;
+
+  erase();
+
+  config_reset();
+  c = config;
+  c.count            = 76;
+  c.power_cycles     = 10;
+  c.lcd_bl_level     = 42;
+  c.measure_display  = true;
+  c.trigger_type     = TRIGGER_TYPE_UART;
+  c.uart_mask        = 0;
+  c.anomaly_margin   = 0;
+  c.mask_margin      = 0;
+  c.jitter           = JITTER_TIE;
+  c.calib_dac_zero   = 1999;
+  c.calib_vs_mult[VS_10_V] = 400000;
+  write_v1(3, &c);
+
+  c.count = 77;
+  write_v1(4, &c);
+
+  // Newer, but damaged
+  c.count = 78;
+  write_v1(5, &c);
+  entry(5)->lcd_bl_level = 43;
+
+  // Size of no known layout
+  c.count = 79;
+  write_v1(6, &c);
+  entry(6)->size = V1_SIZE + 4;
+
+  config_init();
+  check(77 == config.count);
+  check(11 == config.power_cycles);
+  check(sizeof(Config) == config.size);
+  check(42 == config.lcd_bl_level);
+  check(config.measure_display);
+  check(TRIGGER_TYPE_EDGE == config.trigger_type);
+  check(7 == config.uart_baud);
+  check(0x55 == config.uart_value);
+  check(0xff == config.uart_mask);
+  check(8 == config.anomaly_margin);
+  check(4 == config.mask_margin);
+  check(JITTER_OFF == config.jitter);
+  check(EYE_OFF == config.eye_rate);
+  check_calib(1999, 400000);
+
+  for (int i = 0; i < ARRAY_SIZE(config.padding); i++)
+    check(0 == config.padding[i]);
+
+  version = config.version;
+
+  save();
+  check(version == entry(5)->version && sizeof(Config) == entry(5)->size);
+
+  config_init();
+  check(78 == config.count);
+  check(12 == config.power_cycles);
+  check(42 == config.lcd_bl_level);
+  check_calib(1999, 400000);
+
+  printf("version 1 migration: ok\n");
+}
+
+//-----------------------------------------------------------------------------
+int main(void)
+{
+  g_flash = mmap((void *)STORAGE_START, STORAGE_SIZE, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+  check((void *)STORAGE_START == g_flash);
+
+  test_blank();
+  test_migration();
+
+  return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdalign.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "counter.h"
+#include "test.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define BLOCK_SIZE             16384
+#define SAMPLE_PERIOD          256 // ns
+#define LEVEL                  128
+
+/*- Variables ---------------------------------------------------------------*/
+static alignas(4) uint8_t g_block[BLOCK_SIZE];
+static uint64_t g_sample;
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+// Noisy sine, continuous over the blocks. Returns the last result after
+// 'results' gates have completed.
+static void run(double frequency, double amplitude, int results, CounterResult *result)
+{
+  int total = counter_get_total();
+
+  while (counter_get_total() < total + results)
+  {
+    for (int i = 0; i < BLOCK_SIZE; i++, g_sample++)
+    {
+      double v = LEVEL + amplitude * sin(2 * M_PI * frequency * g_sample * SAMPLE_PERIOD * 1e-9) +
+          (rand() % 5 - 2);
+
+      g_block[i] = (v < 0) ? 0 : ((v > 255) ? 255 : (int)v);
+    }
+
+    counter_update(g_block, BLOCK_SIZE, LEVEL);
+  }
+
+  check(counter_get(result));
+}
+
+//-----------------------------------------------------------------------------
+static void test_frequency(double frequency, int gate, double tolerance)
+{
+  CounterResult result;
+  double error;
+
+  counter_start(gate, SAMPLE_PERIOD);
+  check(!counter_get(&result));
+
+  // The first gate starts at a random point of the stream
+  run(frequency, 80, 3, &result);
+
+  error = fabs(result.frequency / 1000.0 - frequency) / frequency;
+
+  check(result.periods > 0);
+  check(error < tolerance);
+  check(fabs(result.period - 1e9 / frequency) <= 1e9 / frequency * tolerance + 1);
+
+  printf("%.4f Hz, %d ms gate: ok, %d periods, error %.1e\n", frequency, gate,
+      result.periods, error);
+}
+
+//-----------------------------------------------------------------------------
+// No edges within the timeout give an empty result
+static void test_no_signal(void)
+{
+  CounterResult result;
+
+  counter_start(100, SAMPLE_PERIOD);
+  run(1000.0, 1, 2, &result);
+
+  check(0 == result.periods && 0 == result.frequency && 0 == result.period);
+
+  printf("no signal: ok\n");
+}
+
+//-----------------------------------------------------------------------------
+int main(void)
+{
+  srand(1);
+
+  test_frequency(1234.5678, 1000, 1e-6);
+  test_frequency(987654.321, 1000, 2e-8);
+  test_frequency(50.0, 100, 1e-5);
+
+  // Period is longer than the gate, the gate is extended to the next edge
+  test_frequency(0.7, 1000, 1e-5);
+
+  test_no_signal();
+
+  return 0;
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdalign.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "edges.h"
+#include "test.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define MAX_SIZE               4096
+#define RECORDS                3000
+
+/*- Variables ---------------------------------------------------------------*/
+static alignas(4) uint8_t g_record[MAX_SIZE];
+static uint32_t g_position[EDGE_INDEX_SIZE];
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+// Random bytes, a square with random run lengths or a sine
+static void make_record(int type, int size, int low, int high)
+{
+  int run = 1 + rand() % 50;
+
+  for (int i = 0; i < size; i++)
+  {
+    if (0 == type)
+      g_record[i] = rand();
+    else if (1 == type)
+      g_record[i] = ((i / run) & 1) ? high + 5 : low - 5;
+    else
+      g_record[i] = 128 + (int)(100 * sin(i * 0.05));
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Sample by sample version of the index, returns the number of edges
+static int reference(int size, int offset, int low, int high, bool *rising, bool *overflow)
+{
+  int known = 0;
+  int count = 0;
+
+  *rising   = false;
+  *overflow = false;
+
+  for (int t = 0; t < size; t++)
+  {
+    int v = g_record[(offset + t) % size];
+
+    if (0 == known)
+    {
+      known = (v > high) ? 1 : ((v < low) ? -1 : 0);
+      continue;
+    }
+
+    if ((known < 0 && v > high) || (known > 0 && v < low))
+    {
+      if (EDGE_INDEX_SIZE == count)
+      {
+        *overflow = true;
+        break;
+      }
+
+      if (0 == count)
+        *rising = (known < 0);
+
+      g_position[count++] = t;
+      known = -known;
+    }
+  }
+
+  return count;
+}
+
+//-----------------------------------------------------------------------------
+// Random sizes and ring offsets cover the unaligned heads and tails of both
+// segments of the ring
+static void test_random(void)
+{
+  int edges = 0, overflows = 0;
+
+  for (int n = 0; n < RECORDS; n++)
+  {
+    int size = (1 + rand() % (MAX_SIZE / 4)) * 4;
+    int offset = rand() % size;
+    int low = 10 + rand() % 200;
+    int high = low + rand() % 40;
+    const EdgeIndex *index;
+    bool rising, overflow;
+    int count;
+
+    make_record(rand() % 3, size, low, high);
+
+    index = edges_build(g_record, size, offset, low, high);
+    count = reference(size, offset, low, high, &rising, &overflow);
+
+    check(index == edges_get());
+    check(index->count == count && index->overflow == overflow);
+    check(0 == count || index->rising == rising);
+
+    for (int i = 0; i < count; i++)
+      check(index->position[i] == g_position[i]);
+
+    edges += count;
+    overflows += overflow;
+  }
+
+  // Full index must be covered as well
+  check(edges > 0 && overflows > 0);
+
+  printf("random records: ok, %d edges, %d overflows\n", edges, overflows);
+}
+
+//-----------------------------------------------------------------------------
+int main(void)
+{
+  srand(1);
+
+  test_random();
+
+  return 0;
+}
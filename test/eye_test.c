@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "eye.h"
+#include "test.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define SIZE                   (128 * 1024)
+#define RECORDS                10
+#define VS_MULT                (10 * 1024) // 10 mV/count
+#define LOW                    60
+#define HIGH                   190
+#define MAX_BITS               (SIZE / 3 + 3)
+
+/*- Types -------------------------------------------------------------------*/
+typedef struct
+{
+  double   ui;     // Samples
+  double   jitter; // Samples
+  double   noise;  // Counts
+  int      rate;   // bps, 0 for the automatic detection
+  int      period; // ns
+} Signal;
+
+/*- Variables ---------------------------------------------------------------*/
+static uint8_t g_record[SIZE];
+static double g_edges[MAX_BITS];
+static int g_bits[MAX_BITS];
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+static double gauss(void)
+{
+  double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+  double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+  return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+//-----------------------------------------------------------------------------
+// Random NRZ data with edges of UI/5, Gaussian jitter of the bit boundaries
+// and Gaussian noise of the levels
+static void make_record(const Signal *s)
+{
+  double phase = rand() % 100 + 0.37;
+  int bits = (int)(SIZE / s->ui) + 3;
+  double ramp = s->ui / 5;
+  int k = 0;
+
+  for (int i = 0; i < bits; i++)
+  {
+    g_bits[i] = rand() & 1;
+    g_edges[i] = phase + i * s->ui + s->jitter * gauss();
+  }
+
+  for (int i = 0; i < SIZE; i++)
+  {
+    double from, to, d, v;
+    int q;
+
+    while (k + 1 < bits && g_edges[k + 1] <= i)
+      k++;
+
+    from = g_bits[(k > 0) ? k - 1 : 0] ? HIGH : LOW;
+    to   = g_bits[k] ? HIGH : LOW;
+    d    = i - g_edges[k];
+    v    = ((d >= ramp) ? to : from + (to - from) * d / ramp) + s->noise * gauss();
+    q    = lround(v);
+
+    g_record[i] = (q < 0) ? 0 : ((q > 255) ? 255 : q);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Returns false if any record was rejected
+static bool run(const Signal *s, EyeResult *r)
+{
+  static uint8_t rows[256];
+  bool ok = true;
+
+  for (int i = 0; i < 256; i++)
+    rows[i] = ((255 - i) * EYE_HEIGHT) / 256;
+
+  eye_reset();
+  eye_set_rows(rows, VS_MULT);
+
+  for (int i = 0; i < RECORDS; i++)
+  {
+    make_record(s);
+    ok &= eye_add(g_record, SIZE, i * 977 % SIZE, s->period, LOW, HIGH, s->rate);
+  }
+
+  eye_get(r);
+
+  return ok;
+}
+
+//-----------------------------------------------------------------------------
+// Eye width is compared with UI - 6 sigma of the jitter, eye height with the
+// distance of the levels minus 6 sigma of the noise. Below 5 samples/UI the
+// interpolated crossings spread more and the eye is narrower.
+static void test_eye(const Signal *s)
+{
+  double width_min = (s->ui < 5) ? 0.85 : 0.94;
+  double ui = s->ui * s->period * 1000; // ps
+  double width = ui - 6 * s->jitter * s->period * 1000;
+  double height = (HIGH - LOW - 6 * s->noise) * VS_MULT * 1000.0 / 1024;
+  double ui_error, height_error;
+  EyeResult r;
+
+  check(run(s, &r));
+  check(RECORDS == r.records);
+
+  ui_error     = (r.ui - ui) / ui;
+  height_error = (r.height - height) / height;
+
+  if (0 == s->rate)
+    check(fabs(ui_error) < 1e-4);
+  else
+    check(r.rate == s->rate);
+
+  check(r.width > width * width_min && r.width <= width);
+  check(fabs(height_error) < 0.02);
+
+  printf("%6.2f samples/UI, %s: ok, UI %+.4f%%, width %.1f%% of UI - 6 sigma, height %+.1f%%\n",
+      s->ui, s->rate ? "fixed rate" : "auto", ui_error * 100, r.width * 100 / width,
+      height_error * 100);
+}
+
+//-----------------------------------------------------------------------------
+// Fewer than 3 samples between the transitions are not enough for the
+// automatic rate detection
+static void test_fast(void)
+{
+  Signal s = { 3.1, 0.1, 1, 0, 8 };
+  EyeResult r;
+
+  check(!run(&s, &r));
+  check(0 == r.records);
+
+  printf("%6.2f samples/UI, auto: ok, rejected\n", s.ui);
+}
+
+//-----------------------------------------------------------------------------
+int main(void)
+{
+  static const Signal auto_rate[] =
+  {
+    { 3.6, 0.1, 1, 0, 8 },
+    { 4.3, 0.1, 1, 0, 8 },
+    { 5.3, 0.2, 1, 0, 8 },
+    { 6.7, 0.3, 1, 0, 8 },
+    { 12.5, 0.3, 1, 0, 8 },
+    { 37.3, 0, 0, 0, 8 },
+    { 37.3, 0.5, 2, 0, 8 },
+  };
+  static const Signal fixed_rate[] =
+  {
+    { 8.68, 0.2, 1, 115200, 1000 },
+    { 8.68 * 1.01, 0.2, 1, 115200, 1000 }, // 1% off
+    { 104.2, 1.0, 2, 9600, 1000 },
+  };
+
+  srand(1);
+
+  for (int i = 0; i < (int)(sizeof(auto_rate) / sizeof(Signal)); i++)
+    test_eye(&auto_rate[i]);
+
+  for (int i = 0; i < (int)(sizeof(fixed_rate) / sizeof(Signal)); i++)
+    test_eye(&fixed_rate[i]);
+
+  test_fast();
+
+  return 0;
+}
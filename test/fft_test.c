@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "common.h"
+#include "fft.h"
+#include "test.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define ZERO_POINT             128
+#define RANGE_DB               40 // Bins this far below the peak are compared
+
+/*- Constants ---------------------------------------------------------------*/
+// Q15 cosine terms of the windows, the same values as used by fft.c
+static const int g_window_terms[][5] =
+{
+  [FFT_WINDOW_HANN]     = { 16384, 16384, 0, 0, 0 },
+  [FFT_WINDOW_FLAT_TOP] = { 7064, 13652, 9085, 2739, 228 },
+  [FFT_WINDOW_BLACKMAN] = { 13763, 16384, 2621, 0, 0 },
+};
+
+/*- Variables ---------------------------------------------------------------*/
+static uint8_t g_data[FFT_MAX_SIZE];
+static double g_x[FFT_MAX_SIZE];
+static double g_cos[FFT_MAX_SIZE];
+static double g_sin[FFT_MAX_SIZE];
+static double g_ref[FFT_MAX_SIZE / 2];
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+static double window(int index, int n, int type)
+{
+  const int *terms = g_window_terms[type];
+  double value = terms[0];
+
+  for (int i = 1; i < 5; i++)
+    value += ((i & 1) ? -1 : 1) * terms[i] * cos(2 * M_PI * i * index / n);
+
+  return value / 32768;
+}
+
+//-----------------------------------------------------------------------------
+// Reference DFT with the input scaling of fft_calc(), powers are 1/N scaled
+static void reference(int n, int type)
+{
+  for (int i = 0; i < n; i++)
+  {
+    g_x[i] = (g_data[i] - ZERO_POINT) * 128.0 * window(i, n, type);
+    g_cos[i] = cos(2 * M_PI * i / n);
+    g_sin[i] = sin(2 * M_PI * i / n);
+  }
+
+  for (int k = 0; k < n / 2; k++)
+  {
+    double re = 0, im = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+      int angle = (int)(((int64_t)k * i) % n);
+
+      re += g_x[i] * g_cos[angle];
+      im -= g_x[i] * g_sin[angle];
+    }
+
+    re /= n;
+    im /= n;
+    g_ref[k] = re * re + im * im;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// A tone between the bins, a -20 dB tone and a dither. Data is a ring with
+// the oldest sample in the middle.
+static void test_spectrum(int n, int type)
+{
+  int offset = n / 3;
+  double peak = 0, sum = 0, worst = 0;
+  int count = 0;
+
+  for (int i = 0; i < n; i++)
+  {
+    double v = ZERO_POINT + 100 * sin(2 * M_PI * 0.1234567 * i) +
+        10 * sin(2 * M_PI * 0.3 * i + 1) + 0.5 * (rand() % 3 - 1);
+
+    g_data[i] = (int)lround(v);
+  }
+
+  reference(n, type);
+
+  // Same samples, rotated in the ring
+  {
+    static uint8_t ring[FFT_MAX_SIZE];
+
+    for (int i = 0; i < n; i++)
+      ring[(offset + i) % n] = g_data[i];
+
+    fft_calc(ring, n, offset, 0, n, type);
+  }
+
+  for (int k = 0; k < n / 2; k++)
+  {
+    if (g_ref[k] > peak)
+      peak = g_ref[k];
+  }
+
+  for (int k = 1; k < n / 2; k++)
+  {
+    double error;
+
+    if (g_ref[k] < peak * pow(10, -RANGE_DB / 10.0))
+      continue;
+
+    error = fabs(10 * log10(g_ref[k]) - 10 * log10(fft_get_power(k) + 1e-9));
+    sum += error;
+    worst = (error > worst) ? error : worst;
+    count++;
+  }
+
+  check(count > 0);
+  check(sum / count < 0.15);
+  check(worst < 0.75);
+
+  printf("spectrum: ok, window %d, N = %4d, %3d bins, mean %.3f dB, worst %.3f dB\n",
+      type, n, count, sum / count, worst);
+}
+
+//-----------------------------------------------------------------------------
+static void test_db(void)
+{
+  double worst = 0;
+
+  for (uint32_t value = 1; value < 0xf0000000; value += value / 7 + 1)
+  {
+    double error = fabs(fft_db(value) / 256.0 - 10 * log10(value));
+
+    worst = (error > worst) ? error : worst;
+  }
+
+  check(worst < 0.05);
+
+  printf("dB conversion: ok, worst %.4f dB\n", worst);
+}
+
+//-----------------------------------------------------------------------------
+static void test_windows(void)
+{
+  check(2 == fft_window_width(FFT_WINDOW_HANN));
+  check(5 == fft_window_width(FFT_WINDOW_FLAT_TOP));
+  check(3 == fft_window_width(FFT_WINDOW_BLACKMAN));
+
+  for (int type = 0; type < 3; type++)
+    check(fft_window_gain(type) == g_window_terms[type][0]);
+
+  printf("windows: ok\n");
+}
+
+//-----------------------------------------------------------------------------
+int main(void)
+{
+  static const int sizes[] = { FFT_MIN_SIZE, 1024, 2048, FFT_MAX_SIZE };
+
+  test_db();
+  test_windows();
+
+  for (int type = 0; type < 3; type++)
+  {
+    for (int i = 0; i < 4; i++)
+      test_spectrum(sizes[i], type);
+  }
+
+  return 0;
+}
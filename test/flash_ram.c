@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// RAM-backed stand-in for flash.c with the same request interface. It has
+// the NOR flash semantics: programming only clears bits and can't cross a
+// page, erase sets whole sectors or blocks to 0xff. Requests are split the
+// same way as by the driver, and each part completes after a random number
+// of flash_task() calls.
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "flash.h"
+#include "flash_ram.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define FLASH_QUEUE_SIZE       8
+#define FLASH_SECTOR_SIZE      4096
+
+/*- Variables ---------------------------------------------------------------*/
+uint8_t flash_ram[FLASH_SIZE];
+int flash_ram_erase_count[FLASH_SIZE / FLASH_BLOCK_SIZE];
+
+static FlashRequest *g_queue[FLASH_QUEUE_SIZE];
+static int g_queue_head = 0;
+static int g_queue_count = 0;
+static FlashRequest *g_request = NULL;
+static int g_request_offset;
+static int g_latency = 4;
+static int g_delay;
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+static void fail(const char *text, FlashRequest *req)
+{
+  fprintf(stderr, "flash: %s (command %d, addr 0x%06x, size %d)\n", text,
+      req->command, (unsigned)req->addr, req->size);
+  abort();
+}
+
+//-----------------------------------------------------------------------------
+static void request_step(FlashRequest *req)
+{
+  uint32_t addr = req->addr + g_request_offset;
+  int size = req->size - g_request_offset;
+
+  if (addr + size > FLASH_SIZE)
+    fail("out of range", req);
+
+  if (FLASH_CMD_READ == req->command)
+  {
+    if (size > FLASH_MAX_TRANSFER)
+      size = FLASH_MAX_TRANSFER;
+
+    memcpy(req->data + g_request_offset, &flash_ram[addr], size);
+  }
+  else if (FLASH_CMD_PROGRAM == req->command)
+  {
+    int space = FLASH_PAGE_SIZE - (addr & (FLASH_PAGE_SIZE - 1));
+
+    if (size > space)
+      size = space;
+
+    for (int i = 0; i < size; i++)
+      flash_ram[addr + i] &= req->data[g_request_offset + i];
+  }
+  else
+  {
+    bool sector = (FLASH_CMD_ERASE_SECTOR == req->command);
+
+    size = sector ? FLASH_SECTOR_SIZE : FLASH_BLOCK_SIZE;
+
+    if (addr % size)
+      fail("unaligned erase", req);
+
+    memset(&flash_ram[addr], 0xff, size);
+
+    if (!sector)
+      flash_ram_erase_count[addr / FLASH_BLOCK_SIZE]++;
+  }
+
+  g_request_offset += size;
+}
+
+//-----------------------------------------------------------------------------
+void flash_init(void)
+{
+}
+
+//-----------------------------------------------------------------------------
+bool flash_present(void)
+{
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+bool flash_submit(FlashRequest *req)
+{
+  if (g_queue_count == FLASH_QUEUE_SIZE)
+    return false;
+
+  req->done = false;
+
+  g_queue[(g_queue_head + g_queue_count) % FLASH_QUEUE_SIZE] = req;
+  g_queue_count++;
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+bool flash_execute(FlashRequest *req)
+{
+  while (!flash_submit(req))
+    flash_task();
+
+  while (!req->done)
+    flash_task();
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+bool flash_idle(void)
+{
+  return (NULL == g_request && 0 == g_queue_count);
+}
+
+//-----------------------------------------------------------------------------
+void flash_task(void)
+{
+  if (NULL == g_request)
+  {
+    if (0 == g_queue_count)
+      return;
+
+    g_request = g_queue[g_queue_head];
+    g_request_offset = 0;
+    g_delay = g_latency ? rand() % g_latency : 0;
+
+    g_queue_head = (g_queue_head + 1) % FLASH_QUEUE_SIZE;
+    g_queue_count--;
+  }
+
+  if (g_delay > 0)
+  {
+    g_delay--;
+    return;
+  }
+
+  if (g_request_offset < g_request->size)
+  {
+    request_step(g_request);
+    g_delay = g_latency ? rand() % g_latency : 0;
+    return;
+  }
+
+  g_request->done = true;
+  g_request = NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Each part of a request takes 0 to 'max_steps' - 1 extra calls
+void flash_ram_set_latency(int max_steps)
+{
+  g_latency = max_steps;
+}
+
+//-----------------------------------------------------------------------------
+// Queued and unfinished requests are lost, the parts already done stay
+void flash_ram_power_loss(void)
+{
+  g_request = NULL;
+  g_queue_head = 0;
+  g_queue_count = 0;
+}
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "harmonics.h"
+#include "test.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define SIZE                   (128 * 1024)
+#define SAMPLE_PERIOD          4 // ns
+#define VS_MULT                10240 // 10 mV per count
+#define AMPLITUDE              100 // Counts
+#define H2_LEVEL               0.01
+#define H2_PHASE               30 // Degrees
+#define H3_LEVEL               0.005
+
+/*- Variables ---------------------------------------------------------------*/
+static uint8_t g_data[SIZE];
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+// Phase difference in degrees, wrapped to +/-180
+static int phase_error(int phase, int expected)
+{
+  int error = (phase - expected) % 360;
+
+  if (error > 180)
+    error -= 360;
+  else if (error < -180)
+    error += 360;
+
+  return abs(error);
+}
+
+//-----------------------------------------------------------------------------
+// Sine with 1% of the second and 0.5% of the third harmonic, stored in the
+// ring with the oldest sample at 'offset'. Phases are reported for the cosine
+// components, so harmonic k of the sines is shifted by (k - 1) * 90 degrees.
+static void test_signal(int size, int offset, double period, double noise)
+{
+  int64_t frequency = llround(1e12 / (period * SAMPLE_PERIOD)); // mHz
+  double thd = sqrt(H2_LEVEL * H2_LEVEL + H3_LEVEL * H3_LEVEL) * 10000;
+  double rms = AMPLITUDE * 10000 / sqrt(2); // uV
+  int count = (int)(period * 0.45); // Below the Nyquist frequency
+  Harmonics h;
+
+  if (count > HARMONICS_COUNT)
+    count = HARMONICS_COUNT;
+
+  for (int i = 0; i < size; i++)
+  {
+    double w = 2 * M_PI * i / period;
+    double v = 133 + AMPLITUDE * (sin(w + 0.3) +
+        H2_LEVEL * sin(2 * w + 0.6 + H2_PHASE * M_PI / 180) +
+        H3_LEVEL * sin(3 * w + 0.9)) +
+        noise * (2.0 * rand() / RAND_MAX - 1);
+
+    g_data[(i + offset) % size] = (int)lround(v);
+  }
+
+  check(harmonics_calc(g_data, size, offset, frequency, SAMPLE_PERIOD, VS_MULT, &h));
+
+  check(h.count == count);
+  check(fabs(h.rms[0] - rms) < rms * 0.002);
+  check(abs(h.level[1] - 100) <= 10);
+  check(abs(h.level[2] - 50) <= 10);
+  check(fabs(h.thd - thd) <= 10);
+  check(0 == h.phase[0]);
+  check(phase_error(h.phase[1], H2_PHASE + 90) <= 2);
+  check(phase_error(h.phase[2], 180) <= 6);
+
+  printf("period %8.2f: ok, %2d harmonics, rms %d uV, H2 %d.%02d%% at %d, "
+      "H3 %d.%02d%% at %d, THD %d.%02d%%\n", period, h.count, h.rms[0],
+      h.level[1] / 100, h.level[1] % 100, h.phase[1],
+      h.level[2] / 100, h.level[2] % 100, h.phase[2], h.thd / 100, h.thd % 100);
+}
+
+//-----------------------------------------------------------------------------
+// Less than two periods in the record
+static void test_short(void)
+{
+  Harmonics h;
+
+  for (int i = 0; i < SIZE; i++)
+    g_data[i] = 128 + lround(AMPLITUDE * sin(2 * M_PI * i / 30000.1));
+
+  check(!harmonics_calc(g_data, 16384, 0, llround(1e12 / (30000.1 * SAMPLE_PERIOD)),
+      SAMPLE_PERIOD, VS_MULT, &h));
+  check(0 == h.count);
+
+  check(!harmonics_calc(g_data, SIZE, 0, 0, SAMPLE_PERIOD, VS_MULT, &h));
+  check(0 == h.count);
+
+  printf("short record: ok\n");
+}
+
+//-----------------------------------------------------------------------------
+int main(void)
+{
+  static const double periods[] = { 7.3, 17.77, 33.3, 50.5, 100.3, 1000.7, 5003.3, 30000.1 };
+
+  srand(1);
+
+  for (int i = 0; i < 8; i++)
+    test_signal(SIZE, 777, periods[i], 0);
+
+  for (int i = 0; i < 7; i++)
+    test_signal(16384, 0, periods[i], 1.5);
+
+  test_short();
+
+  return 0;
+}
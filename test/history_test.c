@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "capture.h"
+#include "history.h"
+#include "test.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define MAX_RECORD_SIZE        (32 * 1024)
+#define ACQUISITIONS           3000
+
+/*- Variables ---------------------------------------------------------------*/
+static uint8_t g_src[MAX_RECORD_SIZE];
+static uint8_t g_ring[MAX_RECORD_SIZE];
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+// Noisy sine with an occasional glitch, the seed makes every record unique
+static void make_record(int seed, int size)
+{
+  for (int i = 0; i < size; i++)
+  {
+    uint32_t hash = ((uint32_t)i * 2654435761u) ^ ((uint32_t)seed * 40503u);
+
+    g_src[i] = 128 + 60 * sin((i + seed * 37) / 50.0) + (int)((hash >> 13) % 3) - 1;
+
+    if (0 == (seed % 7) && i == size / 2)
+      g_src[i] += 90;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Entries are intact and newest first after random interleaving of the adds
+// and the compression. The area is allocated separately, so ASan catches
+// any access outside of it.
+static void test_record_size(int record_size)
+{
+  int area_size = CAPTURE_BUFFER_SIZE - record_size;
+  uint8_t *area = malloc(area_size);
+  int count, last;
+
+  check(area);
+  history_set_area(area, area_size, record_size);
+
+  for (int n = 0; n < ACQUISITIONS; n++)
+  {
+    int offset = rand() % record_size;
+    CaptureRecord record = { 8, record_size, offset, -record_size / 2, n, 1000, g_ring };
+    int steps = rand() % 40;
+
+    make_record(n, record_size);
+
+    for (int i = 0; i < record_size; i++)
+      g_ring[(offset + i) % record_size] = g_src[i];
+
+    history_add(&record);
+
+    for (int i = 0; i < steps; i++)
+      history_task();
+  }
+
+  count = history_get_count();
+  check(count > 0);
+
+  last = ACQUISITIONS;
+
+  for (int i = 0; i < count; i++)
+  {
+    CaptureRecord record;
+
+    check(history_get(i, &record));
+    check(record.offset == 0 && record.size == record_size);
+    check(record.min_index == -record_size / 2 && 8 == record.period && 1000 == record.vs_mult);
+    check(record.vpos < last);
+
+    make_record(record.vpos, record_size);
+    check(0 == memcmp(record.data, g_src, record_size));
+
+    last = record.vpos;
+  }
+
+  check(!history_get(count, &(CaptureRecord){ 0 }));
+
+  printf("record %5d: %3d entries kept\n", record_size, count);
+
+  history_set_area(NULL, 0, 0);
+  free(area);
+}
+
+//-----------------------------------------------------------------------------
+// History is off when the area can't hold a single record
+static void test_disabled(void)
+{
+  static uint8_t area[MAX_RECORD_SIZE];
+  CaptureRecord record = { 8, MAX_RECORD_SIZE, 0, 0, 0, 0, g_src };
+
+  history_set_area(area, sizeof(area), MAX_RECORD_SIZE);
+  history_add(&record);
+
+  for (int i = 0; i < 1000; i++)
+    history_task();
+
+  check(0 == history_get_count());
+
+  printf("disabled: ok\n");
+}
+
+//-----------------------------------------------------------------------------
+int main(void)
+{
+  srand(1);
+
+  for (int size = 1024; size <= MAX_RECORD_SIZE; size *= 2)
+    test_record_size(size);
+
+  test_disabled();
+
+  return 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Host versions of the hardware dependent helpers. The rest of utils.c is
+// used as is.
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include "gd32f4xx.h"
+
+#define crc32_init hw_crc32_init
+#define crc32_calc hw_crc32_calc
+#include "../utils.c"
+#undef crc32_init
+#undef crc32_calc
+
+/*- Prototypes --------------------------------------------------------------*/
+void crc32_init(void);
+uint32_t crc32_calc(uint32_t *data, int size);
+void error(char *text);
+
+/*- Variables ---------------------------------------------------------------*/
+HostRcu host_rcu;
+HostCrc host_crc;
+HostFmc host_fmc;
+uint32_t host_ge;
+uint64_t host_mac_count;
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+void crc32_init(void)
+{
+}
+
+//-----------------------------------------------------------------------------
+// Same as the CRC unit: CRC-32 polynomial, all ones initial value, whole
+// words MSB first and no final inversion
+uint32_t crc32_calc(uint32_t *data, int size)
+{
+  uint32_t crc = 0xffffffff;
+
+  size /= sizeof(uint32_t);
+
+  for (int i = 0; i < size; i++)
+  {
+    crc ^= data[i];
+
+    for (int j = 0; j < 32; j++)
+      crc = (crc & 0x80000000) ? ((crc << 1) ^ 0x04c11db7) : (crc << 1);
+  }
+
+  return crc;
+}
+
+//-----------------------------------------------------------------------------
+void error(char *text)
+{
+  fprintf(stderr, "error: %s\n", text);
+  abort();
+}
@@ -0,0 +1,292 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef GD32F4XX_H
+#define GD32F4XX_H
+
+// Host stand-in for the device header. The DSP intrinsics are emulated in
+// plain C, so the firmware modules can be built and tested on a PC. Calls to
+// the multiply-accumulate intrinsics are counted for the benchmarks.
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/*- Types -------------------------------------------------------------------*/
+typedef struct
+{
+  struct
+  {
+    uint32_t CRCEN;
+  } AHB1EN_b;
+} HostRcu;
+
+typedef struct
+{
+  volatile uint32_t DATA;
+  volatile uint32_t CTL;
+} HostCrc;
+
+// Operations complete at once, erasing is left to the tests
+typedef struct
+{
+  volatile uint32_t KEY;
+  volatile uint32_t STAT;
+  volatile uint32_t CTL;
+} HostFmc;
+
+/*- Definitions -------------------------------------------------------------*/
+#define CRC_CTL_RST_Msk        1
+
+#define FMC_STAT_OPERR_Msk     0x2
+#define FMC_STAT_WPERR_Msk     0x10
+#define FMC_STAT_PGMERR_Msk    0x40
+#define FMC_STAT_PGSERR_Msk    0x80
+#define FMC_STAT_RDDERR_Msk    0x100
+#define FMC_STAT_BUSY_Msk      0x10000
+#define FMC_CTL_LK_Msk         0x80000000
+#define FMC_CTL_START_Msk      0x10000
+#define FMC_CTL_PSZ_Pos        8
+#define FMC_CTL_SN_Pos         3
+#define FMC_CTL_SER_Msk        0x2
+#define FMC_CTL_PG_Msk         0x1
+
+#define RCU                    (&host_rcu)
+#define CRC                    (&host_crc)
+#define FMC                    (&host_fmc)
+
+#define __UNALIGNED_UINT32_READ(addr) host_read32((const void *)(addr))
+
+/*- Variables ---------------------------------------------------------------*/
+extern HostRcu host_rcu;
+extern HostCrc host_crc;
+extern HostFmc host_fmc;
+extern uint64_t host_mac_count;
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+static inline uint32_t host_read32(const void *addr)
+{
+  uint32_t value;
+  memcpy(&value, addr, sizeof(value));
+  return value;
+}
+
+//-----------------------------------------------------------------------------
+static inline void __disable_irq(void)
+{
+}
+
+//-----------------------------------------------------------------------------
+static inline void __enable_irq(void)
+{
+}
+
+//-----------------------------------------------------------------------------
+static inline uint32_t __CLZ(uint32_t value)
+{
+  return value ? __builtin_clz(value) : 32;
+}
+
+//-----------------------------------------------------------------------------
+static inline uint32_t __RBIT(uint32_t value)
+{
+  uint32_t res = 0;
+
+  for (int i = 0; i < 32; i++)
+    res |= ((value >> i) & 1) << (31 - i);
+
+  return res;
+}
+
+//-----------------------------------------------------------------------------
+static inline uint32_t __ROR(uint32_t value, uint32_t shift)
+{
+  shift &= 31;
+  return shift ? ((value >> shift) | (value << (32 - shift))) : value;
+}
+
+//-----------------------------------------------------------------------------
+static inline uint32_t __UXTB16(uint32_t value)
+{
+  return value & 0x00ff00ff;
+}
+
+//-----------------------------------------------------------------------------
+static inline uint32_t __PKHBT(uint32_t a, uint32_t b, uint32_t shift)
+{
+  return (a & 0xffff) | ((b << shift) & 0xffff0000);
+}
+
+//-----------------------------------------------------------------------------
+// GE flags of the last USUB8, used by SEL
+extern uint32_t host_ge;
+
+//-----------------------------------------------------------------------------
+static inline uint32_t __USUB8(uint32_t a, uint32_t b)
+{
+  uint32_t res = 0;
+
+  host_ge = 0;
+
+  for (int i = 0; i < 32; i += 8)
+  {
+    int x = (a >> i) & 0xff;
+    int y = (b >> i) & 0xff;
+
+    if (x >= y)
+      host_ge |= 1 << (i / 8);
+
+    res |= (uint32_t)((x - y) & 0xff) << i;
+  }
+
+  return res;
+}
+
+//-----------------------------------------------------------------------------
+static inline uint32_t __SEL(uint32_t a, uint32_t b)
+{
+  uint32_t res = 0;
+
+  for (int i = 0; i < 4; i++)
+    res |= (((host_ge >> i) & 1) ? a : b) & (0xffu << (i * 8));
+
+  return res;
+}
+
+//-----------------------------------------------------------------------------
+static inline uint32_t __UQSUB8(uint32_t a, uint32_t b)
+{
+  uint32_t res = 0;
+
+  for (int i = 0; i < 32; i += 8)
+  {
+    int v = (int)((a >> i) & 0xff) - (int)((b >> i) & 0xff);
+    res |= (uint32_t)(v < 0 ? 0 : v) << i;
+  }
+
+  return res;
+}
+
+//-----------------------------------------------------------------------------
+static inline uint32_t __UQADD8(uint32_t a, uint32_t b)
+{
+  uint32_t res = 0;
+
+  for (int i = 0; i < 32; i += 8)
+  {
+    int v = (int)((a >> i) & 0xff) + (int)((b >> i) & 0xff);
+    res |= (uint32_t)(v > 0xff ? 0xff : v) << i;
+  }
+
+  return res;
+}
+
+//-----------------------------------------------------------------------------
+static inline uint32_t __USADA8(uint32_t a, uint32_t b, uint32_t acc)
+{
+  for (int i = 0; i < 32; i += 8)
+  {
+    int v = (int)((a >> i) & 0xff) - (int)((b >> i) & 0xff);
+    acc += (v < 0) ? -v : v;
+  }
+
+  return acc;
+}
+
+//-----------------------------------------------------------------------------
+// Products are added modulo 2^32, the same as the hardware does
+static inline uint32_t host_mul16(uint32_t a, uint32_t b)
+{
+  return (uint32_t)((int32_t)(int16_t)a * (int16_t)b);
+}
+
+//-----------------------------------------------------------------------------
+static inline uint32_t __SMLAD(uint32_t a, uint32_t b, uint32_t acc)
+{
+  host_mac_count++;
+  return acc + host_mul16(a, b) + host_mul16(a >> 16, b >> 16);
+}
+
+//-----------------------------------------------------------------------------
+static inline uint32_t __SMUAD(uint32_t a, uint32_t b)
+{
+  return host_mul16(a, b) + host_mul16(a >> 16, b >> 16);
+}
+
+//-----------------------------------------------------------------------------
+static inline uint32_t __SMUSDX(uint32_t a, uint32_t b)
+{
+  return host_mul16(a, b >> 16) - host_mul16(a >> 16, b);
+}
+
+//-----------------------------------------------------------------------------
+static inline uint32_t host_pack16(int lo, int hi)
+{
+  return ((uint32_t)lo & 0xffff) | ((uint32_t)hi << 16);
+}
+
+//-----------------------------------------------------------------------------
+static inline int host_sat16(int value)
+{
+  return (value > INT16_MAX) ? INT16_MAX : (value < INT16_MIN) ? INT16_MIN : value;
+}
+
+//-----------------------------------------------------------------------------
+static inline uint32_t __SHADD16(uint32_t a, uint32_t b)
+{
+  return host_pack16(((int16_t)a + (int16_t)b) >> 1, ((int16_t)(a >> 16) + (int16_t)(b >> 16)) >> 1);
+}
+
+//-----------------------------------------------------------------------------
+static inline uint32_t __SHSUB16(uint32_t a, uint32_t b)
+{
+  return host_pack16(((int16_t)a - (int16_t)b) >> 1, ((int16_t)(a >> 16) - (int16_t)(b >> 16)) >> 1);
+}
+
+//-----------------------------------------------------------------------------
+static inline uint32_t __SHASX(uint32_t a, uint32_t b)
+{
+  return host_pack16(((int16_t)a - (int16_t)(b >> 16)) >> 1, ((int16_t)(a >> 16) + (int16_t)b) >> 1);
+}
+
+//-----------------------------------------------------------------------------
+static inline uint32_t __SHSAX(uint32_t a, uint32_t b)
+{
+  return host_pack16(((int16_t)a + (int16_t)(b >> 16)) >> 1, ((int16_t)(a >> 16) - (int16_t)b) >> 1);
+}
+
+//-----------------------------------------------------------------------------
+static inline uint32_t __QSUB16(uint32_t a, uint32_t b)
+{
+  return host_pack16(host_sat16((int16_t)a - (int16_t)b), host_sat16((int16_t)(a >> 16) - (int16_t)(b >> 16)));
+}
+
+#endif // GD32F4XX_H
@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "config.h"
+#include "measure.h"
+#include "jitter.h"
+#include "test.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define SIZE                   (128 * 1024)
+#define PERIOD                 8 // ns
+#define VS_MULT                (10 * 1024) // 10 mV/count
+#define SIGNAL_PERIOD          1000.37 // Samples
+#define EDGE_TIME              12 // Samples
+#define RECORDS                20
+#define MAX_EDGES              (2 * SIZE / 1000 + 4) // Two per signal period
+
+/*- Variables ---------------------------------------------------------------*/
+static uint8_t g_record[SIZE];
+static double g_edges[MAX_EDGES];
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+static double gauss(void)
+{
+  double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+  double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+  return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+//-----------------------------------------------------------------------------
+// Square between 40 and 200 counts with linear edges, each edge is moved by
+// the Gaussian jitter of 'sigma' samples
+static void make_record(double sigma)
+{
+  int k = 0;
+
+  for (int i = 0; i < MAX_EDGES; i++)
+    g_edges[i] = i * SIGNAL_PERIOD / 2 + 37.3 + sigma * gauss();
+
+  for (int i = 0; i < SIZE; i++)
+  {
+    double from, to, d;
+
+    while (k + 1 < MAX_EDGES && g_edges[k + 1] - EDGE_TIME / 2.0 <= i)
+      k++;
+
+    from = (k & 1) ? 200 : 40;
+    to   = (k & 1) ? 40 : 200;
+    d    = i - g_edges[k];
+
+    if (d < -EDGE_TIME / 2.0)
+      g_record[i] = lround(from);
+    else if (d > EDGE_TIME / 2.0)
+      g_record[i] = lround(to);
+    else
+      g_record[i] = lround(from + (to - from) * (d + EDGE_TIME / 2.0) / EDGE_TIME);
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void run(int mode, double sigma, Jitter *j)
+{
+  const uint32_t *bins;
+  Measurements m;
+  uint32_t total = 0;
+
+  config.jitter = mode;
+  jitter_reset();
+
+  for (int i = 0; i < RECORDS; i++)
+  {
+    make_record(sigma);
+    measure_calc(g_record, SIZE, 0, PERIOD, VS_MULT, 0, &m);
+  }
+
+  check(jitter_get(j));
+  check(RECORDS == j->records);
+
+  bins = jitter_get_bins();
+
+  for (int i = 0; i < JITTER_BINS; i++)
+    total += bins[i];
+
+  check(total == j->count);
+}
+
+//-----------------------------------------------------------------------------
+// Edges of the clean record are only moved by the 8-bit quantization
+static void test_floor(void)
+{
+  Jitter tie, period;
+
+  run(JITTER_TIE, 0, &tie);
+  run(JITTER_PERIOD, 0, &period);
+
+  check(tie.rms > 0 && tie.rms < 200);
+  check(period.rms > 0 && period.rms < 200);
+
+  printf("floor: ok, TIE %d ps, period %d ps\n", (int)tie.rms, (int)period.rms);
+}
+
+//-----------------------------------------------------------------------------
+// Period jitter is the difference of two independent TIE values
+static void test_jitter(int mode, double sigma)
+{
+  double expected = sigma * PERIOD * 1000 * ((JITTER_TIE == mode) ? 1 : sqrt(2));
+  double error;
+  Jitter j;
+
+  run(mode, sigma, &j);
+
+  error = (j.rms - expected) / expected;
+
+  check(fabs(error) < 0.03);
+  check(j.peak > 4 * j.rms && j.peak < 10 * j.rms);
+
+  printf("%s, %.1f samples: ok, %u values, rms %d ps, error %.1f%%\n",
+      (JITTER_TIE == mode) ? "TIE" : "period", sigma, j.count, (int)j.rms, error * 100);
+}
+
+//-----------------------------------------------------------------------------
+int main(void)
+{
+  static const double sigmas[] = { 0.2, 0.5, 2.0 };
+
+  srand(1);
+
+  config.frequency_source = FREQUENCY_SOURCE_EDGES;
+
+  test_floor();
+
+  for (int i = 0; i < 3; i++)
+  {
+    test_jitter(JITTER_TIE, sigmas[i]);
+    test_jitter(JITTER_PERIOD, sigmas[i]);
+  }
+
+  return 0;
+}
@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdalign.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "flash.h"
+#include "flash_ram.h"
+#include "storage.h"
+#include "config.h"
+#include "logger.h"
+#include "stubs.h"
+#include "test.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define BLOCK_SIZE             16384 // Samples per DMA block
+#define LOG_HEADER_SIZE        32 // Private to logger.c
+#define SEGMENT_RECORDS        10000
+
+/*- Variables ---------------------------------------------------------------*/
+static alignas(4) uint8_t g_block[BLOCK_SIZE];
+static uint8_t g_segment[LOG_HEADER_SIZE + SEGMENT_RECORDS * sizeof(LogRecord)];
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+static void run(int steps)
+{
+  for (int i = 0; i < steps; i++)
+  {
+    logger_task();
+    storage_task();
+    flash_task();
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void next_interval(void)
+{
+  stub_uptime += 1000;
+  run(1);
+}
+
+//-----------------------------------------------------------------------------
+static void format_storage(void)
+{
+  memset(flash_ram, 0xff, sizeof(flash_ram));
+  flash_ram_power_loss();
+  storage_init();
+  check(storage_ready());
+}
+
+//-----------------------------------------------------------------------------
+// Records match the exact statistics of the samples
+static void test_records(void)
+{
+  double avg_error = 0.0, rms_error = 0.0;
+
+  format_storage();
+  logger_start(1);
+
+  for (int n = 0; n < 50; n++)
+  {
+    double sum = 0.0, sum_sq = 0.0;
+    int vmin = 255, vmax = 0;
+    const LogRecord *record;
+
+    for (int b = 0; b < 5; b++)
+    {
+      int amp = rand() % 120;
+      int offset = rand() % 40 - 20;
+
+      for (int i = 0; i < BLOCK_SIZE; i++)
+      {
+        int v = 128 + offset + (int)(amp * sin(i * 0.01 + b)) + rand() % 5 - 2;
+
+        v = (v < 0) ? 0 : ((v > 255) ? 255 : v);
+        g_block[i] = v;
+
+        sum    += v;
+        sum_sq += (v - 128.0) * (v - 128.0);
+        vmin    = (v < vmin) ? v : vmin;
+        vmax    = (v > vmax) ? v : vmax;
+      }
+
+      logger_update(g_block, BLOCK_SIZE);
+    }
+
+    next_interval();
+
+    record = logger_get(0);
+    check(record && record->min == vmin && record->max == vmax);
+
+    avg_error = fmax(avg_error, fabs(record->avg / 256.0 - sum / (5 * BLOCK_SIZE)));
+    rms_error = fmax(rms_error, fabs(record->rms / 256.0 - sqrt(sum_sq / (5 * BLOCK_SIZE))));
+  }
+
+  // 8.8 fixed point
+  check(avg_error < 1.0 / 256 && rms_error < 1.0 / 256);
+  check(50 == logger_get_total() && 0 == logger_get_lost());
+
+  logger_stop();
+  run(1000);
+
+  printf("records: ok, avg error %.5f, rms error %.5f\n", avg_error, rms_error);
+}
+
+//-----------------------------------------------------------------------------
+// Full segments are saved and old ones are recycled, records in the storage
+// match the ones shown on the chart
+static void test_segments(void)
+{
+  int records = 3 * SEGMENT_RECORDS + 123;
+  int id, size;
+
+  format_storage();
+  logger_start(1);
+
+  for (int n = 0; n < records; n++)
+  {
+    memset(g_block, n & 0xff, 64);
+    logger_update(g_block, 64);
+    next_interval();
+    run(20);
+  }
+
+  logger_stop();
+  run(100000);
+
+  check(records == logger_get_total() && 0 == logger_get_lost());
+  check(!logger_full());
+
+  id = storage_get_last(STORAGE_TYPE_LOG);
+  size = storage_get_size(id);
+  check(size == LOG_HEADER_SIZE + 123 * (int)sizeof(LogRecord));
+
+  id = storage_get_prev(STORAGE_TYPE_LOG, id);
+  size = storage_get_size(id);
+  check(size == (int)sizeof(g_segment));
+  check(storage_read(id, 0, g_segment, size) == size);
+
+  for (int i = 0; i < SEGMENT_RECORDS; i++)
+  {
+    LogRecord *record = (LogRecord *)&g_segment[LOG_HEADER_SIZE + i * sizeof(LogRecord)];
+    int value = (2 * SEGMENT_RECORDS + i) & 0xff;
+
+    check(record->min == value && record->max == value && record->avg == value * 256);
+  }
+
+  printf("segments: ok\n");
+}
+
+//-----------------------------------------------------------------------------
+// Logger never deletes other objects, it stops once there is no space left
+static void test_full(void)
+{
+  static uint8_t data[60000];
+  int kept = 0;
+  int id;
+
+  format_storage();
+
+  while (1)
+  {
+    id = storage_create(STORAGE_TYPE_WAVEFORM, false);
+    check(id > 0);
+
+    for (int offset = 0; offset < (int)sizeof(data) && !storage_failed(id);)
+    {
+      offset += storage_write(&data[offset], sizeof(data) - offset);
+      storage_task();
+      flash_task();
+    }
+
+    storage_close();
+    run(1000);
+
+    if (storage_failed(id))
+      break;
+
+    kept++;
+  }
+
+  logger_start(1);
+
+  for (int n = 0; n < 100 && !logger_full(); n++)
+  {
+    logger_update(g_block, 64);
+    next_interval();
+    run(1000);
+  }
+
+  check(logger_full());
+  check(logger_get_lost() > 0);
+
+  for (id = storage_get_last(STORAGE_TYPE_WAVEFORM); id > 0; id = storage_get_prev(STORAGE_TYPE_WAVEFORM, id))
+    kept--;
+
+  check(0 == kept);
+
+  // No records are added after the stop
+  id = logger_get_total();
+  next_interval();
+  check(id == logger_get_total());
+
+  printf("full storage: ok\n");
+}
+
+//-----------------------------------------------------------------------------
+int main(void)
+{
+  srand(1);
+
+  test_records();
+  test_segments();
+  test_full();
+
+  return 0;
+}
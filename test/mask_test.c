@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdalign.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "flash.h"
+#include "flash_ram.h"
+#include "storage.h"
+#include "common.h"
+#include "mask.h"
+#include "test.h"
+
+/*- Variables ---------------------------------------------------------------*/
+static alignas(4) uint8_t g_golden_top[GRID_WIDTH];
+static alignas(4) uint8_t g_golden_bottom[GRID_WIDTH];
+static alignas(4) uint8_t g_golden_flags[GRID_WIDTH];
+static alignas(4) uint8_t g_top[GRID_WIDTH];
+static alignas(4) uint8_t g_bottom[GRID_WIDTH];
+static alignas(4) uint8_t g_flags[GRID_WIDTH];
+static alignas(4) uint8_t g_fail[GRID_WIDTH];
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+static void run(void)
+{
+  while (storage_busy())
+  {
+    storage_task();
+    flash_task();
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Top is above the bottom on the screen, so it has the smaller value. Some
+// columns have no data.
+static void make_trace(uint8_t *top, uint8_t *bottom, uint8_t *flags)
+{
+  for (int i = 0; i < GRID_WIDTH; i++)
+  {
+    top[i]    = rand() % 199;
+    bottom[i] = top[i] + rand() % (199 - top[i]);
+    flags[i]  = (rand() % 4) ? SAMPLE_FLAG_VALID : 0;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Scalar version of the limits and the check
+static void check_against_reference(int margin)
+{
+  const uint8_t *mask_top = mask_get_top();
+  const uint8_t *mask_bottom = mask_get_bottom();
+  bool any = false;
+
+  for (int i = 0; i < GRID_WIDTH; i++)
+  {
+    bool valid = g_golden_flags[i] & SAMPLE_FLAG_VALID;
+    int top = valid ? g_golden_top[i] - margin : 0;
+    int bottom = valid ? g_golden_bottom[i] + margin : 255;
+
+    check(mask_top[i] == (top < 0 ? 0 : top));
+    check(mask_bottom[i] == (bottom > 255 ? 255 : bottom));
+  }
+
+  for (int n = 0; n < 200; n++)
+  {
+    bool res;
+
+    make_trace(g_top, g_bottom, g_flags);
+    res = mask_check(g_top, g_bottom, g_flags, g_fail);
+    any = false;
+
+    for (int i = 0; i < GRID_WIDTH; i++)
+    {
+      bool fail = (g_flags[i] & SAMPLE_FLAG_VALID) &&
+          (g_top[i] < mask_top[i] || g_bottom[i] > mask_bottom[i]);
+
+      check(fail == (g_fail[i] != 0));
+      any |= fail;
+    }
+
+    check(res == any);
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void test_check(void)
+{
+  for (int n = 0; n < 100; n++)
+  {
+    int margin = rand() % 51;
+
+    make_trace(g_golden_top, g_golden_bottom, g_golden_flags);
+    mask_set_margin(margin);
+    mask_create(g_golden_top, g_golden_bottom, g_golden_flags);
+
+    check_against_reference(margin);
+  }
+
+  // The golden trace itself always passes
+  mask_set_margin(0);
+  check(!mask_check(g_golden_top, g_golden_bottom, g_golden_flags, g_fail));
+
+  printf("check: ok\n");
+}
+
+//-----------------------------------------------------------------------------
+static void test_save_load(void)
+{
+  int id, other;
+
+  memset(flash_ram, 0xff, sizeof(flash_ram));
+  flash_ram_power_loss();
+  storage_init();
+  check(storage_ready());
+
+  make_trace(g_golden_top, g_golden_bottom, g_golden_flags);
+  mask_set_margin(5);
+
+  id = mask_create(g_golden_top, g_golden_bottom, g_golden_flags);
+  check(id > 0);
+
+  // Storage is busy with the first mask
+  check(mask_create(g_golden_top, g_golden_bottom, g_golden_flags) < 0);
+  run();
+
+  other = mask_create(g_golden_flags, g_golden_flags, g_golden_flags);
+  check(other > id);
+  run();
+
+  check(mask_load(id));
+  check_against_reference(5);
+
+  // Not a mask or no object at all
+  check(!mask_load(0));
+  check(!mask_load(other + 1));
+
+  check(storage_create(STORAGE_TYPE_WAVEFORM, false) > 0);
+  storage_write(g_golden_top, sizeof(g_golden_top));
+  storage_close();
+  run();
+
+  check(!mask_load(storage_get_last(STORAGE_TYPE_WAVEFORM)));
+  check_against_reference(5);
+
+  printf("save and load: ok\n");
+}
+
+//-----------------------------------------------------------------------------
+int main(void)
+{
+  srand(1);
+
+  test_check();
+  test_save_load();
+
+  return 0;
+}
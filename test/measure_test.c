@@ -0,0 +1,299 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdalign.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "config.h"
+#include "measure.h"
+#include "test.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define SIZE                   (32 * 1024)
+#define PERIOD                 8 // ns
+#define VS_MULT                (10 * 1024) // 10 mV/count
+
+/*- Variables ---------------------------------------------------------------*/
+static alignas(4) uint8_t g_record[SIZE];
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+static bool near(double value, double expected, double tolerance)
+{
+  return fabs(value - expected) <= tolerance;
+}
+
+//-----------------------------------------------------------------------------
+// 30% duty square with a period of 1000 samples, 20-sample linear edges and
+// a 10% overshoot spike after the rising edge, between 40 and 200 counts
+static void test_square(void)
+{
+  Measurements m;
+
+  for (int i = 0; i < SIZE; i++)
+  {
+    int p = i % 1000;
+    double v;
+
+    if (p < 20)
+      v = 40 + 160 * p / 20.0;
+    else if (p < 300)
+      v = 200;
+    else if (p < 320)
+      v = 200 - 160 * (p - 300) / 20.0;
+    else
+      v = 40;
+
+    if (20 == p)
+      v = 216;
+
+    g_record[(i + 5000) % SIZE] = lround(v);
+  }
+
+  measure_calc(g_record, SIZE, 5000, PERIOD, VS_MULT, 0, &m);
+
+  check(m.valid && m.frequency_valid && m.timing_valid && m.rise_valid && m.fall_valid);
+  // Codes are the centers of the ADC steps, so the levels are 5 mV up
+  check(885 == m.vmax && -875 == m.vmin);
+  check(near(m.vtop, 725, 2) && near(m.vbase, -875, 2));
+  check(100 == m.overshoot && 0 == m.preshoot);
+  check(8000 == m.period && 125000000 == m.frequency);
+  check(2400 == m.pwidth && 5600 == m.nwidth && 300 == m.duty);
+  check(128 == m.rise && 128 == m.fall);
+
+  printf("square: ok\n");
+}
+
+//-----------------------------------------------------------------------------
+static void test_sine(void)
+{
+  double period = 777.0 * PERIOD;
+  double rise = 2.0 * asin(0.8) / (2.0 * M_PI) * period;
+  double sum = 0.0, sum_sq = 0.0, avg, rms;
+  Measurements m;
+
+  for (int i = 0; i < SIZE; i++)
+  {
+    double mv;
+
+    g_record[i] = lround(128 + 100 * sin(2 * M_PI * i / 777.0));
+
+    mv = (g_record[i] - 128) * 10.0 - 500;
+    sum += mv;
+    sum_sq += mv * mv;
+  }
+
+  avg = sum / SIZE;
+  rms = sqrt(sum_sq / SIZE);
+
+  measure_calc(g_record, SIZE, 0, PERIOD, VS_MULT, 500, &m);
+
+  check(m.valid && m.frequency_valid && m.rise_valid && m.fall_valid);
+  check(near(m.period, period, 1));
+  check(near(m.frequency / 1000.0, 1e9 / period, 0.5));
+  check(near(m.vrms, rms, 2));
+  check(near(m.vavg, avg, 1));
+  check(near(m.rise, rise, period * 0.01) && near(m.fall, rise, period * 0.01));
+  check(near(m.duty, 500, 2));
+
+  printf("sine: ok, rms %d mV, rise %d ns\n", m.vrms, m.rise);
+}
+
+//-----------------------------------------------------------------------------
+// Two counts of noise are below the minimum amplitude for the timing
+static void test_noise(void)
+{
+  Measurements m;
+
+  for (int i = 0; i < SIZE; i++)
+    g_record[i] = 128 + rand() % 3;
+
+  measure_calc(g_record, SIZE, 0, PERIOD, VS_MULT, 0, &m);
+
+  check(m.valid);
+  check(!m.frequency_valid && !m.timing_valid && !m.rise_valid && !m.fall_valid);
+
+  printf("noise: ok\n");
+}
+
+//-----------------------------------------------------------------------------
+// Period is fitted over all crossings, so even a short noisy record gives
+// a fine frequency
+static void test_period_fit(void)
+{
+  double f0 = 7.123456e6;
+  double sum = 0.0, sum_sq = 0.0, mean, sd;
+  Measurements m;
+
+  // 125 MS/s, about 3.6 periods in the record
+  for (int n = 0; n < 200; n++)
+  {
+    double f;
+
+    for (int i = 0; i < 512; i++)
+      g_record[i] = lround(128 + 90 * sin(2 * M_PI * f0 * i * PERIOD * 1e-9 + n * 0.031) +
+          (rand() % 300) / 100.0 - 1.5);
+
+    measure_calc(g_record, 512, 0, PERIOD, VS_MULT, 0, &m);
+    check(m.frequency_valid);
+
+    f = m.frequency / 1000.0;
+    sum += f;
+    sum_sq += f * f;
+  }
+
+  mean = sum / 200;
+  sd   = sqrt(sum_sq / 200 - mean * mean);
+
+  check(near(mean, f0, f0 * 1e-4) && sd < f0 * 1e-4);
+
+  // Slow timebase, sample period is 32.768 us
+  for (int i = 0; i < SIZE; i++)
+    g_record[i] = lround(128 + 90 * sin(2 * M_PI * 50.1234 * i * PERIOD * 4096 * 1e-9));
+
+  measure_calc(g_record, SIZE, 0, PERIOD * 4096, VS_MULT, 0, &m);
+  check(m.frequency_valid && near(m.frequency / 1000.0, 50.1234, 0.001));
+
+  printf("period fit: ok, %.0f Hz deviation at %.0f Hz\n", sd, f0);
+}
+
+//-----------------------------------------------------------------------------
+static double gauss(void)
+{
+  double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+  double v = rand() / (RAND_MAX + 1.0);
+
+  return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+//-----------------------------------------------------------------------------
+// Two levels between the codes with Gaussian noise. The noise is compared
+// with the deviation of the samples on the top level.
+static void test_histogram(double sigma)
+{
+  const uint32_t *histogram;
+  double sum = 0.0, sum_sq = 0.0, sd, error;
+  int count = 0, total = 0;
+  Measurements m;
+
+  for (int i = 0; i < SIZE; i++)
+  {
+    bool top = (i % 1000) < 500;
+    double v = (top ? 190.3 : 60.7) + sigma * gauss();
+
+    g_record[i] = (v < 0) ? 0 : ((v > 255) ? 255 : lround(v));
+
+    if (top)
+    {
+      sum += g_record[i];
+      sum_sq += g_record[i] * (double)g_record[i];
+      count++;
+    }
+  }
+
+  sd = sqrt(sum_sq / count - (sum / count) * (sum / count)) * 10000;
+
+  measure_calc(g_record, SIZE, 0, PERIOD, VS_MULT, 0, &m);
+
+  histogram = measure_get_histogram();
+
+  for (int i = 0; i < 256; i++)
+    total += histogram[i];
+
+  error = (m.noise - sd) / sd;
+
+  check(SIZE == total);
+  check(m.noise_valid && fabs(error) < 0.01);
+  // Levels are 62.3 and -67.3 counts, plus half a step
+  check(near(m.vtop, 628, 1) && near(m.vbase, -668, 1));
+
+  printf("histogram, sigma %.1f: ok, noise %d uV, error %.2f%%\n", sigma, m.noise, error * 100);
+}
+
+//-----------------------------------------------------------------------------
+// Noise is only measured on flat levels
+static void test_no_levels(void)
+{
+  Measurements m;
+
+  for (int i = 0; i < SIZE; i++)
+    g_record[i] = lround(128 + 100 * sin(i * 0.01));
+
+  measure_calc(g_record, SIZE, 0, PERIOD, VS_MULT, 0, &m);
+  check(!m.noise_valid);
+
+  for (int i = 0; i < SIZE; i++)
+    g_record[i] = lround(128 + 100 * sin(i * 0.01) + 2 * gauss());
+
+  measure_calc(g_record, SIZE, 0, PERIOD, VS_MULT, 0, &m);
+  check(!m.noise_valid);
+
+  for (int i = 0; i < SIZE; i++)
+  {
+    int p = i % 1000;
+
+    g_record[i] = lround(((p < 500) ? 190.3 - p * 0.05 : 60.7) + 0.7 * gauss());
+  }
+
+  measure_calc(g_record, SIZE, 0, PERIOD, VS_MULT, 0, &m);
+  check(!m.noise_valid);
+
+  // A flat signal uses the deviation of all samples
+  for (int i = 0; i < SIZE; i++)
+    g_record[i] = lround(130 + 1.5 * gauss());
+
+  measure_calc(g_record, SIZE, 0, PERIOD, VS_MULT, 0, &m);
+  check(m.noise_valid && near(m.noise, 15500, 500));
+
+  printf("no levels: ok, flat noise %d uV\n", m.noise);
+}
+
+//-----------------------------------------------------------------------------
+int main(void)
+{
+  srand(1);
+
+  config.frequency_source = FREQUENCY_SOURCE_EDGES;
+
+  test_square();
+  test_sine();
+  test_noise();
+  test_period_fit();
+
+  for (double sigma = 0.5; sigma < 5; sigma *= 2)
+    test_histogram(sigma);
+
+  test_no_levels();
+
+  return 0;
+}
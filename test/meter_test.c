@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdalign.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "meter.h"
+#include "test.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define SIZE                   (128 * 1024)
+#define RECORDS                20
+#define AVERAGE                16 // Records averaged by the meter
+#define VS_MULT                8343 // 200 mV/div
+#define VPOS                   (-500) // mV
+#define TOLERANCE              5 // uV
+
+/*- Variables ---------------------------------------------------------------*/
+static alignas(4) uint8_t g_record[SIZE];
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+// DC, sine or square with a dither of one count, which gives the meter its
+// sub-count resolution
+static void make_record(int type, int n)
+{
+  for (int i = 0; i < SIZE; i++)
+  {
+    double v = 128 + type * 20;
+    int r;
+
+    if (1 == type)
+      v += 60 * sin(i * 0.001 + n);
+    else if (2 == type)
+      v += ((i / 300) & 1) ? 80 : -80;
+
+    r = (int)floor(v + rand() / (double)RAND_MAX - 0.5);
+    g_record[i] = (r < 0) ? 0 : ((r > 255) ? 255 : r);
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void test_signal(int type)
+{
+  double sum = 0.0, sum_sq = 0.0, dc, ac, rms;
+  long count = 0;
+  MeterValues values;
+
+  meter_reset();
+  check(!meter_get(&values));
+
+  for (int n = 0; n < RECORDS; n++)
+  {
+    make_record(type, n);
+    meter_update(g_record, SIZE, VS_MULT, VPOS);
+
+    if (n < RECORDS - AVERAGE)
+      continue;
+
+    for (int i = 0; i < SIZE; i++)
+    {
+      double uv = (g_record[i] - 128) * (VS_MULT / 1024.0) * 1000.0 - VPOS * 1000.0;
+
+      sum    += uv;
+      sum_sq += uv * uv;
+      count++;
+    }
+  }
+
+  dc  = sum / count;
+  rms = sqrt(sum_sq / count);
+  ac  = sqrt(sum_sq / count - dc * dc);
+
+  check(meter_get(&values));
+  check(fabs(values.dc - dc) < TOLERANCE);
+  check(fabs(values.ac - ac) < TOLERANCE);
+  check(fabs(values.rms - rms) < TOLERANCE);
+
+  printf("signal %d: ok, dc %d uV, ac %d uV, rms %d uV\n", type, values.dc, values.ac, values.rms);
+}
+
+//-----------------------------------------------------------------------------
+// Records with other vertical settings restart the average
+static void test_settings_change(void)
+{
+  MeterValues values;
+  int total = meter_get_total();
+
+  meter_reset();
+
+  for (int i = 0; i < SIZE; i++)
+    g_record[i] = 100;
+
+  for (int n = 0; n < 4; n++)
+    meter_update(g_record, SIZE, VS_MULT, VPOS);
+
+  for (int i = 0; i < SIZE; i++)
+    g_record[i] = 200;
+
+  meter_update(g_record, SIZE, VS_MULT * 2, VPOS);
+
+  check(meter_get(&values));
+  check(abs(values.dc - ((200 - 128) * VS_MULT * 2 * 1000 / 1024 - VPOS * 1000)) < TOLERANCE);
+  check(values.ac < TOLERANCE);
+  check(meter_get_total() == total + 5);
+
+  printf("settings change: ok\n");
+}
+
+//-----------------------------------------------------------------------------
+int main(void)
+{
+  srand(1);
+
+  for (int type = 0; type < 3; type++)
+    test_signal(type);
+
+  test_settings_change();
+
+  return 0;
+}
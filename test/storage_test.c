@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "flash.h"
+#include "flash_ram.h"
+#include "storage.h"
+#include "test.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define MAX_OBJECT_SIZE        (300 * 1024)
+#define DEEP_BLOCKS            64 // Lower half of the flash
+
+/*- Variables ---------------------------------------------------------------*/
+static uint8_t g_src[MAX_OBJECT_SIZE];
+static uint8_t g_dst[MAX_OBJECT_SIZE];
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+static void run(int steps)
+{
+  for (int i = 0; i < steps; i++)
+  {
+    storage_task();
+    flash_task();
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void make_data(int size, int seed)
+{
+  srand(seed);
+
+  for (int i = 0; i < size; i++)
+    g_src[i] = rand();
+}
+
+//-----------------------------------------------------------------------------
+// Returns the object ID or -1 if the object was dropped
+static int write_object(int type, bool reclaim, int size, int seed)
+{
+  int id = storage_create(type, reclaim);
+  int offset = 0;
+
+  check(id > 0);
+
+  make_data(size, seed);
+
+  while (offset < size)
+  {
+    int chunk = 1 + rand() % 3000;
+
+    if (chunk > size - offset)
+      chunk = size - offset;
+
+    offset += storage_write(&g_src[offset], chunk);
+    run(1);
+
+    if (storage_failed(id))
+      return -1;
+  }
+
+  storage_close();
+
+  while (storage_busy())
+    run(1);
+
+  return storage_failed(id) ? -1 : id;
+}
+
+//-----------------------------------------------------------------------------
+static void check_object(int id, int size, int seed)
+{
+  make_data(size, seed);
+
+  check(storage_get_size(id) == size);
+
+  memset(g_dst, 0, size);
+  check(storage_read(id, 0, g_dst, size) == size);
+  check(0 == memcmp(g_src, g_dst, size));
+
+  if (size > 100)
+  {
+    int offset = size / 3;
+
+    check(storage_read(id, offset, g_dst, 50) == 50);
+    check(0 == memcmp(&g_src[offset], g_dst, 50));
+  }
+}
+
+//-----------------------------------------------------------------------------
+static void remount(void)
+{
+  flash_ram_power_loss();
+  storage_init();
+  check(storage_ready());
+}
+
+//-----------------------------------------------------------------------------
+static void test_round_trip(void)
+{
+  static const int sizes[] = { 1, 255, 256, 257, 65024, 65025, 130048, 300000, 70000, 5 };
+  int ids[10];
+  int id, offset;
+
+  // New device, every block is erased first
+  memset(flash_ram, 0, sizeof(flash_ram));
+  remount();
+  run(200000);
+
+  for (int i = 0; i < 10; i++)
+  {
+    ids[i] = write_object(STORAGE_TYPE_WAVEFORM + i % 3, false, sizes[i], i);
+    check(ids[i] > 0);
+    check_object(ids[i], sizes[i], i);
+  }
+
+  remount();
+
+  for (int i = 0; i < 10; i++)
+    check_object(ids[i], sizes[i], i);
+
+  check(storage_get_last(STORAGE_TYPE_WAVEFORM) == ids[9]);
+  check(storage_get_prev(STORAGE_TYPE_WAVEFORM, ids[9]) == ids[6]);
+
+  // Power loss in the middle of a write
+  id = storage_create(STORAGE_TYPE_SCREENSHOT, false);
+  make_data(100000, 99);
+  offset = 0;
+
+  for (int i = 0; i < 2000 && offset < 100000; i++)
+  {
+    offset += storage_write(&g_src[offset], 500);
+    run(1);
+  }
+
+  remount();
+  check(-1 == storage_get_size(id));
+
+  for (int i = 0; i < 10; i++)
+    check_object(ids[i], sizes[i], i);
+
+  run(100000);
+
+  printf("round trip: ok\n");
+}
+
+//-----------------------------------------------------------------------------
+// Reclaimable objects are recycled, the rest is never touched
+static void test_recycling(void)
+{
+  int kept = write_object(STORAGE_TYPE_MASK, false, 1000, 500);
+  int min = INT32_MAX, max = 0;
+
+  check(kept > 0);
+
+  for (int i = 0; i < 600; i++)
+  {
+    int size = 20000 + rand() % 150000;
+    int id = write_object(STORAGE_TYPE_LOG, true, size, 1000 + i);
+
+    check(id > 0);
+    check_object(id, size, 1000 + i);
+    run(rand() % 50000);
+  }
+
+  check_object(kept, 1000, 500);
+
+  for (int i = 0; i < 10; i++)
+    check(storage_get_size(i + 1) > 0);
+
+  for (int i = 0; i < DEEP_BLOCKS; i++)
+    check(0 == flash_ram_erase_count[i]);
+
+  for (int i = DEEP_BLOCKS; i < FLASH_SIZE / FLASH_BLOCK_SIZE; i++)
+  {
+    if (flash_ram_erase_count[i] < min)
+      min = flash_ram_erase_count[i];
+
+    if (flash_ram_erase_count[i] > max)
+      max = flash_ram_erase_count[i];
+  }
+
+  printf("recycling: ok, erase counts %d-%d\n", min, max);
+}
+
+//-----------------------------------------------------------------------------
+static int count_objects(int type)
+{
+  int count = 0;
+
+  for (int id = storage_get_last(type); id > 0; id = storage_get_prev(type, id))
+    count++;
+
+  return count;
+}
+
+//-----------------------------------------------------------------------------
+// Reclaimable objects only replace the older objects of the same type
+static void test_reclaim_scope(void)
+{
+  int capture = write_object(STORAGE_TYPE_WAVEFORM, true, 30000, 600);
+  int logs;
+
+  check(capture > 0);
+
+  for (int i = 0; i < 200; i++)
+  {
+    check(write_object(STORAGE_TYPE_LOG, true, 20000 + rand() % 150000, 700 + i) > 0);
+    run(rand() % 50000);
+  }
+
+  check_object(capture, 30000, 600);
+
+  logs = count_objects(STORAGE_TYPE_LOG);
+
+  for (int i = 0; i < 50; i++)
+  {
+    int id = write_object(STORAGE_TYPE_WAVEFORM, true, 100000, 900 + i);
+
+    if (id > 0)
+      check_object(id, 100000, 900 + i);
+
+    run(rand() % 50000);
+  }
+
+  check(count_objects(STORAGE_TYPE_LOG) == logs);
+  check(count_objects(STORAGE_TYPE_WAVEFORM) > 0);
+
+  printf("reclaim scope: ok, %d logs kept\n", logs);
+}
+
+//-----------------------------------------------------------------------------
+// Objects that are not reclaimable fill the storage, then the writes fail
+static void test_full(void)
+{
+  int ids[64];
+  int count = 0;
+  int id;
+
+  while (count < 64)
+  {
+    id = write_object(STORAGE_TYPE_WAVEFORM, false, 200000, 2000 + count);
+
+    if (id < 0)
+      break;
+
+    ids[count++] = id;
+  }
+
+  check(count > 0 && count < 64);
+
+  for (int i = 0; i < count; i++)
+    check_object(ids[i], 200000, 2000 + i);
+
+  // Dropped parts are erased and reused
+  run(200000);
+  id = write_object(STORAGE_TYPE_SCREENSHOT, false, 50000, 3000);
+  check(id > 0);
+  check_object(id, 50000, 3000);
+
+  remount();
+
+  for (int i = 0; i < count; i++)
+    check_object(ids[i], 200000, 2000 + i);
+
+  check_object(id, 50000, 3000);
+
+  // Explicit delete makes room again
+  storage_delete(ids[0]);
+  run(200000);
+  id = write_object(STORAGE_TYPE_WAVEFORM, false, 200000, 4000);
+  check(id > 0);
+
+  printf("full storage: ok, %d objects kept\n", count);
+}
+
+//-----------------------------------------------------------------------------
+int main(void)
+{
+  test_round_trip();
+  test_recycling();
+  test_reclaim_scope();
+  test_full();
+
+  return 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include "capture.h"
+#include "config.h"
+#include "timer.h"
+#include "stubs.h"
+
+/*- Variables ---------------------------------------------------------------*/
+Config config;
+
+CaptureRecord stub_record;
+CaptureRecord stub_set_record;
+uint8_t stub_buffer[CAPTURE_BUFFER_SIZE];
+bool stub_locked = false;
+bool stub_stopped = false;
+uint32_t stub_uptime = 0;
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+void capture_lock(bool lock)
+{
+  stub_locked = lock;
+}
+
+//-----------------------------------------------------------------------------
+bool capture_get_record(CaptureRecord *record)
+{
+  if (0 == stub_record.size)
+    return false;
+
+  *record = stub_record;
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+uint8_t *capture_get_buffer(void)
+{
+  return stub_buffer;
+}
+
+//-----------------------------------------------------------------------------
+void capture_set_record(CaptureRecord *record)
+{
+  stub_set_record = *record;
+}
+
+//-----------------------------------------------------------------------------
+void capture_stop(void)
+{
+  stub_stopped = true;
+}
+
+//-----------------------------------------------------------------------------
+uint32_t timer_get_uptime(void)
+{
+  return stub_uptime;
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Compression ratio and encode/decode throughput of the waveform codec on
+// typical signals. Throughput is measured on the host, so only the relative
+// numbers are meaningful for the device.
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "capture.h"
+#include "wave.h"
+#include "test.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define SIZE         CAPTURE_BUFFER_SIZE
+#define ITERATIONS   50
+
+/*- Variables ---------------------------------------------------------------*/
+static uint8_t g_src[SIZE];
+static uint8_t g_enc[SIZE * 2];
+static uint8_t g_dec[SIZE];
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//-----------------------------------------------------------------------------
+static double noise(void)
+{
+  double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+  double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+  return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+//-----------------------------------------------------------------------------
+static uint8_t clip(double value)
+{
+  long v = lround(value);
+  return (v < 0) ? 0 : ((v > 255) ? 255 : v);
+}
+
+//-----------------------------------------------------------------------------
+static int encode(void)
+{
+  uint8_t prev = 0x80;
+  int size = 0;
+
+  for (int i = 0; i < SIZE; i += WAVE_BLOCK_SIZE)
+    size += wave_encode_block(&g_src[i], WAVE_BLOCK_SIZE, &prev, &g_enc[size]);
+
+  return size;
+}
+
+//-----------------------------------------------------------------------------
+static int decode(int size)
+{
+  uint8_t prev = 0x80;
+  int used = 0;
+
+  for (int i = 0; i < SIZE; i += WAVE_BLOCK_SIZE)
+  {
+    int res = wave_decode_block(&g_enc[used], size - used, &g_dec[i], WAVE_BLOCK_SIZE, &prev);
+
+    if (res < 0)
+      return -1;
+
+    used += res;
+  }
+
+  return used;
+}
+
+//-----------------------------------------------------------------------------
+static void bench(const char *name)
+{
+  int size = encode();
+  double start, enc_time, dec_time;
+
+  check(decode(size) == size);
+  check(0 == memcmp(g_src, g_dec, SIZE));
+
+  start = now();
+  for (int i = 0; i < ITERATIONS; i++)
+    encode();
+  enc_time = (now() - start) / ITERATIONS;
+
+  start = now();
+  for (int i = 0; i < ITERATIONS; i++)
+    decode(size);
+  dec_time = (now() - start) / ITERATIONS;
+
+  printf("%-24s %7d B  ratio %5.1f  encode %5.0f MB/s  decode %5.0f MB/s\n", name, size,
+      (double)SIZE / size, SIZE / enc_time * 1e-6, SIZE / dec_time * 1e-6);
+}
+
+//-----------------------------------------------------------------------------
+int main(void)
+{
+  srand(1);
+
+  for (int i = 0; i < SIZE; i++)
+    g_src[i] = clip(128 + 0.7 * noise());
+  bench("flat, 0.7 LSB noise");
+
+  for (int i = 0; i < SIZE; i++)
+    g_src[i] = clip(128 + 80 * sin(2 * M_PI * i / 2000.0) + 0.7 * noise());
+  bench("sine, 2000 S/period");
+
+  for (int i = 0; i < SIZE; i++)
+    g_src[i] = clip(128 + 80 * sin(2 * M_PI * i / 100.0) + 0.7 * noise());
+  bench("sine, 100 S/period");
+
+  for (int i = 0; i < SIZE; i++)
+    g_src[i] = clip(128 + 80 * sin(2 * M_PI * i / 12.5) + 0.7 * noise());
+  bench("sine, 12.5 S/period");
+
+  for (int i = 0; i < SIZE; i++)
+    g_src[i] = clip(128 + (((i / 1000) & 1) ? 60 : -60) + 0.7 * noise());
+  bench("square, 2000 S/period");
+
+  for (int i = 0; i < SIZE; i++)
+    g_src[i] = rand();
+  bench("random (worst case)");
+
+  return 0;
+}
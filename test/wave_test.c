@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "gd32f4xx.h"
+#include "flash.h"
+#include "flash_ram.h"
+#include "storage.h"
+#include "config.h"
+#include "utils.h"
+#include "wave.h"
+#include "stubs.h"
+#include "test.h"
+
+/*- Variables ---------------------------------------------------------------*/
+static uint8_t g_src[CAPTURE_BUFFER_SIZE];
+static uint8_t g_enc[CAPTURE_BUFFER_SIZE * 2];
+static uint8_t g_dec[CAPTURE_BUFFER_SIZE];
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+static void run(void)
+{
+  storage_task();
+  flash_task();
+}
+
+//-----------------------------------------------------------------------------
+static void make_signal(int size)
+{
+  for (int i = 0; i < size; i++)
+    g_src[i] = 128 + 80 * sin(i / 300.0) + (rand() % 3 - 1);
+}
+
+//-----------------------------------------------------------------------------
+static int encode(const uint8_t *in, int size, uint8_t *out)
+{
+  uint8_t prev = 0x80;
+  int out_size = 0;
+
+  for (int i = 0; i < size; i += WAVE_BLOCK_SIZE)
+  {
+    int count = (size - i) < WAVE_BLOCK_SIZE ? (size - i) : WAVE_BLOCK_SIZE;
+    out_size += wave_encode_block(&in[i], count, &prev, &out[out_size]);
+  }
+
+  return out_size;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the number of bytes used or -1 if the stream is broken
+static int decode(const uint8_t *in, int in_size, uint8_t *out, int size)
+{
+  uint8_t prev = 0x80;
+  int used = 0;
+
+  for (int i = 0; i < size; i += WAVE_BLOCK_SIZE)
+  {
+    int count = (size - i) < WAVE_BLOCK_SIZE ? (size - i) : WAVE_BLOCK_SIZE;
+    int res = wave_decode_block(&in[used], in_size - used, &out[i], count, &prev);
+
+    if (res < 0)
+      return -1;
+
+    used += res;
+  }
+
+  return used;
+}
+
+//-----------------------------------------------------------------------------
+// Every block size and the extreme sample values are restored exactly, broken
+// streams never write past the output
+static void test_codec(void)
+{
+  for (int size = 1; size <= 3 * WAVE_BLOCK_SIZE; size += 7)
+  {
+    for (int kind = 0; kind < 3; kind++)
+    {
+      for (int i = 0; i < size; i++)
+      {
+        if (0 == kind)
+          g_src[i] = rand();
+        else if (1 == kind)
+          g_src[i] = (i & 1) ? 0 : 255;
+        else
+          g_src[i] = 128 + (rand() % 5 - 2);
+      }
+
+      int enc_size = encode(g_src, size, g_enc);
+      check(enc_size <= ((size + WAVE_BLOCK_SIZE - 1) / WAVE_BLOCK_SIZE) * WAVE_MAX_BLOCK_BYTES);
+      check(decode(g_enc, enc_size, g_dec, size) == enc_size);
+      check(0 == memcmp(g_src, g_dec, size));
+    }
+  }
+
+  make_signal(CAPTURE_BUFFER_SIZE);
+  int enc_size = encode(g_src, CAPTURE_BUFFER_SIZE, g_enc);
+
+  // Truncated and corrupted streams, ASan catches the overruns
+  check(decode(g_enc, enc_size - 10, g_dec, CAPTURE_BUFFER_SIZE) < 0);
+
+  for (int i = 0; i < 2000; i++)
+  {
+    int pos = rand() % enc_size;
+    int bit = 1 << (rand() % 8);
+
+    g_enc[pos] ^= bit;
+    decode(g_enc, enc_size, g_dec, CAPTURE_BUFFER_SIZE);
+    g_enc[pos] ^= bit;
+  }
+
+  printf("codec: ok\n");
+}
+
+//-----------------------------------------------------------------------------
+// Records are saved through the storage and recalled in the oldest first
+// order with the view settings
+static void test_save_recall(void)
+{
+  static const int sizes[] = { 1000, 3000, 9000, 27000, 81000, CAPTURE_BUFFER_SIZE };
+
+  memset(flash_ram, 0xff, sizeof(flash_ram));
+  flash_ram_power_loss();
+  storage_init();
+  check(storage_ready());
+
+  make_signal(CAPTURE_BUFFER_SIZE);
+
+  for (int n = 0; n < ARRAY_SIZE(sizes); n++)
+  {
+    int size = sizes[n];
+    int offset = size / 3;
+    WaveInfo info;
+    int id;
+
+    stub_record = (CaptureRecord){ 8, size, offset, -size / 2, 123, 456, g_src };
+    stub_uptime = size;
+    config.horizontal_position = -5000000000LL;
+    config.vertical_scale      = 3;
+
+    check(wave_save(false));
+    check(stub_locked);
+
+    while (wave_busy())
+    {
+      wave_task();
+      run();
+    }
+
+    check(!stub_locked);
+    check(!wave_failed());
+
+    id = storage_get_last(STORAGE_TYPE_WAVEFORM);
+    check(wave_get_info(id, &info));
+    check(info.size == size && info.time == (uint32_t)size);
+
+    config.horizontal_position = 0;
+    config.vertical_scale      = 0;
+    memset(stub_buffer, 0, sizeof(stub_buffer));
+    stub_stopped = false;
+
+    check(wave_recall(id));
+    check(stub_stopped);
+
+    for (int i = 0; i < size; i++)
+      check(stub_buffer[i] == g_src[(offset + i) % size]);
+
+    check(stub_set_record.size == size && 0 == stub_set_record.offset);
+    check(stub_set_record.min_index == -size / 2 && 8 == stub_set_record.period);
+    check(123 == stub_set_record.vpos && 456 == stub_set_record.vs_mult);
+    check(-5000000000LL == config.horizontal_position && 3 == config.vertical_scale);
+  }
+
+  printf("save and recall: ok\n");
+}
+
+//-----------------------------------------------------------------------------
+// A save that does not fit is reported and releases the capture buffer
+static void test_full(void)
+{
+  int saved = 0;
+
+  for (int i = 0; i < CAPTURE_BUFFER_SIZE; i++)
+    g_src[i] = rand();
+
+  stub_record = (CaptureRecord){ 8, CAPTURE_BUFFER_SIZE, 0, 0, 0, 0, g_src };
+
+  while (1)
+  {
+    check(wave_save(false));
+
+    while (wave_busy())
+    {
+      wave_task();
+      run();
+    }
+
+    check(!stub_locked);
+
+    if (wave_failed())
+      break;
+
+    saved++;
+  }
+
+  check(saved > 0);
+
+  printf("full storage: ok, %d records saved\n", saved);
+}
+
+//-----------------------------------------------------------------------------
+int main(void)
+{
+  srand(1);
+
+  test_codec();
+  test_save_recall();
+  test_full();
+
+  return 0;
+}
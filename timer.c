@@ -42,6 +42,7 @@ static int *g_timer_list[MAX_TIMERS];
 static int g_timer_count = 0;
 static int g_timer_max_delta = 0;
 static int g_timer_prev_value = 0;
+static uint32_t g_timer_uptime = 0;
 
 /*- Implementations ---------------------------------------------------------*/
 
@@ -100,6 +101,12 @@ int timer_get_max_delta(void)
   return res;
 }
 
+//-----------------------------------------------------------------------------
+uint32_t timer_get_uptime(void)
+{
+  return g_timer_uptime;
+}
+
 //-----------------------------------------------------------------------------
 void timer_task(void)
 {
@@ -120,6 +127,7 @@ void timer_task(void)
     }
 
     g_timer_prev_value = value - rem;
+    g_timer_uptime += ms;
 
     if (ms > g_timer_max_delta)
       g_timer_max_delta = ms;
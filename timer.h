@@ -37,6 +37,7 @@ void timer_init(void);
 void timer_add(int *timer);
 void timer_remove(int *timer);
 int timer_get_max_delta(void);
+uint32_t timer_get_uptime(void);
 void timer_task(void);
 
 #endif // _TIMER_H_
@@ -29,13 +29,68 @@
 /*- Includes ----------------------------------------------------------------*/
 #include <stdint.h>
 #include <stdbool.h>
+#include "gd32f4xx.h"
+#include "common.h"
 #include "trigger.h"
 
 /*- Definitions -------------------------------------------------------------*/
 #define TRIGGER_HYSTERESIS     0x03030303
 
+#define UART_DATA_BITS         8
+#define UART_MAX_FRAMES        256 // Per DMA block
+
+#define VIDEO_BROAD_PULSE_DIV  5   // Broad pulses are ~27 us, regular ones are below 5 us
+
+enum
+{
+  UART_STATE_IDLE,
+  UART_STATE_START,
+  UART_STATE_DATA,
+};
+
+enum
+{
+  VIDEO_STATE_WAIT,
+  VIDEO_STATE_ACTIVE,
+  VIDEO_STATE_SYNC,
+};
+
+/*- Types -------------------------------------------------------------------*/
+typedef struct
+{
+  int      state;
+  uint32_t bit_period; // Samples per bit, 16.16 fixed point
+  uint32_t position;   // Next sampling point relative to the block start, 16.16
+  int      bit;
+  int      data;
+  int      value;
+  int      mask;
+  bool     inverted;
+} UartDecoder;
+
+typedef struct
+{
+  int      state;
+  uint32_t time;        // Sample counter at the start of the current block
+  uint32_t sync_start;  // Leading edge of the current sync pulse
+  uint32_t line_start;  // Leading edge of the last counted line
+  bool     line_valid;
+  bool     half;        // The last edge was in the middle of the line
+  bool     broad;       // The last pulse was a broad (vertical sync) pulse
+  bool     locked;      // Line counter is aligned to the vertical sync
+  int      line;
+  int      line_period; // Samples per line
+  int      lines;
+  int      field_1_line;
+  int      field_2_line;
+  int      sync;
+  int      target;
+} VideoDecoder;
+
 /*- Variables ---------------------------------------------------------------*/
 static volatile uint32_t g_trigger_levels;
+static UartDecoder g_uart;
+static VideoDecoder g_video;
 
 /*- Implementations ---------------------------------------------------------*/
 
@@ -1344,3 +1399,309 @@ int trigger_find_both_dual(uint32_t buf, uint32_t count)
 }
 
 
+
+//-----------------------------------------------------------------------------
+void trigger_uart_setup(uint32_t bit_period, bool inverted, int value, int mask)
+{
+  g_uart.bit_period = bit_period;
+  g_uart.inverted   = inverted;
+  g_uart.value      = value & mask;
+  g_uart.mask       = mask;
+
+  trigger_uart_reset();
+}
+
+//-----------------------------------------------------------------------------
+void trigger_uart_reset(void)
+{
+  g_uart.state    = UART_STATE_IDLE;
+  g_uart.position = 0;
+}
+
+//-----------------------------------------------------------------------------
+static inline bool uart_is_mark(int value)
+{
+  return (value > (int)(g_trigger_levels & 0xff)) != g_uart.inverted;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the index of the first sample above (or at and below) the levels
+// or -1 if there is none. Aligned parts of the buffer are checked 4 samples
+// at a time.
+static int find_level(uint8_t *buf, int index, int count, uint32_t levels, bool above)
+{
+  int level = levels & 0xff;
+
+  while (index < count && (index & 3))
+  {
+    if ((buf[index] > level) == above)
+      return index;
+
+    index++;
+  }
+
+  if (!above)
+    levels = __UQADD8(levels, 0x01010101);
+
+  while (index < count)
+  {
+    uint32_t word = *(uint32_t *)&buf[index];
+    uint32_t t = above ? __UQSUB8(word, levels) : __UQSUB8(levels, word);
+
+    if (t)
+      return index + (__CLZ(__RBIT(t)) >> 3);
+
+    index += 4;
+  }
+
+  return -1;
+}
+
+//-----------------------------------------------------------------------------
+static inline int uart_find_level(uint8_t *buf, int index, int count, bool mark)
+{
+  return find_level(buf, index, count, g_trigger_levels, mark != g_uart.inverted);
+}
+
+//-----------------------------------------------------------------------------
+// Bit-level UART decoder. Only the line edges before the start bits are
+// searched for, the rest of the frame is sampled once in the middle of each
+// bit, so the cost is bound by the number of words in the block plus
+// UART_MAX_FRAMES frames. Decoder state is preserved between the blocks.
+int trigger_find_uart(uint32_t buf, uint32_t count)
+{
+  uint8_t *data = (uint8_t *)buf;
+  int frames = 0;
+  int index;
+
+  if (0 == g_uart.bit_period)
+    return 0;
+
+  while (1)
+  {
+    index = g_uart.position >> 16;
+
+    if (index >= (int)count)
+    {
+      g_uart.position -= (count << 16);
+      return 0;
+    }
+
+    if (UART_STATE_IDLE == g_uart.state)
+    {
+      index = uart_find_level(data, index, count, true);
+
+      if (index < 0)
+        break;
+
+      g_uart.state    = UART_STATE_START;
+      g_uart.position = index << 16;
+    }
+    else if (UART_STATE_START == g_uart.state)
+    {
+      index = uart_find_level(data, index, count, false);
+
+      if (index < 0)
+        break;
+
+      g_uart.state    = UART_STATE_DATA;
+      g_uart.bit      = -1;
+      g_uart.data     = 0;
+      g_uart.position = (index << 16) + g_uart.bit_period / 2;
+    }
+    else
+    {
+      bool mark = uart_is_mark(data[index]);
+
+      if (g_uart.bit < 0)
+      {
+        if (mark) // Glitch, not a start bit
+        {
+          g_uart.state    = UART_STATE_START;
+          g_uart.position = index << 16;
+          continue;
+        }
+      }
+      else if (g_uart.bit < UART_DATA_BITS)
+      {
+        g_uart.data |= (mark << g_uart.bit);
+      }
+      else
+      {
+        g_uart.state    = mark ? UART_STATE_START : UART_STATE_IDLE;
+        g_uart.position = index << 16;
+
+        if (mark && (g_uart.data & g_uart.mask) == g_uart.value)
+          return count - index;
+
+        // Out of budget, the decoder keeps its state and looks for the next
+        // start bit from the beginning of the next block
+        if (++frames == UART_MAX_FRAMES)
+          break;
+
+        continue;
+      }
+
+      g_uart.bit++;
+      g_uart.position += g_uart.bit_period;
+    }
+  }
+
+  g_uart.position = 0;
+
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+void trigger_video_setup(int line_period, int lines, int field_1_line, int field_2_line, int sync, int line)
+{
+  g_video.line_period  = line_period;
+  g_video.lines        = lines;
+  g_video.field_1_line = field_1_line;
+  g_video.field_2_line = field_2_line;
+  g_video.sync         = sync;
+  g_video.target       = line;
+
+  trigger_video_reset();
+}
+
+//-----------------------------------------------------------------------------
+void trigger_video_reset(void)
+{
+  g_video.state      = VIDEO_STATE_WAIT;
+  g_video.time       = 0;
+  g_video.line_valid = false;
+  g_video.broad      = false;
+  g_video.locked     = false;
+}
+
+//-----------------------------------------------------------------------------
+// Called on the leading edge of every sync pulse. Edges spaced by more than
+// 3/4 of the line start a new line, edges close to the half of the line are
+// equalizing or broad pulses. Returns true if the edge matches the selected
+// trigger condition.
+static bool video_sync_edge(uint32_t time)
+{
+  uint32_t delta = time - g_video.line_start;
+  int period = g_video.line_period;
+  bool line_edge;
+
+  if (!g_video.line_valid || delta > (uint32_t)(period * 3 / 2))
+  {
+    // First edge or the signal was lost
+    g_video.line_start = time;
+    g_video.line_valid = true;
+    g_video.half       = false;
+    g_video.locked     = false;
+    return false;
+  }
+  else if (delta > (uint32_t)(period * 3 / 4))
+  {
+    g_video.line_start = time;
+    g_video.half       = false;
+    g_video.line       = (g_video.line == g_video.lines) ? 1 : (g_video.line + 1);
+    line_edge          = true;
+  }
+  else if (delta > (uint32_t)(period / 4) && !g_video.half)
+  {
+    g_video.half       = true;
+    line_edge          = false;
+  }
+  else
+  {
+    return false; // Noise
+  }
+
+  if (VIDEO_SYNC_ALL_LINES == g_video.sync)
+    return line_edge;
+
+  if (!g_video.locked)
+    return false;
+
+  if (VIDEO_SYNC_LINE == g_video.sync)
+    return line_edge && (g_video.line == g_video.target);
+
+  if (VIDEO_SYNC_FIELD_1 != g_video.sync && !line_edge && g_video.line == g_video.field_2_line)
+    return true;
+
+  if (VIDEO_SYNC_FIELD_2 != g_video.sync && line_edge && g_video.line == g_video.field_1_line)
+    return true;
+
+  return false;
+}
+
+//-----------------------------------------------------------------------------
+// Called on the trailing edge of every sync pulse. The first broad pulse of
+// the vertical sync is aligned to the line start in the first field and to
+// the middle of the line in the second field, which is used to number the lines.
+static void video_sync_end(uint32_t time)
+{
+  uint32_t width = time - g_video.sync_start;
+  bool broad = (width > (uint32_t)(g_video.line_period / VIDEO_BROAD_PULSE_DIV));
+
+  if (broad && !g_video.broad && g_video.line_valid)
+  {
+    g_video.line   = g_video.half ? g_video.field_2_line : g_video.field_1_line;
+    g_video.locked = true;
+  }
+
+  g_video.broad = broad;
+}
+
+//-----------------------------------------------------------------------------
+// Composite video sync decoder. Sync pulses are the parts of the signal below
+// the trigger level. Each sample is looked at once, the pulse widths and
+// the line counter are carried over between the blocks, so the decoder must
+// see all the blocks, including the ones before the trigger search starts.
+int trigger_find_video(uint32_t buf, uint32_t count)
+{
+  uint8_t *data = (uint8_t *)buf;
+  uint32_t high = __UQADD8(g_trigger_levels, TRIGGER_HYSTERESIS);
+  int trigger = 0;
+  int index = 0;
+
+  if (0 == g_video.line_period)
+    return 0;
+
+  while (1)
+  {
+    if (VIDEO_STATE_SYNC == g_video.state)
+    {
+      index = find_level(data, index, count, high, true);
+
+      if (index < 0)
+        break;
+
+      video_sync_end(g_video.time + index);
+      g_video.state = VIDEO_STATE_ACTIVE;
+    }
+    else if (VIDEO_STATE_ACTIVE == g_video.state)
+    {
+      index = find_level(data, index, count, g_trigger_levels, false);
+
+      if (index < 0)
+        break;
+
+      g_video.sync_start = g_video.time + index;
+      g_video.state = VIDEO_STATE_SYNC;
+
+      if (video_sync_edge(g_video.sync_start) && 0 == trigger)
+        trigger = count - index;
+    }
+    else
+    {
+      // Wait for the signal to leave the sync level, the width of the
+      // current pulse is unknown
+      index = find_level(data, index, count, high, true);
+
+      if (index < 0)
+        break;
+
+      g_video.state = VIDEO_STATE_ACTIVE;
+    }
+  }
+
+  g_video.time += count;
+
+  return trigger;
+}
@@ -38,6 +38,14 @@ int trigger_find_rise_dual(uint32_t buf, uint32_t count);
 int trigger_find_fall_dual(uint32_t buf, uint32_t count);
 int trigger_find_both_dual(uint32_t buf, uint32_t count);
 
+void trigger_uart_setup(uint32_t bit_period, bool inverted, int value, int mask);
+void trigger_uart_reset(void);
+int trigger_find_uart(uint32_t buf, uint32_t count);
+
+void trigger_video_setup(int line_period, int lines, int field_1_line, int field_2_line, int sync, int line);
+void trigger_video_reset(void);
+int trigger_find_video(uint32_t buf, uint32_t count);
+
 #endif // _TRIGGER_H_
 
 
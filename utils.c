@@ -109,6 +109,20 @@ char *format_time(int64_t value, bool show_plus_sign)
     return format_number(value / 10000000, sign, 2, 7, SPACE"s ");
 }
 
+//-----------------------------------------------------------------------------
+// Value is in ps, for the intervals shorter than the sample period
+char *format_time_fine(int64_t value)
+{
+  if (value < 1000)
+    return format_number(value, 0, 0, 7, SPACE"ps");
+  else if (value < 1000000)
+    return format_number(value, 0, 3, 7, SPACE"ns");
+  else if (value < 1000000000)
+    return format_number(value / 1000, 0, 3, 7, SPACE"us");
+  else
+    return format_number(value / 1000000, 0, 3, 7, SPACE"ms");
+}
+
 //-----------------------------------------------------------------------------
 char *format_voltage(int value, bool show_plus_sign)
 {
@@ -123,6 +137,21 @@ char *format_voltage(int value, bool show_plus_sign)
     return format_number(value / 10, sign, 2, 7, SPACE"V ");
 }
 
+//-----------------------------------------------------------------------------
+// Value is in uV, for the readings with more digits than the screen labels
+char *format_voltage_uv(int value, bool show_plus_sign)
+{
+  int sign = (value < 0) ? -1 : (show_plus_sign ? 1 : 0);
+
+  if (value < 0)
+    value = -value;
+
+  if (value < 1000000)
+    return format_number(value / 10, sign, 2, 8, SPACE"mV");
+  else
+    return format_number(value / 100, sign, 4, 8, SPACE"V ");
+}
+
 //-----------------------------------------------------------------------------
 char *format_divisions(int value, bool show_plus_sign)
 {
@@ -145,6 +174,30 @@ char *format_frequency(int value)
     return format_number(value / 10000, 0, 2, 6, SPACE"MHz");
 }
 
+//-----------------------------------------------------------------------------
+// Value is in mHz, for the measurements with more digits
+char *format_frequency_fine(int64_t value)
+{
+  if (value < 1000000)
+    return format_number(value, 0, 3, 7, SPACE"Hz ");
+  else if (value < 1000000000)
+    return format_number(value / 1000, 0, 3, 7, SPACE"kHz");
+  else
+    return format_number(value / 1000000, 0, 3, 7, SPACE"MHz");
+}
+
+//-----------------------------------------------------------------------------
+// Value is in mHz, 7 digits are shown above 1 kHz
+char *format_frequency_counter(int64_t value)
+{
+  if (value < 1000000)
+    return format_number(value, 0, 3, 8, SPACE"Hz ");
+  else if (value < 1000000000)
+    return format_number(value / 100, 0, 4, 8, SPACE"kHz");
+  else
+    return format_number(value / 1000, 0, 6, 8, SPACE"MHz");
+}
+
 //-----------------------------------------------------------------------------
 char *format_sps(int value)
 {
@@ -156,6 +209,32 @@ char *format_sps(int value)
     return format_number(value / 1000000, 0, 0, 3, SPACE"M");
 }
 
+//-----------------------------------------------------------------------------
+// Value is in 0.1% units
+char *format_percent(int value)
+{
+  return format_number(value, 0, 1, 5, SPACE"%");
+}
+
+//-----------------------------------------------------------------------------
+// Value is in 0.01% units
+char *format_percent_fine(int value)
+{
+  return format_number(value, 0, 2, 6, SPACE"%");
+}
+
+//-----------------------------------------------------------------------------
+// Value is in 0.1 dBV units
+char *format_dbv(int value)
+{
+  int sign = (value < 0) ? -1 : 0;
+
+  if (value < 0)
+    value = -value;
+
+  return format_number(value, sign, 1, 6, SPACE"dBV");
+}
+
 //-----------------------------------------------------------------------------
 char *format_raw_data(int *data, int size)
 {
@@ -181,4 +260,29 @@ uint64_t round_divide(int64_t dividend, int64_t divisor)
   return (dividend + (divisor / 2)) / divisor;
 }
 
+//-----------------------------------------------------------------------------
+uint32_t isqrt(uint64_t value)
+{
+  uint64_t res = 0;
+  uint64_t bit = 1ull << 62;
+
+  while (bit > value)
+    bit >>= 2;
+
+  while (bit)
+  {
+    if (value >= res + bit)
+    {
+      value -= res + bit;
+      res = (res >> 1) + bit;
+    }
+    else
+    {
+      res >>= 1;
+    }
+
+    bit >>= 2;
+  }
 
+  return res;
+}
@@ -40,13 +40,21 @@
 void crc32_init(void);
 uint32_t crc32_calc(uint32_t *data, int size);
 char *format_time(int64_t value, bool show_plus_sign);
+char *format_time_fine(int64_t value);
 char *format_voltage(int value, bool show_plus_sign);
+char *format_voltage_uv(int value, bool show_plus_sign);
 char *format_divisions(int value, bool show_plus_sign);
 char *format_frequency(int value);
+char *format_frequency_fine(int64_t value);
+char *format_frequency_counter(int64_t value);
 char *format_raw_data(int *data, int size);
 char *format_sps(int value);
+char *format_percent(int value);
+char *format_percent_fine(int value);
+char *format_dbv(int value);
 
 uint64_t round_divide(int64_t dividend, int64_t divisor);
+uint32_t isqrt(uint64_t value);
 
 /*- Implementations ---------------------------------------------------------*/
 
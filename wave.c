@@ -0,0 +1,612 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "gd32f4xx.h"
+#include "utils.h"
+#include "timer.h"
+#include "config.h"
+#include "capture.h"
+#include "storage.h"
+#include "wave.h"
+#include "overlay.h"
+
+/*- Definitions -------------------------------------------------------------*/
+#define WAVE_MAGIC             0x45564157 // "WAVE"
+#define WAVE_VERSION           2
+#define WAVE_MAX_RICE_K        7
+
+#define ZERO_POINT             0x80
+
+enum
+{
+  BLOCK_RAW   = 0x80,
+  BLOCK_CONST = 0x81,
+};
+
+enum
+{
+  WAVE_STATE_IDLE,
+  WAVE_STATE_DATA,
+  WAVE_STATE_FLUSH,
+};
+
+/*- Types -------------------------------------------------------------------*/
+// File layout:
+//   header - WaveHeader
+//   data   - blocks of WAVE_BLOCK_SIZE samples (the last one may be shorter),
+//            each block starts with a type byte:
+//              0..7        - Rice coded zigzag deltas with the parameter k,
+//                            padded to a byte boundary
+//              BLOCK_RAW   - plain samples
+//              BLOCK_CONST - all samples are equal to the last sample of
+//                            the previous block, no data follows
+//   Deltas continue across the blocks, the first one is relative to ZERO_POINT.
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  int32_t  size;
+  int32_t  min_index;
+  int32_t  period;
+  int32_t  vpos;
+  int32_t  vs_mult;
+  int32_t  horizontal_scale;
+  int32_t  horizontal_position_lo;
+  int32_t  horizontal_position_hi;
+  int32_t  vertical_scale;
+  int32_t  vertical_position;
+  int32_t  trigger_level;
+  int32_t  trigger_edge;
+  int32_t  ac_coupling;
+  uint32_t time; // Uptime at the moment of saving, ms
+  uint32_t crc;
+} WaveHeader;
+
+typedef struct
+{
+  uint8_t  *ptr;
+  uint32_t acc;
+  int      bits;
+} BitWriter;
+
+typedef struct
+{
+  const uint8_t *ptr;
+  const uint8_t *end;
+  uint32_t acc; // Left aligned
+  int      bits;
+  int      pad;
+} BitReader;
+
+/*- Variables ---------------------------------------------------------------*/
+static int g_state = WAVE_STATE_IDLE;
+static int g_id = -1;
+static CaptureRecord g_record;
+static int g_index;
+static uint8_t g_prev;
+static uint8_t g_block[WAVE_BLOCK_SIZE];
+static uint8_t g_out[WAVE_MAX_BLOCK_BYTES];
+static int g_out_ptr;
+static int g_out_size;
+static WaveHeader g_header;
+static uint8_t *g_recall_buffer;
+static int g_recall_index;
+
+/*- Implementations ---------------------------------------------------------*/
+
+//-----------------------------------------------------------------------------
+static inline int zigzag(uint8_t value, uint8_t prev)
+{
+  int8_t d = value - prev;
+
+  return (d < 0) ? (-2 * d - 1) : (2 * d);
+}
+
+//-----------------------------------------------------------------------------
+static inline void put_bits(BitWriter *w, uint32_t value, int count)
+{
+  w->acc = (w->acc << count) | value;
+  w->bits += count;
+
+  while (w->bits >= 8)
+  {
+    w->bits -= 8;
+    *w->ptr++ = w->acc >> w->bits;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Parameter k is picked per block by the exact size of the coded data, so
+// noisy blocks get larger k and flat blocks end up with one bit per sample.
+// Blocks that would not get smaller are stored as is. Returns the number of
+// bytes written into 'out' (at most WAVE_MAX_BLOCK_BYTES).
+int wave_encode_block(const uint8_t *in, int count, uint8_t *prev, uint8_t *out)
+{
+  uint32_t cost[WAVE_MAX_RICE_K + 1] = { 0 };
+  uint8_t last = *prev;
+  uint32_t best, mask;
+  int k = 0;
+  BitWriter w;
+
+  for (int i = 0; i < count; i++)
+  {
+    int u = zigzag(in[i], last);
+
+    for (int j = 0; j <= WAVE_MAX_RICE_K; j++)
+      cost[j] += u >> j;
+
+    last = in[i];
+  }
+
+  if (0 == cost[0])
+  {
+    out[0] = BLOCK_CONST;
+    return 1;
+  }
+
+  best = cost[0] + count;
+
+  for (int j = 1; j <= WAVE_MAX_RICE_K; j++)
+  {
+    uint32_t bits = cost[j] + count * (j + 1);
+
+    if (bits < best)
+    {
+      best = bits;
+      k = j;
+    }
+  }
+
+  if (best >= (uint32_t)count * 8)
+  {
+    out[0] = BLOCK_RAW;
+    memcpy(&out[1], in, count);
+    *prev = last;
+    return count + 1;
+  }
+
+  out[0] = k;
+
+  w.ptr  = &out[1];
+  w.acc  = 0;
+  w.bits = 0;
+  mask   = (1 << k) - 1;
+  last   = *prev;
+
+  for (int i = 0; i < count; i++)
+  {
+    int u = zigzag(in[i], last);
+    int q = u >> k;
+
+    while (q >= 16)
+    {
+      put_bits(&w, 0xffff, 16);
+      q -= 16;
+    }
+
+    put_bits(&w, ((1 << q) - 1) << 1, q + 1);
+
+    if (k)
+      put_bits(&w, u & mask, k);
+
+    last = in[i];
+  }
+
+  if (w.bits)
+    put_bits(&w, 0, 8 - w.bits);
+
+  *prev = last;
+
+  return w.ptr - out;
+}
+
+//-----------------------------------------------------------------------------
+static inline void refill(BitReader *r)
+{
+  while (r->bits <= 24)
+  {
+    if (r->ptr < r->end)
+    {
+      r->acc |= (uint32_t)*r->ptr++ << (24 - r->bits);
+    }
+    else
+    {
+      r->pad++;
+    }
+
+    r->bits += 8;
+  }
+}
+
+//-----------------------------------------------------------------------------
+static inline int get_unary(BitReader *r)
+{
+  int q = 0;
+
+  while (1)
+  {
+    int n;
+
+    refill(r);
+
+    n = __CLZ(~r->acc);
+
+    if (n < r->bits)
+    {
+      r->acc = (r->acc << n) << 1;
+      r->bits -= n + 1;
+      return q + n;
+    }
+
+    // Past the end of the input all bits are zero, so this terminates
+    q += r->bits;
+    r->acc  = 0;
+    r->bits = 0;
+  }
+}
+
+//-----------------------------------------------------------------------------
+static inline int get_bits(BitReader *r, int count)
+{
+  int value;
+
+  refill(r);
+
+  value = r->acc >> (32 - count);
+  r->acc <<= count;
+  r->bits -= count;
+
+  return value;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the number of bytes consumed from 'in' or -1 if the block is corrupted
+int wave_decode_block(const uint8_t *in, int size, uint8_t *out, int count, uint8_t *prev)
+{
+  uint8_t last = *prev;
+  int k, used;
+  BitReader r;
+
+  if (size < 1)
+    return -1;
+
+  k = in[0];
+
+  if (BLOCK_CONST == k)
+  {
+    memset(out, last, count);
+    return 1;
+  }
+
+  if (BLOCK_RAW == k)
+  {
+    if (size < (count + 1))
+      return -1;
+
+    memcpy(out, &in[1], count);
+    *prev = out[count-1];
+    return count + 1;
+  }
+
+  if (k > WAVE_MAX_RICE_K)
+    return -1;
+
+  r.ptr  = &in[1];
+  r.end  = &in[size];
+  r.acc  = 0;
+  r.bits = 0;
+  r.pad  = 0;
+
+  for (int i = 0; i < count; i++)
+  {
+    int u = get_unary(&r) << k;
+
+    if (k)
+      u |= get_bits(&r, k);
+
+    last += (u >> 1) ^ -(u & 1);
+    out[i] = last;
+  }
+
+  // Unused bits of the last byte are padding
+  used = (r.ptr - in) + r.pad - r.bits / 8;
+
+  if (used > size)
+    return -1;
+
+  *prev = last;
+
+  return used;
+}
+
+//-----------------------------------------------------------------------------
+// Saving runs in the background from wave_task(), the source buffer stays
+// locked until the last block is encoded. Waveforms saved with 'reclaim' set
+// may be deleted when the storage runs out of space.
+bool wave_save(bool reclaim)
+{
+  int64_t hpos = config.horizontal_position;
+
+  if (WAVE_STATE_IDLE != g_state || !storage_ready() || storage_busy())
+    return false;
+
+  capture_lock(true);
+
+  if (!capture_get_record(&g_record))
+  {
+    capture_lock(false);
+    return false;
+  }
+
+  g_id = storage_create(STORAGE_TYPE_WAVEFORM, reclaim);
+
+  if (g_id < 0)
+  {
+    capture_lock(false);
+    return false;
+  }
+
+  g_header.magic                  = WAVE_MAGIC;
+  g_header.version                = WAVE_VERSION;
+  g_header.size                   = g_record.size;
+  g_header.min_index              = g_record.min_index;
+  g_header.period                 = g_record.period;
+  g_header.vpos                   = g_record.vpos;
+  g_header.vs_mult                = g_record.vs_mult;
+  g_header.horizontal_scale       = config.horizontal_scale;
+  g_header.horizontal_position_lo = (uint32_t)hpos;
+  g_header.horizontal_position_hi = (uint32_t)(hpos >> 32);
+  g_header.vertical_scale         = config.vertical_scale;
+  g_header.vertical_position      = config.vertical_position;
+  g_header.trigger_level          = config.trigger_level;
+  g_header.trigger_edge           = config.trigger_edge;
+  g_header.ac_coupling            = config.ac_coupling;
+  g_header.time                   = timer_get_uptime();
+  g_header.crc = crc32_calc((uint32_t *)&g_header, sizeof(WaveHeader) - sizeof(uint32_t));
+
+  memcpy(g_out, &g_header, sizeof(WaveHeader));
+
+  g_out_ptr  = 0;
+  g_out_size = sizeof(WaveHeader);
+  g_index    = 0;
+  g_prev     = ZERO_POINT;
+  g_state    = WAVE_STATE_DATA;
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+bool wave_busy(void)
+{
+  return WAVE_STATE_IDLE != g_state || storage_busy();
+}
+
+//-----------------------------------------------------------------------------
+// Last saved waveform was dropped because the storage is full
+bool wave_failed(void)
+{
+  return storage_failed(g_id);
+}
+
+//-----------------------------------------------------------------------------
+// Samples are taken from the oldest one, wrapping around the end of the ring
+static void encode_next_block(void)
+{
+  int count = g_record.size - g_index;
+  int index = g_record.offset + g_index;
+  int sz;
+
+  if (count > WAVE_BLOCK_SIZE)
+    count = WAVE_BLOCK_SIZE;
+
+  if (index >= g_record.size)
+    index -= g_record.size;
+
+  sz = g_record.size - index;
+
+  if (sz > count)
+    sz = count;
+
+  memcpy(g_block, &g_record.data[index], sz);
+
+  if (sz < count)
+    memcpy(&g_block[sz], g_record.data, count - sz);
+
+  g_out_size = wave_encode_block(g_block, count, &g_prev, g_out);
+  g_out_ptr  = 0;
+  g_index   += count;
+}
+
+//-----------------------------------------------------------------------------
+void wave_task(void)
+{
+  while (WAVE_STATE_IDLE != g_state)
+  {
+    if (storage_failed(g_id))
+    {
+      if (WAVE_STATE_FLUSH != g_state)
+        capture_lock(false);
+
+      g_state = WAVE_STATE_IDLE;
+      return;
+    }
+
+    g_out_ptr += storage_write(&g_out[g_out_ptr], g_out_size - g_out_ptr);
+
+    if (g_out_ptr < g_out_size)
+      return;
+
+    if (WAVE_STATE_FLUSH == g_state)
+    {
+      storage_close();
+      g_state = WAVE_STATE_IDLE;
+    }
+    else if (g_index < g_record.size)
+    {
+      encode_next_block();
+    }
+    else
+    {
+      capture_lock(false);
+      g_state = WAVE_STATE_FLUSH;
+      g_out_size = 0;
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+static bool read_header(int id, WaveHeader *header)
+{
+  if (storage_read(id, 0, (uint8_t *)header, sizeof(WaveHeader)) != sizeof(WaveHeader))
+    return false;
+
+  return header->magic == WAVE_MAGIC && header->version == WAVE_VERSION &&
+      header->crc == crc32_calc((uint32_t *)header, sizeof(WaveHeader) - sizeof(uint32_t)) &&
+      header->size > 0 && header->size <= CAPTURE_BUFFER_SIZE;
+}
+
+//-----------------------------------------------------------------------------
+bool wave_get_info(int id, WaveInfo *info)
+{
+  WaveHeader header;
+
+  if (!read_header(id, &header))
+    return false;
+
+  info->size      = header.size;
+  info->min_index = header.min_index;
+  info->period    = header.period;
+  info->vpos      = header.vpos;
+  info->vs_mult   = header.vs_mult;
+  info->time      = header.time;
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// Decodes the saved record block by block, oldest samples first. The handler
+// may return false to stop decoding early. Returns false if the record is
+// corrupted.
+bool wave_load(int id, bool (*handler)(const uint8_t *data, int count))
+{
+  uint8_t *in = overlay.scratch.wave.in;
+  uint8_t *out = overlay.scratch.wave.out;
+  WaveHeader header;
+  uint8_t prev = ZERO_POINT;
+  int offset = sizeof(WaveHeader);
+  int start = 0;
+  int count = 0;
+
+  if (!read_header(id, &header))
+    return false;
+
+  for (int index = 0; index < header.size; index += WAVE_BLOCK_SIZE)
+  {
+    int size = header.size - index;
+    int used;
+
+    if (size > WAVE_BLOCK_SIZE)
+      size = WAVE_BLOCK_SIZE;
+
+    // Keep at least one complete block in the input buffer
+    if (count < WAVE_MAX_BLOCK_BYTES)
+    {
+      int sz;
+
+      memmove(in, &in[start], count);
+      start = 0;
+
+      sz = storage_read(id, offset, &in[count], WAVE_INPUT_SIZE - count);
+      offset += sz;
+      count  += sz;
+    }
+
+    used = wave_decode_block(&in[start], count, out, size, &prev);
+
+    if (used < 0)
+      return false;
+
+    start += used;
+    count -= used;
+
+    if (!handler(out, size))
+      break;
+  }
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+static bool recall_handler(const uint8_t *data, int count)
+{
+  memcpy(&g_recall_buffer[g_recall_index], data, count);
+  g_recall_index += count;
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// Decodes the saved record straight into the capture buffer and restores
+// the view settings. Derived configuration values are left to the caller.
+bool wave_recall(int id)
+{
+  WaveHeader header;
+  CaptureRecord record;
+
+  if (WAVE_STATE_IDLE != g_state || !read_header(id, &header))
+    return false;
+
+  capture_stop();
+
+  g_recall_buffer = capture_get_buffer();
+  g_recall_index  = 0;
+
+  if (!wave_load(id, recall_handler))
+    return false;
+
+  record.period    = header.period;
+  record.size      = header.size;
+  record.offset    = 0;
+  record.min_index = header.min_index;
+  record.vpos      = header.vpos;
+  record.vs_mult   = header.vs_mult;
+  record.data      = g_recall_buffer;
+
+  capture_set_record(&record);
+
+  config.horizontal_scale    = header.horizontal_scale;
+  config.horizontal_position = (int64_t)(((uint64_t)(uint32_t)header.horizontal_position_hi << 32) |
+      (uint32_t)header.horizontal_position_lo);
+  config.vertical_scale      = header.vertical_scale;
+  config.vertical_position   = header.vertical_position;
+
+  return true;
+}
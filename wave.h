@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2019-2020, Alex Taradov <alex@taradov.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _WAVE_H_
+#define _WAVE_H_
+
+/*- Includes ----------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+
+/*- Definitions -------------------------------------------------------------*/
+#define WAVE_BLOCK_SIZE        256 // Samples
+#define WAVE_MAX_BLOCK_BYTES   (WAVE_BLOCK_SIZE + 1)
+#define WAVE_INPUT_SIZE        (WAVE_MAX_BLOCK_BYTES * 2)
+
+/*- Types -------------------------------------------------------------------*/
+typedef struct
+{
+  int      size;
+  int      min_index;
+  int      period;
+  int      vpos;
+  int      vs_mult;
+  uint32_t time;
+} WaveInfo;
+
+/*- Prototypes --------------------------------------------------------------*/
+int wave_encode_block(const uint8_t *in, int count, uint8_t *prev, uint8_t *out);
+int wave_decode_block(const uint8_t *in, int size, uint8_t *out, int count, uint8_t *prev);
+
+bool wave_save(bool reclaim);
+bool wave_recall(int id);
+bool wave_get_info(int id, WaveInfo *info);
+bool wave_load(int id, bool (*handler)(const uint8_t *data, int count));
+bool wave_busy(void);
+bool wave_failed(void);
+void wave_task(void);
+
+#endif // _WAVE_H_
+